@@ -4,32 +4,80 @@ namespace ogl
 {
 
 
-const std::vector<int>& BVTree::intersectBoundingBoxes(const Ray &ray, const float maxLambda) const
+const std::vector<int>& BVTree::intersectBoundingBoxes(const Ray &ray, const float maxLambda,
+  QueryContext &context) const
 {
  // int* jobs = (int*)alloca(sizeof(int)*100); //yields 25% better performance
 
-  mTempCandidates.clear();
-  mTempTraversalJobs.push(0);
+  std::vector<int> &candidates = context.candidates;
+  std::vector<int> &traversalJobs = context.traversalJobs;
 
-  while(!mTempTraversalJobs.empty())
+  candidates.clear();
+  traversalJobs.clear();
+  traversalJobs.push_back(0);
+
+  while(!traversalJobs.empty())
   {
     //take current job
-    int node = mTempTraversalJobs.top();
-    mTempTraversalJobs.pop();
+    int node = traversalJobs.back();
+    traversalJobs.pop_back();
 
     //test ray vs. bounding box of node
     if(mNodes[node].bbox.anyIntersection(ray,maxLambda))
     {
       if(mNodes[node].left <= 0 && mNodes[node].right == -1) // is a leaf node
-        mTempCandidates.push_back(-mNodes[node].left);
+        candidates.push_back(-mNodes[node].left);
       else//is not a leaf
       {
-        mTempTraversalJobs.push(mNodes[node].left);
-        mTempTraversalJobs.push(mNodes[node].right);
+        traversalJobs.push_back(mNodes[node].left);
+        traversalJobs.push_back(mNodes[node].right);
       }
     }
   }
-  return mTempCandidates;
+  return candidates;
+}
+
+void BVTree::intersectPacket(RayPacket4 &packet, const std::vector<Vec3> &vertexPositions,
+    const std::vector<Vec3i> &triangleIndices) const
+{
+  if(!mNodes.empty())
+    this->intersectPacketSubtree(0,packet,vertexPositions,triangleIndices);
+}
+
+void BVTree::intersectPacketSubtree(int root, RayPacket4 &packet, const std::vector<Vec3> &vertexPositions,
+    const std::vector<Vec3i> &triangleIndices) const
+{
+  //depth first, every level leaves at most one sibling on the stack
+  int traversalJobs[kPacketStackSize];
+  int numJobs = 0;
+  traversalJobs[numJobs++] = root;
+
+  while(numJobs > 0)
+  {
+    const Node &node = mNodes[traversalJobs[--numJobs]];
+
+    //test all rays vs. bounding box of node, the box is skipped if none enters it
+    if(!intersectBox(packet,node.bbox))
+      continue;
+
+    if(node.left <= 0 && node.right == -1) // is a leaf node
+    {
+      const int triangleIndex = -node.left;
+      const Vec3i &t = triangleIndices[triangleIndex];
+      intersectTriangle(packet,vertexPositions[t[0]],vertexPositions[t[1]],vertexPositions[t[2]],triangleIndex);
+    }
+    else if(numJobs+2 > kPacketStackSize)
+    {
+      //the stack is full, the right child is visited first as below
+      this->intersectPacketSubtree(node.right,packet,vertexPositions,triangleIndices);
+      traversalJobs[numJobs++] = node.left;
+    }
+    else
+    {
+      traversalJobs[numJobs++] = node.left;
+      traversalJobs[numJobs++] = node.right;
+    }
+  }
 }
 
 void BVTree::createNodes(const std::vector<Vec3> &vertexPositions,
@@ -3,8 +3,8 @@
 
 #include "OpenGL.hpp"
 #include <vector>
-#include <stack>
 #include "Collision.hpp"
+#include "RayPacket.hpp"
 
 namespace ogl
 {
@@ -13,15 +13,36 @@ class BVTree
 {
 public:
 
-
   //build from indexed triangle set
   void build(const std::vector<Vec3> &vertexPositions,const std::vector<Vec3i> &triangleIndices);
 
+  //buffers of the single ray queries. Queries with different contexts may
+  //run in parallel, so every thread needs its own one. A reused context
+  //does not allocate once its buffers are large enough
+  struct QueryContext
+  {
+    std::vector<int> candidates;
+    std::vector<int> traversalJobs;
+  };
+
   //returns a set of triangle indices as candidates for ray-triangle intersection
-  const std::vector<int>& intersectBoundingBoxes(const Ray &ray, const float maxLambda) const;
+  //the set is stored in context and valid until its next query
+  const std::vector<int>& intersectBoundingBoxes(const Ray &ray, const float maxLambda,
+    QueryContext &context) const;
+
+  //intersects the rays of packet with the triangles (the ones the tree was
+  //built from), the lanes keep their closest hit. Allocates nothing.
+  void intersectPacket(RayPacket4 &packet, const std::vector<Vec3> &vertexPositions,
+    const std::vector<Vec3i> &triangleIndices) const;
 
   size_t numNodes() const { return mNodes.size();}
 private:
+  //Size of the fixed traversal stack of intersectPacket. Subtrees which do
+  //not fit on it are traversed by a recursive call with a stack of their own.
+  static const int kPacketStackSize = 64;
+
+  void intersectPacketSubtree(int root, RayPacket4 &packet, const std::vector<Vec3> &vertexPositions,
+    const std::vector<Vec3i> &triangleIndices) const;
 
   struct Node
   {
@@ -47,8 +68,6 @@ private:
   std::vector<Vec3i>       mTempBufferTriangleIndices;
   std::vector<Vec3>        mTempAreasLeft;
   std::vector<Vec3>        mTempAreasRight;
-  mutable std::vector<int>         mTempCandidates;
-  mutable std::stack<int>          mTempTraversalJobs;
   
 };
 } //namespace ogl
@@ -3,7 +3,7 @@
 namespace ogl
 {
 
-CollisionGeometry::CollisionGeometry() : mInitialized(false)
+CollisionGeometry::CollisionGeometry() : mInitialized(false), mUploadToGPU(false)
 {
   // Initialize default values
   mModelMatrix.setIdentity();
@@ -22,7 +22,8 @@ CollisionGeometry::~CollisionGeometry()
   this->clear();
 }
 
-void CollisionGeometry::init(const std::vector<Vec3>& p, const std::vector<Vec3>& n, const std::vector<unsigned int>& t)
+void CollisionGeometry::init(const std::vector<Vec3>& p, const std::vector<Vec3>& n, const std::vector<unsigned int>& t,
+                             bool uploadToGPU)
 {
   this->clear();
 
@@ -39,6 +40,11 @@ void CollisionGeometry::init(const std::vector<Vec3>& p, const std::vector<Vec3>
 
   mNumIndices = GLsizei(t.size());
 
+  mInitialized=true;
+  mUploadToGPU=uploadToGPU;
+  if(!uploadToGPU)
+    return;
+
   // Create and copy index buffer on GPU
   glGenBuffers(1, &mIndexBuffer);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndexBuffer);
@@ -75,11 +81,9 @@ void CollisionGeometry::init(const std::vector<Vec3>& p, const std::vector<Vec3>
   glBindBuffer(GL_UNIFORM_BUFFER, mUniformBuffer);
   glBufferData(GL_UNIFORM_BUFFER, sizeof(float) * 56, NULL, GL_STREAM_DRAW);
   glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-  mInitialized=true;
 }
 
-void CollisionGeometry::initInstance(std::shared_ptr<CollisionGeometry> original)
+void CollisionGeometry::initInstance(std::shared_ptr<CollisionGeometry> original, bool uploadToGPU)
 {
   // For instances, only create uniform buffer 
   // Point to the geometry of the original
@@ -87,13 +91,16 @@ void CollisionGeometry::initInstance(std::shared_ptr<CollisionGeometry> original
   this->clear();
   mInstance=original;
 
+  mInitialized=true;
+  mUploadToGPU=uploadToGPU;
+  if(!uploadToGPU)
+    return;
+
   //Create uniform buffer
   glGenBuffers(1, &mUniformBuffer);
   glBindBuffer(GL_UNIFORM_BUFFER, mUniformBuffer);
   glBufferData(GL_UNIFORM_BUFFER, sizeof(float) * 56, NULL, GL_STREAM_DRAW);
   glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-  mInitialized=true;
 }
 
 GLuint CollisionGeometry::handle() const
@@ -132,7 +139,10 @@ void CollisionGeometry::clear()
   {
     std::vector<Vec3>().swap(mCollisionPositions);
     std::vector<Vec3i>().swap(mCollisionIndices);
+  }
 
+  if(!mInstance && mUploadToGPU)
+  {
     glDeleteBuffers(1,&mIndexBuffer);
     glDeleteBuffers(1,&mPositionBuffer);
     glDeleteBuffers(1,&mNormalBuffer);
@@ -145,12 +155,17 @@ void CollisionGeometry::clear()
   mInitialized=false;
 }
 
-void CollisionGeometry::updateUniforms()
+void CollisionGeometry::updateTransform()
 {
   mModelMatrixInverse = mModelMatrix;
   mModelMatrixInverse.invert();
   mModelMatrixInverseTransposed =mModelMatrixInverse;
   mModelMatrixInverseTransposed.transpose();
+}
+
+void CollisionGeometry::updateUniforms()
+{
+  this->updateTransform();
   // Compute the normal matrix
   Mat4 normalMatrix = mModelMatrix.getInverse().transpose();
 
@@ -169,13 +184,14 @@ void CollisionGeometry::updateUniforms()
 }
 
 std::shared_ptr<RayIntersection>
-  CollisionGeometry::closestIntersectionModel(const Ray &ray, float maxLambda) const
+  CollisionGeometry::closestIntersectionModel(const Ray &ray, float maxLambda,
+  BVTree::QueryContext &context) const
 {
   const BVTree &collisionTree = mInstance ? mInstance->mCollisionTree : mCollisionTree;
   const std::vector<Vec3> &collisionPositions = mInstance ? mInstance->mCollisionPositions : mCollisionPositions;
   const std::vector<Vec3> &collisionNormals = mInstance ? mInstance->mCollisionNormals : mCollisionNormals;
   const std::vector<Vec3i> &collisionIndices = mInstance ? mInstance->mCollisionIndices : mCollisionIndices;
-  const std::vector<int> &intersectionCandidates = collisionTree.intersectBoundingBoxes(ray,maxLambda);
+  const std::vector<int> &intersectionCandidates = collisionTree.intersectBoundingBoxes(ray,maxLambda,context);
 
   float closestLambda = maxLambda;
   Vec3 closestbary;
@@ -225,6 +241,14 @@ std::shared_ptr<RayIntersection>
 
 std::shared_ptr<RayIntersection>
   CollisionGeometry::closestIntersection(const Ray &ray, float maxLambda) const
+{
+  BVTree::QueryContext context;
+  return this->closestIntersection(ray,maxLambda,context);
+}
+
+std::shared_ptr<RayIntersection>
+  CollisionGeometry::closestIntersection(const Ray &ray, float maxLambda,
+  BVTree::QueryContext &context) const
 {
   //adapt maximal lambda value relative to transformation properties
   //(e.g., scaling)
@@ -233,7 +257,7 @@ std::shared_ptr<RayIntersection>
 
   //transform ray from world to model coordinate system
   std::shared_ptr<RayIntersection> isect_local =
-    this->closestIntersectionModel(modelRay,maxLambda);
+    this->closestIntersectionModel(modelRay,maxLambda,context);
 
   if (!isect_local)
     return nullptr;
@@ -244,6 +268,53 @@ std::shared_ptr<RayIntersection>
   return isect_local;
 }
 
+void CollisionGeometry::closestIntersections(size_t numRays, const Vec3 *origins, const Vec3 *directions,
+  float *lambdas, Vec3 *normals) const
+{
+  const BVTree &collisionTree = mInstance ? mInstance->mCollisionTree : mCollisionTree;
+  const std::vector<Vec3> &collisionPositions = mInstance ? mInstance->mCollisionPositions : mCollisionPositions;
+  const std::vector<Vec3> &collisionNormals = mInstance ? mInstance->mCollisionNormals : mCollisionNormals;
+  const std::vector<Vec3i> &collisionIndices = mInstance ? mInstance->mCollisionIndices : mCollisionIndices;
+
+  const Mat4 modelToWorldNormal = mModelMatrixInverseTransposed.as3x3();
+  const Mat4 worldToModel = mModelMatrixInverse.as3x3();
+  for(size_t first=0;first<numRays;first+=RayPacket4::kSize)
+  {
+    const int size = int(std::min<size_t>(RayPacket4::kSize,numRays-first));
+
+    //transform the rays from world to model coordinate system, lambdas
+    //scale with the length of the transformed direction
+    RayPacket4 packet;
+    float scale[RayPacket4::kSize];
+    for(int l=0;l<size;++l)
+    {
+      Vec3 direction = worldToModel*directions[first+l];
+      direction.normalize(&scale[l]);
+      packet.set(l,mModelMatrixInverse*origins[first+l],direction,lambdas[first+l]*scale[l]);
+    }
+
+    collisionTree.intersectPacket(packet,collisionPositions,collisionIndices);
+
+    //transform the hits from model to world coordinate system
+    for(int l=0;l<size;++l)
+    {
+      const int triangleIndex = packet.triangle[l];
+      if(triangleIndex < 0)
+        continue;
+      const float lambda = packet.lambda[l]/scale[l];
+      if(!(lambda < lambdas[first+l]))
+        continue;
+
+      const Vec3i &t = collisionIndices[triangleIndex];
+      Vec3 n = collisionNormals[t[0]]*packet.u[l]+
+               collisionNormals[t[1]]*packet.v[l]+
+               collisionNormals[t[2]]*(1-packet.u[l]-packet.v[l]);
+      lambdas[first+l] = lambda;
+      normals[first+l] = (modelToWorldNormal*n).normalize();
+    }
+  }
+}
+
 void CollisionGeometry::bind(const GLuint shaderProgram,const GLuint bindingPoint, const std::string &blockName) const
 {
   GLuint uniformBlockIndex = glGetUniformBlockIndex(shaderProgram, blockName.c_str());
@@ -19,8 +19,10 @@ namespace ogl
     virtual ~CollisionGeometry();
 
     // Initialize by a set of vertex positions, vertex normals and triangle indices (starting from 0)
-    void init(const std::vector<Vec3>& p, const std::vector<Vec3>& n, const std::vector<unsigned int>& t);
-    void initInstance(std::shared_ptr<CollisionGeometry> original);
+    // Without uploadToGPU only the collision data is kept (headless simulation)
+    void init(const std::vector<Vec3>& p, const std::vector<Vec3>& n, const std::vector<unsigned int>& t,
+              bool uploadToGPU=true);
+    void initInstance(std::shared_ptr<CollisionGeometry> original, bool uploadToGPU=true);
 
     void clear();
 
@@ -42,6 +44,9 @@ namespace ogl
     void setLightPosition2(const Vec3& p) {mLightPosition[2]=Vec4(p,1);}
     void setMaterial(float shininess, const Vec3& color, float lineWidth=0.f, const Vec3& lineColor=Vec3(0,0,0));
 
+    // Update the inverse model matrices used by the collision queries
+    void updateTransform();
+
     // Update data and upload it to the GPU
     void updateUniforms();
 
@@ -49,6 +54,11 @@ namespace ogl
     void bind(const GLuint shaderProgram,const GLuint bindingPoint=0, const std::string &blockName="ub_Geometry") const;
 
     // Computes the point of intersection between ray and object.
+    // Queries with different contexts may run in parallel
+    std::shared_ptr<RayIntersection>
+      closestIntersection(const Ray &ray, float maxLambda, BVTree::QueryContext &context) const;
+
+    // Same as above with a temporary context
     std::shared_ptr<RayIntersection>
       closestIntersection(const Ray &ray, float maxLambda) const;
 
@@ -62,10 +72,18 @@ namespace ogl
       return lambda * model_direction.length();
     }
     std::shared_ptr<RayIntersection>
-      closestIntersectionModel(const Ray &ray, float maxLambda) const;
+      closestIntersectionModel(const Ray &ray, float maxLambda, BVTree::QueryContext &context) const;
+
+    // Batch version of closestIntersection for numRays rays with normalized
+    // directions, in world coordinates. lambdas holds the maximal lambda of
+    // every ray, a ray hitting the geometry closer gets the lambda and the
+    // normal of the hit. Allocates nothing and may run in parallel.
+    void closestIntersections(size_t numRays, const Vec3 *origins, const Vec3 *directions,
+      float *lambdas, Vec3 *normals) const;
 
   private:
     bool   mInitialized;                          //< True if initialized
+    bool   mUploadToGPU;                          //< False if no OpenGL objects were created
 
     //Transformation-related
     Mat4   mModelMatrix;                          //< The model matrix.
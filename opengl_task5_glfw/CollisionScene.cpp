@@ -1,10 +1,18 @@
 #include "CollisionScene.hpp"
 #include "CollisionGeometry.hpp"
+#include <algorithm>
 
 namespace ogl
 {
 
 std::shared_ptr<RayIntersection> CollisionScene::closestIntersection(const Ray &ray, float maxLambda) const
+{
+  BVTree::QueryContext context;
+  return this->closestIntersection(ray,maxLambda,context);
+}
+
+std::shared_ptr<RayIntersection> CollisionScene::closestIntersection(const Ray &ray, float maxLambda,
+  BVTree::QueryContext &context) const
 {
   float closestLambda = maxLambda;
   std::shared_ptr<RayIntersection> tmpIntersection;
@@ -12,7 +20,7 @@ std::shared_ptr<RayIntersection> CollisionScene::closestIntersection(const Ray &
   for (size_t i=0;i<mGeometries.size();++i)
   {
     std::shared_ptr<CollisionGeometry> r = mGeometries[i];
-    if(tmpIntersection = r->closestIntersection(ray,closestLambda))
+    if(tmpIntersection = r->closestIntersection(ray,closestLambda,context))
     {
       if(tmpIntersection->lambda() < closestLambda)
       {
@@ -24,4 +32,14 @@ std::shared_ptr<RayIntersection> CollisionScene::closestIntersection(const Ray &
   return closestIntersection;
 }
 
+void CollisionScene::closestIntersections(size_t numRays, const Vec3 *origins, const Vec3 *directions,
+  const float *maxLambdas, float *hitLambdas, Vec3 *hitNormals) const
+{
+  std::copy(maxLambdas,maxLambdas+numRays,hitLambdas);
+
+  //every geometry only reports hits closer than the ones found so far
+  for (size_t i=0;i<mGeometries.size();++i)
+    mGeometries[i]->closestIntersections(numRays,origins,directions,hitLambdas,hitNormals);
+}
+
 } //namespace ogl
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "OpenGL.hpp"
 #include <vector>
 #include "Collision.hpp"
+#include "BVTree.hpp"
 
 namespace ogl
 {
@@ -21,6 +22,19 @@ public:
     closestIntersection(const Ray &ray,
     float maxLambda = std::numeric_limits<float>::infinity()) const; 
 
+  /// Same as above, queries with different contexts may run in parallel.
+  std::shared_ptr<RayIntersection>
+    closestIntersection(const Ray &ray, float maxLambda, BVTree::QueryContext &context) const;
+
+  /// Computes the closest intersections of numRays rays with normalized
+  /// directions. Ray i hits the scene if hitLambdas[i] < maxLambdas[i], then
+  /// origins[i]+directions[i]*hitLambdas[i] is the point of intersection and
+  /// hitNormals[i] the normal there. The rays are intersected with the
+  /// geometries in SIMD packets, nothing is allocated and any number of
+  /// threads may query at once.
+  void closestIntersections(size_t numRays, const Vec3 *origins, const Vec3 *directions,
+    const float *maxLambdas, float *hitLambdas, Vec3 *hitNormals) const;
+
 private:
   std::vector<std::shared_ptr<CollisionGeometry>> mGeometries;
 };
@@ -0,0 +1,222 @@
+#include "ForceOctree.hpp"
+#include <algorithm>
+#include <typeindex>
+
+namespace ogl
+{
+
+namespace
+{
+struct SourceClassLess
+{
+  bool operator()(const ForceSource &a, const ForceSource &b) const
+  {
+    const std::type_index ta(typeid(*a.force)), tb(typeid(*b.force));
+    if(ta != tb)
+      return ta < tb;
+    return a.handle < b.handle;
+  }
+};
+
+bool contains(const Vec3 &lower, const Vec3 &upper, const Vec3 &p)
+{
+  return p.x() >= lower.x() && p.y() >= lower.y() && p.z() >= lower.z() &&
+    p.x() <= upper.x() && p.y() <= upper.y() && p.z() <= upper.z();
+}
+}
+
+void ForceOctree::build(const std::vector<ForceSource> &sources, float theta)
+{
+  mTheta = theta;
+  mSources.clear();
+  mExactSources.clear();
+  mNodes.clear();
+  mGroups.clear();
+  mSourcePositions.clear();
+
+  for(size_t i = 0; i < sources.size(); ++i)
+  {
+    if(sources[i].force->isApproximable())
+    {
+      mSources.push_back(sources[i]);
+      mSourcePositions[sources[i].handle] = sources[i].particle.position;
+    }
+    else
+      mExactSources.push_back(sources[i]);
+  }
+
+  //sorting by class and handle makes the tree independent of the hash map order
+  std::sort(mSources.begin(),mSources.end(),SourceClassLess());
+  mTempSources.resize(mSources.size());
+
+  size_t first = 0;
+  while(first < mSources.size())
+  {
+    const std::type_index type(typeid(*mSources[first].force));
+    size_t end = first+1;
+    while(end < mSources.size() && std::type_index(typeid(*mSources[end].force)) == type)
+      ++end;
+
+    //the root cell is the bounding cube of the group
+    Vec3 lower = mSources[first].particle.position;
+    Vec3 upper = lower;
+    for(size_t i = first+1; i < end; ++i)
+    {
+      lower = min(lower,mSources[i].particle.position);
+      upper = max(upper,mSources[i].particle.position);
+    }
+    const Vec3 extent = upper-lower;
+    const float size = std::max(extent.x(),std::max(extent.y(),extent.z()));
+    upper = lower+Vec3(size,size,size);
+
+    Group group;
+    group.representative = mSources[first].force;
+    group.root = this->buildNode(int(first),int(end-first),lower,upper,0);
+    mGroups.push_back(group);
+    first = end;
+  }
+}
+
+int ForceOctree::buildNode(int first, int count, const Vec3 &lower, const Vec3 &upper, int depth)
+{
+  const int nodeIndex = int(mNodes.size());
+  mNodes.push_back(Node());
+
+  Node node;
+  node.lower = lower;
+  node.upper = upper;
+  node.first = first;
+  node.count = count;
+  node.leaf = count <= kLeafSize || depth >= kMaxDepth;
+  std::fill(node.children,node.children+8,-1);
+
+  Vec3 position(0,0,0), velocity(0,0,0);
+  float lifeLeft = 0.f;
+  for(int i = first; i < first+count; ++i)
+  {
+    position += mSources[i].particle.position;
+    velocity += mSources[i].particle.velocity;
+    lifeLeft += mSources[i].particle.lifeLeft;
+  }
+  node.mean.position = position*(1.f/count);
+  node.mean.velocity = velocity*(1.f/count);
+  node.mean.lifeLeft = lifeLeft/count;
+  node.mean.isSpecialParticle = 1.f;
+  node.size = upper.x()-lower.x();
+  node.offset = (node.mean.position-(lower+upper)*0.5f).length();
+
+  if(!node.leaf)
+  {
+    //counting sort of the particles into the octants of the cell
+    const Vec3 center = (lower+upper)*0.5f;
+    int octantCount[8] = {0,0,0,0,0,0,0,0};
+    for(int i = first; i < first+count; ++i)
+    {
+      const Vec3 &p = mSources[i].particle.position;
+      ++octantCount[(p.x() > center.x() ? 1 : 0) | (p.y() > center.y() ? 2 : 0) | (p.z() > center.z() ? 4 : 0)];
+    }
+    int octantFirst[9];
+    octantFirst[0] = first;
+    for(int o = 0; o < 8; ++o)
+      octantFirst[o+1] = octantFirst[o]+octantCount[o];
+
+    int octantEnd[8];
+    std::copy(octantFirst,octantFirst+8,octantEnd);
+    for(int i = first; i < first+count; ++i)
+    {
+      const Vec3 &p = mSources[i].particle.position;
+      const int o = (p.x() > center.x() ? 1 : 0) | (p.y() > center.y() ? 2 : 0) | (p.z() > center.z() ? 4 : 0);
+      mTempSources[octantEnd[o]++] = mSources[i];
+    }
+    std::copy(mTempSources.begin()+first,mTempSources.begin()+first+count,mSources.begin()+first);
+
+    for(int o = 0; o < 8; ++o)
+    {
+      if(octantCount[o] == 0)
+        continue;
+      const Vec3 childLower((o & 1) ? center.x() : lower.x(),
+                            (o & 2) ? center.y() : lower.y(),
+                            (o & 4) ? center.z() : lower.z());
+      const Vec3 childUpper((o & 1) ? upper.x() : center.x(),
+                            (o & 2) ? upper.y() : center.y(),
+                            (o & 4) ? upper.z() : center.z());
+      node.children[o] = this->buildNode(octantFirst[o],octantCount[o],childLower,childUpper,depth+1);
+    }
+  }
+
+  //the recursion may have reallocated mNodes
+  mNodes[nodeIndex] = node;
+  return nodeIndex;
+}
+
+void ForceOctree::sumNode(const Node &node, const ForceParticle *force, const Vec3 &position,
+  size_t handle, Vec3 &forces) const
+{
+  for(int i = node.first; i < node.first+node.count; ++i)
+  {
+    // A particle does not exert force upon itself
+    if(mSources[i].handle != handle)
+      forces+=force->computeForce(mSources[i].particle,position);
+  }
+}
+
+Vec3 ForceOctree::sumForces(const Vec3 &position, size_t handle) const
+{
+  Vec3 forces(0,0,0);
+  for(size_t i = 0; i < mExactSources.size(); ++i)
+  {
+    if(mExactSources[i].handle != handle)
+      forces+=mExactSources[i].force->computeForce(mExactSources[i].particle,position);
+  }
+
+  //cells containing the particle's own force particle must be opened as well
+  bool isSource = false;
+  Vec3 sourcePosition;
+  if(!mSourcePositions.empty())
+  {
+    std::unordered_map<size_t,Vec3>::const_iterator iter = mSourcePositions.find(handle);
+    if(iter != mSourcePositions.end())
+    {
+      isSource = true;
+      sourcePosition = iter->second;
+    }
+  }
+
+  if(mGroups.empty())
+    return forces;
+  const float invTheta = 1.f/mTheta;
+  int stack[7*kMaxDepth+8];
+  for(size_t g = 0; g < mGroups.size(); ++g)
+  {
+    const ForceParticle *force = mGroups[g].representative;
+    int stackSize = 0;
+    stack[stackSize++] = mGroups[g].root;
+    while(stackSize > 0)
+    {
+      const Node &node = mNodes[stack[--stackSize]];
+      if(node.leaf)
+      {
+        this->sumNode(node,force,position,handle,forces);
+        continue;
+      }
+
+      // Opening criterion size/theta + offset < distance, where the offset of the
+      // mean from the cell center guards against cells with a lopsided mean
+      const float bound = node.size*invTheta+node.offset;
+      const float distance2 = (node.mean.position-position).lengthSquared();
+      if(bound*bound < distance2 && !contains(node.lower,node.upper,position) &&
+        !(isSource && contains(node.lower,node.upper,sourcePosition)))
+      {
+        forces+=force->computeForce(node.mean,position)*float(node.count);
+        continue;
+      }
+
+      for(int o = 0; o < 8; ++o)
+        if(node.children[o] >= 0)
+          stack[stackSize++] = node.children[o];
+    }
+  }
+  return forces;
+}
+
+} //namespace ogl
@@ -0,0 +1,78 @@
+#ifndef FORCEOCTREE_HPP_INCLUDE_ONCE
+#define FORCEOCTREE_HPP_INCLUDE_ONCE
+
+#include "OpenGL.hpp"
+#include <vector>
+#include <unordered_map>
+#include "Particle.hpp"
+
+namespace ogl
+{
+
+//A force particle as seen by the force accumulation of one step
+struct ForceSource
+{
+  size_t handle;              //< Handle of the particle the force is attached to
+  Particle particle;          //< The particle at the beginning of the step
+  const ForceParticle *force;
+};
+
+//Barnes-Hut octree over the force particles of a step. Approximable force
+//particles (see ForceParticle) of the same class share one octree. A cell
+//which is far away from the particle (size/theta plus the offset of its mean
+//from its center < distance) acts as a single force particle at the mean of
+//its particles, with the force scaled by their number. Leaves, cells
+//containing the particle and force particles which are not approximable are
+//summed exactly.
+class ForceOctree
+{
+public:
+  ForceOctree() : mTheta(0.f) {}
+
+  //Rebuilds the trees from the force particles of the current step
+  void build(const std::vector<ForceSource> &sources, float theta);
+
+  //Sum of the forces of all force particles except the one attached to
+  //handle upon a particle at position. Safe to call from several threads.
+  Vec3 sumForces(const Vec3 &position, size_t handle) const;
+
+  size_t numNodes() const { return mNodes.size(); }
+
+private:
+  static const int kLeafSize = 4;   //< Maximum number of particles in a leaf
+  static const int kMaxDepth = 16;  //< Deeper cells are leaves regardless of their size
+
+  struct Node
+  {
+    Vec3 lower, upper;    //< Cell bounds
+    Particle mean;        //< Mean of the particles in the cell
+    float size;           //< Edge length of the cubic cell
+    float offset;         //< Distance of the mean from the cell center
+    int first, count;     //< Range of the particles in mSources
+    int children[8];      //< Child nodes, -1 for empty octants
+    bool leaf;
+  };
+
+  //One octree per class of approximable force particles
+  struct Group
+  {
+    int root;
+    const ForceParticle *representative;
+  };
+
+  int buildNode(int first, int count, const Vec3 &lower, const Vec3 &upper, int depth);
+  void sumNode(const Node &node, const ForceParticle *force, const Vec3 &position,
+    size_t handle, Vec3 &forces) const;
+
+  float mTheta;
+  std::vector<ForceSource> mSources;      //< Approximable sources sorted by group and cell
+  std::vector<ForceSource> mExactSources; //< Sources which are always summed exactly
+  std::vector<ForceSource> mTempSources;
+  std::vector<Node> mNodes;
+  std::vector<Group> mGroups;
+  std::unordered_map<size_t,Vec3> mSourcePositions; //< Snapshot position of approximable sources by handle
+};
+
+} //namespace ogl
+
+#endif //FORCEOCTREE_HPP_INCLUDE_ONCE
@@ -11,6 +11,7 @@
 #include "Matrix3.hpp"
 #include "Matrix4.hpp"
 #include <random>
+#include <cstdint>
 
 
 #ifndef M_PI
@@ -41,6 +42,44 @@ typedef vl::Vector2<int> Vec2i;
 typedef vl::Vector3<int> Vec3i;
 typedef vl::Vector4<int> Vec4i;
 
+// PCG32 random number generator (O'Neill 2014). It is small and fast, and
+// the sequence number selects one of 2^63 independent streams, so parallel
+// workers can draw reproducible numbers without sharing a generator.
+class Random
+{
+public:
+  explicit Random(uint64_t seed = 0, uint64_t sequence = 0) { this->seed(seed,sequence); }
+
+  void seed(uint64_t seed, uint64_t sequence)
+  {
+    mState = 0;
+    mIncrement = (sequence << 1) | 1;
+    next();
+    mState += seed;
+    next();
+  }
+
+  // uniformly distributed 32 bit integer
+  uint32_t next()
+  {
+    const uint64_t old = mState;
+    mState = old * 6364136223846793005ULL + mIncrement;
+    const uint32_t xorShifted = uint32_t(((old >> 18) ^ old) >> 27);
+    const uint32_t rotation = uint32_t(old >> 59);
+    return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+  }
+
+  // uniformly distributed number in [minValue..maxValue)
+  float uniform(float minValue = 0.f, float maxValue = 1.f)
+  {
+    return float(next() >> 8) * (1.f / 16777216.f) * (maxValue-minValue)+minValue;
+  }
+
+private:
+  uint64_t mState;
+  uint64_t mIncrement;
+};
+
 /*
 inline static Vec3 cross (const Vec3 &a, const Vec3 &b)
 {
@@ -83,11 +122,15 @@ public:
     V = cross(W,U);
   }
 
-  static Vec3 sampleUnitSphere()
+  // The sampling functions draw from the shared generator of random(),
+  // or from the given one (e.g. one per thread).
+  static Vec3 sampleUnitSphere() { return sampleUnitSphere(mRandomGenerator); }
+
+  static Vec3 sampleUnitSphere(Random &random)
   {
-    float phi = random(0,float(2*M_PI));
-    float r = random(); r=r*r*r;
-    float cos_theta = random(-1,1);
+    float phi = random.uniform(0,float(2*M_PI));
+    float r = random.uniform(); r=r*r*r;
+    float cos_theta = random.uniform(-1,1);
 
     float x = r*sqrt(1-cos_theta*cos_theta)*cos(phi);
     float y = r*sqrt(1-cos_theta*cos_theta)*sin(phi);
@@ -96,10 +139,12 @@ public:
     return Vec3(x,y,z).normalize();
   }
 
-  static Vec3 sampleUnitHemisphereCosine()
+  static Vec3 sampleUnitHemisphereCosine() { return sampleUnitHemisphereCosine(mRandomGenerator); }
+
+  static Vec3 sampleUnitHemisphereCosine(Random &random)
   {
-    float sample_x = random();
-    float sample_y = random();
+    float sample_x = random.uniform();
+    float sample_y = random.uniform();
     float phi = float(2.f * M_PI * sample_x);
     float r = float(sqrt(sample_y));
     float x = r * float(cos(phi));
@@ -110,19 +155,26 @@ public:
   }
 
   static Vec3 sampleDirectionUnitHemisphereCosine(const Vec3 &N)
+  {
+    return sampleDirectionUnitHemisphereCosine(N,mRandomGenerator);
+  }
+
+  static Vec3 sampleDirectionUnitHemisphereCosine(const Vec3 &N, Random &random)
   {
     Vec3 U,V,W;
     orthonormalBasis(N,U,V,W);
 
-    Vec3 D = sampleUnitHemisphereCosine();
+    Vec3 D = sampleUnitHemisphereCosine(random);
 
     return (U * D[0] + V * D[1] + W * D[2]).normalize();
   }
 
-  static Vec3 samplePhongLobe(const float exponent)
+  static Vec3 samplePhongLobe(const float exponent) { return samplePhongLobe(exponent,mRandomGenerator); }
+
+  static Vec3 samplePhongLobe(const float exponent, Random &random)
   {
-   float sample_x = random();
-   float sample_y = random();
+   float sample_x = random.uniform();
+   float sample_y = random.uniform();
    float power = exp( log(sample_y) / (exponent+1.f) );
    float phi = float(2.f * M_PI * sample_x);
    float scale = sqrt(1.f-power*power);
@@ -133,24 +185,29 @@ public:
   }
 
   static Vec3 sampleDirectionPhongLobe(const Vec3 & N, const float exponent)
+  {
+    return sampleDirectionPhongLobe(N,exponent,mRandomGenerator);
+  }
+
+  static Vec3 sampleDirectionPhongLobe(const Vec3 & N, const float exponent, Random &random)
   {
     Vec3 U,V,W;
     orthonormalBasis(N,U,V,W);
 
-    Vec3 D = samplePhongLobe(exponent);
+    Vec3 D = samplePhongLobe(exponent,random);
 
     return (U * D[0] + V * D[1] + W * D[2]).normalize();
   }
 
   // generates a uniformly distributed random number in [0..1]
+  // from a generator shared by all callers (not thread-safe)
   inline static const float random(float minValue = 0.f, float maxValue = 1.f)
   {
-    return mUniformDistribution(mRandomGenerator) * (maxValue-minValue)+minValue;
+    return mRandomGenerator.uniform(minValue,maxValue);
   }
 
 private:
-  static std::default_random_engine mRandomGenerator;
-  static std::uniform_real_distribution<float> mUniformDistribution;
+  static Random mRandomGenerator;
 };
 
 } //namespace rt
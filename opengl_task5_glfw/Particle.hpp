@@ -25,6 +25,14 @@ public:
   // The second parameter is the world position of the other particle (that the force acts upon)
   // The return value is a force vector in world coordinates.
   virtual Vec3 computeForce(const Particle &forceParticle, const Vec3 &otherParticlePosition) const=0;
+
+  // Returns true if the force only depends on the force particle and the other
+  // position, is the same for all objects of the class and adds up linearly.
+  // Far away groups of such force particles may then be approximated by a
+  // single one at their mean (see ParticleEmitter::Configuration::forceTheta).
+  virtual bool isApproximable() const { return false; }
+
+  virtual ~ForceParticle() {}
 };
 
 class PointGravitySource : public ForceParticle
@@ -37,6 +45,8 @@ public:
     // Experiment with different formulas and test the outcome.
     return Vec3(0,0,0);
   }
+
+  bool isApproximable() const override { return true; }
 };
 
 }
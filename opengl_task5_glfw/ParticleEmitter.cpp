@@ -1,34 +1,44 @@
 #include "ParticleEmitter.hpp"
 #include "Collision.hpp"
 #include "CollisionScene.hpp"
+#include <thread>
+#include <atomic>
 
 namespace ogl
 {
 
-ParticleEmitter::ParticleEmitter() : mInitialized(false),
-  mGlobalTime(0)
+ParticleEmitter::ParticleEmitter() : mInitialized(false), mUploadToGPU(false),
+  mGlobalTime(0), mTimeAccumulator(0), mStepCount(0),
+  mWorkerJob(0), mWorkerGeneration(0), mWorkersBusy(0), mStopWorkers(false)
 {
 }
 
 ParticleEmitter::~ParticleEmitter()
 {
+  this->stopWorkers();
   this->clear();
 }
 
-bool ParticleEmitter::init()
+bool ParticleEmitter::init(bool uploadToGPU)
 {
   this->clear();
 
-  mParticles.resize(mConfig.maxNumParticles);
+  mParticles.init(mConfig.maxNumParticles);
+  mStepCount = 0;
+  mRandom.seed(mConfig.seed,0);
+  Math::orthonormalBasis(mConfig.mainDirection,mBasisU,mBasisV,mBasisW);
 
-  for(size_t i = 0; i<mParticles.size();++i)
-  {
-    mInactiveParticles.push_back(i);
-  }
-  // Create and copy particles to GPU
+  mInitialized = true;
+  mUploadToGPU = uploadToGPU;
+  if(!uploadToGPU)
+    return true;
+
+  // Create the particle buffer on the GPU, it holds the four particle
+  // arrays one after the other
+  const size_t n = mParticles.capacity();
   glGenBuffers(1, &mParticleBuffer);
   glBindBuffer(GL_ARRAY_BUFFER, mParticleBuffer);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(Particle) * mParticles.size(), 0, GL_STATIC_DRAW);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(Particle) * n, 0, GL_STREAM_DRAW);
   ogl::printOpenGLError();
 
   // Generate a vertex array object
@@ -36,10 +46,10 @@ bool ParticleEmitter::init()
   glBindVertexArray(mVertexArrayObject);
   glBindBuffer(GL_ARRAY_BUFFER, mParticleBuffer);
   size_t f = sizeof(float);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), 0);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)(3*f));
-  glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)(6*f));
-  glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)(7*f));
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)(3*f*n));
+  glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 0, (void*)(6*f*n));
+  glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, 0, (void*)(7*f*n));
   glBindBuffer(GL_ARRAY_BUFFER, 0);
   glEnableVertexAttribArray(0);
   glEnableVertexAttribArray(1);
@@ -54,69 +64,88 @@ bool ParticleEmitter::init()
   glBindBuffer(GL_UNIFORM_BUFFER, 0);
   
   mGlobalTime = float(glfwGetTime());
+  mTimeAccumulator = 0;
 
-  Math::orthonormalBasis(mConfig.mainDirection,mBasisU,mBasisV,mBasisW);
-  
   return true;
 }
 
-Particle ParticleEmitter::createParticle() const
+Particle ParticleEmitter::createParticle()
+{
+  return this->createParticle(mRandom);
+}
+
+Particle ParticleEmitter::createParticle(Random &random) const
 {
   Particle p;
 
   //The lifespan is uniformly distributed.
-  p.lifeLeft = Math::random(mConfig.lifeSpan[0],mConfig.lifeSpan[1]);
+  p.lifeLeft = random.uniform(mConfig.lifeSpan[0],mConfig.lifeSpan[1]);
   p.position = mConfig.position;
 
   //The initial velocity direction is based on a Phong lobe around mConfig.mainDirection)
-  Vec3 sampleDir = Math::samplePhongLobe(mConfig.randomDirectionExponent);
+  Vec3 sampleDir = Math::samplePhongLobe(mConfig.randomDirectionExponent,random);
   p.velocity =(mBasisU * sampleDir[0] + mBasisV * sampleDir[1] + mBasisW * sampleDir[2]).normalize();
 
   //The initial velocity length is uniformly distributed
-  p.velocity *=Math::random(mConfig.velocitySpan[0],mConfig.velocitySpan[1]);
+  p.velocity *=random.uniform(mConfig.velocitySpan[0],mConfig.velocitySpan[1]);
 
   return p;
 }
 
 void ParticleEmitter::step()
 {
-  // Compute the time step in seconds
+  // Compute the time passed in seconds
   float oldTime=mGlobalTime;
   mGlobalTime=float(glfwGetTime());
-  float dt = (mGlobalTime-oldTime); //time step in seconds
+  mTimeAccumulator += (mGlobalTime-oldTime);
 
+  // Simulate in steps of fixed length, the remaining time is carried over.
+  // Slow frames do not trigger ever more steps, the simulation slows down.
+  int numSteps = int(mTimeAccumulator/mConfig.timeStep);
+  mTimeAccumulator -= numSteps*mConfig.timeStep;
+  if(numSteps > mConfig.maxStepsPerFrame)
+    numSteps = mConfig.maxStepsPerFrame;
+  this->simulate(numSteps);
+
+  // Copy updated data to GPU
+  updateParticlesOnGPU();
+}
+
+void ParticleEmitter::simulate(int numSteps)
+{
+  for(int i = 0; i < numSteps; ++i)
+    this->simulationStep(mConfig.timeStep);
+}
+
+void ParticleEmitter::simulationStep(float dt)
+{
   if(mConfig.enableFireworks)
     this->fireworkStep(dt);
 
   // Inactivate particles that will die within this step
   this->inactivateDyingParticles(dt);
 
+  // The force particles act with their positions at the start of the step
+  this->updateForceSources();
+
   // Spawn new particles
   this->spawnParticles(dt);
 
   // Advect the active particles
   this->advectActiveParticles(dt);
 
-  // Copy updated data to GPU
-  updateParticlesOnGPU();
+  ++mStepCount;
 }
 
 
-bool ParticleEmitter::addParticle(const Particle &p, size_t &particleIndex)
+bool ParticleEmitter::addParticle(const Particle &p, size_t &particleHandle)
 {
   // We have no more free memory for a new particle
-  if(mInactiveParticles.empty())
+  if(mParticles.full())
     return false;
 
-  // Get and remove the index from the inactive ones
-  particleIndex = mInactiveParticles.front();
-  mInactiveParticles.pop_front();
-
-  // Set the new particle
-  mParticles[particleIndex]=p;
-
-  // Add to the list of active particles
-  mActiveParticles.push_back(particleIndex);
+  // Append the new particle behind the active ones
+  particleHandle = mParticles.add(p);
 
   return true;
 }
@@ -128,14 +157,14 @@ bool ParticleEmitter::addForceParticle(std::shared_ptr<ForceParticle> forceParti
   p.isSpecialParticle=1.f;
 
   // The force particle lifespan differs from the normal one
-  p.lifeLeft = Math::random(mConfig.forceParticleLifeSpan[0],mConfig.forceParticleLifeSpan[1]);
+  p.lifeLeft = mRandom.uniform(mConfig.forceParticleLifeSpan[0],mConfig.forceParticleLifeSpan[1]);
 
-  size_t particleIndex;
-  if(!this->addParticle(p,particleIndex))
+  size_t particleHandle;
+  if(!this->addParticle(p,particleHandle))
     return false; // no more free memory?
 
   // Add force particle to list
-  mForceParticles[particleIndex]=forceParticle;
+  mForceParticles[particleHandle]=forceParticle;
 
   return true;
 }
@@ -158,9 +187,19 @@ void ParticleEmitter::bind(const GLuint shaderProgram,const GLuint bindingPoint,
 
 void ParticleEmitter::updateParticlesOnGPU()
 {
-  // Copy all particle data to GPU
+  if(!mUploadToGPU)
+    return;
+
+  // Copy the active particles of each array to the GPU
+  const size_t n = mParticles.capacity(), numActive = mParticles.size();
+  if(numActive == 0)
+    return;
+  const size_t f = sizeof(float);
   glBindBuffer(GL_ARRAY_BUFFER, mParticleBuffer);
-  glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(Particle) * mParticles.size(), &mParticles[0]);
+  glBufferSubData(GL_ARRAY_BUFFER, 0,       3*f*numActive, mParticles.positions());
+  glBufferSubData(GL_ARRAY_BUFFER, 3*f*n,   3*f*numActive, mParticles.velocities());
+  glBufferSubData(GL_ARRAY_BUFFER, 6*f*n,   f*numActive,   mParticles.lifeLefts());
+  glBufferSubData(GL_ARRAY_BUFFER, 7*f*n,   f*numActive,   mParticles.isSpecialParticles());
   ogl::printOpenGLError();
 }
 
@@ -170,13 +209,14 @@ void ParticleEmitter::clear()
     return;
 
   mParticles.clear();
-  mParticles.shrink_to_fit();
-  mActiveParticles.clear();
-  mInactiveParticles.clear();
+  mForceParticles.clear();
 
-  glDeleteVertexArrays(1,&mVertexArrayObject);
-  glDeleteBuffers(1,&mParticleBuffer);
-  glDeleteBuffers(1,&mUniformBuffer);
+  if(mUploadToGPU)
+  {
+    glDeleteVertexArrays(1,&mVertexArrayObject);
+    glDeleteBuffers(1,&mParticleBuffer);
+    glDeleteBuffers(1,&mUniformBuffer);
+  }
 
   mInitialized = false;
 }
@@ -188,140 +228,286 @@ void ParticleEmitter::spawnParticles(float dt)
   // Compute the fraction of the new particle amount
   // This makes it possible to, e.g., emit 0.1 particles per second
   float nFrac = dt*mConfig.spawnrate - n;
-  if(Math::random() < nFrac)
+  if(mRandom.uniform() < nFrac)
     ++n;
 
-  for(size_t i= 0; i < n;++i)
-  {
-    // Create a new particle based on the current configuration
-    Particle p = this->createParticle();
-
-    // Add the new particle if free memory is available
-    size_t particleIndex;
-    if (!this->addParticle(p,particleIndex))
+  // Add the new particles if free memory is available, they are appended
+  // behind the active ones
+  const size_t first = mParticles.size();
+  size_t particleHandle;
+  for(int i = 0; i < n; ++i)
+    if (!this->addParticle(Particle(),particleHandle))
       break; //no more free memory for new particles
 
-    // Advect particle some random amount of time between 0 and dt
-    this->advectParticle(particleIndex,Math::random(0,dt));
-  }
+  this->parallelChunks(first,mParticles.size(),0,[&](size_t begin, size_t end, Random &random)
+  {
+    float timeSpans[kBatchSize];
+    for(size_t batch = begin; batch < end; batch += kBatchSize)
+    {
+      const size_t batchSize = end-batch < kBatchSize ? end-batch : kBatchSize;
+      for(size_t i = 0; i < batchSize; ++i)
+      {
+        // Create a new particle based on the current configuration
+        mParticles.set(batch+i,this->createParticle(random));
+
+        // Advect particle some random amount of time between 0 and dt
+        timeSpans[i] = random.uniform(0,dt);
+      }
+      this->advectParticles(batch,batchSize,timeSpans,random);
+    }
+  });
 }
 
 void ParticleEmitter::inactivateDyingParticles(float dt)
 {
-  for(std::list<size_t>::iterator iter = mActiveParticles.begin(); iter != mActiveParticles.end();)
+  for(size_t particleIndex = 0; particleIndex < mParticles.size();)
   {
-    size_t particleIndex = *iter;
-
     // Kill particles that will not survive this time step
-    if((mParticles[particleIndex].lifeLeft - dt) < 0.f)
+    if((mParticles.lifeLeft(particleIndex) - dt) < 0.f)
     {
-      //Delete the dying particle
-      iter=mActiveParticles.erase(iter);
-      mInactiveParticles.push_back(particleIndex);
-      mForceParticles.erase(particleIndex);
+      //Delete the dying particle, the last active one takes its place
+      if(!mForceParticles.empty())
+        mForceParticles.erase(mParticles.handle(particleIndex));
+      mParticles.remove(particleIndex);
     }
     else
-      ++iter;
+      ++particleIndex;
   }
 }
 
 void ParticleEmitter::advectActiveParticles(float dt)
 {
-  for(std::list<size_t>::iterator iter = mActiveParticles.begin(); iter != mActiveParticles.end(); ++iter)
-    this->advectParticle(*iter,dt);
+  this->parallelChunks(0,mParticles.size(),1,[&](size_t begin, size_t end, Random &random)
+  {
+    float timeSpans[kBatchSize];
+    std::fill(timeSpans,timeSpans+kBatchSize,dt);
+    for(size_t batch = begin; batch < end; batch += kBatchSize)
+      this->advectParticles(batch,end-batch < kBatchSize ? end-batch : kBatchSize,timeSpans,random);
+  });
 }
 
-void ParticleEmitter::advectParticle(size_t particleIndex, const float dt)
+void ParticleEmitter::advectParticles(size_t first, size_t count, const float *dt, Random &random)
 {
-  float maxLambda, speed;
-  Vec3 normal, forces, offset;
-  Mat4 M;
+  // The ray casts of all particles of a sub step are done in one batch,
+  // the arrays live on the stack
+  float timeLeft[kBatchSize], speed[kBatchSize];
+  float maxLambdas[kBatchSize], hitLambdas[kBatchSize];
+  Vec3 origins[kBatchSize], directions[kBatchSize], hitNormals[kBatchSize];
+  size_t rayParticles[kBatchSize];
 
-  float timeLeft = dt;
-  int stepCount=0;
-  Particle &p = mParticles[particleIndex];
+  std::copy(dt,dt+count,timeLeft);
 
   // Intersecting with geometry will result in multiple sub steps
   // It is therefore useful to bound the number of them for consistent performance
   // even though it is physically wrong
-  while (stepCount <mConfig.maxStepIterations && timeLeft > 0.f)
+  for(int stepCount = 0; stepCount < mConfig.maxStepIterations; ++stepCount)
   {
-    // Sum the particle forces (including gravity)
-    forces = sumParticleForces(particleIndex);
-
-    // Update the velocity vector
-    p.velocity +=forces*timeLeft;
-
-    speed = p.velocity.length();
-
-    //Perform a raycast to see whether the particle intersects with geometry
-    maxLambda = speed*timeLeft+mConfig.radius;
-    Ray ray(p.position,p.velocity);
-
-    //If no collision geometry is present the intersection object is 0
-    std::shared_ptr<RayIntersection> intersection = mCollisionScene ? mCollisionScene->closestIntersection(ray,maxLambda) : nullptr;
-
-    //If the trajectory intersects it gets a little more complicated
-    if(intersection)
-    { 
-      //Flip back-facing normals
-      normal = intersection->normal();
-      normal = dot(normal,p.velocity) > 0 ? -normal : normal;
-
-      //Compute the time until the particle intersects
-      maxLambda=intersection->lambda();
-      timeLeft -= maxLambda/speed;
-
-      //Compute an offset position slightly above the collision point
-      offset = (normal*mConfig.radius);
-      p.position=intersection->position()+offset;
-
-      // Reflect velocity vector at surface normal
-      p.velocity = reflect(p.velocity,normal).normalize();
-
-      // Add some deviation to the reflected vector
-      p.velocity.normalize();
-      Vec3 displace = Math::sampleDirectionPhongLobe(p.velocity,mConfig.reflectDeviationExponent);
-      p.velocity = (p.velocity + displace).normalize();
-      
-      // The particle should lose energy when colliding,
-      // This is realized by dampening with coefficients 0<coeff<1
-      p.velocity *= speed*Math::random(mConfig.reflectVelocityDampeningSpan[0],
-        mConfig.reflectVelocityDampeningSpan[1]);
+    size_t numRays = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+      if(!(timeLeft[i] > 0.f))
+        continue;
+      const size_t particleIndex = first+i;
+      Vec3 &velocity = mParticles.velocity(particleIndex);
+
+      // Sum the particle forces (including gravity) and update the velocity vector
+      velocity += sumParticleForces(particleIndex)*timeLeft[i];
+      speed[i] = velocity.length();
+
+      // The ray of the particle's trajectory
+      rayParticles[numRays] = i;
+      origins[numRays] = mParticles.position(particleIndex);
+      directions[numRays] = Vec3(velocity).normalize();
+      maxLambdas[numRays] = speed[i]*timeLeft[i]+mConfig.radius;
+      ++numRays;
     }
-    //This is the easy case, no intersection with collision geometry :)
+    if(numRays == 0)
+      break;
+
+    //Perform the raycasts to see whether the particles intersect with geometry
+    if(mCollisionScene)
+      mCollisionScene->closestIntersections(numRays,origins,directions,maxLambdas,hitLambdas,hitNormals);
     else
+      std::copy(maxLambdas,maxLambdas+numRays,hitLambdas);
+
+    for(size_t r = 0; r < numRays; ++r)
     {
-      // The particle is displaced by the velocity over time
-      p.position+=p.velocity*timeLeft;
-      timeLeft = 0;
+      const size_t i = rayParticles[r];
+      Vec3 &position = mParticles.position(first+i);
+      Vec3 &velocity = mParticles.velocity(first+i);
+
+      //If the trajectory intersects it gets a little more complicated
+      if(hitLambdas[r] < maxLambdas[r])
+      {
+        //Flip back-facing normals
+        Vec3 normal = hitNormals[r];
+        normal = dot(normal,velocity) > 0 ? -normal : normal;
+
+        //Compute the time until the particle intersects
+        timeLeft[i] -= hitLambdas[r]/speed[i];
+
+        //Compute an offset position slightly above the collision point
+        position = origins[r]+directions[r]*hitLambdas[r]+normal*mConfig.radius;
+
+        // Reflect velocity vector at surface normal
+        velocity = reflect(velocity,normal).normalize();
+
+        // Add some deviation to the reflected vector
+        Vec3 displace = Math::sampleDirectionPhongLobe(velocity,mConfig.reflectDeviationExponent,random);
+        velocity = (velocity + displace).normalize();
+
+        // The particle should lose energy when colliding,
+        // This is realized by dampening with coefficients 0<coeff<1
+        velocity *= speed[i]*random.uniform(mConfig.reflectVelocityDampeningSpan[0],
+          mConfig.reflectVelocityDampeningSpan[1]);
+      }
+      //This is the easy case, no intersection with collision geometry :)
+      else
+      {
+        // The particle is displaced by the velocity over time
+        position+=velocity*timeLeft[i];
+        timeLeft[i] = 0;
+      }
     }
-    ++stepCount;
   }
 
   //subtract life
-  p.lifeLeft-=dt;
+  for(size_t i = 0; i < count; ++i)
+    mParticles.lifeLeft(first+i)-=dt[i];
 }
 
-Vec3 ParticleEmitter::sumParticleForces(size_t particleIndex)
+void ParticleEmitter::updateForceSources()
 {
-  Vec3 forces = mConfig.gravity;
+  mForceSources.clear();
   for(ForceParticleMap::const_iterator iter = mForceParticles.begin();iter != mForceParticles.end();++iter)
+  {
+    ForceSource source;
+    source.handle = iter->first;
+    source.particle = mParticles.particle(mParticles.index(iter->first));
+    source.force = iter->second.get();
+    mForceSources.push_back(source);
+  }
+
+  if(mConfig.forceTheta > 0.f)
+    mForceOctree.build(mForceSources,mConfig.forceTheta);
+}
+
+Vec3 ParticleEmitter::sumParticleForces(size_t particleIndex) const
+{
+  Vec3 forces = mConfig.gravity;
+  const size_t particleHandle = mParticles.handle(particleIndex);
+  if(mConfig.forceTheta > 0.f)
+    return forces+mForceOctree.sumForces(mParticles.position(particleIndex),particleHandle);
+
+  for(size_t i = 0; i < mForceSources.size(); ++i)
   {
     // Only compute the force for other particles
     // A particle does not exert force upon itself
-    if(iter->first != particleIndex)
-      forces+=iter->second->computeForce(mParticles[iter->first],mParticles[particleIndex].position);
+    if(mForceSources[i].handle != particleHandle)
+      forces+=mForceSources[i].force->computeForce(mForceSources[i].particle,mParticles.position(particleIndex));
   }
   return forces;
 }
 
+template<class Function>
+void ParticleEmitter::parallelChunks(size_t first, size_t end, unsigned phase, Function function)
+{
+  const size_t numChunks = (end-first+kChunkSize-1)/kChunkSize;
+  if(numChunks == 0)
+    return;
+
+  // Chunks are handed out in order, every chunk draws from its own random
+  // stream, so the result does not depend on which thread takes it
+  std::atomic<size_t> nextChunk(0);
+  auto worker = [&]()
+  {
+    for(size_t chunk = nextChunk++; chunk < numChunks; chunk = nextChunk++)
+    {
+      // sequence 0 is the serial stream mRandom
+      Random random(mConfig.seed, (uint64_t(mStepCount) << 32 | chunk) * 4 + phase + 1);
+      const size_t begin = first + chunk*kChunkSize;
+      function(begin, std::min(begin+kChunkSize,end), random);
+    }
+  };
+
+  const size_t numThreads = mConfig.numThreads > 0 ? size_t(mConfig.numThreads) : std::thread::hardware_concurrency();
+
+  // A single chunk is not worth waking the pool
+  if(numThreads <= 1 || numChunks == 1)
+  {
+    worker();
+    return;
+  }
+  this->runOnWorkers(numThreads,worker);
+}
+
+void ParticleEmitter::runOnWorkers(size_t numThreads, const std::function<void()> &job)
+{
+  if(mWorkers.size()+1 != numThreads)
+  {
+    this->stopWorkers();
+    for(size_t i = 0; i+1 < numThreads; ++i)
+      mWorkers.push_back(std::thread(&ParticleEmitter::workerLoop,this,mWorkerGeneration));
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mWorkerMutex);
+    mWorkerJob = &job;
+    mWorkersBusy = mWorkers.size();
+    ++mWorkerGeneration;
+  }
+  mWorkerWake.notify_all();
+
+  // The calling thread is one of the workers
+  job();
+
+  std::unique_lock<std::mutex> lock(mWorkerMutex);
+  mWorkerDone.wait(lock,[this]() { return mWorkersBusy == 0; });
+  mWorkerJob = 0;
+}
+
+// generation is the last job before the worker was started, it waits for the next one
+void ParticleEmitter::workerLoop(unsigned generation)
+{
+  std::unique_lock<std::mutex> lock(mWorkerMutex);
+  for(;;)
+  {
+    mWorkerWake.wait(lock,[&]() { return mStopWorkers || mWorkerGeneration != generation; });
+    if(mStopWorkers)
+      return;
+    generation = mWorkerGeneration;
+    const std::function<void()> *job = mWorkerJob;
+
+    lock.unlock();
+    (*job)();
+    lock.lock();
+
+    if(--mWorkersBusy == 0)
+      mWorkerDone.notify_one();
+  }
+}
+
+void ParticleEmitter::stopWorkers()
+{
+  {
+    std::lock_guard<std::mutex> lock(mWorkerMutex);
+    mStopWorkers = true;
+  }
+  mWorkerWake.notify_all();
+  for(size_t i = 0; i < mWorkers.size(); ++i)
+    mWorkers[i].join();
+  mWorkers.clear();
+  mStopWorkers = false;
+}
+
 void ParticleEmitter::fireworkStep(float dt)
 {
   //Iterate over all active particles
-  for(std::list<size_t>::iterator iter = mActiveParticles.begin(); iter != mActiveParticles.end(); ++iter)
+  //New particles are appended behind the active ones and not visited
+  const size_t numParticles = mParticles.size();
+  for(size_t particleIndex = 0; particleIndex < numParticles; ++particleIndex)
   {
-    Particle &p = mParticles[*iter];
+    Particle p = mParticles.particle(particleIndex);
 
     //TODO: fireworks
     // A fireworks is based on particles that emit new particles
@@ -336,14 +522,14 @@ void ParticleEmitter::fireworkStep(float dt)
     // Particle newParticle = createParticle();
     // do something ..
     // newParticle.isSpecialParticle = p.isSpecialParticle+10.f;
-    // size_t newParticleIndex;
-    // this->addParticle(newParticle,newParticleIndex);
+    // size_t newParticleHandle;
+    // this->addParticle(newParticle,newParticleHandle);
 
     // Note: you can obtain uniform samples of a new using
     // Math::sampleUnitSphere()
 
     // Note: do not explicitly remove Particle p in this loop
-    // If you want to get rid off it, call p.lifeLeft=0;
+    // If you want to get rid off it, call mParticles.lifeLeft(particleIndex)=0;
   }
 }
 
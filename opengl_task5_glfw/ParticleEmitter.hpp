@@ -3,10 +3,15 @@
 
 #include "OpenGL.hpp"
 #include <vector>
-#include <list>
 #include <unordered_map>
 #include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 #include "Particle.hpp"
+#include "ParticlePool.hpp"
+#include "ForceOctree.hpp"
 
 namespace ogl
 {
@@ -26,7 +31,10 @@ public:
       reflectDeviationExponent(100000),
       reflectVelocityDampeningSpan(0.5f,0.7f),
       forceParticleLifeSpan(4,4),
-      enableFireworks(false)
+      enableFireworks(false),
+      numThreads(0), seed(1),
+      timeStep(1.f/60.f), maxStepsPerFrame(4),
+      forceTheta(0.f)
     {}
     int maxStepIterations;
     int maxNumParticles;
@@ -42,6 +50,11 @@ public:
     Vec2 reflectVelocityDampeningSpan;
     Vec2 forceParticleLifeSpan;
     bool enableFireworks;
+    int numThreads;     // threads advecting and spawning particles, 0 -> hardware threads
+    unsigned seed;      // random numbers are reproducible for a given seed
+    float timeStep;     // fixed simulation time step in seconds
+    int maxStepsPerFrame; // step() drops time beyond this many steps per call
+    float forceTheta;   // Barnes-Hut accuracy of the force particles, 0 -> exact sum
   };
 
   // The particle constructor.
@@ -51,20 +64,29 @@ public:
   virtual ~ParticleEmitter();
 
   // Initializes the emitter based on the current configuration
-  bool init();
+  // Without uploadToGPU no OpenGL calls are made (headless simulation)
+  bool init(bool uploadToGPU=true);
 
-  // Performs an update step (kill, spawn and advect particles
+  // Performs the simulation steps of mConfig.timeStep for the time passed
+  // since the last call and copies the particles to the GPU
   void step();
 
+  // Performs numSteps simulation steps of mConfig.timeStep (kill, spawn and
+  // advect particles) without OpenGL. The result only depends on the
+  // configuration and the number of steps, not on the wall clock.
+  void simulate(int numSteps=1);
+
   // Creates a particle based on the current configuration
   // Note: the particle is not added!
-  Particle createParticle() const;
+  Particle createParticle();
+  Particle createParticle(Random &random) const;
 
   // Adds a particle to the system if free memory is available
-  // The particle index is stored in particleIndex
+  // The particle handle is stored in particleHandle, it stays valid until
+  // the particle dies (the array index of a particle changes when others die)
   // The return value is true if the particle system has been added,
   // and false if not.
-  bool addParticle(const Particle &p, size_t &particleIndex);
+  bool addParticle(const Particle &p, size_t &particleHandle);
 
   // Adds a force particle to the particle set, the corresponding tracked 
   // 'normal particle' is created internally
@@ -84,7 +106,8 @@ public:
     mCollisionScene=collisionScene;
   }
 
-  // Returns the maximum number of particles
+  // Returns the number of live particles, they are stored at the front of
+  // the particle buffer
   int numParticles() const { return (int)mParticles.size();}
 
   // Returns the VAO handle for the particle structs
@@ -97,8 +120,12 @@ private:
   // Copy particle buffer data to the GPU
   void updateParticlesOnGPU();
 
-  // Advect a particle over time span dt
-  void advectParticle(size_t particleIndex, const float dt);
+  // Performs one simulation step over time span dt
+  void simulationStep(float dt);
+
+  // Advect the count <= kBatchSize particles from first on over time spans dt[i],
+  // the collisions of a sub step are found by one batch of ray casts
+  void advectParticles(size_t first, size_t count, const float *dt, Random &random);
 
   // Kill particles that will not last longer than time span dt
   void inactivateDyingParticles(float dt);
@@ -109,9 +136,26 @@ private:
   //Advect all particles over time span dt
   void advectActiveParticles(float dt);
 
+  // Copies the force particles at the beginning of a step, they are read by
+  // all threads while the particles move. Rebuilds the force octree.
+  void updateForceSources();
+
   // Computes the sum of all forces including gravity and the forces,
   // of all other(!) force particles upon the particle with particleIndex.
-  Vec3 sumParticleForces(size_t particleIndex);
+  Vec3 sumParticleForces(size_t particleIndex) const;
+
+  // Calls function(first,end,random) for chunks of kChunkSize particles
+  // of [first,end) on the worker threads. The random numbers of a chunk only
+  // depend on the seed, the step, the phase and the chunk index.
+  template<class Function>
+  void parallelChunks(size_t first, size_t end, unsigned phase, Function function);
+
+  // Runs job on the calling thread and on all workers of the pool, returns
+  // when every call has finished. The pool is (re)started with
+  // numThreads-1 workers if its size differs.
+  void runOnWorkers(size_t numThreads, const std::function<void()> &job);
+  void workerLoop(unsigned generation);
+  void stopWorkers();
 
   //Fireworks step
   void fireworkStep(float dt);
@@ -120,6 +164,7 @@ private:
   void clear();
 
   bool mInitialized;              //< True if init has been called after last clear() call.
+  bool mUploadToGPU;              //< False for a headless emitter without OpenGL objects.
 
   GLuint mVertexArrayObject;      //< Handle to the VAO
   GLuint mParticleBuffer;         //< Handle to the VBO holding the particle structs
@@ -129,16 +174,33 @@ private:
 
   Vec3 mBasisU, mBasisV, mBasisW; //< Cached orthonormal system for velocity direction of spawned particles
 
-  float mGlobalTime;                //< The process runtime in milliseconds
+  float mGlobalTime;                //< The process runtime in seconds
+  float mTimeAccumulator;           //< Time passed which is not simulated yet
+
+  unsigned mStepCount;              //< Number of steps since init, selects the random streams
+  Random mRandom;                   //< Random numbers of the serial parts of a step
 
   std::shared_ptr<CollisionScene> mCollisionScene; //Pointer to the collision scene
 
-  std::vector<Particle> mParticles;     //< The particle data
-  std::list<size_t> mActiveParticles;   //< List of indices of active particles
-  std::list<size_t> mInactiveParticles; //< List of indices of inactive particles
+  ParticlePool mParticles;        //< The particle data, live particles first
 
   typedef std::unordered_map<size_t,std::shared_ptr<ForceParticle>> ForceParticleMap;
-  ForceParticleMap mForceParticles; //<The hash map for forces attached to particles
+  ForceParticleMap mForceParticles; //<The hash map for forces attached to particle handles
+
+  std::vector<ForceSource> mForceSources; //< Force particles at the beginning of the step
+  ForceOctree mForceOctree;               //< Approximation of mForceSources if forceTheta > 0
+
+  std::vector<std::thread> mWorkers;      //< Persistent threads of parallelChunks besides the caller
+  std::mutex mWorkerMutex;
+  std::condition_variable mWorkerWake;    //< Signals a new job or the shutdown to the workers
+  std::condition_variable mWorkerDone;    //< Signals the caller that all workers finished the job
+  const std::function<void()> *mWorkerJob;
+  unsigned mWorkerGeneration;             //< Incremented for every job
+  size_t mWorkersBusy;                    //< Workers which have not finished the current job
+  bool mStopWorkers;
+
+  static const size_t kChunkSize = 1024;  //< Particles per parallel work item
+  static const size_t kBatchSize = 64;    //< Particles advected together, their ray casts are batched
 };
 } //namespace ogl
 
@@ -0,0 +1,137 @@
+#ifndef PARTICLEPOOL_HPP_INCLUDE_ONCE
+#define PARTICLEPOOL_HPP_INCLUDE_ONCE
+
+#include <vector>
+#include <cstdint>
+#include "Particle.hpp"
+
+namespace ogl
+{
+//Fixed capacity particle storage as a structure of arrays. The live
+//particles are kept densely at the front: a particle is appended behind
+//the last live one, and a dying particle is replaced by the last live one.
+//Both are O(1) and never allocate after init().
+//Since removing moves particles, every particle also gets a handle which
+//stays valid until the particle dies (used to attach force particles).
+class ParticlePool
+{
+public:
+  ParticlePool() : mSize(0), mNumFreeHandles(0) {}
+
+  //Allocates the arrays for capacity particles, all of them dead
+  void init(size_t capacity)
+  {
+    mPositions.assign(capacity,Vec3(0,0,0));
+    mVelocities.assign(capacity,Vec3(0,0,0));
+    mLifeLeft.assign(capacity,0.f);
+    mIsSpecialParticle.assign(capacity,0.f);
+    mHandles.assign(capacity,0);
+    mIndices.assign(capacity,0);
+    mFreeHandles.resize(capacity);
+
+    //handles are handed out in ascending order
+    for(size_t i = 0; i < capacity; ++i)
+      mFreeHandles[i] = uint32_t(capacity-1-i);
+    mNumFreeHandles = capacity;
+    mSize = 0;
+  }
+
+  //Frees all memory
+  void clear()
+  {
+    std::vector<Vec3>().swap(mPositions);
+    std::vector<Vec3>().swap(mVelocities);
+    std::vector<float>().swap(mLifeLeft);
+    std::vector<float>().swap(mIsSpecialParticle);
+    std::vector<uint32_t>().swap(mHandles);
+    std::vector<uint32_t>().swap(mIndices);
+    std::vector<uint32_t>().swap(mFreeHandles);
+    mNumFreeHandles = 0;
+    mSize = 0;
+  }
+
+  size_t size()     const { return mSize; }
+  size_t capacity() const { return mPositions.size(); }
+  bool   full()     const { return mSize == capacity(); }
+
+  //Appends a particle behind the live ones and returns its handle.
+  //The pool must not be full.
+  size_t add(const Particle &p)
+  {
+    const uint32_t handle = mFreeHandles[--mNumFreeHandles];
+    const size_t index = mSize++;
+    this->set(index,p);
+    mHandles[index] = handle;
+    mIndices[handle] = uint32_t(index);
+    return handle;
+  }
+
+  //Overwrites the particle at index
+  void set(size_t index, const Particle &p)
+  {
+    mPositions[index] = p.position;
+    mVelocities[index] = p.velocity;
+    mLifeLeft[index] = p.lifeLeft;
+    mIsSpecialParticle[index] = p.isSpecialParticle;
+  }
+
+  //Kills the particle at index, the last live particle takes its place
+  void remove(size_t index)
+  {
+    const size_t last = --mSize;
+    mFreeHandles[mNumFreeHandles++] = mHandles[index];
+    if(index == last)
+      return;
+    mPositions[index] = mPositions[last];
+    mVelocities[index] = mVelocities[last];
+    mLifeLeft[index] = mLifeLeft[last];
+    mIsSpecialParticle[index] = mIsSpecialParticle[last];
+    mHandles[index] = mHandles[last];
+    mIndices[mHandles[index]] = uint32_t(index);
+  }
+
+  //Conversion between handles and the current array index of live particles
+  size_t index(size_t handle) const { return mIndices[handle]; }
+  size_t handle(size_t index) const { return mHandles[index]; }
+
+  //Returns a copy of the particle at index
+  Particle particle(size_t index) const
+  {
+    Particle p;
+    p.position = mPositions[index];
+    p.velocity = mVelocities[index];
+    p.lifeLeft = mLifeLeft[index];
+    p.isSpecialParticle = mIsSpecialParticle[index];
+    return p;
+  }
+
+  Vec3&  position(size_t index)          { return mPositions[index]; }
+  Vec3&  velocity(size_t index)          { return mVelocities[index]; }
+  float& lifeLeft(size_t index)          { return mLifeLeft[index]; }
+  float& isSpecialParticle(size_t index) { return mIsSpecialParticle[index]; }
+
+  const Vec3&  position(size_t index)          const { return mPositions[index]; }
+  const Vec3&  velocity(size_t index)          const { return mVelocities[index]; }
+  float        lifeLeft(size_t index)          const { return mLifeLeft[index]; }
+  float        isSpecialParticle(size_t index) const { return mIsSpecialParticle[index]; }
+
+  //The arrays, e.g. for copying the live particles to the GPU
+  const Vec3*  positions()          const { return mPositions.data(); }
+  const Vec3*  velocities()         const { return mVelocities.data(); }
+  const float* lifeLefts()          const { return mLifeLeft.data(); }
+  const float* isSpecialParticles() const { return mIsSpecialParticle.data(); }
+
+private:
+  std::vector<Vec3>     mPositions;         //< Particle world positions
+  std::vector<Vec3>     mVelocities;        //< Particle velocity vectors
+  std::vector<float>    mLifeLeft;          //< Life left in seconds
+  std::vector<float>    mIsSpecialParticle; //< 0->normal, 1->force particle
+  std::vector<uint32_t> mHandles;           //< Handle of the particle at an index
+  std::vector<uint32_t> mIndices;           //< Index of the particle with a handle
+  std::vector<uint32_t> mFreeHandles;       //< Stack of unused handles
+  size_t mSize;                             //< Number of live particles
+  size_t mNumFreeHandles;                   //< Size of the free handle stack
+};
+} //namespace ogl
+
+#endif //PARTICLEPOOL_HPP_INCLUDE_ONCE
@@ -0,0 +1,199 @@
+#ifndef RAYPACKET_HPP_INCLUDE_ONCE
+#define RAYPACKET_HPP_INCLUDE_ONCE
+
+#include <limits>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#  define OGL_RAYPACKET_SSE
+#  include <xmmintrin.h>
+#endif
+
+#include "OpenGL.hpp"
+#include "Collision.hpp"
+
+namespace ogl
+{
+
+/// Four rays which are intersected with the collision geometry together,
+/// in structure of arrays layout. Every lane keeps the closest triangle hit
+/// so far, lambda shrinks from the maximal lambda to the lambda of that hit.
+/// Lanes without a ray have a negative lambda and never hit anything.
+struct RayPacket4
+{
+  static const int kSize = 4;
+
+  RayPacket4()
+  {
+    for(int l=0;l<kSize;++l)
+      this->disable(l);
+  }
+
+  /// Sets the ray of a lane, direction must be normalized
+  void set(int lane, const Vec3 &o, const Vec3 &d, float maxLambda)
+  {
+    for(int a=0;a<3;++a)
+    {
+      origin[a][lane] = o[a];
+      direction[a][lane] = d[a];
+      //zero components get a huge reciprocal, no NaNs in the slab test
+      invDirection[a][lane] = d[a] != 0 ? 1.f/d[a] : (std::signbit(d[a]) ? -1e30f : 1e30f);
+    }
+    lambda[lane] = maxLambda;
+    triangle[lane] = -1;
+  }
+
+  void disable(int lane)
+  {
+    for(int a=0;a<3;++a)
+    {
+      origin[a][lane] = 0.f;
+      direction[a][lane] = 0.f;
+      invDirection[a][lane] = 1e30f;
+    }
+    lambda[lane] = -1.f;
+    triangle[lane] = -1;
+  }
+
+  float origin[3][kSize];
+  float direction[3][kSize];
+  float invDirection[3][kSize];
+  float lambda[kSize];      //< Maximal lambda, then lambda of the closest hit
+  int   triangle[kSize];    //< Index of the closest triangle hit, -1 for none
+  float u[kSize], v[kSize]; //< Barycentric coordinates of the hit (w = 1-u-v)
+};
+
+/// Returns the mask of lanes (bit i for lane i) which enter box within
+/// [0,lambda[lane]].
+inline int intersectBox(const RayPacket4 &packet, const BoundingBox &box)
+{
+  const Vec3 &lower = box.min();
+  const Vec3 &upper = box.max();
+#ifdef OGL_RAYPACKET_SSE
+  const __m128 ox = _mm_loadu_ps(packet.origin[0]);
+  const __m128 oy = _mm_loadu_ps(packet.origin[1]);
+  const __m128 oz = _mm_loadu_ps(packet.origin[2]);
+  const __m128 ix = _mm_loadu_ps(packet.invDirection[0]);
+  const __m128 iy = _mm_loadu_ps(packet.invDirection[1]);
+  const __m128 iz = _mm_loadu_ps(packet.invDirection[2]);
+
+  const __m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lower[0]),ox),ix), x1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(upper[0]),ox),ix);
+  const __m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lower[1]),oy),iy), y1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(upper[1]),oy),iy);
+  const __m128 z0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lower[2]),oz),iz), z1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(upper[2]),oz),iz);
+
+  const __m128 tnear = _mm_max_ps(
+    _mm_max_ps(_mm_min_ps(x0,x1),_mm_min_ps(y0,y1)),
+    _mm_max_ps(_mm_min_ps(z0,z1),_mm_setzero_ps()));
+  const __m128 tfar = _mm_min_ps(
+    _mm_min_ps(_mm_max_ps(x0,x1),_mm_max_ps(y0,y1)),
+    _mm_min_ps(_mm_max_ps(z0,z1),_mm_loadu_ps(packet.lambda)));
+  return _mm_movemask_ps(_mm_cmple_ps(tnear,tfar));
+#else
+  int mask = 0;
+  for(int l=0;l<RayPacket4::kSize;++l)
+  {
+    float tnear = 0, tfar = packet.lambda[l];
+    for(int a=0;a<3;++a)
+    {
+      const float t0 = (lower[a]-packet.origin[a][l])*packet.invDirection[a][l];
+      const float t1 = (upper[a]-packet.origin[a][l])*packet.invDirection[a][l];
+      tnear = std::max(tnear,std::min(t0,t1));
+      tfar = std::min(tfar,std::max(t0,t1));
+    }
+    if(tnear <= tfar)
+      mask |= 1<<l;
+  }
+  return mask;
+#endif
+}
+
+/// Intersects the lanes with triangle (a,b,c) like Intersection::lineTriangle.
+/// Lanes hitting it at 0 < lambda < lambda[lane] record the hit.
+inline void intersectTriangle(RayPacket4 &packet, const Vec3 &a, const Vec3 &b, const Vec3 &c,
+                              int triangleIndex)
+{
+  // Moeller and Trumbore with c as base vertex, see Intersection::linePlane
+  const Vec3 e1 = a-c;
+  const Vec3 e2 = b-c;
+#ifdef OGL_RAYPACKET_SSE
+  const __m128 e1x = _mm_set1_ps(e1[0]), e1y = _mm_set1_ps(e1[1]), e1z = _mm_set1_ps(e1[2]);
+  const __m128 e2x = _mm_set1_ps(e2[0]), e2y = _mm_set1_ps(e2[1]), e2z = _mm_set1_ps(e2[2]);
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+
+  // -d
+  const __m128 dx = _mm_sub_ps(zero,_mm_loadu_ps(packet.direction[0]));
+  const __m128 dy = _mm_sub_ps(zero,_mm_loadu_ps(packet.direction[1]));
+  const __m128 dz = _mm_sub_ps(zero,_mm_loadu_ps(packet.direction[2]));
+  // tt = o-c
+  const __m128 tx = _mm_sub_ps(_mm_loadu_ps(packet.origin[0]),_mm_set1_ps(c[0]));
+  const __m128 ty = _mm_sub_ps(_mm_loadu_ps(packet.origin[1]),_mm_set1_ps(c[1]));
+  const __m128 tz = _mm_sub_ps(_mm_loadu_ps(packet.origin[2]),_mm_set1_ps(c[2]));
+  // pp = e2 x -d, qq = e1 x tt
+  const __m128 px = _mm_sub_ps(_mm_mul_ps(e2y,dz),_mm_mul_ps(e2z,dy));
+  const __m128 py = _mm_sub_ps(_mm_mul_ps(e2z,dx),_mm_mul_ps(e2x,dz));
+  const __m128 pz = _mm_sub_ps(_mm_mul_ps(e2x,dy),_mm_mul_ps(e2y,dx));
+  const __m128 qx = _mm_sub_ps(_mm_mul_ps(e1y,tz),_mm_mul_ps(e1z,ty));
+  const __m128 qy = _mm_sub_ps(_mm_mul_ps(e1z,tx),_mm_mul_ps(e1x,tz));
+  const __m128 qz = _mm_sub_ps(_mm_mul_ps(e1x,ty),_mm_mul_ps(e1y,tx));
+
+  const __m128 detA = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x,px),_mm_mul_ps(e1y,py)),_mm_mul_ps(e1z,pz));
+  const __m128 absDetA = _mm_andnot_ps(_mm_set1_ps(-0.0f),detA);
+  const __m128 u = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx,px),_mm_mul_ps(ty,py)),_mm_mul_ps(tz,pz)),detA);
+  const __m128 v = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx,qx),_mm_mul_ps(dy,qy)),_mm_mul_ps(dz,qz)),detA);
+  const __m128 w = _mm_sub_ps(_mm_sub_ps(one,u),v);
+  const __m128 lambda = _mm_div_ps(_mm_sub_ps(zero,
+    _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x,qx),_mm_mul_ps(e2y,qy)),_mm_mul_ps(e2z,qz))),detA);
+
+  __m128 hit = _mm_cmpge_ps(absDetA,_mm_set1_ps(Math::safetyEps()));
+  hit = _mm_and_ps(hit,_mm_and_ps(_mm_cmpge_ps(u,zero),_mm_cmple_ps(u,one)));
+  hit = _mm_and_ps(hit,_mm_and_ps(_mm_cmpge_ps(v,zero),_mm_cmple_ps(v,one)));
+  hit = _mm_and_ps(hit,_mm_and_ps(_mm_cmpge_ps(w,zero),_mm_cmple_ps(w,one)));
+  hit = _mm_and_ps(hit,_mm_and_ps(_mm_cmpgt_ps(lambda,zero),_mm_cmplt_ps(lambda,_mm_loadu_ps(packet.lambda))));
+
+  const int mask = _mm_movemask_ps(hit);
+  if(!mask)
+    return;
+  float lambdas[4], us[4], vs[4];
+  _mm_storeu_ps(lambdas,lambda);
+  _mm_storeu_ps(us,u);
+  _mm_storeu_ps(vs,v);
+  for(int l=0;l<RayPacket4::kSize;++l)
+  {
+    if(mask & (1<<l))
+    {
+      packet.lambda[l] = lambdas[l];
+      packet.u[l] = us[l];
+      packet.v[l] = vs[l];
+      packet.triangle[l] = triangleIndex;
+    }
+  }
+#else
+  for(int l=0;l<RayPacket4::kSize;++l)
+  {
+    const Vec3 d(-packet.direction[0][l],-packet.direction[1][l],-packet.direction[2][l]);
+    const Vec3 tt = Vec3(packet.origin[0][l],packet.origin[1][l],packet.origin[2][l])-c;
+    const Vec3 pp = cross(e2,d);
+    const Vec3 qq = cross(e1,tt);
+    const float detA = dot(e1,pp);
+    if(fabs(detA) < Math::safetyEps())
+      continue;
+    const float u = dot(tt,pp)/detA;
+    const float v = dot(d,qq)/detA;
+    const float w = 1-u-v;
+    const float lambda = dot(-e2,qq)/detA;
+    if(u<0.f || u>1.f || v<0.f || v>1.f || w<0.f || w>1.f)
+      continue;
+    if(lambda > 0 && lambda < packet.lambda[l])
+    {
+      packet.lambda[l] = lambda;
+      packet.u[l] = u;
+      packet.v[l] = v;
+      packet.triangle[l] = triangleIndex;
+    }
+  }
+#endif
+}
+
+} //namespace ogl
+
+#endif //RAYPACKET_HPP_INCLUDE_ONCE
@@ -8,6 +8,10 @@
 #include "CollisionGeometry.hpp"
 #include "CollisionScene.hpp"
 #include "Particle.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
 
 std::string gDataPath= ""; ///< The path pointing to the resources (OBJ, shader)
 enum SceneChoice
@@ -223,7 +227,8 @@ bool initAxisArrows()
   return true;
 }
 
-bool initScenePlanes()
+// The scenes are set up without OpenGL objects and camera if headless
+bool initScenePlanes(bool headless=false)
 {
   ogl::IndexedTriangleIO io;
   io.loadFromOBJ(gDataPath+"collisionPlane.obj");
@@ -242,9 +247,9 @@ bool initScenePlanes()
   {
     std::shared_ptr<ogl::CollisionGeometry> geom= std::make_shared<ogl::CollisionGeometry>();
     if(i==0)
-      geom->init(io.vertexPositions(),io.vertexNormals(),io.triangleIndices());
+      geom->init(io.vertexPositions(),io.vertexNormals(),io.triangleIndices(),!headless);
     else
-      geom->initInstance(gCollisionPlanes[0]);
+      geom->initInstance(gCollisionPlanes[0],!headless);
 
     geom->setMaterial(100.f,ogl::Vec3(0.2f,0.5f,1.0f));
     geom->setLightPosition0(gLight0);
@@ -274,6 +279,9 @@ bool initScenePlanes()
   gCollisionPlanes[4]->modelMatrix().translate(10,0,-6);
   gCollisionPlanes[4]->setMaterial(100.f,ogl::Vec3(0.2f,1.0f,0.2f)); //green plane
 
+  for(size_t i=0;i<gNumCollisionPlanes;++i)
+    gCollisionPlanes[i]->updateTransform();
+
   //Initialize the particle emitter
   gParticleEmitter = std::make_shared<ogl::ParticleEmitter>();
   gParticleEmitter->setCollisionScene(gCollisionScene);
@@ -291,8 +299,10 @@ bool initScenePlanes()
   c.forceParticleLifeSpan = ogl::Vec2(3,4);
   c.enableFireworks=false;
 
-  if(!gParticleEmitter->init())
+  if(!gParticleEmitter->init(!headless))
     return false;
+  if(headless)
+    return true;
 
   //Set the camera
   gCamera->setPosition(ogl::Vec3(0,-20,3));
@@ -301,7 +311,7 @@ bool initScenePlanes()
   return true;
 }
 
-bool initSceneRoom()
+bool initSceneRoom(bool headless=false)
 {
   //Load and init the room collision geometry
   ogl::IndexedTriangleIO io;
@@ -319,7 +329,8 @@ bool initSceneRoom()
   //Setup the collision room scene
   gCollisionScene = std::make_shared<ogl::CollisionScene>();
   gCollisionRoom = std::make_shared<ogl::CollisionGeometry>();
-  gCollisionRoom->init(io.vertexPositions(),io.vertexNormals(),io.triangleIndices());
+  gCollisionRoom->init(io.vertexPositions(),io.vertexNormals(),io.triangleIndices(),!headless);
+  gCollisionRoom->updateTransform();
   gCollisionRoom->setMaterial(100.f,ogl::Vec3(0.2f,0.5f,1.0f));
   gCollisionRoom->setLightPosition0(gLight0);
   gCollisionRoom->setLightPosition1(gLight1);
@@ -327,8 +338,11 @@ bool initSceneRoom()
   gCollisionScene->addGeometry(gCollisionRoom);
 
   // Cull the back-facing triangles to allow viewing into the room
-  glEnable(GL_CULL_FACE);
-  glCullFace(GL_BACK);
+  if(!headless)
+  {
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+  }
 
   //Initialize the particle emitter system
   gParticleEmitter = std::make_shared<ogl::ParticleEmitter>();
@@ -348,8 +362,10 @@ bool initSceneRoom()
   c.forceParticleLifeSpan = ogl::Vec2(3,4);
   c.enableFireworks=false;
 
-  if(!gParticleEmitter->init())
+  if(!gParticleEmitter->init(!headless))
     return false;
+  if(headless)
+    return true;
 
   //Set the camera
   gCamera->setPosition(ogl::Vec3(-20,-13,6));
@@ -357,11 +373,14 @@ bool initSceneRoom()
   return true;
 }
 
-bool initFireworksScene()
+bool initFireworksScene(bool headless=false)
 {
   //Set the camera
-  gCamera->setPosition(ogl::Vec3(-26,-26,15));
-  gCamera->setTarget(ogl::Vec3(0,0,15));
+  if(!headless)
+  {
+    gCamera->setPosition(ogl::Vec3(-26,-26,15));
+    gCamera->setTarget(ogl::Vec3(0,0,15));
+  }
 
   //Setup the emitter
   gParticleEmitter = std::make_shared<ogl::ParticleEmitter>();
@@ -377,7 +396,7 @@ bool initFireworksScene()
   c.lifeSpan = ogl::Vec2(3,4);
   c.enableFireworks=true;
 
-  if(!gParticleEmitter->init())
+  if(!gParticleEmitter->init(!headless))
     return false;
 
   return true;
@@ -491,9 +510,261 @@ void keyboardCB(int key, int action)
   }
 }
 
+// Runs the simulation of every scene for numSteps fixed time steps without
+// a window and prints the time per step and the particles advected per second
+void benchmarkSimulation(int numSteps, int numThreads)
+{
+  const char *names[3] = {"room", "planes", "fireworks"};
+  for(int scene=0;scene<3;++scene)
+  {
+    gCollisionPlanes.clear();
+    gCollisionScene.reset();
+    bool ok = scene == 0 ? initSceneRoom(true) : scene == 1 ? initScenePlanes(true) : initFireworksScene(true);
+    if(!ok)
+      continue;
+    gParticleEmitter->configuration().numThreads=numThreads;
+
+    typedef std::chrono::steady_clock Clock;
+    double particleSteps = 0, seconds = 0;
+    for(int i=0;i<numSteps;++i)
+    {
+      const Clock::time_point start = Clock::now();
+      gParticleEmitter->simulate(1);
+      seconds += std::chrono::duration<double>(Clock::now()-start).count();
+      particleSteps += gParticleEmitter->numParticles();
+    }
+
+    std::cout<<names[scene]<<": "<<numSteps<<" steps in "<<seconds<<"s, "
+      <<seconds/numSteps*1000<<" ms/step, "<<gParticleEmitter->numParticles()<<" particles at the end, "
+      <<particleSteps/seconds/1e6<<" M particle steps/s"<<std::endl;
+  }
+}
+
+// Softened inverse square attraction, used to measure the force octree
+// because the PointGravitySource of the exercise returns no force yet
+class InverseSquareSource : public ogl::ForceParticle
+{
+public:
+  ogl::Vec3 computeForce(const ogl::Particle &forceParticle, const ogl::Vec3 &otherParticlePosition) const override
+  {
+    const ogl::Vec3 d = forceParticle.position-otherParticlePosition;
+    const float r2 = d.lengthSquared()+0.01f;
+    return d*(1.f/(r2*std::sqrt(r2)));
+  }
+  bool isApproximable() const override { return true; }
+};
+
+// Sums the forces of numSources random force particles upon as many particles,
+// exactly and with the force octree for several theta, and prints the time
+// and the error relative to the rms of the exact forces
+void benchmarkForces(int numSources)
+{
+  ogl::Random random;
+  random.seed(1,0);
+  InverseSquareSource force;
+  std::vector<ogl::ForceSource> sources(numSources);
+  std::vector<ogl::Vec3> positions(numSources);
+  for(int i=0;i<numSources;++i)
+  {
+    sources[i].handle = size_t(i);
+    sources[i].particle.position = ogl::Vec3(random.uniform(-10,10),random.uniform(-10,10),random.uniform(0,20));
+    sources[i].particle.isSpecialParticle = 1.f;
+    sources[i].force = &force;
+    positions[i] = sources[i].particle.position+ogl::Vec3(random.uniform(-1,1),random.uniform(-1,1),random.uniform(-1,1));
+  }
+
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point start = Clock::now();
+  std::vector<ogl::Vec3> exact(numSources,ogl::Vec3(0,0,0));
+  for(int i=0;i<numSources;++i)
+    for(int j=0;j<numSources;++j)
+      if(j != i)
+        exact[i]+=force.computeForce(sources[j].particle,positions[i]);
+  const double exactSeconds = std::chrono::duration<double>(Clock::now()-start).count();
+  double meanSquare = 0;
+  for(int i=0;i<numSources;++i)
+    meanSquare += exact[i].lengthSquared()/numSources;
+  const float rms = float(std::sqrt(meanSquare));
+  std::cout<<numSources<<" force particles, exact: "<<exactSeconds*1000<<" ms"<<std::endl;
+
+  const float thetas[4] = {0.25f, 0.5f, 0.75f, 1.f};
+  for(int t=0;t<4;++t)
+  {
+    ogl::ForceOctree octree;
+    start = Clock::now();
+    octree.build(sources,thetas[t]);
+    const double buildSeconds = std::chrono::duration<double>(Clock::now()-start).count();
+    std::vector<ogl::Vec3> approximate(numSources);
+    start = Clock::now();
+    for(int i=0;i<numSources;++i)
+      approximate[i] = octree.sumForces(positions[i],size_t(i));
+    const double sumSeconds = std::chrono::duration<double>(Clock::now()-start).count();
+
+    // Relative to the rms force, forces which almost cancel out would dominate otherwise
+    float maxError = 0, meanError = 0;
+    for(int i=0;i<numSources;++i)
+    {
+      const float error = (approximate[i]-exact[i]).length()/rms;
+      maxError = std::max(maxError,error);
+      meanError += error/numSources;
+    }
+    std::cout<<"theta "<<thetas[t]<<": build "<<buildSeconds*1000<<" ms, sum "<<sumSeconds*1000
+      <<" ms, speedup "<<exactSeconds/(buildSeconds+sumSeconds)<<", error/rms force mean "<<meanError
+      <<" max "<<maxError<<std::endl;
+  }
+}
+
+// Casts numRays random rays into the collision scenes, once serially and
+// then from numThreads threads at once, each with its own query context,
+// for several rounds. The serial single ray and batch (ray packet) results
+// must agree up to rounding, the threaded queries of each path must give
+// its serial results exactly. Returns the number of differing results.
+int stressTestCollisions(int numThreads, int numRays, int numRounds)
+{
+  const char *names[2] = {"room", "planes"};
+  int totalErrors = 0;
+  for(int scene=0;scene<2;++scene)
+  {
+    gCollisionPlanes.clear();
+    gCollisionScene.reset();
+    bool ok = scene == 0 ? initSceneRoom(true) : initScenePlanes(true);
+    if(!ok)
+      continue;
+    for(size_t i=0;i<gCollisionPlanes.size();++i)
+      gCollisionPlanes[i]->updateTransform();
+    const ogl::CollisionScene &collisionScene = *gCollisionScene;
+
+    ogl::Random random;
+    random.seed(1,0);
+    std::vector<ogl::Vec3> origins(numRays), directions(numRays);
+    std::vector<float> maxLambdas(numRays);
+    std::vector<std::shared_ptr<ogl::CollisionGeometry>> targets = gCollisionPlanes;
+    if(targets.empty())
+      targets.push_back(gCollisionRoom);
+    for(int i=0;i<numRays;++i)
+    {
+      origins[i] = ogl::Vec3(random.uniform(-15,15),random.uniform(-15,15),random.uniform(-5,15));
+      directions[i] = ogl::Vec3(random.uniform(-1,1),random.uniform(-1,1),random.uniform(-1,1));
+      // Every other ray aims at a geometry
+      if(i%2)
+        directions[i] = targets[i/2%targets.size()]->getPosition()-origins[i]+directions[i];
+      directions[i].normalize();
+      maxLambdas[i] = i%4 > 1 ? random.uniform(0,5) : std::numeric_limits<float>::infinity();
+    }
+
+    // Serial results of both query paths
+    std::vector<float> singleLambdas(numRays), batchLambdas(numRays);
+    std::vector<ogl::Vec3> singleNormals(numRays), batchNormals(numRays);
+    ogl::BVTree::QueryContext context;
+    int numHits = 0;
+    for(int i=0;i<numRays;++i)
+    {
+      std::shared_ptr<ogl::RayIntersection> intersection =
+        collisionScene.closestIntersection(ogl::Ray(origins[i],directions[i]),maxLambdas[i],context);
+      singleLambdas[i] = intersection ? intersection->lambda() : maxLambdas[i];
+      singleNormals[i] = intersection ? intersection->normal() : ogl::Vec3(0,0,0);
+      numHits += intersection ? 1 : 0;
+    }
+    collisionScene.closestIntersections(numRays,origins.data(),directions.data(),maxLambdas.data(),
+      batchLambdas.data(),batchNormals.data());
+
+    // The packet traversal computes the same intersections in a different order
+    // of operations, hit flags must match and lambdas and normals nearly so
+    int pathErrors = 0;
+    for(int i=0;i<numRays;++i)
+    {
+      const bool singleHit = singleLambdas[i] < maxLambdas[i];
+      const bool batchHit = batchLambdas[i] < maxLambdas[i];
+      if(singleHit != batchHit ||
+        (singleHit && (std::fabs(singleLambdas[i]-batchLambdas[i]) > 1e-4f*std::max(1.f,singleLambdas[i]) ||
+                       (singleNormals[i]-batchNormals[i]).length() > 1e-3f)))
+        ++pathErrors;
+    }
+
+    std::atomic<int> errors(0);
+    auto worker = [&](int thread)
+    {
+      ogl::BVTree::QueryContext threadContext;
+      const int batchSize = 64;
+      float lambdas[batchSize];
+      ogl::Vec3 normals[batchSize];
+      for(int round=0;round<numRounds;++round)
+      {
+        // The threads start at different rays and alternate the query paths
+        const int start = (thread*numRays/numThreads + round*batchSize)%numRays;
+        for(int j=0;j<numRays;j+=batchSize)
+        {
+          const int first = (start+j)%numRays;
+          const int count = std::min(batchSize,numRays-first);
+          if((round+thread)%2)
+          {
+            collisionScene.closestIntersections(count,&origins[first],&directions[first],&maxLambdas[first],lambdas,normals);
+            for(int i=0;i<count;++i)
+              if(lambdas[i] != batchLambdas[first+i] ||
+                (lambdas[i] < maxLambdas[first+i] && normals[i] != batchNormals[first+i]))
+                ++errors;
+          }
+          else
+          {
+            for(int i=first;i<first+count;++i)
+            {
+              std::shared_ptr<ogl::RayIntersection> intersection =
+                collisionScene.closestIntersection(ogl::Ray(origins[i],directions[i]),maxLambdas[i],threadContext);
+              if((intersection ? intersection->lambda() : maxLambdas[i]) != singleLambdas[i] ||
+                (intersection && intersection->normal() != singleNormals[i]))
+                ++errors;
+            }
+          }
+        }
+      }
+    };
+
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point start = Clock::now();
+    std::vector<std::thread> threads;
+    for(int t=0;t<numThreads;++t)
+      threads.push_back(std::thread(worker,t));
+    for(size_t t=0;t<threads.size();++t)
+      threads[t].join();
+    const double seconds = std::chrono::duration<double>(Clock::now()-start).count();
+
+    std::cout<<names[scene]<<": "<<numThreads<<" threads, "<<numRounds<<" rounds of "<<numRays<<" rays ("
+      <<numHits<<" hits) in "<<seconds<<"s, "<<pathErrors<<" batch results differ from the single ray ones, "
+      <<errors<<" results differ from the serial ones"<<std::endl;
+    totalErrors += pathErrors+errors;
+  }
+  return totalErrors;
+}
+
 // Main entry point
 int main (int argc, char** argv)
 {
+  // Usage: --collision-stress-test [threads] [rays] [rounds] queries the
+  // collision scenes from several threads and compares with serial queries
+  if(argc > 1 && std::string(argv[1]) == "--collision-stress-test")
+  {
+    const int numThreads = argc > 2 ? std::atoi(argv[2]) : 8;
+    const int errors = stressTestCollisions(numThreads > 0 ? numThreads : 8,
+      argc > 3 ? std::atoi(argv[3]) : 20000, argc > 4 ? std::atoi(argv[4]) : 10);
+    return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // Usage: --force-benchmark [force particles] compares the exact force sum
+  // with the force octree
+  if(argc > 1 && std::string(argv[1]) == "--force-benchmark")
+  {
+    benchmarkForces(argc > 2 ? std::atoi(argv[2]) : 4000);
+    return 0;
+  }
+
+  // Usage: --simulation-benchmark [steps] [threads] simulates the scenes
+  // headless with fixed time steps
+  if(argc > 1 && std::string(argv[1]) == "--simulation-benchmark")
+  {
+    benchmarkSimulation(argc > 2 ? std::atoi(argv[2]) : 2000, argc > 3 ? std::atoi(argv[3]) : 0);
+    return 0;
+  }
+
   std::cerr<<"Use your mouse to rotate,pan and zoom the camera"<<std::endl;
   std::cerr<<"left mouse button + drag -> rotate"<<std::endl;
   std::cerr<<"middle mouse button + drag -> pan"<<std::endl;
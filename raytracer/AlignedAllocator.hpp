@@ -0,0 +1,70 @@
+#ifndef ALIGNEDALLOCATOR_HPP_INCLUDE_ONCE
+#define ALIGNEDALLOCATOR_HPP_INCLUDE_ONCE
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#  include <malloc.h>
+#endif
+
+namespace rt
+{
+
+/// Allocator for std::vector which places the elements at an Alignment byte
+/// boundary, e.g. cache line aligned nodes. std::allocator only guarantees
+/// the alignment of the fundamental types. Alignment has to be a power of two
+/// and a multiple of sizeof(void*).
+template<class T, size_t Alignment>
+class AlignedAllocator
+{
+public:
+  typedef T         value_type;
+  typedef T*        pointer;
+  typedef const T*  const_pointer;
+  typedef T&        reference;
+  typedef const T&  const_reference;
+  typedef size_t    size_type;
+  typedef ptrdiff_t difference_type;
+
+  template<class U>
+  struct rebind { typedef AlignedAllocator<U,Alignment> other; };
+
+  AlignedAllocator() {}
+  template<class U>
+  AlignedAllocator(const AlignedAllocator<U,Alignment>&) {}
+
+  T* allocate(size_t n)
+  {
+    if(n == 0)
+      return 0;
+    void *p = 0;
+#ifdef _WIN32
+    p = _aligned_malloc(n*sizeof(T),Alignment);
+#else
+    if(posix_memalign(&p,Alignment,n*sizeof(T)) != 0)
+      p = 0;
+#endif
+    if(!p)
+      throw std::bad_alloc();
+    return static_cast<T*>(p);
+  }
+
+  void deallocate(T *p, size_t)
+  {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+  }
+
+  template<class U>
+  bool operator==(const AlignedAllocator<U,Alignment>&) const { return true; }
+  template<class U>
+  bool operator!=(const AlignedAllocator<U,Alignment>&) const { return false; }
+};
+
+} //namespace rt
+
+#endif //ALIGNEDALLOCATOR_HPP_INCLUDE_ONCE
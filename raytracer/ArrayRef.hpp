@@ -0,0 +1,37 @@
+#ifndef ARRAYREF_HPP_INCLUDE_ONCE
+#define ARRAYREF_HPP_INCLUDE_ONCE
+
+#include <vector>
+#include <cstddef>
+
+namespace rt
+{
+
+/// Read only view of a contiguous array, e.g. of a std::vector or of a memory
+/// mapped file. The view does not own the elements, they have to stay valid
+/// as long as the view is used.
+template<class T>
+class ArrayRef
+{
+public:
+  ArrayRef() : mData(0), mSize(0) {}
+  ArrayRef(const T *data, size_t size) : mData(data), mSize(size) {}
+  ArrayRef(const std::vector<T> &v) : mData(v.empty() ? 0 : &v[0]), mSize(v.size()) {}
+
+  const T* data()  const { return mData; }
+  size_t   size()  const { return mSize; }
+  bool     empty() const { return mSize == 0; }
+
+  const T* begin() const { return mData; }
+  const T* end()   const { return mData+mSize; }
+
+  const T& operator[](size_t i) const { return mData[i]; }
+
+private:
+  const T *mData;
+  size_t   mSize;
+};
+
+} //namespace rt
+
+#endif //ARRAYREF_HPP_INCLUDE_ONCE
@@ -12,96 +12,114 @@ BVHIndexedTriangleMesh::BVHIndexedTriangleMesh() : IndexedTriangleMesh()
 
 void BVHIndexedTriangleMesh::initialize()
 {
-  mTree.build(this->vertexPositions(),*((const std::vector<Vec3i>*)(&this->triangleIndices())));
+  const ArrayRef<int> indices = this->triangleIndices();
+  const ArrayRef<Vec3i> triangles((const Vec3i*)indices.data(),indices.size()/3);
+
+  //initialized before, e.g. for the previous frame: refit for moved vertices,
+  //refit() falls back to a full build if the triangle count changed
+  if(mTree.numPrimitives() > 0)
+    mTree.refit(this->vertexPositions(),triangles);
+  //a mapped mesh file may contain a prebuilt tree
+  else if(!this->meshFile().loadBVH(mTree))
+  {
+    if(mCacheFile.empty())
+      mTree.build(this->vertexPositions(),triangles);
+    else
+      mTree.build(this->vertexPositions(),triangles,mCacheFile);
+  }
 }
 
-std::shared_ptr<RayIntersection>
-  BVHIndexedTriangleMesh::closestIntersectionModel(const Ray &ray, real maxLambda) const
+bool BVHIndexedTriangleMesh::closestIntersectionModel(const Ray &ray, real maxLambda,
+                                                      HitRecord &hit) const
 {
-  const std::vector<int> &intersectionCandidates = mTree.intersectBoundingBoxes(ray,maxLambda);
+  const ArrayRef<int>  indices   = this->triangleIndices();
+  const ArrayRef<Vec3> positions = this->vertexPositions();
 
   real closestLambda = maxLambda;
   Vec3 closestbary;
   int  closestTri = -1;
 
-  Vec3 bary;
-  real lambda;
-
-  for(size_t i=0;i<intersectionCandidates.size();++i)
+  // triangles are intersected during the traversal, every hit shrinks the
+  // ray and prunes the remaining subtrees
+  mTree.closestIntersection(ray, closestLambda,
+    [&](int triangleIndex, real &lambdaMax) -> bool
   {
-    const int triangleIndex = intersectionCandidates[i];
-    const int idx0 = this->triangleIndices()[3*triangleIndex+0];
-    const int idx1 = this->triangleIndices()[3*triangleIndex+1];
-    const int idx2 = this->triangleIndices()[3*triangleIndex+2];
-
-    const Vec3 &p0 = this->vertexPositions()[idx0];
-    const Vec3 &p1 = this->vertexPositions()[idx1];
-    const Vec3 &p2 = this->vertexPositions()[idx2];
+    const Vec3 &p0 = positions[indices[3*triangleIndex+0]];
+    const Vec3 &p1 = positions[indices[3*triangleIndex+1]];
+    const Vec3 &p2 = positions[indices[3*triangleIndex+2]];
 
+    Vec3 bary;
+    real lambda;
     if (Intersection::lineTriangle(ray,p0,p1,p2,bary,lambda) &&
-      lambda > 0 && lambda < closestLambda)
+      lambda > 0 && lambda < lambdaMax)
     {
-      closestLambda = lambda;
+      lambdaMax = lambda;
       closestbary = bary;
       closestTri = triangleIndex;
+      return true;
     }
-  }
-
-  if (closestTri >= 0)
-  {
-    const int i0 = this->triangleIndices()[3*closestTri+0];
-    const int i1 = this->triangleIndices()[3*closestTri+1];
-    const int i2 = this->triangleIndices()[3*closestTri+2];
+    return false;
+  });
 
-    const Vec3 &p0 = this->vertexPositions()[i0];
-    const Vec3 &p1 = this->vertexPositions()[i1];
-    const Vec3 &p2 = this->vertexPositions()[i2];
-
-    Vec3 n;
-    if(this->vertexNormals().empty())
-      n = util::cross(p1-p0,p2-p0).normalized();
-    else
-      n = this->vertexNormals()[i0]*closestbary[0]+
-          this->vertexNormals()[i1]*closestbary[1]+
-          this->vertexNormals()[i2]*closestbary[2];
-
-    Vec3 uvw(0,0,0);
-    if(!this->vertexTextureCoordinates().empty())
-      uvw = this->vertexTextureCoordinates()[i0]*closestbary[0]+
-            this->vertexTextureCoordinates()[i1]*closestbary[1]+
-            this->vertexTextureCoordinates()[i2]*closestbary[2];
-
-    return std::make_shared<IndexedTriangleMeshRayIntersection>(ray, closestLambda,
-      shared_from_this(),n,uvw);
-  }
+  if (closestTri < 0)
+    return false;
 
-  return nullptr;
- 
+  // normal and uv coordinates are interpolated by IndexedTriangleMesh
+  hit.lambda    = closestLambda;
+  hit.primitive = closestTri;
+  hit.bary      = closestbary;
+  return true;
 }
 
-bool BVHIndexedTriangleMesh::anyIntersectionModel(const Ray &ray, real maxLambda) const
+int BVHIndexedTriangleMesh::closestIntersectionsModel(const RayPacket &packet, int mask,
+                                                      real *maxLambda, HitRecord *hits) const
 {
-  std::vector<int> intersectionCandidates = mTree.intersectBoundingBoxes(ray,maxLambda);
-
+  const ArrayRef<int>  indices   = this->triangleIndices();
+  const ArrayRef<Vec3> positions = this->vertexPositions();
 
-  Vec3 bary;
-  real lambda;
-  for(size_t i=0;i<intersectionCandidates.size();++i)
+  return mTree.closestIntersections(packet, mask, maxLambda,
+    [&](int triangleIndex, int laneMask, real *lambdaMax) -> int
   {
-    const int triangleIndex = intersectionCandidates[i];
-    const int idx0 = this->triangleIndices()[3*triangleIndex+0];
-    const int idx1 = this->triangleIndices()[3*triangleIndex+1];
-    const int idx2 = this->triangleIndices()[3*triangleIndex+2];
+    const Vec3 &p0 = positions[indices[3*triangleIndex+0]];
+    const Vec3 &p1 = positions[indices[3*triangleIndex+1]];
+    const Vec3 &p2 = positions[indices[3*triangleIndex+2]];
 
-    const Vec3 &p0 = this->vertexPositions()[idx0];
-    const Vec3 &p1 = this->vertexPositions()[idx1];
-    const Vec3 &p2 = this->vertexPositions()[idx2];
+    real bary[3][RayPacket::kMaxSize], lambda[RayPacket::kMaxSize];
+    const int inside = Intersection::lineTriangle(packet,laneMask,p0,p1,p2,bary,lambda);
 
-    if (Intersection::lineTriangle(ray,p0,p1,p2,bary,lambda) &&
-      lambda > 0 && lambda < maxLambda)
-      return true;
-  }
+    int hitMask = 0;
+    for (int m=inside;m;m&=m-1)
+    {
+      const int l = lowestLane(m);
+      if (lambda[l] > 0 && lambda[l] < lambdaMax[l])
+      {
+        lambdaMax[l]       = lambda[l];
+        hits[l].lambda     = lambda[l];
+        hits[l].primitive  = triangleIndex;
+        hits[l].bary       = Vec3(bary[0][l],bary[1][l],bary[2][l]);
+        hitMask |= 1<<l;
+      }
+    }
+    return hitMask;
+  });
+}
+
+bool BVHIndexedTriangleMesh::anyIntersectionModel(const Ray &ray, real maxLambda) const
+{
+  const ArrayRef<int>  indices   = this->triangleIndices();
+  const ArrayRef<Vec3> positions = this->vertexPositions();
 
-  return false;
+  return mTree.anyIntersection(ray, maxLambda,
+    [&](int triangleIndex, real &lambdaMax) -> bool
+  {
+    const Vec3 &p0 = positions[indices[3*triangleIndex+0]];
+    const Vec3 &p1 = positions[indices[3*triangleIndex+1]];
+    const Vec3 &p2 = positions[indices[3*triangleIndex+2]];
+
+    Vec3 bary;
+    real lambda;
+    return Intersection::lineTriangle(ray,p0,p1,p2,bary,lambda) &&
+      lambda > 0 && lambda < lambdaMax;
+  });
 }
 } //namespace rt
\ No newline at end of file
@@ -13,13 +13,25 @@ public:
 
   void initialize() override;
 
-  std::shared_ptr<RayIntersection>
-    closestIntersectionModel(const Ray &ray, real maxLambda) const override;
+  /// Sidecar file caching the BVH between runs, e.g. "mesh.obj.bvh". The
+  /// cache is reused as long as triangles and build settings are unchanged.
+  /// An empty name (default) always builds the tree.
+  void setBVHCacheFile(const std::string &cacheFile) { mCacheFile=cacheFile; }
+  const std::string& bvhCacheFile() const { return mCacheFile; }
+
+  bool closestIntersectionModel(const Ray &ray, real maxLambda,
+                                HitRecord &hit) const override;
 
   bool anyIntersectionModel(const Ray &ray, real maxLambda) const override;
 
+  /// Traverses the tree once for the whole packet, the triangles of a leaf
+  /// are tested against all lanes which entered it at once.
+  int closestIntersectionsModel(const RayPacket &packet, int mask,
+                                real *maxLambda, HitRecord *hits) const override;
+
 private:
-  BVTree mTree;
+  BVTree      mTree;
+  std::string mCacheFile;
 };
 } //namespace rt
 
@@ -1,42 +1,144 @@
 #include "BVTree.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <thread>
 
 namespace rt
 {
 
+BVTree::BVTree() :
+  mPrimitiveIndexData(0), mCompactNodeData(0), mWideNode4Data(0), mWideNode8Data(0),
+  mNumPrimitiveIndices(0), mNumTraversalNodes(0),
+  mBuildMethod(BinnedSAH), mMaxLeafSize(4),
+  mTraversalCost(1), mIntersectionCost(1), mBranchingFactor(4), mBuildTime(0),
+  mNumNodes(0), mNumLeaves(0), mSahCost(0),
+  mRebuildThreshold(real(1.5)), mBuildTraversalCost(0), mTraversalSahCost(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Binned SAH builder
+///////////////////////////////////////////////////////////////////////////////
+
+//Number of bins per axis used to evaluate split candidates
+static const int kNumBins = 16;
+
+//Subtrees with fewer primitives are always built by the calling thread
+static const size_t kMinParallelPrimitives = 4096;
 
-const std::vector<int> BVTree::intersectBoundingBoxes(const Ray &ray, const real maxLambda) const
+//Primitive as seen by the binned builder. Primitives are partitioned in
+//place, so every node works on a contiguous range. The centroid is not
+//stored, the builder bins min+max (twice the centroid) instead.
+struct BuildPrimitive
 {
- // int* jobs = (int*)alloca(sizeof(int)*100); //yields 25% better performance
+  real min[3];
+  real max[3];
+  int  index;
+};
 
-  std::vector<int> candidates;
-  std::stack<int> traversalJobs;
-  
-  candidates.clear();
-  traversalJobs.push(0);
+//Bounding box of the primitives and of their centroids and primitive count
+//of a bin or node
+struct BVTree::Bin
+{
+  void clear()
+  {
+    count = 0;
+    for(int i=0;i<3;++i)
+    {
+      min[i] = centroidMin[i] =  std::numeric_limits<real>::max();
+      max[i] = centroidMax[i] = -std::numeric_limits<real>::max();
+    }
+  }
 
-  while(!traversalJobs.empty())
+  void add(const BuildPrimitive &p)
   {
-    //take current job
-    int node = traversalJobs.top();
-    traversalJobs.pop();
+    for(int i=0;i<3;++i)
+    {
+      min[i] = std::min(min[i],p.min[i]);
+      max[i] = std::max(max[i],p.max[i]);
+      const real c = p.min[i]+p.max[i];
+      centroidMin[i] = std::min(centroidMin[i],c);
+      centroidMax[i] = std::max(centroidMax[i],c);
+    }
+    ++count;
+  }
 
-    //test ray vs. bounding box of node
-    if(mNodes[node].bbox.anyIntersection(ray,maxLambda))
+  void merge(const Bin &other)
+  {
+    for(int i=0;i<3;++i)
     {
-      if(mNodes[node].left <= 0 && mNodes[node].right == -1) // is a leaf node
-        candidates.push_back(-mNodes[node].left);
-      else//is not a leaf
+      min[i] = std::min(min[i],other.min[i]);
+      max[i] = std::max(max[i],other.max[i]);
+      centroidMin[i] = std::min(centroidMin[i],other.centroidMin[i]);
+      centroidMax[i] = std::max(centroidMax[i],other.centroidMax[i]);
+    }
+    count += other.count;
+  }
+
+  real area() const
+  {
+    const real dx = max[0]-min[0], dy = max[1]-min[1], dz = max[2]-min[2];
+    return 2*(dx*dy+dx*dz+dy*dz);
+  }
+
+  BoundingBox box() const
+  {
+    return BoundingBox(Vec3(min[0],min[1],min[2]),Vec3(max[0],max[1],max[2]));
+  }
+
+  real   min[3];
+  real   max[3];
+  real   centroidMin[3];
+  real   centroidMax[3];
+  size_t count;
+};
+
+//Shared state of a binned build. Nodes are preallocated for the worst case
+//(a tree with one primitive per leaf), so threads building different
+//subtrees only need to agree on the next free node index.
+struct BVTree::BinnedBuild
+{
+  BinnedBuild(BVTree &tree) : numNodes(1), maxParallelDepth(0)
+  {
+    const size_t n = tree.mTempTriangleBoxes.size();
+    tree.mNodes.resize(2*n-1);
+    tree.mPrimitiveIndices.resize(n);
+
+    rootBounds.clear();
+    primitives.resize(n);
+    for(size_t i=0;i<n;++i)
+    {
+      const BoundingBox &box = tree.mTempTriangleBoxes[i];
+      BuildPrimitive &p = primitives[i];
+      for(int j=0;j<3;++j)
       {
-        traversalJobs.push(mNodes[node].left);
-        traversalJobs.push(mNodes[node].right);
+        p.min[j] = box.min()[j];
+        p.max[j] = box.max()[j];
       }
+      p.index = int(i);
+      rootBounds.add(p);
     }
+    tree.mNodes[0].bbox = rootBounds.box();
+
+    //spawn tasks until there are about twice as many subtrees as threads
+    const size_t numThreads = std::max(size_t(std::thread::hardware_concurrency()),size_t(1));
+    while((size_t(1)<<maxParallelDepth) < 2*numThreads)
+      ++maxParallelDepth;
   }
-  return candidates;
-}
 
-void BVTree::createNodes(const std::vector<Vec3> &vertexPositions,
-    const std::vector<Vec3i> &triangleIndices)
+  std::vector<BuildPrimitive> primitives;
+  Bin                         rootBounds;
+  std::atomic<int>            numNodes;
+  int                         maxParallelDepth;
+};
+
+void BVTree::createNodes(ArrayRef<Vec3> vertexPositions,
+    ArrayRef<Vec3i> triangleIndices)
 {
   size_t n=triangleIndices.size();
   mTempTriangleBoxes.resize(n);
@@ -89,31 +191,81 @@ void BVTree::sortTriangles()
   }
 }
 
-void BVTree::build(const std::vector<Vec3> &vertexPositions,const std::vector<Vec3i> &triangleIndices)
+void BVTree::build(ArrayRef<Vec3> vertexPositions,ArrayRef<Vec3i> triangleIndices)
 {
   //create bounding boxes for all triangles
   this->createNodes(vertexPositions,triangleIndices);
-  size_t n = triangleIndices.size();
-  //sort triangles by x,y and z
-  //sortedTriangles now holds sorting permutations for orderings w.r.t x,y,z in the three components
-  this->sortTriangles();
+  this->buildFromTempBoxes();
+}
 
-  mTempMarker.resize(n);
-  mTempBufferTriangleIndices.resize(n);
-  mTempAreasLeft.resize(n);
-  mTempAreasRight.resize(n);
+void BVTree::build(const std::vector<BoundingBox> &primitiveBoxes)
+{
+  mTempTriangleBoxes = primitiveBoxes;
+  this->buildFromTempBoxes();
+}
+
+bool BVTree::build(ArrayRef<Vec3> vertexPositions,ArrayRef<Vec3i> triangleIndices,
+                   const std::string &cacheFile)
+{
+  const uint64_t key = this->cacheKey(vertexPositions,triangleIndices);
+  if(this->loadCache(cacheFile,key,triangleIndices.size()))
+    return true;
+
+  this->build(vertexPositions,triangleIndices);
+  if(!this->saveCache(cacheFile,key))
+    std::cerr<<"Warning: Could not write BVH cache "<<cacheFile<<std::endl;
+  return false;
+}
 
-  //Create root node
+void BVTree::buildFromTempBoxes()
+{
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  size_t n = mTempTriangleBoxes.size();
+  std::vector<Node>().swap(mNodes);
+  std::vector<int>().swap(mPrimitiveIndices);
+  mCacheMapping.reset();
+
+  if(mBuildMethod == BinnedSAH)
   {
-    Node root;
-    BoundingBox nodeBox;
-    for(size_t i=0;i<mTempTriangleBoxes.size();++i)
-      nodeBox.merge(mTempTriangleBoxes[i]);
-    root.bbox=nodeBox;
-    mNodes.push_back(root);
+    if(n>0)
+    {
+      BinnedBuild state(*this);
+      this->buildBinned(state,0,state.rootBounds,0,n,0);
+      mNodes.resize(state.numNodes);
+    }
   }
+  else
+  {
+    //sort triangles by x,y and z
+    //sortedTriangles now holds sorting permutations for orderings w.r.t x,y,z in the three components
+    this->sortTriangles();
+
+    mTempMarker.resize(n);
+    mTempBufferTriangleIndices.resize(n);
+    mTempAreasLeft.resize(n);
+    mTempAreasRight.resize(n);
+    mPrimitiveIndices.reserve(n);
 
-  this->buildHierarchy(0,0,n);
+    //Create root node
+    if(n>0)
+    {
+      Node root;
+      BoundingBox nodeBox;
+      for(size_t i=0;i<mTempTriangleBoxes.size();++i)
+        nodeBox.merge(mTempTriangleBoxes[i]);
+      root.bbox=nodeBox;
+      mNodes.push_back(root);
+    }
+
+    if(n==1) //a single primitive, the root is a leaf
+    {
+      mPrimitiveIndices.push_back(0);
+      this->makeLeaf(0,0,1);
+    }
+    else if(n>1)
+      this->buildHierarchy(0,0,n);
+  }
 
   //clear temporary storage
   std::vector<bool>().swap(mTempMarker);
@@ -123,6 +275,15 @@ void BVTree::build(const std::vector<Vec3> &vertexPositions,const std::vector<Ve
   std::vector<Vec3>().swap(mTempAreasLeft);
   std::vector<Vec3>().swap(mTempAreasRight);
 
+  //replace the build nodes by the traversal layout
+  this->computeStatistics();
+  this->buildCompactNodes();
+  this->buildWideNodes();
+  std::vector<Node>().swap(mNodes);
+  this->setTraversalData();
+  mBuildTraversalCost = mTraversalSahCost = this->traversalSahCost();
+
+  mBuildTime = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
 
 //   std::cerr<<"created bvh tree with "<<mNodes.size()<<" nodes"<<std::endl;
 // 
@@ -258,16 +419,16 @@ void BVTree::buildHierarchy(size_t rootNodeIndex,size_t offset, size_t numTriang
 
   if(splitIndex==0) //left count == 1  -> left child is a leaf
   {
-    mNodes[idxLeft].left=-mTempSortedTriangleIndices[0+offset][splitDimension];
-    mNodes[idxLeft].right=-1;
+    mPrimitiveIndices.push_back(mTempSortedTriangleIndices[0+offset][splitDimension]);
+    this->makeLeaf(int(idxLeft),mPrimitiveIndices.size()-1,mPrimitiveIndices.size());
   }
   else
     this->buildHierarchy(idxLeft,offset,splitIndex+1);
 
   if(splitIndex==numTriangles-2) //right count == 1 -> right child is a leaf
   {
-    mNodes[idxRight].left=-mTempSortedTriangleIndices[numTriangles+offset-1][splitDimension];
-    mNodes[idxRight].right=-1;
+    mPrimitiveIndices.push_back(mTempSortedTriangleIndices[numTriangles+offset-1][splitDimension]);
+    this->makeLeaf(int(idxRight),mPrimitiveIndices.size()-1,mPrimitiveIndices.size());
   }
   else
   {
@@ -300,4 +461,777 @@ void BVTree::computeBoundingBoxAreas(size_t offset, size_t numTriangles)
     }
   }
 }
+
+void BVTree::makeLeaf(int node, size_t begin, size_t end)
+{
+  mNodes[node].left  = int(begin);
+  mNodes[node].right = -int(end-begin);
+}
+
+void BVTree::buildBinned(BinnedBuild &state, int node, const Bin &bounds,
+                         size_t begin, size_t end, int depth)
+{
+  BuildPrimitive *primitives = &state.primitives[0];
+  const size_t n = end-begin;
+
+  //the centroid bounds determine the bin layout, small nodes use fewer
+  //bins, their setup would dominate otherwise
+  const int numBins = int(std::min(n,size_t(kNumBins)));
+  real binScale[3];
+  for(int axis=0;axis<3;++axis)
+  {
+    const real extent = bounds.centroidMax[axis]-bounds.centroidMin[axis];
+    binScale[axis] = extent > 0 ? real(numBins)/extent : real(0);
+  }
+
+  //bin all primitives along all three axes in a single pass
+  Bin bins[3][kNumBins];
+  if(n > 1)
+  {
+    for(int axis=0;axis<3;++axis)
+      for(int b=0;b<numBins;++b)
+        bins[axis][b].clear();
+
+    for(size_t i=begin;i<end;++i)
+    {
+      const BuildPrimitive &p = primitives[i];
+      for(int axis=0;axis<3;++axis)
+      {
+        const real c = p.min[axis]+p.max[axis];
+        const int b = std::min(int((c-bounds.centroidMin[axis])*binScale[axis]),numBins-1);
+        bins[axis][b].add(p);
+      }
+    }
+  }
+
+  //evaluate the surface area heuristic at all bin boundaries
+  const real nodeArea = bounds.area();
+  real bestCost = std::numeric_limits<real>::max();
+  int  bestAxis = -1;
+  int  bestBin  = 0;
+
+  for(int axis=0;axis<3 && n>1;++axis)
+  {
+    if(binScale[axis] == 0)
+      continue;
+
+    //sweep from the right to collect the areas right of each split plane
+    real rightArea[kNumBins];
+    size_t rightCount[kNumBins];
+    Bin accum;
+    accum.clear();
+    for(int b=numBins-1;b>0;--b)
+    {
+      accum.merge(bins[axis][b]);
+      rightArea[b]  = accum.count ? accum.area() : real(0);
+      rightCount[b] = accum.count;
+    }
+
+    //sweep from the left and evaluate split between bin b-1 and b
+    accum.clear();
+    for(int b=1;b<numBins;++b)
+    {
+      accum.merge(bins[axis][b-1]);
+      if(accum.count==0 || rightCount[b]==0)
+        continue;
+
+      const real cost = mTraversalCost + mIntersectionCost*
+        (accum.area()*accum.count + rightArea[b]*rightCount[b])/nodeArea;
+      if(cost < bestCost)
+      {
+        bestCost = cost;
+        bestAxis = axis;
+        bestBin  = b;
+      }
+    }
+  }
+
+  //terminate if intersecting all primitives is cheaper than splitting
+  const real leafCost = mIntersectionCost*n;
+  if(n==1 || (n <= mMaxLeafSize && (bestAxis < 0 || leafCost <= bestCost)))
+  {
+    for(size_t i=begin;i<end;++i)
+      mPrimitiveIndices[i] = primitives[i].index;
+    this->makeLeaf(node,begin,end);
+    return;
+  }
+
+  size_t mid;
+  Bin leftBounds, rightBounds;
+  leftBounds.clear();
+  rightBounds.clear();
+  if(bestAxis >= 0)
+  {
+    const real cmin  = bounds.centroidMin[bestAxis];
+    const real scale = binScale[bestAxis];
+    mid = std::partition(primitives+begin,primitives+end,[&](const BuildPrimitive &p)
+    {
+      const real c = p.min[bestAxis]+p.max[bestAxis];
+      return std::min(int((c-cmin)*scale),numBins-1) < bestBin;
+    }) - primitives;
+
+    for(int b=0;b<bestBin;++b)
+      leftBounds.merge(bins[bestAxis][b]);
+    for(int b=bestBin;b<numBins;++b)
+      rightBounds.merge(bins[bestAxis][b]);
+  }
+  else
+  {
+    //all centroids coincide, split in the middle
+    mid = begin + n/2;
+    for(size_t i=begin;i<mid;++i)
+      leftBounds.add(primitives[i]);
+    for(size_t i=mid;i<end;++i)
+      rightBounds.add(primitives[i]);
+  }
+
+  //allocate both children next to each other
+  const int left = state.numNodes.fetch_add(2);
+  const int right = left+1;
+  mNodes[node].left  = left;
+  mNodes[node].right = right;
+  mNodes[left].bbox  = leftBounds.box();
+  mNodes[right].bbox = rightBounds.box();
+
+  if(depth < state.maxParallelDepth && n >= kMinParallelPrimitives)
+  {
+    std::future<void> leftTask = std::async(std::launch::async,
+      [&]() { this->buildBinned(state,left,leftBounds,begin,mid,depth+1); });
+    this->buildBinned(state,right,rightBounds,mid,end,depth+1);
+    leftTask.get();
+  }
+  else
+  {
+    this->buildBinned(state,left,leftBounds,begin,mid,depth+1);
+    this->buildBinned(state,right,rightBounds,mid,end,depth+1);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Wide tree
+///////////////////////////////////////////////////////////////////////////////
+
+void BVTree::buildCompactNodes()
+{
+  CompactNodeVector().swap(mCompactNodes);
+
+  if(mNodes.empty() || mBranchingFactor != 2)
+    return;
+
+  mCompactNodes.reserve(mNodes.size());
+  this->flatten(0);
+}
+
+void BVTree::flatten(int binaryNode)
+{
+  const Node &node = mNodes[binaryNode];
+  const int index = int(mCompactNodes.size());
+  mCompactNodes.push_back(CompactNode());
+
+  CompactNode &compact = mCompactNodes.back();
+  for(int a=0;a<3;++a)
+  {
+    compact.bounds[a  ] = roundBoundDown(node.bbox.min()[a]);
+    compact.bounds[a+3] = roundBoundUp  (node.bbox.max()[a]);
+  }
+
+  if(node.isLeaf())
+  {
+    compact.offset = node.left;
+    compact.countAxis = (unsigned int)(-node.right) << 2;
+    return;
+  }
+
+  //the split axis is the one separating the child centers most
+  const Vec3 d = (mNodes[node.right].bbox.min()+mNodes[node.right].bbox.max())
+                -(mNodes[node.left ].bbox.min()+mNodes[node.left ].bbox.max());
+  int axis = 0;
+  for(int a=1;a<3;++a)
+    if(std::fabs(d[a]) > std::fabs(d[axis]))
+      axis = a;
+
+  //the first child is the one with the smaller center along the axis,
+  //rays in positive direction visit it first
+  int first = node.left, second = node.right;
+  if(d[axis] < 0)
+    std::swap(first,second);
+
+  mCompactNodes[index].countAxis = (unsigned int)axis;
+  this->flatten(first);
+  const int secondIndex = int(mCompactNodes.size());
+  this->flatten(second);
+  mCompactNodes[index].offset = secondIndex;
+}
+
+void BVTree::buildWideNodes()
+{
+  WideNodeVector<4>().swap(mWideNodes4);
+  WideNodeVector<8>().swap(mWideNodes8);
+
+  if(mNodes.empty())
+    return;
+
+  if(mBranchingFactor == 4)
+  {
+    mWideNodes4.reserve(mNodes.size()/2+1);
+    this->collapse(mWideNodes4,0);
+  }
+  else if(mBranchingFactor == 8)
+  {
+    mWideNodes8.reserve(mNodes.size()/4+1);
+    this->collapse(mWideNodes8,0);
+  }
+}
+
+template<int N>
+int BVTree::collapse(WideNodeVector<N> &wideNodes, int binaryNode) const
+{
+  //pull up grandchildren of the binary tree, always opening the inner
+  //child with the largest surface area
+  int children[N];
+  int numChildren = 0;
+  const Node &root = mNodes[binaryNode];
+  if(root.isLeaf())
+    children[numChildren++] = binaryNode;
+  else
+  {
+    children[numChildren++] = root.left;
+    children[numChildren++] = root.right;
+    while(numChildren < N)
+    {
+      int  largest = -1;
+      real largestArea = -1;
+      for(int i=0;i<numChildren;++i)
+      {
+        const Node &child = mNodes[children[i]];
+        if(!child.isLeaf() && child.bbox.computeArea() > largestArea)
+        {
+          largest = i;
+          largestArea = child.bbox.computeArea();
+        }
+      }
+      if(largest < 0)
+        break;
+
+      const Node &inner = mNodes[children[largest]];
+      children[largest] = inner.left;
+      children[numChildren++] = inner.right;
+    }
+  }
+
+  const int index = int(wideNodes.size());
+  wideNodes.push_back(WideNode<N>());
+
+  for(int i=0;i<N;++i)
+  {
+    //the vector may grow in the recursion, do not keep references
+    if(i >= numChildren)
+    {
+      for(int a=0;a<6;++a)
+        wideNodes[index].bounds[a][i] = std::numeric_limits<float>::infinity();
+      wideNodes[index].child[i] = 0;
+      wideNodes[index].count[i] = 0;
+      continue;
+    }
+
+    const Node &child = mNodes[children[i]];
+    for(int a=0;a<3;++a)
+    {
+      wideNodes[index].bounds[a  ][i] = roundBoundDown(child.bbox.min()[a]);
+      wideNodes[index].bounds[a+3][i] = roundBoundUp  (child.bbox.max()[a]);
+    }
+
+    if(child.isLeaf())
+    {
+      wideNodes[index].child[i] = child.left;
+      wideNodes[index].count[i] = -child.right;
+    }
+    else
+    {
+      const int wideChild = this->collapse(wideNodes,children[i]);
+      wideNodes[index].child[i] = wideChild;
+      wideNodes[index].count[i] = 0;
+    }
+  }
+  return index;
+}
+
+void BVTree::setTraversalData()
+{
+  mPrimitiveIndexData = mPrimitiveIndices.empty() ? 0 : &mPrimitiveIndices[0];
+  mNumPrimitiveIndices = mPrimitiveIndices.size();
+  mCompactNodeData = mCompactNodes.empty() ? 0 : &mCompactNodes[0];
+  mWideNode4Data = mWideNodes4.empty() ? 0 : &mWideNodes4[0];
+  mWideNode8Data = mWideNodes8.empty() ? 0 : &mWideNodes8[0];
+  mNumTraversalNodes = mCompactNodes.size()+mWideNodes4.size()+mWideNodes8.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Refit
+///////////////////////////////////////////////////////////////////////////////
+
+bool BVTree::refit(ArrayRef<Vec3> vertexPositions,ArrayRef<Vec3i> triangleIndices)
+{
+  this->createNodes(vertexPositions,triangleIndices);
+  return this->refitFromTempBoxes();
+}
+
+bool BVTree::refit(const std::vector<BoundingBox> &primitiveBoxes)
+{
+  mTempTriangleBoxes = primitiveBoxes;
+  return this->refitFromTempBoxes();
+}
+
+bool BVTree::refitFromTempBoxes()
+{
+  if(mTempTriangleBoxes.size() != mNumPrimitiveIndices || mNumTraversalNodes == 0)
+  {
+    this->buildFromTempBoxes();
+    return false;
+  }
+
+  //a tree mapped from a cache file is read only
+  this->makeTraversalDataWritable();
+
+  if(!mCompactNodes.empty())
+    this->refitCompact(0);
+  else if(!mWideNodes4.empty())
+    this->refitWide(mWideNodes4,0);
+  else if(!mWideNodes8.empty())
+    this->refitWide(mWideNodes8,0);
+
+  mTraversalSahCost = this->traversalSahCost();
+  if(mTraversalSahCost > mRebuildThreshold*mBuildTraversalCost)
+  {
+    this->buildFromTempBoxes();
+    return false;
+  }
+
+  std::vector<BoundingBox>().swap(mTempTriangleBoxes);
+  return true;
+}
+
+void BVTree::makeTraversalDataWritable()
+{
+  if(!mCacheMapping)
+    return;
+
+  mPrimitiveIndices.assign(mPrimitiveIndexData,mPrimitiveIndexData+mNumPrimitiveIndices);
+  if(mCompactNodeData)
+    mCompactNodes.assign(mCompactNodeData,mCompactNodeData+mNumTraversalNodes);
+  if(mWideNode4Data)
+    mWideNodes4.assign(mWideNode4Data,mWideNode4Data+mNumTraversalNodes);
+  if(mWideNode8Data)
+    mWideNodes8.assign(mWideNode8Data,mWideNode8Data+mNumTraversalNodes);
+
+  this->setTraversalData();
+  mCacheMapping.reset();
+}
+
+BoundingBox BVTree::refitCompact(int node)
+{
+  BoundingBox box;
+  if(mCompactNodes[node].isLeaf())
+  {
+    const int first = mCompactNodes[node].offset;
+    for(int i=first;i<first+mCompactNodes[node].count();++i)
+      box.merge(mTempTriangleBoxes[mPrimitiveIndices[i]]);
+  }
+  else
+  {
+    box = this->refitCompact(node+1);
+    box.merge(this->refitCompact(mCompactNodes[node].offset));
+  }
+
+  CompactNode &compact = mCompactNodes[node];
+  for(int a=0;a<3;++a)
+  {
+    compact.bounds[a  ] = roundBoundDown(box.min()[a]);
+    compact.bounds[a+3] = roundBoundUp  (box.max()[a]);
+  }
+  return box;
+}
+
+template<int N>
+BoundingBox BVTree::refitWide(WideNodeVector<N> &wideNodes, int node)
+{
+  BoundingBox box;
+  for(int i=0;i<N;++i)
+  {
+    const int child = wideNodes[node].child[i];
+    const int count = wideNodes[node].count[i];
+
+    //unused slot, inner children are never the root
+    if(count == 0 && child == 0)
+      continue;
+
+    BoundingBox childBox;
+    if(count > 0)
+    {
+      for(int j=child;j<child+count;++j)
+        childBox.merge(mTempTriangleBoxes[mPrimitiveIndices[j]]);
+    }
+    else
+      childBox = this->refitWide(wideNodes,child);
+
+    for(int a=0;a<3;++a)
+    {
+      wideNodes[node].bounds[a  ][i] = roundBoundDown(childBox.min()[a]);
+      wideNodes[node].bounds[a+3][i] = roundBoundUp  (childBox.max()[a]);
+    }
+    box.merge(childBox);
+  }
+  return box;
+}
+
+//surface area of a float box, 0 for the empty slots at infinity
+static real boundsArea(float minX, float minY, float minZ,
+                       float maxX, float maxY, float maxZ)
+{
+  if(!(maxX >= minX && maxY >= minY && maxZ >= minZ) || maxX == std::numeric_limits<float>::infinity())
+    return 0;
+  const real dx = real(maxX)-minX, dy = real(maxY)-minY, dz = real(maxZ)-minZ;
+  return 2*(dx*dy+dx*dz+dy*dz);
+}
+
+real BVTree::traversalSahCost() const
+{
+  if(mWideNode4Data)
+    return this->wideSahCost(mWideNode4Data);
+  if(mWideNode8Data)
+    return this->wideSahCost(mWideNode8Data);
+  if(!mCompactNodeData)
+    return 0;
+
+  real cost = 0;
+  for(size_t i=0;i<mNumTraversalNodes;++i)
+  {
+    const CompactNode &node = mCompactNodeData[i];
+    const float *b = node.bounds;
+    const real area = boundsArea(b[0],b[1],b[2],b[3],b[4],b[5]);
+    cost += area*(node.isLeaf() ? mIntersectionCost*node.count() : mTraversalCost);
+  }
+  const float *b = mCompactNodeData[0].bounds;
+  const real rootArea = boundsArea(b[0],b[1],b[2],b[3],b[4],b[5]);
+  return rootArea > 0 ? cost/rootArea : 0;
+}
+
+template<int N>
+real BVTree::wideSahCost(const WideNode<N> *wideNodes) const
+{
+  real cost = 0;
+  for(size_t n=0;n<mNumTraversalNodes;++n)
+  {
+    const WideNode<N> &node = wideNodes[n];
+    for(int i=0;i<N;++i)
+    {
+      const real area = boundsArea(node.bounds[0][i],node.bounds[1][i],node.bounds[2][i],
+                                   node.bounds[3][i],node.bounds[4][i],node.bounds[5][i]);
+      cost += area*(node.count[i] > 0 ? mIntersectionCost*node.count[i] : mTraversalCost);
+    }
+  }
+
+  //the root has no box of its own, it is the union of its children
+  float rootBounds[6];
+  for(int a=0;a<3;++a)
+  {
+    rootBounds[a  ] =  std::numeric_limits<float>::infinity();
+    rootBounds[a+3] = -std::numeric_limits<float>::infinity();
+    for(int i=0;i<N;++i)
+    {
+      if(wideNodes[0].count[i] == 0 && wideNodes[0].child[i] == 0)
+        continue;
+      rootBounds[a  ] = std::min(rootBounds[a  ],wideNodes[0].bounds[a  ][i]);
+      rootBounds[a+3] = std::max(rootBounds[a+3],wideNodes[0].bounds[a+3][i]);
+    }
+  }
+  const real rootArea = boundsArea(rootBounds[0],rootBounds[1],rootBounds[2],
+                                   rootBounds[3],rootBounds[4],rootBounds[5]);
+  return rootArea > 0 ? mTraversalCost+cost/rootArea : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Cache file
+///////////////////////////////////////////////////////////////////////////////
+
+//Increase whenever the file layout or the node layouts change
+static const uint32_t kCacheVersion = 1;
+static const char     kCacheMagic[8] = {'R','T','B','V','T','R','E','E'};
+
+//Header of a cache file, followed by the primitive indices and the nodes of
+//the traversal layout at the given (aligned) offsets
+struct BVTree::CacheHeader
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t byteOrder;       //0x01020304 in the byte order of the writer
+  uint64_t key;
+  uint32_t branchingFactor;
+  uint32_t nodeSize;
+  uint64_t numPrimitiveIndices;
+  uint64_t primitiveIndexOffset;
+  uint64_t numTraversalNodes;
+  uint64_t traversalNodeOffset;
+  uint64_t numNodes;
+  uint64_t numLeaves;
+  double   sahCost;
+};
+
+//64 bit FNV-1a over 8 byte words
+static uint64_t hashWords(uint64_t hash, const void *data, size_t size)
+{
+  const unsigned char *bytes = (const unsigned char*)data;
+  for(size_t i=0;i+8<=size;i+=8)
+  {
+    uint64_t word;
+    std::memcpy(&word,bytes+i,8);
+    hash = (hash^word)*1099511628211ull;
+  }
+  for(size_t i=size&~size_t(7);i<size;++i)
+    hash = (hash^bytes[i])*1099511628211ull;
+  return hash;
+}
+
+uint64_t BVTree::cacheKey(ArrayRef<Vec3> vertexPositions,
+                          ArrayRef<Vec3i> triangleIndices) const
+{
+  //the build settings change the tree as well
+  const double settings[6] = {double(mBuildMethod), double(mMaxLeafSize), double(mTraversalCost),
+                              double(mIntersectionCost), double(mBranchingFactor), double(sizeof(real))};
+
+  uint64_t hash = 14695981039346656037ull;
+  hash = hashWords(hash,settings,sizeof(settings));
+  for(size_t i=0;i<vertexPositions.size();++i)
+    for(int j=0;j<3;++j)
+    {
+      const double value = vertexPositions[i][j];
+      hash = hashWords(hash,&value,sizeof(value));
+    }
+  for(size_t i=0;i<triangleIndices.size();++i)
+    for(int j=0;j<3;++j)
+    {
+      const int32_t value = int32_t(triangleIndices[i][j]);
+      hash = hashWords(hash,&value,sizeof(value));
+    }
+  return hash;
+}
+
+static uint64_t alignOffset(uint64_t offset)
+{
+  return (offset+63) & ~uint64_t(63);
+}
+
+bool BVTree::loadCache(const std::string &cacheFile, uint64_t key, size_t numPrimitives)
+{
+  std::shared_ptr<MappedFile> file(new MappedFile());
+  if(!file->open(cacheFile))
+    return false;
+  return this->useCacheData(file,0,true,key,numPrimitives);
+}
+
+bool BVTree::load(const std::shared_ptr<MappedFile> &file, size_t offset, size_t numPrimitives)
+{
+  return this->useCacheData(file,offset,false,0,numPrimitives);
+}
+
+bool BVTree::isValidTraversalData(const int *primitiveIndices, size_t numPrimitiveIndices,
+                                  const char *nodes, size_t numNodes, size_t numPrimitives) const
+{
+  //every primitive index refers to a primitive of the mesh
+  for(size_t i=0;i<numPrimitiveIndices;++i)
+    if(primitiveIndices[i] < 0 || size_t(primitiveIndices[i]) >= numPrimitives)
+      return false;
+
+  if(mBranchingFactor == 4)
+    return isValidWideNodes((const WideNode<4>*)nodes,numNodes,numPrimitiveIndices);
+  if(mBranchingFactor == 8)
+    return isValidWideNodes((const WideNode<8>*)nodes,numNodes,numPrimitiveIndices);
+
+  //the first child of an inner node follows it, the second one comes later,
+  //so the traversal cannot run in circles
+  const CompactNode *compactNodes = (const CompactNode*)nodes;
+  for(size_t i=0;i<numNodes;++i)
+  {
+    const CompactNode &node = compactNodes[i];
+    if(node.isLeaf() ?
+       node.offset < 0 || size_t(node.offset) > numPrimitiveIndices ||
+       size_t(node.count()) > numPrimitiveIndices-size_t(node.offset) :
+       i+1 >= numNodes || node.offset <= int(i) || size_t(node.offset) >= numNodes)
+      return false;
+  }
+  return true;
+}
+
+template<int N>
+bool BVTree::isValidWideNodes(const WideNode<N> *wideNodes, size_t numNodes,
+                              size_t numPrimitiveIndices)
+{
+  for(size_t i=0;i<numNodes;++i)
+    for(int c=0;c<N;++c)
+    {
+      const int child = wideNodes[i].child[c];
+      const int count = wideNodes[i].count[c];
+      if(count < 0 || child < 0)
+        return false;
+      //leaves reference a range of primitive indices, inner nodes come after
+      //their parent. Unused slots have a box at infinity and are never entered
+      if(count > 0 ?
+         size_t(child) > numPrimitiveIndices || size_t(count) > numPrimitiveIndices-size_t(child) :
+         wideNodes[i].bounds[0][c] != std::numeric_limits<float>::infinity() &&
+         (child <= int(i) || size_t(child) >= numNodes))
+        return false;
+    }
+  return true;
+}
+
+bool BVTree::useCacheData(const std::shared_ptr<MappedFile> &file, size_t offset,
+                          bool checkKey, uint64_t key, size_t numPrimitives)
+{
+  if(!file || !file->isOpen() || offset%64 != 0 || offset > file->size() ||
+     file->size()-offset < sizeof(CacheHeader))
+    return false;
+
+  const char *data = file->data()+offset;
+  const size_t size = file->size()-offset;
+  CacheHeader header;
+  std::memcpy(&header,data,sizeof(header));
+
+  const size_t nodeSize = mBranchingFactor == 4 ? sizeof(WideNode<4>) :
+                          mBranchingFactor == 8 ? sizeof(WideNode<8>) : sizeof(CompactNode);
+  if(std::memcmp(header.magic,kCacheMagic,8) != 0 || header.version != kCacheVersion ||
+     header.byteOrder != 0x01020304 || (checkKey && header.key != key) ||
+     header.branchingFactor != uint32_t(mBranchingFactor) || header.nodeSize != nodeSize)
+    return false;
+
+  //offset is 64 byte aligned within the page aligned mapping
+  const size_t nodeAlignment = mBranchingFactor == 4 ? alignof(WideNode<4>) :
+                               mBranchingFactor == 8 ? alignof(WideNode<8>) : alignof(CompactNode);
+  if(!isValidFileArray(header.primitiveIndexOffset,header.numPrimitiveIndices,sizeof(int),alignof(int),size) ||
+     !isValidFileArray(header.traversalNodeOffset,header.numTraversalNodes,nodeSize,nodeAlignment,size))
+    return false;
+
+  const char *nodes = data+header.traversalNodeOffset;
+  const int *primitiveIndices = (const int*)(data+header.primitiveIndexOffset);
+  if(!this->isValidTraversalData(primitiveIndices,size_t(header.numPrimitiveIndices),
+                                 nodes,size_t(header.numTraversalNodes),numPrimitives))
+    return false;
+
+  //the tree is used in place, only the build nodes of a previous build are dropped
+  std::vector<int>().swap(mPrimitiveIndices);
+  CompactNodeVector().swap(mCompactNodes);
+  WideNodeVector<4>().swap(mWideNodes4);
+  WideNodeVector<8>().swap(mWideNodes8);
+
+  mPrimitiveIndexData  = primitiveIndices;
+  mNumPrimitiveIndices = size_t(header.numPrimitiveIndices);
+  mNumTraversalNodes   = size_t(header.numTraversalNodes);
+  mCompactNodeData = mBranchingFactor != 4 && mBranchingFactor != 8 && mNumTraversalNodes ? (const CompactNode*)nodes : 0;
+  mWideNode4Data   = mBranchingFactor == 4 && mNumTraversalNodes ? (const WideNode<4>*)nodes : 0;
+  mWideNode8Data   = mBranchingFactor == 8 && mNumTraversalNodes ? (const WideNode<8>*)nodes : 0;
+
+  mNumNodes  = size_t(header.numNodes);
+  mNumLeaves = size_t(header.numLeaves);
+  mSahCost   = real(header.sahCost);
+  mBuildTime = 0;
+
+  mCacheMapping = file;
+  mBuildTraversalCost = mTraversalSahCost = this->traversalSahCost();
+  return true;
+}
+
+bool BVTree::save(std::ostream &out) const
+{
+  return this->writeCacheData(out,0);
+}
+
+bool BVTree::writeCacheData(std::ostream &out, uint64_t key) const
+{
+  const char *nodes = mWideNode4Data ? (const char*)mWideNode4Data :
+                      mWideNode8Data ? (const char*)mWideNode8Data : (const char*)mCompactNodeData;
+  const size_t nodeSize = mWideNode4Data ? sizeof(WideNode<4>) :
+                          mWideNode8Data ? sizeof(WideNode<8>) : sizeof(CompactNode);
+
+  CacheHeader header;
+  std::memset(&header,0,sizeof(header));
+  std::memcpy(header.magic,kCacheMagic,8);
+  header.version              = kCacheVersion;
+  header.byteOrder            = 0x01020304;
+  header.key                  = key;
+  header.branchingFactor      = uint32_t(mBranchingFactor);
+  header.nodeSize             = uint32_t(nodeSize);
+  header.numPrimitiveIndices  = mNumPrimitiveIndices;
+  header.primitiveIndexOffset = alignOffset(sizeof(CacheHeader));
+  header.numTraversalNodes    = mNumTraversalNodes;
+  header.traversalNodeOffset  = alignOffset(header.primitiveIndexOffset+mNumPrimitiveIndices*sizeof(int));
+  header.numNodes             = mNumNodes;
+  header.numLeaves            = mNumLeaves;
+  header.sahCost              = double(mSahCost);
+
+  const char padding[64] = {0};
+  out.write((const char*)&header,sizeof(header));
+  out.write(padding,std::streamsize(header.primitiveIndexOffset-sizeof(header)));
+  out.write((const char*)mPrimitiveIndexData,std::streamsize(mNumPrimitiveIndices*sizeof(int)));
+  out.write(padding,std::streamsize(header.traversalNodeOffset-header.primitiveIndexOffset
+                                    -mNumPrimitiveIndices*sizeof(int)));
+  out.write(nodes,std::streamsize(mNumTraversalNodes*nodeSize));
+  return bool(out);
+}
+
+bool BVTree::saveCache(const std::string &cacheFile, uint64_t key) const
+{
+  //write to a temporary file first, so readers never see a partial file
+  const std::string tempFile = cacheFile+".tmp";
+  {
+    std::ofstream out(tempFile.c_str(),std::ios::binary | std::ios::out | std::ios::trunc);
+    if(!out.is_open())
+      return false;
+
+    if(!this->writeCacheData(out,key))
+    {
+      out.close();
+      std::remove(tempFile.c_str());
+      return false;
+    }
+  }
+
+  return replaceFile(tempFile,cacheFile);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Statistics
+///////////////////////////////////////////////////////////////////////////////
+
+void BVTree::computeStatistics()
+{
+  mNumNodes = mNodes.size();
+  mNumLeaves = 0;
+  mSahCost = 0;
+  if(mNodes.empty())
+    return;
+
+  real cost = 0;
+  for(size_t i=0;i<mNodes.size();++i)
+  {
+    const Node &node = mNodes[i];
+    const real area = node.bbox.computeArea();
+    if(node.isLeaf())
+    {
+      cost += area*mIntersectionCost*real(-node.right);
+      ++mNumLeaves;
+    }
+    else
+      cost += area*mTraversalCost;
+  }
+  mSahCost = cost/mNodes[0].bbox.computeArea();
+}
+
+size_t BVTree::nodeMemory() const
+{
+  if(mWideNode4Data)
+    return mNumTraversalNodes*sizeof(WideNode<4>);
+  if(mWideNode8Data)
+    return mNumTraversalNodes*sizeof(WideNode<8>);
+  return mNumTraversalNodes*sizeof(CompactNode);
+}
+
 } //namespace rt
\ No newline at end of file
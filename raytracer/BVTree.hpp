@@ -2,9 +2,18 @@
 #define BVTREE_HPP_INCLUDE_ONCE
 
 #include <vector>
-#include <stack>
+#include <memory>
+#include <cstdint>
+#include <string>
+#include <iosfwd>
 #include "Math.hpp"
+#include "ArrayRef.hpp"
+#include "AlignedAllocator.hpp"
 #include "BoundingBox.hpp"
+#include "Ray.hpp"
+#include "SlabTest.hpp"
+#include "RayPacket.hpp"
+#include "MappedFile.hpp"
 
 namespace rt
 {
@@ -13,24 +22,261 @@ class BVTree
 {
 public:
 
+  //Available construction algorithms
+  enum BuildMethod
+  {
+    SweepSAH,  //full SAH sweep over presorted boxes, one primitive per leaf
+    BinnedSAH  //parallel binned SAH on centroids with SAH based leaf creation
+  };
+
+  BVTree();
+
+  //selects the construction algorithm used by the next build (default BinnedSAH)
+  void setBuildMethod(BuildMethod method) { mBuildMethod=method; }
+  BuildMethod buildMethod() const { return mBuildMethod; }
+
+  //maximal number of primitives per leaf of the binned builder
+  void setMaxLeafSize(size_t maxLeafSize) { mMaxLeafSize=maxLeafSize; }
+  size_t maxLeafSize() const { return mMaxLeafSize; }
+
+  //relative costs of a node traversal step and a primitive intersection
+  //used by the surface area heuristic
+  void setTraversalCost(real cost)    { mTraversalCost=cost; }
+  void setIntersectionCost(real cost) { mIntersectionCost=cost; }
+
+  //Number of children per node used for traversal (2, 4 or 8, default 4).
+  //Wider trees are collapsed from the binary tree after each build, the
+  //boxes of all children of a node are then tested at once using SSE/AVX.
+  //Binary trees are traversed in the compact 32 byte node layout.
+  void setBranchingFactor(int branchingFactor) { mBranchingFactor=branchingFactor; }
+  int branchingFactor() const { return mBranchingFactor; }
 
   //build from indexed triangle set
-  void build(const std::vector<Vec3> &vertexPositions,const std::vector<Vec3i> &triangleIndices);
+  void build(ArrayRef<Vec3> vertexPositions,ArrayRef<Vec3i> triangleIndices);
+
+  //build from a set of primitive bounding boxes, leaves refer to indices into this set
+  void build(const std::vector<BoundingBox> &primitiveBoxes);
+
+  //Build from indexed triangle set using an on-disk cache. If cacheFile holds
+  //a tree for the same triangles and build settings, it is memory mapped and
+  //used directly. Otherwise the tree is built and written to cacheFile.
+  //Returns true if the tree was loaded from the cache.
+  bool build(ArrayRef<Vec3> vertexPositions,ArrayRef<Vec3i> triangleIndices,
+             const std::string &cacheFile);
+
+  //Stores the tree in the layout of the cache file at the current position
+  //of out, which has to be 64 byte aligned relative to the start of the file.
+  //Used to embed the tree into other files, see MeshFile.
+  bool save(std::ostream &out) const;
+
+  //Uses a tree stored by save() at offset of a mapped file in place. The
+  //tree has to be built over numPrimitives primitives. Besides the branching
+  //factor and the node layout, all primitive and node indices are checked,
+  //so a corrupt file is rejected. The tree shares the ownership of the mapping.
+  bool load(const std::shared_ptr<MappedFile> &file, size_t offset, size_t numPrimitives);
+
+  //Updates the node boxes after the primitives moved, bottom up in linear
+  //time. The primitives must be the ones of the last build in the same order,
+  //only their geometry may change. The tree is rebuilt instead if the number
+  //of primitives differs or if the SAH cost of the refitted tree exceeds the
+  //cost after the last build by more than the rebuild threshold.
+  //Returns true if the tree was refitted, false if it was rebuilt.
+  bool refit(ArrayRef<Vec3> vertexPositions,ArrayRef<Vec3i> triangleIndices);
+  bool refit(const std::vector<BoundingBox> &primitiveBoxes);
+
+  //factor by which refitting may increase the SAH cost before refit()
+  //rebuilds the tree (default 1.5)
+  void setRebuildThreshold(real threshold) { mRebuildThreshold=threshold; }
+  real rebuildThreshold() const { return mRebuildThreshold; }
+
+  //SAH cost of the current tree relative to the cost after the last build
+  real sahDegradation() const { return mBuildTraversalCost > 0 ? mTraversalSahCost/mBuildTraversalCost : 1; }
 
-  //returns a set of triangle indices as candidates for ray-triangle intersection
-  const std::vector<int> intersectBoundingBoxes(const Ray &ray, const real maxLambda) const;
+  //number of primitives the tree was built for
+  size_t numPrimitives() const { return mNumPrimitiveIndices; }
+
+  //Traverses the tree front to back and calls intersectLeaf(primitive,maxLambda)
+  //for each leaf whose box is entered before maxLambda. The callback returns
+  //true on a hit and then lowers maxLambda to the hit distance, which prunes
+  //all nodes further away. Returns true if any leaf reported a hit.
+  template<class IntersectLeaf>
+  bool closestIntersection(const Ray &ray, real &maxLambda,
+                           IntersectLeaf intersectLeaf) const;
+
+  //Same traversal for 'any hit' rays, stops at the first leaf reporting a hit.
+  template<class IntersectLeaf>
+  bool anyIntersection(const Ray &ray, real maxLambda,
+                       IntersectLeaf intersectLeaf) const;
+
+  //Traverses the tree once for the lanes in mask of a packet. maxLambda holds
+  //one distance per lane. intersectLeaf(primitive,laneMask,maxLambda) is
+  //called with the lanes which entered the leaf, it returns the mask of lanes
+  //hit and lowers their maxLambda. Subtrees entered by a single lane are
+  //traversed as a single ray, binary trees are traversed lane by lane.
+  //Returns the mask of lanes reporting any hit.
+  template<class IntersectLeafPacket>
+  int closestIntersections(const RayPacket &packet, int mask, real *maxLambda,
+                           IntersectLeafPacket intersectLeaf) const;
+
+  //statistics of the last build
+  size_t numNodes() const { return mNumNodes; }
+  size_t numLeaves() const { return mNumLeaves; }
+  double buildTime() const { return mBuildTime; } //wall clock seconds
+
+  //expected costs of a random ray according to the surface area heuristic
+  real sahCost() const { return mSahCost; }
+
+  //Memory of the traversal nodes and of the primitive index list in bytes.
+  //buildNodeMemory() is the size of the binary double precision tree of the
+  //builder, which is released once the traversal nodes are created.
+  size_t nodeMemory() const;
+  size_t primitiveIndexMemory() const { return mNumPrimitiveIndices*sizeof(int); }
+  size_t buildNodeMemory() const { return mNumNodes*sizeof(Node); }
 private:
 
+  //the traversal arrays may point into the own vectors
+  BVTree(const BVTree&);
+  BVTree& operator=(const BVTree&);
+
+  //Size of the traversal stack kept on the call stack. Deeper trees are
+  //handled by recursing into the subtree once the stack is full.
+  static const int kTraversalStackSize = 64;
+
+  //Binary node in 32 bytes. Nodes are stored depth first, so the first child
+  //of an inner node directly follows it and offset is the index of the
+  //second child. Leaves store the first entry in mPrimitiveIndices in offset.
+  //countAxis packs the number of primitives (0 for inner nodes) in the upper
+  //30 bits and the split axis, which orders the traversal, in the lower 2.
+  //A node never straddles a cache line, in a 64 byte aligned array a node
+  //and its first child share one if the node starts at an even index.
+  struct alignas(32) CompactNode
+  {
+    bool isLeaf() const { return countAxis > 3; }
+    int count() const { return int(countAxis >> 2); }
+    int axis() const { return int(countAxis & 3); }
+
+    float        bounds[6];
+    int          offset;
+    unsigned int countAxis;
+  };
+  static_assert(sizeof(CompactNode) == 32, "CompactNode has to fill half a cache line");
+
+  //The traversal nodes are stored cache line aligned in memory as in the cache file
+  typedef std::vector<CompactNode,AlignedAllocator<CompactNode,64> > CompactNodeVector;
+
+  template<class IntersectLeaf>
+  bool traverse(int root, const SlabRay &slabRay, real &maxLambda, bool anyHit,
+                IntersectLeaf &intersectLeaf) const;
+
+  void buildCompactNodes();
+  void flatten(int binaryNode);
+
+  //Node of the collapsed N-ary tree. The child boxes are stored in single
+  //precision as structure of arrays (min x,y,z, max x,y,z), rounded outwards.
+  //Child i is an inner node if count[i] is 0, otherwise a leaf referencing
+  //count[i] primitives starting at mPrimitiveIndices[child[i]]. Unused slots
+  //have a box at infinity, which is never hit.
+  template<int N>
+  struct alignas(64) WideNode
+  {
+    float bounds[6][N];
+    int   child[N];
+    int   count[N];
+  };
+
+  template<int N>
+  using WideNodeVector = std::vector<WideNode<N>,AlignedAllocator<WideNode<N>,64> >;
+
+  static const int kWideTraversalStackSize = 256;
+
+  struct WideStackEntry
+  {
+    int   child;
+    int   count;
+    float tnear;
+  };
+
+  void buildWideNodes();
+  void computeStatistics();
+  void setTraversalData();
+  void makeTraversalDataWritable();
+
+  bool refitFromTempBoxes();
+  BoundingBox refitCompact(int node);
+  template<int N>
+  BoundingBox refitWide(WideNodeVector<N> &wideNodes, int node);
+  real traversalSahCost() const;
+  template<int N>
+  real wideSahCost(const WideNode<N> *wideNodes) const;
+
+  struct CacheHeader;
+  uint64_t cacheKey(ArrayRef<Vec3> vertexPositions,
+                    ArrayRef<Vec3i> triangleIndices) const;
+  bool loadCache(const std::string &cacheFile, uint64_t key, size_t numPrimitives);
+  bool saveCache(const std::string &cacheFile, uint64_t key) const;
+  bool useCacheData(const std::shared_ptr<MappedFile> &file, size_t offset,
+                    bool checkKey, uint64_t key, size_t numPrimitives);
+  bool isValidTraversalData(const int *primitiveIndices, size_t numPrimitiveIndices,
+                            const char *nodes, size_t numNodes, size_t numPrimitives) const;
+  template<int N>
+  static bool isValidWideNodes(const WideNode<N> *wideNodes, size_t numNodes,
+                               size_t numPrimitiveIndices);
+  bool writeCacheData(std::ostream &out, uint64_t key) const;
+
+  template<int N>
+  int collapse(WideNodeVector<N> &wideNodes, int binaryNode) const;
+
+  template<int N, class IntersectLeaf>
+  bool traverseWide(const WideNode<N> *wideNodes, int root,
+                    const Ray &ray, const SlabRay &slabRay, real &maxLambda,
+                    bool anyHit, IntersectLeaf &intersectLeaf) const;
+
+  template<class IntersectLeaf>
+  bool intersectLeafRange(int first, int count, real &maxLambda, bool anyHit,
+                          IntersectLeaf &intersectLeaf) const;
+
+  struct PacketStackEntry
+  {
+    int   child;
+    int   count;
+    int   mask;
+    float tnear;          //smallest entry distance of the lanes in mask
+  };
+
+  template<int N, class IntersectLeafPacket>
+  int traverseWidePacket(const WideNode<N> *wideNodes, int root,
+                         const RayPacket &packet, const SlabRayPacket &slabPacket,
+                         int mask, real *maxLambda, float *tmax,
+                         IntersectLeafPacket &intersectLeaf) const;
+
+  template<int N, class IntersectLeafPacket>
+  bool traverseWideLane(const WideNode<N> *wideNodes, int root,
+                        const RayPacket &packet, int lane, real *maxLambda,
+                        IntersectLeafPacket &intersectLeaf) const;
+
+  //Binary node of the builders, only kept until the traversal layout is
+  //created. Inner nodes store the indices of both children. Leaves store the
+  //first entry in mPrimitiveIndices in left and the negated number of primitives
+  //in right.
   struct Node
   {
     Node() {left=0;right=0;}
+    bool isLeaf() const { return right < 0; }
     int left;
     int right;
     BoundingBox bbox;
   };
+
+  struct Bin;
+  struct BinnedBuild;
+  void buildBinned(BinnedBuild &state, int node, const Bin &bounds,
+                   size_t begin, size_t end, int depth);
+  void makeLeaf(int node, size_t begin, size_t end);
+
   void sortTriangles();
-  void createNodes(const std::vector<Vec3> &vertexPositions,
-    const std::vector<Vec3i> &triangleIndices);
+  void buildFromTempBoxes();
+  void createNodes(ArrayRef<Vec3> vertexPositions,
+    ArrayRef<Vec3i> triangleIndices);
 
   void printSortedIndicesStatus(size_t offset, size_t numTriangles);
   void buildHierarchy(size_t rootNodeIndex, size_t numTriangles,size_t offset);
@@ -38,6 +284,33 @@ private:
   void computeBoundingBoxAreas(size_t offset, size_t numTriangles);
 
   std::vector<Node> mNodes;
+  std::vector<int>  mPrimitiveIndices;
+  CompactNodeVector         mCompactNodes;
+  WideNodeVector<4>         mWideNodes4;
+  WideNodeVector<8>         mWideNodes8;
+
+  //Arrays used by the traversal, they point into the vectors above after a
+  //build or into the mapped cache file. Only one node layout is set.
+  const int         *mPrimitiveIndexData;
+  const CompactNode *mCompactNodeData;
+  const WideNode<4> *mWideNode4Data;
+  const WideNode<8> *mWideNode8Data;
+  size_t             mNumPrimitiveIndices;
+  size_t             mNumTraversalNodes;
+  std::shared_ptr<MappedFile> mCacheMapping;
+
+  BuildMethod mBuildMethod;
+  size_t      mMaxLeafSize;
+  real        mTraversalCost;
+  real        mIntersectionCost;
+  int         mBranchingFactor;
+  double      mBuildTime;
+  size_t      mNumNodes;
+  size_t      mNumLeaves;
+  real        mSahCost;
+  real        mRebuildThreshold;
+  real        mBuildTraversalCost;  //SAH cost of the traversal layout after the last build
+  real        mTraversalSahCost;    //and after the last refit
 
   std::vector<bool>        mTempMarker;
   std::vector<BoundingBox> mTempTriangleBoxes;
@@ -47,6 +320,333 @@ private:
   std::vector<Vec3>        mTempAreasRight;
 
 };
+
+template<class IntersectLeaf>
+bool BVTree::closestIntersection(const Ray &ray, real &maxLambda,
+                                 IntersectLeaf intersectLeaf) const
+{
+  if(mWideNode4Data)
+    return this->traverseWide(mWideNode4Data,0,ray,SlabRay(ray),maxLambda,false,intersectLeaf);
+  if(mWideNode8Data)
+    return this->traverseWide(mWideNode8Data,0,ray,SlabRay(ray),maxLambda,false,intersectLeaf);
+  if(mCompactNodeData)
+    return this->traverse(0,SlabRay(ray),maxLambda,false,intersectLeaf);
+  return false;
+}
+
+template<class IntersectLeaf>
+bool BVTree::anyIntersection(const Ray &ray, real maxLambda,
+                             IntersectLeaf intersectLeaf) const
+{
+  if(mWideNode4Data)
+    return this->traverseWide(mWideNode4Data,0,ray,SlabRay(ray),maxLambda,true,intersectLeaf);
+  if(mWideNode8Data)
+    return this->traverseWide(mWideNode8Data,0,ray,SlabRay(ray),maxLambda,true,intersectLeaf);
+  if(mCompactNodeData)
+    return this->traverse(0,SlabRay(ray),maxLambda,true,intersectLeaf);
+  return false;
+}
+
+template<class IntersectLeafPacket>
+int BVTree::closestIntersections(const RayPacket &packet, int mask, real *maxLambda,
+                                 IntersectLeafPacket intersectLeaf) const
+{
+  if(mWideNode4Data || mWideNode8Data)
+  {
+    //lanes outside mask never enter a box
+    float tmax[RayPacket::kMaxSize];
+    for(int l=0;l<RayPacket::kMaxSize;++l)
+      tmax[l] = (mask & (1<<l)) ? slabTestMax(maxLambda[l]) : -1.0f;
+
+    const SlabRayPacket slabPacket(packet,mask);
+    if(mWideNode4Data)
+      return this->traverseWidePacket(mWideNode4Data,0,packet,slabPacket,mask,maxLambda,tmax,intersectLeaf);
+    return this->traverseWidePacket(mWideNode8Data,0,packet,slabPacket,mask,maxLambda,tmax,intersectLeaf);
+  }
+
+  int hitMask = 0;
+  if(!mCompactNodeData)
+    return hitMask;
+  for(int m=mask;m;m&=m-1)
+  {
+    const int l = lowestLane(m);
+    auto intersectLane = [&](int primitive, real &) -> bool
+    {
+      return intersectLeaf(primitive,1<<l,maxLambda) != 0;
+    };
+    if(this->traverse(0,SlabRay(packet.rays[l]),maxLambda[l],false,intersectLane))
+      hitMask |= 1<<l;
+  }
+  return hitMask;
+}
+
+template<class IntersectLeaf>
+bool BVTree::traverse(int root, const SlabRay &slabRay, real &maxLambda, bool anyHit,
+                      IntersectLeaf &intersectLeaf) const
+{
+  int stack[kTraversalStackSize];
+  int stackSize = 0;
+  bool hit = false;
+
+  //children are visited in the order of the ray direction along the split axis
+  const bool negativeDirection[3] = {slabRay.invDirection[0] < 0,
+                                     slabRay.invDirection[1] < 0,
+                                     slabRay.invDirection[2] < 0};
+  float tmax = slabTestMax(maxLambda);
+
+  int node = root;
+  for(;;)
+  {
+    const CompactNode &current = mCompactNodeData[node];
+    float tnear;
+    if(slabTest(current.bounds,slabRay,tmax,tnear))
+    {
+      if(current.isLeaf())
+      {
+        if(this->intersectLeafRange(current.offset,current.count(),maxLambda,anyHit,intersectLeaf))
+        {
+          hit = true;
+          if(anyHit)
+            return true;
+          tmax = slabTestMax(maxLambda);
+        }
+      }
+      else
+      {
+        int near = node+1, far = current.offset;
+        if(negativeDirection[current.axis()])
+          std::swap(near,far);
+
+        if(stackSize < kTraversalStackSize)
+          stack[stackSize++] = far;
+        else if(this->traverse(far,slabRay,maxLambda,anyHit,intersectLeaf))
+        {
+          hit = true;
+          if(anyHit)
+            return true;
+          tmax = slabTestMax(maxLambda);
+        }
+        node = near;
+        continue;
+      }
+    }
+
+    if(stackSize == 0)
+      return hit;
+    node = stack[--stackSize];
+  }
+}
+
+template<class IntersectLeaf>
+bool BVTree::intersectLeafRange(int first, int count, real &maxLambda, bool anyHit,
+                                IntersectLeaf &intersectLeaf) const
+{
+  bool hit = false;
+  for(int i=first;i<first+count;++i)
+  {
+    if(intersectLeaf(mPrimitiveIndexData[i],maxLambda))
+    {
+      hit = true;
+      if(anyHit)
+        return true;
+    }
+  }
+  return hit;
+}
+
+template<int N, class IntersectLeaf>
+bool BVTree::traverseWide(const WideNode<N> *wideNodes, int root,
+                          const Ray &ray, const SlabRay &slabRay, real &maxLambda,
+                          bool anyHit, IntersectLeaf &intersectLeaf) const
+{
+  WideStackEntry stack[kWideTraversalStackSize];
+  int stackSize = 0;
+  bool hit = false;
+
+  int node = root;
+  for(;;)
+  {
+    //test all children at once
+    const WideNode<N> &current = wideNodes[node];
+    float tnear[N];
+    //tmax is kept finite, so the empty slots at infinity are never entered
+    int mask = slabTest<N>(current.bounds,slabRay,slabTestMax(maxLambda),tnear);
+
+    //sort the children hit by decreasing entry distance
+    int order[N];
+    int numHits = 0;
+    for(int i=0;i<N;++i)
+    {
+      if(!(mask & (1<<i)))
+        continue;
+      int j = numHits++;
+      for(;j>0 && tnear[order[j-1]] < tnear[i];--j)
+        order[j] = order[j-1];
+      order[j] = i;
+    }
+
+    //push them far to near, so the nearest child is visited next
+    for(int k=0;k<numHits;++k)
+    {
+      const int i = order[k];
+      if(stackSize < kWideTraversalStackSize)
+      {
+        WideStackEntry &entry = stack[stackSize++];
+        entry.child = current.child[i];
+        entry.count = current.count[i];
+        entry.tnear = tnear[i];
+      }
+      else if(current.count[i] > 0 ?
+        this->intersectLeafRange(current.child[i],current.count[i],maxLambda,anyHit,intersectLeaf) :
+        this->traverseWide(wideNodes,current.child[i],ray,slabRay,maxLambda,anyHit,intersectLeaf))
+      {
+        hit = true;
+        if(anyHit)
+          return true;
+      }
+    }
+
+    //continue with the nearest inner node which is not behind the closest hit,
+    //leaves on the way are intersected directly
+    for(;;)
+    {
+      if(stackSize == 0)
+        return hit;
+      const WideStackEntry &entry = stack[--stackSize];
+      if(entry.tnear > maxLambda)
+        continue;
+      if(entry.count == 0)
+      {
+        node = entry.child;
+        break;
+      }
+      if(this->intersectLeafRange(entry.child,entry.count,maxLambda,anyHit,intersectLeaf))
+      {
+        hit = true;
+        if(anyHit)
+          return true;
+      }
+    }
+  }
+}
+
+template<int N, class IntersectLeafPacket>
+bool BVTree::traverseWideLane(const WideNode<N> *wideNodes, int root,
+                              const RayPacket &packet, int lane, real *maxLambda,
+                              IntersectLeafPacket &intersectLeaf) const
+{
+  //the callback updates maxLambda[lane], which is the distance traversed
+  auto intersectLane = [&](int primitive, real &) -> bool
+  {
+    return intersectLeaf(primitive,1<<lane,maxLambda) != 0;
+  };
+  return this->traverseWide(wideNodes,root,packet.rays[lane],SlabRay(packet.rays[lane]),
+                            maxLambda[lane],false,intersectLane);
+}
+
+template<int N, class IntersectLeafPacket>
+int BVTree::traverseWidePacket(const WideNode<N> *wideNodes, int root,
+                               const RayPacket &packet, const SlabRayPacket &slabPacket,
+                               int mask, real *maxLambda, float *tmax,
+                               IntersectLeafPacket &intersectLeaf) const
+{
+  PacketStackEntry stack[kWideTraversalStackSize];
+  int stackSize = 0;
+  int hitMask = 0;
+
+  //lanes hit by a leaf get their slab test distance shortened
+  auto intersectLeaves = [&](int first, int count, int laneMask)
+  {
+    int leafHits = 0;
+    for(int i=first;i<first+count;++i)
+      leafHits |= intersectLeaf(mPrimitiveIndexData[i],laneMask,maxLambda);
+    for(int m=leafHits;m;m&=m-1)
+      tmax[lowestLane(m)] = slabTestMax(maxLambda[lowestLane(m)]);
+    hitMask |= leafHits;
+  };
+
+  int node = root;
+  int nodeMask = mask;
+  for(;;)
+  {
+    //test all children against the lanes which entered the node
+    const WideNode<N> &current = wideNodes[node];
+    int childMask[N];
+    float tnear[N];
+    int order[N];
+    int numHits = 0;
+    for(int i=0;i<N;++i)
+    {
+      const float bounds[6] = {current.bounds[0][i],current.bounds[1][i],current.bounds[2][i],
+                               current.bounds[3][i],current.bounds[4][i],current.bounds[5][i]};
+      childMask[i] = slabTest(bounds,slabPacket,nodeMask,tmax,tnear[i]);
+      if(!childMask[i])
+        continue;
+
+      //sort the children hit by decreasing entry distance
+      int j = numHits++;
+      for(;j>0 && tnear[order[j-1]] < tnear[i];--j)
+        order[j] = order[j-1];
+      order[j] = i;
+    }
+
+    //push them far to near, so the nearest child is visited next
+    for(int k=0;k<numHits;++k)
+    {
+      const int i = order[k];
+      if(stackSize < kWideTraversalStackSize)
+      {
+        PacketStackEntry &entry = stack[stackSize++];
+        entry.child = current.child[i];
+        entry.count = current.count[i];
+        entry.mask  = childMask[i];
+        entry.tnear = tnear[i];
+      }
+      else if(current.count[i] > 0)
+        intersectLeaves(current.child[i],current.count[i],childMask[i]);
+      else
+        hitMask |= this->traverseWidePacket(wideNodes,current.child[i],packet,slabPacket,
+                                            childMask[i],maxLambda,tmax,intersectLeaf);
+    }
+
+    //continue with the nearest inner node which is not behind the closest
+    //hits of all its lanes, leaves on the way are intersected directly
+    for(;;)
+    {
+      if(stackSize == 0)
+        return hitMask;
+      const PacketStackEntry &entry = stack[--stackSize];
+      float farthest = 0;
+      for(int m=entry.mask;m;m&=m-1)
+        farthest = std::max(farthest,tmax[lowestLane(m)]);
+      if(entry.tnear > farthest)
+        continue;
+
+      if(entry.count > 0)
+      {
+        intersectLeaves(entry.child,entry.count,entry.mask);
+        continue;
+      }
+
+      //a single lane is left, the packet has lost its coherence
+      if(!(entry.mask & (entry.mask-1)))
+      {
+        const int lane = lowestLane(entry.mask);
+        if(this->traverseWideLane(wideNodes,entry.child,packet,lane,maxLambda,intersectLeaf))
+        {
+          hitMask |= entry.mask;
+          tmax[lane] = slabTestMax(maxLambda[lane]);
+        }
+        continue;
+      }
+
+      node = entry.child;
+      nodeMask = entry.mask;
+      break;
+    }
+  }
+}
+
 }
 
 #endif //BVTREE_HPP_INCLUDE_ONCE
\ No newline at end of file
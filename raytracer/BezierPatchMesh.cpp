@@ -18,6 +18,7 @@ void BezierPatchMesh::initialize()
   //regularly with triangles
 
   //sample at triangle vertices at uniform uv parameters
+  this->clearTriangles();
   std::vector<BezierPatchSample> samples; samples.reserve(mResU*mResV);
 
   for(size_t j=0; j<mResV; ++j)
@@ -77,6 +78,9 @@ void BezierPatchMesh::initialize()
       }
     }
   }
+
+  //same triangle order for the same resolution, the BVH can be refitted
+  TriangleMesh::initialize();
 }
 
 BezierPatchMesh::BezierPatchSample BezierPatchMesh::sample(real u, real v) const
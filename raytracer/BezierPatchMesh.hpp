@@ -21,8 +21,9 @@ public:
                   size_t resu, size_t resv);
 
   // Must be called before rendering and after control point manipulation
-  // Creates the set of triangles.
-  void initialize();
+  // Creates the set of triangles. As long as the resolution is unchanged
+  // the BVH of the previous tessellation is refitted instead of rebuilt.
+  void initialize() override;
 
   void setControlPoint(size_t i, size_t j, const Vec3& p)
   {
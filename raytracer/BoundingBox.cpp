@@ -49,6 +49,34 @@ bool BoundingBox::anyIntersection(const Ray &ray, real maxLambda) const
   return true;
 }
 
+bool BoundingBox::intersect(const Ray &ray, const Vec3 &invDirection,
+                            real maxLambda, real &tnear) const
+{
+  const Vec3 &origin = ray.origin();
+  real tmin = 0;
+  real tmax = maxLambda;
+
+  for (int i=0; i<3; i++)
+  {
+    if (ray.direction()[i])
+    {
+      real t1 = (mMin[i]-origin[i])*invDirection[i];
+      real t2 = (mMax[i]-origin[i])*invDirection[i];
+      if (t1 > t2)
+        std::swap(t1,t2);
+      tmin = std::max(tmin,t1);
+      tmax = std::min(tmax,t2);
+      if (tmin > tmax)
+        return false;
+    }
+    else if (origin[i]<mMin[i] || origin[i]>mMax[i])
+      return false;
+  }
+
+  tnear = tmin;
+  return true;
+}
+
 void BoundingBox::expandByPoint(const Vec3& p)
 {
   for (int i=0;i<3;++i)
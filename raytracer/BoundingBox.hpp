@@ -22,6 +22,12 @@ public:
 	// Returns true in case of any intersection
 	bool anyIntersection(const Ray &ray, real maxLambda) const;
 
+  // Returns true if the ray enters the box within [0,maxLambda] and stores
+  // the entry distance (clamped to 0) in tnear. invDirection holds the
+  // component-wise inverse of the ray direction.
+  bool intersect(const Ray &ray, const Vec3 &invDirection, real maxLambda,
+                 real &tnear) const;
+
   void merge(const BoundingBox& box); // merge with a given bounding box
         
 	const Vec3& min() const { return mMin; }
@@ -15,6 +15,15 @@ Camera::~Camera()
 
 }
 
+void Camera::rays(size_t x, size_t y, size_t width, size_t height,
+                  RayPacket &packet, RayDifferentials *differentials) const
+{
+  packet.size = int(width*height);
+  for(size_t j=0;j<height;++j)
+    for(size_t i=0;i<width;++i)
+      packet.setRay(int(i+width*j),this->ray(x+i,y+j,differentials[i+width*j]));
+}
+
 void Camera::init()
 {
   mDirection = (mLookAt - mPosition).normalize();
@@ -27,8 +36,8 @@ void Camera::init()
 
   mTopLeft = mPosition + mDirection - mRight + mDown;
 
-  mRight = 2.0 * mRight / real(mXResolution);
-  mDown  = 2.0 * mDown  / real(mYResolution);
+  mRight = real(2) * mRight / real(mXResolution);
+  mDown  = real(2) * mDown  / real(mYResolution);
 }
 
 } //namespace rt
@@ -2,6 +2,7 @@
 #define CAMERA_HPP_INCLUDE_ONCE
 
 #include "Ray.hpp"
+#include "RayPacket.hpp"
 
 namespace rt {
 
@@ -15,6 +16,21 @@ public:
   /// Compute the primary ray passing through pixel x,y.
   virtual Ray ray(size_t x, size_t y) const = 0;
 
+  /// Compute the primary ray through pixel x,y and its differentials with
+  /// respect to x and y. By default the ray has no differentials.
+  virtual Ray ray(size_t x, size_t y, RayDifferentials &differentials) const
+  {
+    differentials = RayDifferentials();
+    return this->ray(x,y);
+  }
+
+  /// Computes the primary rays of the width x height pixels starting at
+  /// x,y into the lanes of packet, row by row, and their differentials.
+  /// At most RayPacket::kMaxSize pixels. By default ray() is called for
+  /// every pixel.
+  virtual void rays(size_t x, size_t y, size_t width, size_t height,
+                    RayPacket &packet, RayDifferentials *differentials) const;
+
   // Constant accessors.
   const Vec3& position()     const { return mPosition; }
   const Vec3& lookAt()       const { return mLookAt; }
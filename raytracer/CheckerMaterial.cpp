@@ -10,10 +10,10 @@ CheckerMaterial::CheckerMaterial(std::shared_ptr<Material> material1,
   Material(), mMaterial1(material1), mMaterial2(material2), mTiles(tiles)
 {}
 
-Vec4 CheckerMaterial::shade(std::shared_ptr<RayIntersection> intersection, 
+Vec4 CheckerMaterial::shade(const RayIntersection &intersection, 
            const Light& light) const
 {
-  const Vec3 &uvw = intersection->uvw();
+  const Vec3 &uvw = intersection.uvw();
 
   const bool left  = (fmod(fabs(uvw[0]), 1/mTiles[0])
     < (1/mTiles[0] / real(2)))
@@ -16,7 +16,7 @@ public:
                   std::shared_ptr<Material> material2,
                   const Vec2 &tiles = Vec2(1,1));
 
-  Vec4 shade(std::shared_ptr<RayIntersection> intersection, 
+  Vec4 shade(const RayIntersection &intersection, 
     const Light& light) const override;
 
 private:
@@ -8,7 +8,7 @@ ConstantMaterial::ConstantMaterial(const Vec3& color) :
 
 }
 
-Vec4 ConstantMaterial::shade(std::shared_ptr<RayIntersection> intersection,
+Vec4 ConstantMaterial::shade(const RayIntersection &intersection,
                              const Light& light) const 
 {
    return Vec4(this->color(),1.0);
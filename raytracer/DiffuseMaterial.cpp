@@ -11,11 +11,11 @@ DiffuseMaterial::DiffuseMaterial(const Vec3& color) :
 
 }
 
-Vec4 DiffuseMaterial::shade(std::shared_ptr<RayIntersection> intersection,
+Vec4 DiffuseMaterial::shade(const RayIntersection &intersection,
                              const Light& light) const 
 {
-  Vec3 N = intersection->normal();
-  Vec3 L = (light.position() - intersection->position()).normalized();
+  Vec3 N = intersection.normal();
+  Vec3 L = (light.position() - intersection.position()).normalized();
 
   real cosNL = std::max(N.dot(L),real(0));
 
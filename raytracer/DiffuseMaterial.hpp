@@ -16,7 +16,7 @@ class DiffuseMaterial : public Material
 public:
   DiffuseMaterial(const Vec3& color = Vec3(0,0.4,0.8));
 
-  Vec4 shade(std::shared_ptr<RayIntersection> intersection, 
+  Vec4 shade(const RayIntersection &intersection, 
              const Light& light) const override;
 };
 
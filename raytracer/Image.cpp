@@ -5,25 +5,33 @@
 #include <iostream>
 #include <string>
 #include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define RT_IMAGE_SSE2
+#  include <emmintrin.h>
+#endif
 
 namespace rt {
   
-  Image::Image() : mWidth(0), mHeight(0)
+  Image::Image() : mWidth(0), mHeight(0), mFormat(RGBA32F)
   {
   }
   
-  Image::Image(size_t width, size_t height)
+  Image::Image(size_t width, size_t height, PixelFormat format)
   {
 	assert(width>0 && height>0);
-	this->init(width,height);
+	this->init(width,height,format);
   }
   
-  void Image::init(size_t width, size_t height)
+  void Image::init(size_t width, size_t height, PixelFormat format)
   {
 	mWidth=width;
 	mHeight=height;
+	mFormat=format;
 	mData.clear();
-	mData.resize(width*height);
+	mData.resize(width*height*bytesPerPixel(format));
   }
   
   typedef struct
@@ -105,27 +113,121 @@ namespace rt {
     return true;
   }
   
-  Image::Image(std::string filename)
+  Image::Image(std::string filename) : mWidth(0), mHeight(0), mFormat(RGBA8)
   {
 	TGAFILE	file;
-	LoadTGAFile(filename.c_str(), &file);
-	mWidth = file.imageWidth;
-	mHeight = file.imageHeight;
-	unsigned int position = 0;
-	for (unsigned int y = 0; y < mHeight; y++)
-	  for (unsigned int x = 0; x < mWidth; x++) {
-		Vec4 pixel;
-		pixel[0] = file.imageData[position++] / 255.;
-		pixel[1] = file.imageData[position++] / 255.;
-		pixel[2] = file.imageData[position++] / 255.;
-		pixel[3] = file.imageData[position++] / 255.;
-		mData.push_back(pixel);
+	if (!LoadTGAFile(filename.c_str(), &file))
+	  return;
+	
+	//the bytes are kept as they are, RGB files get an opaque alpha channel
+	this->init(file.imageWidth, file.imageHeight, RGBA8);
+	const size_t colorMode = file.bitCount / 8;
+	for (size_t i = 0; i < mWidth*mHeight; i++)
+	{
+	  mData[4*i+0] = file.imageData[colorMode*i+0];
+	  mData[4*i+1] = file.imageData[colorMode*i+1];
+	  mData[4*i+2] = file.imageData[colorMode*i+2];
+	  mData[4*i+3] = colorMode == 4 ? file.imageData[colorMode*i+3] : 255;
+	}
+	free(file.imageData);
+  }
+  
+#ifdef RT_IMAGE_SSE2
+  // Clamps RGBA to [0,1], scales to [0,255] with truncation and stores the
+  // pixel as BGRA bytes. The arithmetic is done in the precision of real,
+  // so the results match the scalar conversion.
+#ifdef RT_USE_FLOAT
+  static inline void storeBGRA8(__m128 rgba, unsigned char *out)
+  {
+	// min first, so NaN ends up as 1 like Math::clamp
+	const __m128 zero  = _mm_setzero_ps();
+	const __m128 one   = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(255.0f);
+	rgba = _mm_mul_ps(_mm_max_ps(_mm_min_ps(rgba,one),zero),scale);
+	
+	__m128i c = _mm_shuffle_epi32(_mm_cvttps_epi32(rgba),_MM_SHUFFLE(3,0,1,2));
+	c = _mm_packus_epi16(_mm_packs_epi32(c,c),c);
+	const int bgra = _mm_cvtsi128_si32(c);
+	memcpy(out,&bgra,4);
+  }
+  
+  static inline void storeBGRA8(__m128d rg, __m128d ba, unsigned char *out)
+  {
+	storeBGRA8(_mm_movelh_ps(_mm_cvtpd_ps(rg),_mm_cvtpd_ps(ba)),out);
+  }
+#else
+  static inline void storeBGRA8(__m128d rg, __m128d ba, unsigned char *out)
+  {
+	// min first, so NaN ends up as 1 like Math::clamp
+	const __m128d zero  = _mm_setzero_pd();
+	const __m128d one   = _mm_set1_pd(1.0);
+	const __m128d scale = _mm_set1_pd(255.0);
+	rg = _mm_mul_pd(_mm_max_pd(_mm_min_pd(rg,one),zero),scale);
+	ba = _mm_mul_pd(_mm_max_pd(_mm_min_pd(ba,one),zero),scale);
+	
+	// RGBA as 32 bit integers, swapped to BGRA and packed to bytes
+	__m128i c = _mm_unpacklo_epi64(_mm_cvttpd_epi32(rg),_mm_cvttpd_epi32(ba));
+	c = _mm_shuffle_epi32(c,_MM_SHUFFLE(3,0,1,2));
+	c = _mm_packus_epi16(_mm_packs_epi32(c,c),c);
+	const int bgra = _mm_cvtsi128_si32(c);
+	memcpy(out,&bgra,4);
+  }
+  
+  static inline void storeBGRA8(__m128 rgba, unsigned char *out)
+  {
+	storeBGRA8(_mm_cvtps_pd(rgba),_mm_cvtps_pd(_mm_movehl_ps(rgba,rgba)),out);
+  }
+#endif
+#endif
+  
+  // Converts pixels to BGRA bytes like Math::clamp(c)*255 with truncation,
+  // RGBA8 images are copied with swapped channels.
+  void Image::convertToBGRA8(size_t first, size_t count, unsigned char *out) const
+  {
+	if (mFormat == RGBA8)
+	{
+	  const unsigned char *p = &mData[4*first];
+	  for (size_t i=0; i<count; ++i)
+	  {
+		out[4*i+0] = p[4*i+2];
+		out[4*i+1] = p[4*i+1];
+		out[4*i+2] = p[4*i+0];
+		out[4*i+3] = p[4*i+3];
 	  }
+	  return;
+	}
 	
+#ifdef RT_IMAGE_SSE2
+	if (mFormat == RGBA64F)
+	{
+	  const double *p = (const double*)&mData[0] + 4*first;
+	  for (size_t i=0; i<count; ++i)
+		storeBGRA8(_mm_loadu_pd(p+4*i),_mm_loadu_pd(p+4*i+2),out+4*i);
+	  return;
+	}
+	if (mFormat == RGBA32F)
+	{
+	  const float *p = (const float*)&mData[0] + 4*first;
+	  for (size_t i=0; i<count; ++i)
+		storeBGRA8(_mm_loadu_ps(p+4*i),out+4*i);
+	  return;
+	}
+#endif
+	
+	for (size_t i=0; i<count; ++i)
+	{
+	  const Vec4 c = this->load(first+i);
+	  out[4*i+0] = (unsigned char)(Math::clamp(c(2))*255);
+	  out[4*i+1] = (unsigned char)(Math::clamp(c(1))*255);
+	  out[4*i+2] = (unsigned char)(Math::clamp(c(0))*255);
+	  out[4*i+3] = (unsigned char)(Math::clamp(c(3))*255);
+	}
   }
   
-  bool Image::saveToTGA(std::string fileName) const
+  bool Image::saveToTGA(std::string fileName, WriteStatistics *statistics) const
   {
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	
 	//add .tga file extension if not yet present
 	std::string suffix(".tga"), outName(fileName), outNameLower(fileName);
 	
@@ -162,32 +264,45 @@ namespace rt {
 	}
 	
 	//Write the header
-	f.put(0);
-	f.put(0);
-	f.put(2);                       /* uncompressed RGB */
-	f.put(0); 	f.put(0);
-	f.put(0); 	f.put(0);
-	f.put(0);
-	f.put(0); 	f.put(0);           /* X origin */
-	f.put(0); 	f.put(0);           /* y origin */
-	f.put((mWidth & 0x00FF));
-	f.put((unsigned char)((mWidth & 0xFF00) / 256));
-	f.put((unsigned char)(mHeight & 0x00FF));
-	f.put((unsigned char)((mHeight & 0xFF00) / 256));
-	f.put(32);                      /* 32 bit RGBA bitmap */
-	f.put(0);
-	
-	//Write the pixel data in BGRA
-	for (size_t i=0; i<mHeight*mWidth; i++)
+	const unsigned char header[18] =
 	{
-	  f.put((unsigned char)(Math::clamp(mData[i](2))*255));
-	  f.put((unsigned char)(Math::clamp(mData[i](1))*255));
-	  f.put((unsigned char)(Math::clamp(mData[i](0))*255));
-	  f.put((unsigned char)(Math::clamp(mData[i](3))*255));
+	  0, 0,
+	  2,                            /* uncompressed RGB */
+	  0, 0, 0, 0, 0,
+	  0, 0,                         /* X origin */
+	  0, 0,                         /* y origin */
+	  (unsigned char)(mWidth & 0x00FF),
+	  (unsigned char)((mWidth & 0xFF00) / 256),
+	  (unsigned char)(mHeight & 0x00FF),
+	  (unsigned char)((mHeight & 0xFF00) / 256),
+	  32,                           /* 32 bit RGBA bitmap */
+	  0
+	};
+	f.write((const char*)header,sizeof(header));
+	
+	//Write the pixel data in BGRA, converted in blocks of 1 MiB
+	const size_t numPixels = mHeight*mWidth;
+	const size_t blockSize = std::min(numPixels,size_t(1)<<18);
+	std::vector<unsigned char> block(4*blockSize);
+	for (size_t i=0; i<numPixels; i+=blockSize)
+	{
+	  const size_t count = std::min(blockSize,numPixels-i);
+	  this->convertToBGRA8(i,count,&block[0]);
+	  f.write((const char*)&block[0],std::streamsize(4*count));
 	}
 	
 	f.close();
+	if (!f)
+	{
+	  std::cerr<<"Image::saveToBitmap: could not write file " << outName << std::endl;
+	  return false;
+	}
 	
+	if (statistics)
+	{
+	  statistics->bytes   = sizeof(header)+4*numPixels;
+	  statistics->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+	}
 	return true;
   }
   
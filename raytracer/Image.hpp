@@ -2,44 +2,219 @@
 #define IMAGE_HPP_INCLUDE_ONCE
 
 #include "Math.hpp"
+#include "WriteStatistics.hpp"
 
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__F16C__)
+#  include <immintrin.h>
+#endif
 
 namespace rt {
 
-/// Storage for an RGBA floating point image.
+/// Storage for an RGBA image. Pixels are stored in one of several formats
+/// and converted to and from Vec4 by the accessors.
 class Image
 {
 public:
+  /// Pixel storage formats. RGBA8 stores [0,1] values in 4 bytes (textures),
+  /// RGBA16F and RGBA32F store half and single precision floats in 8 and 16
+  /// bytes (HDR framebuffers), RGBA64F stores doubles in 32 bytes.
+  enum PixelFormat
+  {
+    RGBA8,
+    RGBA16F,
+    RGBA32F,
+    RGBA64F
+  };
+
   Image();
-  Image(size_t width, size_t height);
+  Image(size_t width, size_t height, PixelFormat format=RGBA32F);
+
+  /// Loads an uncompressed TGA file into an RGBA8 image.
   Image(std::string filename);
 
   /// Valid values for width and height must be > 0.
-  void init(size_t width, size_t height);
+  void init(size_t width, size_t height, PixelFormat format=RGBA32F);
 
   /// Writes an integer 4x[0,255] RGBA image in TGA format.
-  /// Pixel intensities outside valid range [0,1] are clamped.
-  bool saveToTGA(std::string filename)  const;
+  /// Pixel intensities outside valid range [0,1] are clamped. The pixels
+  /// are converted in blocks which are written at once, statistics receives
+  /// the file size and the time taken if given.
+  bool saveToTGA(std::string filename, WriteStatistics *statistics=0) const;
 
   size_t width ()                       const { return mWidth; }
   size_t height()                       const { return mHeight; }
+  PixelFormat format()                  const { return mFormat; }
+
+  /// Bytes per pixel of the storage format and of the whole image.
+  size_t bytesPerPixel()                const { return bytesPerPixel(mFormat); }
+  size_t memory()                       const { return mData.size(); }
+  static size_t bytesPerPixel(PixelFormat format);
 
   /// Returns the RGBA color at image position i,j
-  const Vec4& pixel(size_t i, size_t j) const { return mData[i+mWidth*j]; }
+  Vec4 pixel(size_t i, size_t j) const { return this->load(i+mWidth*j); }
 
-  /// RGBA colors components must be in [0,1] range for TGA export. 
-  void setPixel(Vec4 &rgba, size_t i, size_t j) { mData[i+mWidth*j]=rgba; }
-  Vec4 getPixel(size_t i, size_t j) const { return mData[i+mWidth*j]; }
+  /// RGBA colors components must be in [0,1] range for TGA export. RGBA8
+  /// images clamp to [0,1] and round to the nearest of the 256 levels.
+  void setPixel(const Vec4 &rgba, size_t i, size_t j) { this->store(rgba,i+mWidth*j); }
+  Vec4 getPixel(size_t i, size_t j) const { return this->load(i+mWidth*j); }
   Vec4 getTexPixel(real	i, real j) const { return getPixel(i * mWidth, j * mHeight); }
 
+  /// Conversion between single and half precision floats (round to nearest even).
+  static float    halfToFloat(uint16_t h);
+  static uint16_t floatToHalf(float f);
+
 private:
+  Vec4 load(size_t index) const;
+  void store(const Vec4 &rgba, size_t index);
+
+  void convertToBGRA8(size_t first, size_t count, unsigned char *out) const;
+
   size_t mWidth;
   size_t mHeight;
-  std::vector<Vec4> mData;
+  PixelFormat mFormat;
+  std::vector<unsigned char> mData;
 };
 
+inline size_t Image::bytesPerPixel(PixelFormat format)
+{
+  return format == RGBA8 ? 4 : format == RGBA16F ? 8 : format == RGBA32F ? 16 : 32;
+}
+
+inline Vec4 Image::load(size_t index) const
+{
+  switch(mFormat)
+  {
+  case RGBA8:
+  {
+    const unsigned char *p = &mData[4*index];
+    return Vec4(p[0]/real(255),p[1]/real(255),p[2]/real(255),p[3]/real(255));
+  }
+  case RGBA16F:
+  {
+    const uint16_t *p = (const uint16_t*)&mData[8*index];
+    return Vec4(halfToFloat(p[0]),halfToFloat(p[1]),halfToFloat(p[2]),halfToFloat(p[3]));
+  }
+  case RGBA32F:
+  {
+    const float *p = (const float*)&mData[16*index];
+    return Vec4(p[0],p[1],p[2],p[3]);
+  }
+  default:
+  {
+    const double *p = (const double*)&mData[32*index];
+    return Vec4(real(p[0]),real(p[1]),real(p[2]),real(p[3]));
+  }
+  }
+}
+
+inline void Image::store(const Vec4 &rgba, size_t index)
+{
+  switch(mFormat)
+  {
+  case RGBA8:
+  {
+    unsigned char *p = &mData[4*index];
+    for(int k=0;k<4;++k)
+      p[k] = (unsigned char)(Math::clamp(rgba[k])*255+real(0.5));
+    break;
+  }
+  case RGBA16F:
+  {
+    uint16_t *p = (uint16_t*)&mData[8*index];
+    for(int k=0;k<4;++k)
+      p[k] = floatToHalf(float(rgba[k]));
+    break;
+  }
+  case RGBA32F:
+  {
+    float *p = (float*)&mData[16*index];
+    for(int k=0;k<4;++k)
+      p[k] = float(rgba[k]);
+    break;
+  }
+  default:
+  {
+    double *p = (double*)&mData[32*index];
+    for(int k=0;k<4;++k)
+      p[k] = double(rgba[k]);
+  }
+  }
+}
+
+inline float Image::halfToFloat(uint16_t h)
+{
+#if defined(__F16C__)
+  return _cvtsh_ss(h);
+#else
+  const uint32_t sign = uint32_t(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+  uint32_t bits;
+  if(exponent == 0x1f)      //infinity, NaN (quiet)
+    bits = sign | 0x7f800000 | (mantissa << 13) | (mantissa ? 0x400000 : 0);
+  else if(exponent != 0)    //normal, rebias the exponent
+    bits = sign | ((exponent+112) << 23) | (mantissa << 13);
+  else if(mantissa == 0)    //zero
+    bits = sign;
+  else                      //subnormal, normalized in single precision
+  {
+    exponent = 113;
+    while(!(mantissa & 0x400))
+    {
+      mantissa <<= 1;
+      --exponent;
+    }
+    bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+  }
+  float f;
+  std::memcpy(&f,&bits,sizeof(f));
+  return f;
+#endif
+}
+
+inline uint16_t Image::floatToHalf(float f)
+{
+#if defined(__F16C__)
+  return uint16_t(_cvtss_sh(f,0));
+#else
+  uint32_t bits;
+  std::memcpy(&bits,&f,sizeof(bits));
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  const uint32_t absBits = bits & 0x7fffffff;
+
+  if(absBits >= 0x7f800000)   //infinity, NaN (quiet, upper payload bits kept)
+    return uint16_t(sign | 0x7c00 | (absBits > 0x7f800000 ? 0x200 | ((absBits & 0x7fffff) >> 13) : 0));
+  if(absBits >= 0x477ff000)   //rounds to infinity
+    return uint16_t(sign | 0x7c00);
+
+  uint32_t h, remainder, halfway;
+  if(absBits < 0x38800000)    //subnormal half (below 2^-14) or zero
+  {
+    if(absBits < 0x33000000)
+      return uint16_t(sign);
+    const uint32_t shift = 126 - (absBits >> 23);
+    const uint32_t mantissa = (absBits & 0x7fffff) | 0x800000;
+    h = mantissa >> shift;
+    remainder = mantissa & ((1u << shift)-1);
+    halfway = 1u << (shift-1);
+  }
+  else                        //normal, rebias the exponent
+  {
+    h = (absBits - 0x38000000) >> 13;
+    remainder = absBits & 0x1fff;
+    halfway = 0x1000;
+  }
+  if(remainder > halfway || (remainder == halfway && (h & 1)))
+    ++h;
+  return uint16_t(sign | h);
+#endif
+}
+
 } //namespace rt
 
 #endif //IMAGE_HPP_INCLUDE_ONCE
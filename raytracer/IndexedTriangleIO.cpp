@@ -1,8 +1,18 @@
 #include "IndexedTriangleIO.hpp"
 
+#include "MappedFile.hpp"
+
 #include <fstream>
 #include <string>
 #include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <climits>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <thread>
 
 namespace rt
 {
@@ -18,130 +28,383 @@ void IndexedTriangleIO::clear()
 }
 
 
-bool IndexedTriangleIO::loadFromOBJ(const std::string &filePath)
+//Fast number and token parsing for the OBJ loader. Numbers are parsed
+//directly from the mapped file, no line is copied.
+
+static inline bool isBlank(char c)
 {
-  std::fstream in(filePath, std::ios::binary | std::ios::in);
+  return c==' ' || c=='\t' || c=='\r';
+}
 
-  //could not open file, reject
-  if(!in.is_open())
-  {
-    std::cerr<<"Error: Could not open file "<<filePath<<std::endl;
-    return false;
-  }
+static inline const char* skipBlanks(const char *p, const char *end)
+{
+  while (p<end && isBlank(*p))
+    ++p;
+  return p;
+}
 
-  char line[1024];
-  rt::Vec3 v,t,n;
-  rt::Vec3i idx_v,idx_t,idx_n;
+//Parses a decimal number with the result of strtod. Short numbers, which is
+//virtually every number in an OBJ file, are exactly representable as
+//mantissa * 10^exponent with a single rounding, longer ones fall back to
+//strtod. Returns the position after the number or 0 if there is none.
+static const char* parseReal(const char *p, const char *end, double &value)
+{
+  static const double powersOf10[23] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,
+    1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22};
 
-  int lineIndex(0);
+  const char *start = p;
+  bool negative = false;
+  if (p<end && (*p=='-' || *p=='+'))
+    negative = *p++=='-';
 
-  UnsupportedFeatures features;
+  unsigned long long mantissa = 0;
+  int  significantDigits = 0;
+  int  exponent = 0;
+  bool hasDigits = false;
+  bool exact = true;
 
-  //read lines in file
-  while (!in.eof())
+  for (;p<end && (unsigned)(*p-'0')<10;++p)
   {
-    //line could not be read, this may have different reasons
-    if (!in.getline(line,1024))
+    hasDigits = true;
+    if (significantDigits < 19)
     {
-      if (in.eof())
-        break;
-      std::cerr<<"Error: Could not read file"<<std::endl;
-      this->clear();
-      return false;
+      mantissa = mantissa*10+(*p-'0');
+      significantDigits += mantissa!=0;
+    }
+    else
+    {
+      ++exponent;
+      exact &= *p=='0';
+    }
+  }
+  if (p<end && *p=='.')
+  {
+    for (++p;p<end && (unsigned)(*p-'0')<10;++p)
+    {
+      hasDigits = true;
+      if (significantDigits < 19)
+      {
+        mantissa = mantissa*10+(*p-'0');
+        significantDigits += mantissa!=0;
+        --exponent;
+      }
+      else
+        exact &= *p=='0';
+    }
+  }
+
+  if (!hasDigits)
+  {
+    //inf and nan are left to strtod
+    if (p<end && (*p=='i' || *p=='I' || *p=='n' || *p=='N'))
+      exact = false;
+    else
+      return 0;
+  }
+  else if (p<end && (*p=='e' || *p=='E'))
+  {
+    const char *q = p+1;
+    bool negativeExponent = false;
+    if (q<end && (*q=='-' || *q=='+'))
+      negativeExponent = *q++=='-';
+    if (q<end && (unsigned)(*q-'0')<10)
+    {
+      int e = 0;
+      for (;q<end && (unsigned)(*q-'0')<10;++q)
+        e = e<100000 ? e*10+(*q-'0') : e;
+      exponent += negativeExponent ? -e : e;
+      p = q;
     }
-    ++lineIndex;
+  }
+
+  if (exact && mantissa <= (1ull<<53) && exponent >= -22 && exponent <= 22)
+  {
+    value = exponent < 0 ? double(mantissa)/powersOf10[-exponent] :
+                           double(mantissa)*powersOf10[exponent];
+    if (negative)
+      value = -value;
+    return p;
+  }
+
+  //slow path on a null terminated copy of the token
+  const char *tokenEnd = start;
+  while (tokenEnd<end && !isBlank(*tokenEnd) && *tokenEnd!='\n')
+    ++tokenEnd;
+  const std::string token(start,tokenEnd);
+  char *parsedEnd = 0;
+  value = strtod(token.c_str(),&parsedEnd);
+  if (parsedEnd == token.c_str())
+    return 0;
+  return start+(parsedEnd-token.c_str());
+}
+
+static inline const char* parseInt(const char *p, const char *end, int &value)
+{
+  bool negative = false;
+  if (p<end && *p=='-')
+  {
+    negative = true;
+    ++p;
+  }
+  if (p==end || (unsigned)(*p-'0')>=10)
+    return 0;
+  //indices beyond INT_MAX are rejected instead of wrapping around
+  int result = 0;
+  for (;p<end && (unsigned)(*p-'0')<10;++p)
+  {
+    const int digit = *p-'0';
+    if (result > (INT_MAX-digit)/10)
+      return 0;
+    result = result*10+digit;
+  }
+  value = negative ? -result : result;
+  return p;
+}
+
+//Parses count blank separated numbers, the remainder of the line is ignored
+static inline const char* parseReals(const char *p, const char *end, int count, Vec3 &v)
+{
+  for (int i=0;i<count;++i)
+  {
+    double value;
+    p = skipBlanks(p,end);
+    if (!(p = parseReal(p,end,value)))
+      return 0;
+    v[i] = real(value);
+  }
+  return p;
+}
+
+//Parses a face corner v, v/t, v//n or v/t/n, missing indices are set to 0
+static inline const char* parseCorner(const char *p, const char *end, Vec3i &corner)
+{
+  corner = Vec3i(0,0,0);
+  if (!(p = parseInt(p,end,corner[0])))
+    return 0;
+  if (p<end && *p=='/')
+  {
+    ++p;
+    if (p<end && *p!='/' && !(p = parseInt(p,end,corner[1])))
+      return 0;
+    if (p<end && *p=='/' && !(p = parseInt(p+1,end,corner[2])))
+      return 0;
+  }
+  return (p==end || isBlank(*p) || *p=='\n') ? p : 0;
+}
 
-    //comment
-    if (line[0]=='#')  continue;
+static inline bool startsWith(const char *p, const char *end, const char *word)
+{
+  for (;*word;++p,++word)
+    if (p==end || *p!=*word)
+      return false;
+  return true;
+}
 
-    //empty line
-    if (line[0]=='\n' || line[0]=='\r') continue;
+void IndexedTriangleIO::parseRecords(const char *begin, const char *end, Records &records)
+{
+  const char *p = begin;
+  while (p<end)
+  {
+    const char *lineEnd = (const char*)memchr(p,'\n',size_t(end-p));
+    if (!lineEnd)
+      lineEnd = end;
+    const size_t lineIndex = ++records.numLines;
+    const char *error = 0;
 
     //vertex position
-    if (line[0]=='v' && line[1]==' ') 
+    if (p[0]=='v' && lineEnd-p>1 && p[1]==' ')
     {
-      if (sscanf(line+2,"%lf %lf %lf\n",&v[0],&v[1],&v[2])!=3)
-      {
-        std::cerr<<"Error: Could not read 'v' line "<<lineIndex<<std::endl;
-        this->clear();
-        return false;
-      }
-      mVertexPositionCache.push_back(v);
+      Vec3 v;
+      if (parseReals(p+2,lineEnd,3,v))
+        records.positions.push_back(v);
+      else
+        error = "Could not read 'v' line";
     }
-    //vertex texture coordinate
-    else if (line[0]=='v' && line[1]=='t')
+    //vertex texture coordinate, a third coordinate is ignored
+    else if (p[0]=='v' && lineEnd-p>1 && p[1]=='t')
     {
-      if (sscanf(line+3,"%lf %lf\n",&t[0],&t[1])!=2)
-      {
-        std::cerr<<"Error: Could not read 'vt' line "<<lineIndex<<std::endl;
-        this->clear();
-        return false;
-      }
-      mVertexTextureCoordinateCache.push_back(t);
+      Vec3 t(0,0,0);
+      if (parseReals(p+2,lineEnd,2,t))
+        records.textureCoordinates.push_back(t);
+      else
+        error = "Could not read 'vt' line";
     }
     //vertex normal
-    else if (line[0]=='v' && line[1]=='n')
+    else if (p[0]=='v' && lineEnd-p>1 && p[1]=='n')
     {
-      if (sscanf(line+3,"%lf %lf %lf\n",&n[0],&n[1],&n[2])!=3)
-      {
-        std::cerr<<"Error: Could not read 'vn' line "<<lineIndex<<std::endl;
-        this->clear();
-        return false;
-      }
-      mVertexNormalCache.push_back(n);
+      Vec3 n;
+      if (parseReals(p+2,lineEnd,3,n))
+        records.normals.push_back(n);
+      else
+        error = "Could not read 'vn' line";
     }
-
-    //(triangle) face
-    else if (line[0]=='f' && line[1]==' ')
+    //face, polygons are split into a triangle fan
+    else if (p[0]=='f' && lineEnd-p>1 && p[1]==' ')
     {
-      // position index
-      if (sscanf(line+2,"%d %d %d\n",&idx_v[0],&idx_v[1],&idx_v[2])==3)
-      {
-        this->insertFlattenedTriangleV(idx_v);
-      }
-      // position and texture coordinate index
-      else if (sscanf(line+2,"%d/%d %d/%d %d/%d\n",&idx_v[0],&idx_t[0],
-        &idx_v[1],&idx_t[1],
-        &idx_v[2],&idx_t[2])==6)
-      {
-        this->insertFlattenedTriangleVT(idx_v,idx_t);
-      }
-      // position and normal index
-      else if (sscanf(line+2,"%d//%d %d//%d %d//%d\n",&idx_v[0],&idx_n[0],
-        &idx_v[1],&idx_n[1],
-        &idx_v[2],&idx_n[2])==6)
-      {
-        this->insertFlattenedTriangleVN(idx_v,idx_n);
-      }
-      // position, texture coordinate and normal index
-      else if (sscanf(line+2,"%d/%d/%d %d/%d/%d %d/%d/%d\n",&idx_v[0],&idx_t[0],&idx_n[0],
-        &idx_v[1],&idx_t[1],&idx_n[1],
-        &idx_v[2],&idx_t[2],&idx_n[2])==9)
+      const int counts[3] = {int(records.positions.size()),
+                             int(records.textureCoordinates.size()),
+                             int(records.normals.size())};
+      Vec3i corners[3];
+      int   relative[3];
+      int numCorners = 0;
+      const size_t firstCorner = records.corners.size();
+      const char *q = skipBlanks(p+2,lineEnd);
+      while (q<lineEnd && *q!='#')
       {
-        this->insertFlattenedTriangleVTN(idx_v,idx_t,idx_n);
+        const int slot = numCorners<3 ? numCorners : 2;
+        Vec3i &corner = corners[slot];
+        if (!(q = parseCorner(q,lineEnd,corner)))
+          break;
+
+        //relative indices count back from the last record read so far
+        relative[slot] = 0;
+        for (int i=0;i<3;++i)
+          if (corner[i] < 0)
+          {
+            corner[i] += counts[i]+1;
+            relative[slot] |= 1<<i;
+          }
+
+        if (++numCorners >= 3)
+        {
+          for (int i=0;i<3;++i)
+          {
+            if (relative[i])
+              records.relativeCorners.push_back(std::make_pair(records.corners.size(),relative[i]));
+            records.corners.push_back(corners[i]);
+          }
+          corners[1] = corners[2];
+          relative[1] = relative[2];
+        }
+        q = skipBlanks(q,lineEnd);
       }
-      //quads and other n-gons are not supported
+      if (!q || numCorners < 3)
+        error = "face format invalid in line";
       else
-      {
-        std::cerr<<"Error: face format invalid in line "<<lineIndex<<std::endl;
-        this->clear();
-        return false;
-      }
+        records.faceLines.push_back(std::make_pair(firstCorner,lineIndex));
+    }
+    //comment or empty line
+    else if (p[0]=='#' || skipBlanks(p,lineEnd)==lineEnd)
+    {
     }
-    else if(line[0]=='s') //smoothing group
-      features.hasSmoothingGroup=true;
-    else if(line[0]=='g')
-      features.hasGroup=true;
-    else if(line[0]=='l')
-      features.hasLine=true;
-    else if(strstr(line,"usemtl")!=0 || strstr(line,"mtllib")!=0)
-      features.hasMaterial=true;
+    else if (p[0]=='s') //smoothing group
+      records.features.hasSmoothingGroup=true;
+    else if (p[0]=='g')
+      records.features.hasGroup=true;
+    else if (p[0]=='l')
+      records.features.hasLine=true;
+    else if (startsWith(p,lineEnd,"usemtl") || startsWith(p,lineEnd,"mtllib"))
+      records.features.hasMaterial=true;
     else
+      records.unknownLines.push_back(lineIndex);
+
+    if (error)
+    {
+      records.error = error;
+      records.errorLine = lineIndex;
+      return;
+    }
+    p = lineEnd+1;
+  }
+}
+
+//Runs task(0) ... task(n-1), task(0) on the calling thread
+template<class Task>
+static void runParallel(size_t n, Task task)
+{
+  std::vector<std::future<void> > futures;
+  for (size_t i=1;i<n;++i)
+    futures.push_back(std::async(std::launch::async,task,i));
+  if (n > 0)
+    task(0);
+  for (size_t i=0;i<futures.size();++i)
+    futures[i].get();
+}
+
+bool IndexedTriangleIO::loadFromOBJ(const std::string &filePath)
+{
+  MappedFile file;
+
+  //could not open file, reject
+  if(!file.open(filePath))
+  {
+    std::cerr<<"Error: Could not open file "<<filePath<<std::endl;
+    return false;
+  }
+
+  this->clear();
+
+  //split the file into chunks of complete lines, small files are parsed
+  //by the calling thread only
+  const size_t minChunkSize = size_t(1)<<20;
+  const size_t numThreads = mNumThreads > 0 ? mNumThreads :
+    std::max(size_t(std::thread::hardware_concurrency()),size_t(1));
+  const size_t numChunks = std::max(std::min(numThreads,file.size()/minChunkSize),size_t(1));
+
+  const char *begin = file.data(), *end = file.data()+file.size();
+  std::vector<const char*> chunkBegin(numChunks+1,end);
+  chunkBegin[0] = begin;
+  for (size_t i=1;i<numChunks;++i)
+  {
+    const char *p = std::max(begin+file.size()*i/numChunks,chunkBegin[i-1]);
+    const char *lineEnd = p<end ? (const char*)memchr(p,'\n',size_t(end-p)) : 0;
+    chunkBegin[i] = lineEnd ? lineEnd+1 : end;
+  }
+
+  std::vector<Records> chunks(numChunks);
+  runParallel(numChunks,[&](size_t i)
+  {
+    parseRecords(chunkBegin[i],chunkBegin[i+1],chunks[i]);
+  });
+
+  //report in file order, stop at the first chunk with an error
+  UnsupportedFeatures features;
+  size_t firstLine = 0;
+  Vec3i totals(0,0,0);
+  std::vector<Vec3i> offsets(numChunks);
+  std::vector<size_t> firstLines(numChunks);
+  for (size_t i=0;i<numChunks;++i)
+  {
+    const Records &records = chunks[i];
+    firstLines[i] = firstLine;
+    for (size_t j=0;j<records.unknownLines.size();++j)
+      std::cerr<<"Warning: unknown data in line "<<firstLine+records.unknownLines[j]<<std::endl;
+
+    if (records.error)
     {
-      std::cerr<<"Warning: unknown data in line "<<lineIndex<<std::endl;
+      std::cerr<<"Error: "<<records.error<<" "<<firstLine+records.errorLine<<std::endl;
+      this->clear();
+      return false;
+    }
+
+    features.hasLine           |= records.features.hasLine;
+    features.hasGroup          |= records.features.hasGroup;
+    features.hasSmoothingGroup |= records.features.hasSmoothingGroup;
+    features.hasMaterial       |= records.features.hasMaterial;
+    firstLine += records.numLines;
+
+    offsets[i] = totals;
+    totals += Vec3i(int(records.positions.size()),int(records.textureCoordinates.size()),
+                    int(records.normals.size()));
+  }
+
+  //global indices and merging of equal corners within each chunk
+  runParallel(numChunks,[&](size_t i)
+  {
+    flattenChunk(chunks[i],offsets[i],totals);
+  });
+  for (size_t i=0;i<numChunks;++i)
+  {
+    if (chunks[i].error)
+    {
+      std::cerr<<"Error: "<<chunks[i].error<<" "<<firstLines[i]+chunks[i].errorLine<<std::endl;
+      this->clear();
+      return false;
     }
   }
 
+  this->insertFlattenedRecords(chunks);
+
   if(features.hasGroup || features.hasLine || features.hasMaterial || features.hasSmoothingGroup)
     std::cerr<<"Warning: obj file contains unsupported data."<<std::endl;
 
@@ -149,9 +412,150 @@ bool IndexedTriangleIO::loadFromOBJ(const std::string &filePath)
   return true;
 }
 
-bool IndexedTriangleIO::saveToOBJ(const std::string &filePath,bool textureCoordinates,bool normals) const
+void IndexedTriangleIO::moveDataTo(std::vector<Vec3> &vertexPositions,
+                                   std::vector<Vec3> &vertexTextureCoordinates,
+                                   std::vector<Vec3> &vertexNormals,
+                                   std::vector<int> &triangleIndices)
+{
+  vertexPositions.swap(mVertexPosition);
+  vertexTextureCoordinates.swap(mVertexTextureCoordinate);
+  vertexNormals.swap(mVertexNormal);
+  triangleIndices.swap(mIndices);
+  this->clear();
+}
+
+//Fast number formatting for the OBJ writer. The output is the same as the
+//one of the default formatted std::ostream output used before.
+
+//Writes a non negative integer, returns the position after the last digit
+static inline char* formatUnsigned(unsigned long long value, char *out)
+{
+  char digits[20];
+  int n = 0;
+  do
+  {
+    digits[n++] = char('0'+value%10);
+    value /= 10;
+  } while (value);
+  while (n)
+    *out++ = digits[--n];
+  return out;
+}
+
+//Formats like printf("%g"), i.e. six significant digits without trailing
+//zeros. Values that need an exponent and rounding ties, where the exact
+//decimal expansion of the double decides, are left to snprintf.
+static char* formatReal(double value, char *out)
+{
+  static const double pow10[10] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9};
+
+  const double a = std::fabs(value);
+  if (a == 0)
+  {
+    if (std::signbit(value))
+      *out++ = '-';
+    *out++ = '0';
+    return out;
+  }
+  if (!(a >= 1e-4 && a < 999999.5))
+    return out+snprintf(out,32,"%g",value);
+
+  //decimal exponent e of the leading digit, a*10^(5-e) then has six
+  //integer digits and is computed with a single rounding
+  int e = 5;
+  while (e > -4 && a < pow10[e+4]*1e-4)
+    --e;
+  double scaled = a*pow10[5-e];
+  double integral = std::floor(scaled);
+  if (std::fabs(scaled-integral-0.5) < 1e-6)
+    return out+snprintf(out,32,"%g",value);
+  unsigned long long digits = (unsigned long long)integral + (scaled-integral > 0.5 ? 1 : 0);
+  if (digits >= 1000000)
+  {
+    //rounded up to the next power of ten
+    digits /= 10;
+    ++e;
+  }
+
+  if (value < 0)
+    *out++ = '-';
+  if (e < 0)
+  {
+    *out++ = '0';
+    *out++ = '.';
+    for (int i=-1;i>e;--i)
+      *out++ = '0';
+  }
+
+  //six digits with the decimal point after digit e, without trailing zeros
+  char text[6];
+  formatUnsigned(digits,text);
+  int numDigits = 6;
+  while (numDigits > std::max(e+1,1) && text[numDigits-1] == '0')
+    --numDigits;
+  for (int i=0;i<numDigits;++i)
+  {
+    if (e >= 0 && i == e+1)
+      *out++ = '.';
+    *out++ = text[i];
+  }
+  return out;
+}
+
+//Collects formatted text and writes it to the file in large blocks
+class BufferedWriter
+{
+public:
+  explicit BufferedWriter(std::ostream &out) : mOut(out), mBuffer(1<<20), mSize(0), mWritten(0) {}
+
+  //room for at least one line
+  char* reserve()
+  {
+    if (mSize+kMaxLineLength > mBuffer.size())
+      this->flush();
+    return &mBuffer[mSize];
+  }
+  void commit(char *end) { mSize = size_t(end-&mBuffer[0]); }
+
+  void flush()
+  {
+    mOut.write(&mBuffer[0],std::streamsize(mSize));
+    mWritten += mSize;
+    mSize = 0;
+  }
+  size_t bytesWritten() const { return mWritten; }
+
+  static const size_t kMaxLineLength = 256;
+
+private:
+  std::ostream     &mOut;
+  std::vector<char> mBuffer;
+  size_t            mSize;
+  size_t            mWritten;
+};
+
+static void writeVectors(BufferedWriter &writer, const char *prefix, const std::vector<Vec3> &vectors)
+{
+  const size_t prefixLength = strlen(prefix);
+  for (size_t i=0;i<vectors.size();++i)
+  {
+    char *p = writer.reserve();
+    memcpy(p,prefix,prefixLength);
+    p += prefixLength;
+    for (int j=0;j<3;++j)
+    {
+      *p++ = ' ';
+      p = formatReal(vectors[i][j],p);
+    }
+    *p++ = '\n';
+    writer.commit(p);
+  }
+}
+
+bool IndexedTriangleIO::saveToOBJ(const std::string &filePath,bool textureCoordinates,bool normals,
+                                  WriteStatistics *statistics) const
 {
-  std::fstream out(filePath, std::ios::binary | std::ios::out);
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
   if (mVertexPosition.empty() || mIndices.empty())
   {
@@ -163,132 +567,234 @@ bool IndexedTriangleIO::saveToOBJ(const std::string &filePath,bool textureCoordi
     std::cerr<<"Warning: Mesh does not contain vertex texture coordinates"<<std::endl;
     textureCoordinates=false;
   }
-  if (textureCoordinates && mVertexNormal.empty())
+  if (normals && mVertexNormal.empty())
   {
     std::cerr<<"Warning: Mesh does not contain vertex normals"<<std::endl;
     normals=false;
   }
+  if (mIndices.size() % 3 !=0)
+  {
+    std::cerr<<"Error: Number of position indices not divisible by 3"<<std::endl;
+    return false;
+  }
 
+  std::ofstream out(filePath.c_str(), std::ios::binary | std::ios::out | std::ios::trunc);
   if (!out.is_open())
   {
     std::cerr<<"Error: Could not write file "<<filePath<<std::endl;
     return false;
   }
 
-  out<<"# IndexedTriangleIO exporter"<<std::endl;
-  out<<"# exporting:"<<std::endl;
-  out<<"# "<<mVertexPosition.size()<<" vertex positions"<<std::endl;
+  BufferedWriter writer(out);
+  char *p = writer.reserve();
+  p += sprintf(p,"# IndexedTriangleIO exporter\n# exporting:\n# %lu vertex positions\n",
+               (unsigned long)mVertexPosition.size());
   if (textureCoordinates)
-    out<<"# "<<mVertexTextureCoordinate.size()<<" texture coordinates"<<std::endl;
+    p += sprintf(p,"# %lu texture coordinates\n",(unsigned long)mVertexTextureCoordinate.size());
   if (normals)
-    out<<"# "<<mVertexNormal.size()<<" normals"<<std::endl;
-  out<<"# "<<mIndices.size()/3<<" triangles"<<std::endl;
-  out<<std::endl;
+    p += sprintf(p,"# %lu normals\n",(unsigned long)mVertexNormal.size());
+  p += sprintf(p,"# %lu triangles\n\n",(unsigned long)(mIndices.size()/3));
+  writer.commit(p);
 
-  Vec3 v;
-  Vec3i idx_v,idx_t,idx_n;
-
-  //vertex positions
-  for (size_t i=0;i<mVertexPosition.size();++i)
-  {
-    v = mVertexPosition[i];
-    out<<"v "<<v[0]<<" "<<v[1]<<" "<<v[2]<<std::endl;
-  }
-  out<<std::endl;
-  //texture Coordinates
+  //vertex positions, texture coordinates and normals, each followed by a blank line
+  writeVectors(writer,"v",mVertexPosition);
+  p = writer.reserve(); *p++ = '\n'; writer.commit(p);
   if (textureCoordinates)
-  {
-    for (size_t i=0;i<mVertexTextureCoordinate.size();++i)
-    {
-      v = mVertexTextureCoordinate[i];
-      out<<"vt "<<v[0]<<" "<<v[1]<<" "<<v[2]<<std::endl;
-    }
-  }
-  out<<std::endl;
-  //normals
+    writeVectors(writer,"vt",mVertexTextureCoordinate);
+  p = writer.reserve(); *p++ = '\n'; writer.commit(p);
   if (normals)
+    writeVectors(writer,"vn",mVertexNormal);
+  p = writer.reserve(); *p++ = '\n'; writer.commit(p);
+
+  //triangles, texture coordinates and normals share the position index
+  const char *separator = normals && textureCoordinates ? "/" : normals ? "//" : "/";
+  const int   numIndices = normals && textureCoordinates ? 3 : normals || textureCoordinates ? 2 : 1;
+  const size_t separatorLength = strlen(separator);
+  for (size_t i=0;i<mIndices.size();i+=3)
   {
-    for (size_t i=0;i<mVertexNormal.size();++i)
+    p = writer.reserve();
+    *p++ = 'f';
+    for (int j=0;j<3;++j)
     {
-      v = mVertexNormal[i];
-      out<<"vn "<<v[0]<<" "<<v[1]<<" "<<v[2]<<std::endl;
+      const unsigned long long index = (unsigned long long)(mIndices[i+j]+1);
+      *p++ = ' ';
+      p = formatUnsigned(index,p);
+      for (int k=1;k<numIndices;++k)
+      {
+        memcpy(p,separator,separatorLength);
+        p = formatUnsigned(index,p+separatorLength);
+      }
     }
+    *p++ = '\n';
+    writer.commit(p);
   }
-  out<<std::endl;
 
-  //triangles
-  if (mIndices.size() % 3 !=0)
+  writer.flush();
+  out.close();
+  if (!out)
   {
-    std::cerr<<"Error: Number of position indices not divisible by 3"<<std::endl;
+    std::cerr<<"Error: Could not write file "<<filePath<<std::endl;
     return false;
   }
-  if (normals && textureCoordinates)
-    for (size_t i=0;i<mIndices.size();i+=3)
-      out<<"f "<<mIndices[i+0]+1<<"/"<<mIndices[i+0]+1<<"/"<<mIndices[i+0]+1<<" "<<
-      mIndices[i+1]+1<<"/"<<mIndices[i+1]+1<<"/"<<mIndices[i+1]+1<<" "<<
-      mIndices[i+2]+1<<"/"<<mIndices[i+2]+1<<"/"<<mIndices[i+2]+1<<std::endl;
-  else if (textureCoordinates)
-    for (size_t i=0;i<mIndices.size();i+=3)
-      out<<"f "<<mIndices[i+0]+1<<"/"<<mIndices[i+0]+1<<" "<<
-      mIndices[i+1]+1<<"/"<<mIndices[i+1]+1<<" "<<
-      mIndices[i+2]+1<<"/"<<mIndices[i+2]+1<<std::endl;
-  else if (normals)
-    for (size_t i=0;i<mIndices.size();i+=3)
-      out<<"f "<<mIndices[i+0]+1<<"//"<<mIndices[i+0]+1<<" "<<
-      mIndices[i+1]+1<<"//"<<mIndices[i+1]+1<<" "<<
-      mIndices[i+2]+1<<"//"<<mIndices[i+2]+1<<std::endl;
-  else
-    for (size_t i=0;i<mIndices.size();i+=3)
-      out<<"f "<<mIndices[i+0]+1<<" "<<mIndices[i+1]+1<<" "<<mIndices[i+2]+1<<std::endl;
 
+  if (statistics)
+  {
+    statistics->bytes   = writer.bytesWritten();
+    statistics->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+  }
   return true;
 }
 
-void IndexedTriangleIO::insertFlattenedTriangleV(const Vec3i &v)
+void IndexedTriangleIO::flattenChunk(Records &records, const Vec3i &offsets, const Vec3i &totals)
 {
-  for (int i = 0; i < 3;++i)
-    mIndices.push_back(insertFlattenedVertexVTN(v[i],-1,-1));
+  for (size_t i=0;i<records.relativeCorners.size();++i)
+  {
+    Vec3i &corner = records.corners[records.relativeCorners[i].first];
+    for (int j=0;j<3;++j)
+      if (records.relativeCorners[i].second & (1<<j))
+        corner[j] += offsets[j];
+  }
+
+  VertexIndexMap corners;
+  corners.reserve(records.corners.size()/2);
+  records.cornerVertices.resize(records.corners.size());
+
+  for (size_t i=0;i<records.corners.size();++i)
+  {
+    //positions are required, texture coordinates and normals optional
+    const Vec3i &corner = records.corners[i];
+    if (corner[0] < 1 || corner[0] > totals[0] ||
+        corner[1] < 0 || corner[1] > totals[1] ||
+        corner[2] < 0 || corner[2] > totals[2])
+    {
+      //the face line of the corner is the last one starting at or before it
+      const std::vector<std::pair<size_t,size_t> >::const_iterator face =
+        std::upper_bound(records.faceLines.begin(),records.faceLines.end(),
+                         std::make_pair(i,~size_t(0)))-1;
+      records.error = "face index out of range in line";
+      records.errorLine = face->second;
+      return;
+    }
+
+    const int index = corners.insert(corner,int(records.uniqueCorners.size()));
+    if (index == int(records.uniqueCorners.size()))
+      records.uniqueCorners.push_back(corner);
+    records.cornerVertices[i] = index;
+  }
 }
-void IndexedTriangleIO::insertFlattenedTriangleVT(const Vec3i &v, const Vec3i &t)
+
+void IndexedTriangleIO::insertFlattenedRecords(std::vector<Records> &chunks)
 {
-  for (int i = 0; i < 3;++i)
-    mIndices.push_back(insertFlattenedVertexVTN(v[i],t[i],-1));
+  //all records of the file, the first chunk is taken over
+  Records &all = chunks[0];
+  for (size_t i=1;i<chunks.size();++i)
+  {
+    all.positions.insert(all.positions.end(),chunks[i].positions.begin(),chunks[i].positions.end());
+    all.textureCoordinates.insert(all.textureCoordinates.end(),
+      chunks[i].textureCoordinates.begin(),chunks[i].textureCoordinates.end());
+    all.normals.insert(all.normals.end(),chunks[i].normals.begin(),chunks[i].normals.end());
+  }
+
+  //assign vertices in the order of their first use in the file
+  size_t numUniqueCorners = 0;
+  for (size_t i=0;i<chunks.size();++i)
+    numUniqueCorners += chunks[i].uniqueCorners.size();
+  mIndicesCache.reserve(numUniqueCorners);
+
+  std::vector<std::vector<int> > vertices(chunks.size());
+  for (size_t i=0;i<chunks.size();++i)
+  {
+    const std::vector<Vec3i> &uniqueCorners = chunks[i].uniqueCorners;
+    vertices[i].resize(uniqueCorners.size());
+    for (size_t j=0;j<uniqueCorners.size();++j)
+    {
+      const Vec3i &corner = uniqueCorners[j];
+      const int index = mIndicesCache.insert(corner,int(mVertexPosition.size()));
+
+      //vertex does not exist
+      if (index == int(mVertexPosition.size()))
+      {
+        mVertexPosition.push_back(all.positions[corner[0]-1]);
+
+        // copy / duplicate texcoords and normals if appropriate
+        if (corner[1] > 0)
+          mVertexTextureCoordinate.push_back(all.textureCoordinates[corner[1]-1]);
+        if (corner[2] > 0)
+          mVertexNormal.push_back(all.normals[corner[2]-1]);
+      }
+      vertices[i][j] = index;
+    }
+  }
+
+  std::vector<size_t> firstCorner(chunks.size()+1,0);
+  for (size_t i=0;i<chunks.size();++i)
+    firstCorner[i+1] = firstCorner[i]+chunks[i].cornerVertices.size();
+  mIndices.resize(firstCorner.back());
+
+  runParallel(chunks.size(),[&](size_t i)
+  {
+    const std::vector<int> &cornerVertices = chunks[i].cornerVertices;
+    for (size_t j=0;j<cornerVertices.size();++j)
+      mIndices[firstCorner[i]+j] = vertices[i][cornerVertices[j]];
+  });
 }
-void IndexedTriangleIO::insertFlattenedTriangleVN(const Vec3i &v, const Vec3i &n)
+
+void IndexedTriangleIO::clearCaches()
 {
-  for (int i = 0; i < 3;++i)
-    mIndices.push_back(insertFlattenedVertexVTN(v[i],-1,n[i]));
+  mIndicesCache.clear();
 }
-void IndexedTriangleIO::insertFlattenedTriangleVTN(const Vec3i &v, const Vec3i &t, const Vec3i &n)
+
+void IndexedTriangleIO::VertexIndexMap::clear()
 {
-  for (int i = 0; i < 3;++i)
-    mIndices.push_back(insertFlattenedVertexVTN(v[i],t[i],n[i]));
+  std::vector<Slot>().swap(mSlots);
+  mSize = 0;
 }
 
-int IndexedTriangleIO::insertFlattenedVertexVTN(const int v, const int t, const  int n)
+void IndexedTriangleIO::VertexIndexMap::reserve(size_t size)
 {
-  Vec3i idx(v,t,n);
-  std::map<Vec3i,size_t>::iterator it = mIndicesCache.find(idx);
+  //keep the load factor below 1/2
+  size_t capacity = 16;
+  while (capacity < 2*size)
+    capacity *= 2;
+  if (capacity <= mSlots.size())
+    return;
 
-  //vertex does not exist
-  if(it==mIndicesCache.end())
-  {
-    it = (mIndicesCache.insert(std::make_pair(idx,mVertexPosition.size()))).first;
-    mVertexPosition.push_back(mVertexPositionCache[v-1]);
+  std::vector<Slot> slots(capacity);
+  for (size_t i=0;i<capacity;++i)
+    slots[i].index = -1;
+  slots.swap(mSlots);
 
-    // copy / duplicate texcoords and normals if appropriate
-    if(t >= 0)
-      mVertexTextureCoordinate.push_back(mVertexTextureCoordinateCache[t-1]);
-    if(n >= 0)
-      mVertexNormal.push_back(mVertexNormalCache[n-1]);
-  }
-  return it->second;
+  mSize = 0;
+  for (size_t i=0;i<slots.size();++i)
+    if (slots[i].index >= 0)
+      this->insert(Vec3i(slots[i].key[0],slots[i].key[1],slots[i].key[2]),slots[i].index);
 }
-void IndexedTriangleIO::clearCaches()
+
+int IndexedTriangleIO::VertexIndexMap::insert(const Vec3i &key, int newIndex)
 {
-  std::vector<Vec3>().swap(mVertexPositionCache);
-  std::vector<Vec3>().swap(mVertexTextureCoordinateCache);
-  std::vector<Vec3>().swap(mVertexNormalCache);
-  std::map<Vec3i,size_t,CompareVec3i>().swap(mIndicesCache);
+  if (2*(mSize+1) > mSlots.size())
+    this->reserve(mSlots.size());
+
+  unsigned int hash = unsigned(key[0])*0x9E3779B1u ^ unsigned(key[1])*0x85EBCA77u ^ unsigned(key[2])*0xC2B2AE3Du;
+  hash ^= hash >> 15;
+
+  //linear probing
+  const size_t mask = mSlots.size()-1;
+  for (size_t i=hash & mask;;i=(i+1) & mask)
+  {
+    Slot &slot = mSlots[i];
+    if (slot.index < 0)
+    {
+      slot.key[0] = key[0];
+      slot.key[1] = key[1];
+      slot.key[2] = key[2];
+      slot.index = newIndex;
+      ++mSize;
+      return newIndex;
+    }
+    if (slot.key[0]==key[0] && slot.key[1]==key[1] && slot.key[2]==key[2])
+      return slot.index;
+  }
 }
+
 } //namespace rt
\ No newline at end of file
@@ -2,8 +2,9 @@
 #define _INDEXEDTRIANGLEIO_INCLUDE_ONCE
 
 #include "Math.hpp"
-#include <map>
+#include "WriteStatistics.hpp"
 #include <vector>
+#include <string>
 
 namespace rt
 {
@@ -11,9 +12,24 @@ namespace rt
 class IndexedTriangleIO
 {
 public:
+  IndexedTriangleIO() : mNumThreads(0) {}
+
   void clear();
+
+  /// Loads a triangle mesh from a Wavefront OBJ file. The file is memory
+  /// mapped and parsed in place, corners referring to the same position,
+  /// texture coordinate and normal are merged into one vertex. Large files
+  /// are split into chunks at line ends which are parsed in parallel.
   bool loadFromOBJ(const std::string &filePath);
-  bool saveToOBJ(const std::string &filePath, bool textureCoordinates=true, bool normals=true) const;
+
+  /// Number of threads used by loadFromOBJ, 0 (default) uses all hardware threads.
+  void setNumThreads(size_t numThreads) { mNumThreads=numThreads; }
+
+  /// Writes the mesh as Wavefront OBJ file. The text is formatted into a
+  /// large buffer which is written in blocks, statistics receives the file
+  /// size and the time taken if given.
+  bool saveToOBJ(const std::string &filePath, bool textureCoordinates=true, bool normals=true,
+                 WriteStatistics *statistics=0) const;
 
   const std::vector<Vec3>& vertexPositions()          const {return mVertexPosition;}
   const std::vector<Vec3>& vertexTextureCoordinates() const {return mVertexTextureCoordinate;}
@@ -25,6 +41,11 @@ public:
   void setVertexNormals(const std::vector<Vec3>& v) {mVertexNormal=std::vector<Vec3>(v);}
   void setTriangleIndices(const std::vector<int>& v) {mIndices=std::vector<int>(v);}
 
+  /// Moves the mesh data into the given containers without copying, this
+  /// object is empty afterwards.
+  void moveDataTo(std::vector<Vec3> &vertexPositions, std::vector<Vec3> &vertexTextureCoordinates,
+                  std::vector<Vec3> &vertexNormals, std::vector<int> &triangleIndices);
+
 private:
 
   // Container for printing warnings on Wavefront OBJ format specs
@@ -43,25 +64,59 @@ private:
     bool hasMaterial;
   };
   
-  // Vertex flattening or duplication needs strict weak ordering
-  struct CompareVec3i
+  // Records of an OBJ file (or a chunk of it) in file order, before the
+  // vertices are flattened. Face corners are (position, texture coordinate,
+  // normal) index triples with 1 based indices, 0 marks a missing index.
+  // Relative (negative) indices are resolved within the chunk, the corners
+  // and components (bit mask) still missing the offset of the preceding
+  // chunks are listed in relativeCorners.
+  struct Records
+  {
+    Records() : numLines(0), errorLine(0), error(0) {}
+
+    std::vector<Vec3>   positions;
+    std::vector<Vec3>   textureCoordinates;
+    std::vector<Vec3>   normals;
+    std::vector<Vec3i>  corners;
+    std::vector<std::pair<size_t,int> > relativeCorners;
+    std::vector<std::pair<size_t,size_t> > faceLines; //first corner and line of each face
+    std::vector<size_t> unknownLines;
+    UnsupportedFeatures features;
+    size_t              numLines;
+    size_t              errorLine; //line of the first error, counted from 1
+    const char         *error;     //0 if the records were parsed successfully
+
+    // distinct corners of the chunk in order of first use and the index
+    // into this list for each corner, see flattenChunk
+    std::vector<Vec3i>  uniqueCorners;
+    std::vector<int>    cornerVertices;
+  };
+
+  // Vertex flattening or duplication: open addressing hash map from index
+  // triples to the index of the flattened vertex
+  class VertexIndexMap
   {
-    bool operator()(const Vec3i& lhs, const Vec3i& rhs) const
+  public:
+    VertexIndexMap() : mSize(0) {}
+    void clear();
+    void reserve(size_t size);
+
+    // Returns the vertex of key. New keys are inserted with vertex newIndex.
+    int insert(const Vec3i &key, int newIndex);
+
+  private:
+    struct Slot
     {
-      for (int i=0;i<3;++i)
-      {
-        if (lhs[i] < rhs[i]) return true;
-        if (lhs[i] > rhs[i]) return false;
-      }
-      return false;
-    }
+      int key[3];
+      int index; //-1 for empty slots
+    };
+    std::vector<Slot> mSlots;
+    size_t            mSize;
   };
 
-  void insertFlattenedTriangleV  (const Vec3i &v);
-  void insertFlattenedTriangleVT (const Vec3i &v,const Vec3i &t);
-  void insertFlattenedTriangleVN (const Vec3i &v,const Vec3i &n);
-  void insertFlattenedTriangleVTN(const Vec3i &v,const Vec3i &t,const Vec3i &n);
-  int insertFlattenedVertexVTN(const int v, const int t, const  int n);
+  static void parseRecords(const char *begin, const char *end, Records &records);
+  static void flattenChunk(Records &records, const Vec3i &offsets, const Vec3i &totals);
+  void insertFlattenedRecords(std::vector<Records> &chunks);
   void clearCaches();
 
   std::vector<Vec3>                   mVertexPosition;
@@ -69,10 +124,8 @@ private:
   std::vector<Vec3>                   mVertexNormal;
   std::vector<int>                    mIndices;
 
-  std::vector<Vec3>                   mVertexPositionCache;
-  std::vector<Vec3>                   mVertexTextureCoordinateCache;
-  std::vector<Vec3>                   mVertexNormalCache;
-  std::map<Vec3i,size_t,CompareVec3i> mIndicesCache;
+  VertexIndexMap                      mIndicesCache;
+  size_t                              mNumThreads;
 };
 
 } //namespace rt
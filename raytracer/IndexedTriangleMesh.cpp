@@ -1,15 +1,19 @@
 #include "IndexedTriangleMesh.hpp"
 #include "IndexedTriangleIO.hpp"
 #include "Intersection.hpp"
+#include <iostream>
 
 namespace rt
 {
 
 
-std::shared_ptr<RayIntersection>  IndexedTriangleMesh::closestIntersectionModel(const Ray &ray,
-  real maxLambda) const
+bool IndexedTriangleMesh::closestIntersectionModel(const Ray &ray, real maxLambda,
+                                                   HitRecord &hit) const
 {
 
+  const ArrayRef<int>  indices   = this->triangleIndices();
+  const ArrayRef<Vec3> positions = this->vertexPositions();
+
   real closestLambda = maxLambda;
   Vec3 closestbary;
   int  closestTri = -1;
@@ -19,58 +23,103 @@ std::shared_ptr<RayIntersection>  IndexedTriangleMesh::closestIntersectionModel(
 
   // Loop over all stored triangles to find a possible intersection between ray 
   // and any triangle
-  for (size_t i=0;i<mIndices.size();i+=3)
+  for (size_t i=0;i<indices.size();i+=3)
   {
-    const int i0 = mIndices[i+0];
-    const int i1 = mIndices[i+1];
-    const int i2 = mIndices[i+2];
-    if (Intersection::lineTriangle(ray,mVertexPosition[i0],mVertexPosition[i1],mVertexPosition[i2],bary,lambda) &&
+    const int i0 = indices[i+0];
+    const int i1 = indices[i+1];
+    const int i2 = indices[i+2];
+    if (Intersection::lineTriangle(ray,positions[i0],positions[i1],positions[i2],bary,lambda) &&
       lambda > 0 && lambda < closestLambda)
     {
       closestLambda = lambda;
       closestbary = bary;
-      closestTri = (int)i;
+      closestTri = (int)(i/3);
     }
   }
 
-  // If an intersection occurred, compute the normal and the uv coordinates based
-  // on the barycentric coordinates of the hit point
-  if (closestTri >= 0)
+  if (closestTri < 0)
+    return false;
+
+  hit.lambda    = closestLambda;
+  hit.primitive = closestTri;
+  hit.bary      = closestbary;
+  return true;
+}
+
+void IndexedTriangleMesh::surfaceModel(const Ray &ray, const HitRecord &hit,
+                                       Vec3 &normal, Vec3 &uvw) const
+{
+  // compute the normal and the uv coordinates based on the barycentric
+  // coordinates of the hit point
+  const ArrayRef<int>  indices            = this->triangleIndices();
+  const ArrayRef<Vec3> positions          = this->vertexPositions();
+  const ArrayRef<Vec3> normals            = this->vertexNormals();
+  const ArrayRef<Vec3> textureCoordinates = this->vertexTextureCoordinates();
+
+  const int i0 = indices[3*hit.primitive+0];
+  const int i1 = indices[3*hit.primitive+1];
+  const int i2 = indices[3*hit.primitive+2];
+  const Vec3 &bary = hit.bary;
+
+  if(normals.empty())
+    normal = util::cross(positions[i1]-positions[i0],positions[i2]-positions[i0]).normalized();
+  else
+    normal = (normals[i0]*bary[0]+
+              normals[i1]*bary[1]+
+              normals[i2]*bary[2]).normalized();
+
+  uvw = Vec3(0,0,0);
+  if(!textureCoordinates.empty())
+    uvw = (textureCoordinates[i0]*bary[0]+
+           textureCoordinates[i1]*bary[1]+
+           textureCoordinates[i2]*bary[2]);
+}
+
+void IndexedTriangleMesh::surfaceDifferentialModel(const Ray &/*ray*/, const HitRecord &hit,
+                                                   const Vec3 &dP, Vec3 &dNormal,
+                                                   Vec3 &dUVW) const
+{
+  const ArrayRef<int>  indices            = this->triangleIndices();
+  const ArrayRef<Vec3> positions          = this->vertexPositions();
+  const ArrayRef<Vec3> normals            = this->vertexNormals();
+  const ArrayRef<Vec3> textureCoordinates = this->vertexTextureCoordinates();
+
+  const int i0 = indices[3*hit.primitive+0];
+  const int i1 = indices[3*hit.primitive+1];
+  const int i2 = indices[3*hit.primitive+2];
+  const Vec3 &bary = hit.bary;
+  const Vec3 dBary = Intersection::barycentricDifferential(positions[i0],positions[i1],positions[i2],dP);
+
+  dNormal = Vec3(0,0,0);
+  if(!normals.empty())
   {
-    const int i0 = mIndices[closestTri+0];
-    const int i1 = mIndices[closestTri+1];
-    const int i2 = mIndices[closestTri+2];
-
-    Vec3 n;
-    if(mVertexNormal.empty())
-      n = util::cross(mVertexPosition[i1]-mVertexPosition[i0],mVertexPosition[i2]-mVertexPosition[i0]).normalized();
-    else
-      n = (mVertexNormal[i0]*closestbary[0]+
-           mVertexNormal[i1]*closestbary[1]+
-           mVertexNormal[i2]*closestbary[2]).normalized();
-
-    Vec3 uvw(0,0,0);
-    if(!mVertexTextureCoordinate.empty())
-      uvw = (mVertexTextureCoordinate[i0]*closestbary[0]+
-             mVertexTextureCoordinate[i1]*closestbary[1]+
-             mVertexTextureCoordinate[i2]*closestbary[2]);
-    return std::make_shared<IndexedTriangleMeshRayIntersection>(ray, closestLambda,
-      shared_from_this(),n,uvw);
+    // derivative of the normalized interpolated normal
+    const Vec3 n  = normals[i0]*bary[0]+normals[i1]*bary[1]+normals[i2]*bary[2];
+    const Vec3 dn = normals[i0]*dBary[0]+normals[i1]*dBary[1]+normals[i2]*dBary[2];
+    const Vec3 normal = n.normalized();
+    dNormal = (dn - normal*(normal|dn))/n.norm();
   }
 
-  return nullptr;
+  dUVW = Vec3(0,0,0);
+  if(!textureCoordinates.empty())
+    dUVW = (textureCoordinates[i0]*dBary[0]+
+            textureCoordinates[i1]*dBary[1]+
+            textureCoordinates[i2]*dBary[2]);
 }
 
 bool IndexedTriangleMesh::anyIntersectionModel(const Ray &ray, real maxLambda) const
 {
+  const ArrayRef<int>  indices   = this->triangleIndices();
+  const ArrayRef<Vec3> positions = this->vertexPositions();
+
   Vec3 uvw;
   real lambda;
-  for (size_t i=0;i<mIndices.size();i+=3)
+  for (size_t i=0;i<indices.size();i+=3)
   {
-    const int i0 = mIndices[i+0];
-    const int i1 = mIndices[i+1];
-    const int i2 = mIndices[i+2];
-    if (Intersection::lineTriangle(ray,mVertexPosition[i0],mVertexPosition[i1],mVertexPosition[i2],uvw,lambda) &&
+    const int i0 = indices[i+0];
+    const int i1 = indices[i+1];
+    const int i2 = indices[i+2];
+    if (Intersection::lineTriangle(ray,positions[i0],positions[i1],positions[i2],uvw,lambda) &&
       lambda > 0 && lambda < maxLambda)
       return true;
   }
@@ -83,15 +132,35 @@ bool IndexedTriangleMesh::loadFromOBJ(const std::string &filePath)
   if(!io.loadFromOBJ(filePath))
     return false;
 
-  //loading succeeded, copy data
-  mVertexPosition=std::vector<Vec3>(io.vertexPositions());
-  mVertexTextureCoordinate=std::vector<Vec3>(io.vertexTextureCoordinates());
-  mVertexNormal=std::vector<Vec3>(io.vertexNormals());
-  mIndices=std::vector<int>(io.triangleIndices());
+  //loading succeeded, take over the data
+  mMeshFile.close();
+  io.moveDataTo(mVertexPosition,mVertexTextureCoordinate,mVertexNormal,mIndices);
 
   return true;
 }
 
+bool IndexedTriangleMesh::loadFromMeshFile(const std::string &filePath)
+{
+  if(!mMeshFile.open(filePath))
+  {
+    std::cerr<<"Error: Could not open mesh file "<<filePath<<std::endl;
+    return false;
+  }
+
+  //the data of a previous OBJ file is no longer used
+  std::vector<Vec3>().swap(mVertexPosition);
+  std::vector<Vec3>().swap(mVertexTextureCoordinate);
+  std::vector<Vec3>().swap(mVertexNormal);
+  std::vector<int>().swap(mIndices);
+  return true;
+}
+
+bool IndexedTriangleMesh::saveToMeshFile(const std::string &filePath) const
+{
+  return MeshFile::save(filePath,this->vertexPositions(),this->vertexTextureCoordinates(),
+                        this->vertexNormals(),this->triangleIndices());
+}
+
 bool IndexedTriangleMesh::saveToOBJ(const std::string &filePath,
                                     bool textureCoordinates,
                                     bool normals) const
@@ -99,18 +168,24 @@ bool IndexedTriangleMesh::saveToOBJ(const std::string &filePath,
   IndexedTriangleIO io;
 
   //set io data
-  io.setVertexPositions(mVertexPosition);
-  io.setVertexTextureCoordinates(mVertexTextureCoordinate);
-  io.setVertexNormals(mVertexNormal);
-  io.setTriangleIndices(mIndices);
+  const ArrayRef<Vec3> positions = this->vertexPositions();
+  const ArrayRef<Vec3> uvs       = this->vertexTextureCoordinates();
+  const ArrayRef<Vec3> ns        = this->vertexNormals();
+  const ArrayRef<int>  indices   = this->triangleIndices();
+  io.setVertexPositions(std::vector<Vec3>(positions.begin(),positions.end()));
+  io.setVertexTextureCoordinates(std::vector<Vec3>(uvs.begin(),uvs.end()));
+  io.setVertexNormals(std::vector<Vec3>(ns.begin(),ns.end()));
+  io.setTriangleIndices(std::vector<int>(indices.begin(),indices.end()));
   return io.saveToOBJ(filePath,textureCoordinates,normals);
 }
 
 BoundingBox IndexedTriangleMesh::computeBoundingBox() const
 {
+  const ArrayRef<Vec3> positions = this->vertexPositions();
+
   BoundingBox bbox;
-  for (size_t i=0;i<mVertexPosition.size();++i)
-    bbox.expandByPoint(mVertexPosition[i]);
+  for (size_t i=0;i<positions.size();++i)
+    bbox.expandByPoint(positions[i]);
   return bbox;
 }
 
@@ -3,6 +3,8 @@
 
 #include "Renderable.hpp"
 #include "Ray.hpp"
+#include "ArrayRef.hpp"
+#include "MeshFile.hpp"
 
 namespace rt
 {
@@ -12,42 +14,48 @@ class IndexedTriangleMesh : public Renderable
 public:
 
   /// Implements the intersection computation between ray and any stored triangle.
-  std::shared_ptr<RayIntersection>
-    closestIntersectionModel(const Ray &ray, real maxLambda) const override;
+  bool closestIntersectionModel(const Ray &ray, real maxLambda,
+                                HitRecord &hit) const override;
 
   bool anyIntersectionModel(const Ray &ray, real maxLambda) const override;
 
   bool loadFromOBJ(const std::string &filePath);
   bool saveToOBJ(const std::string &filePath, bool textureCoordinates=true, bool normals=true) const;
 
+  /// Maps a binary mesh file (see MeshFile), the mesh data is used in place.
+  bool loadFromMeshFile(const std::string &filePath);
+  bool saveToMeshFile(const std::string &filePath) const;
 
-  const std::vector<Vec3>& vertexPositions()          const {return mVertexPosition;}
-  const std::vector<Vec3>& vertexTextureCoordinates() const {return mVertexTextureCoordinate;}
-  const std::vector<Vec3>& vertexNormals()            const {return mVertexNormal;}
-  const std::vector<int>&  triangleIndices()          const {return mIndices;}
+  /// The arrays either refer to the data loaded from an OBJ file or into a
+  /// mapped mesh file.
+  ArrayRef<Vec3> vertexPositions()          const {return mMeshFile.isOpen() ? mMeshFile.vertexPositions()          : ArrayRef<Vec3>(mVertexPosition);}
+  ArrayRef<Vec3> vertexTextureCoordinates() const {return mMeshFile.isOpen() ? mMeshFile.vertexTextureCoordinates() : ArrayRef<Vec3>(mVertexTextureCoordinate);}
+  ArrayRef<Vec3> vertexNormals()            const {return mMeshFile.isOpen() ? mMeshFile.vertexNormals()            : ArrayRef<Vec3>(mVertexNormal);}
+  ArrayRef<int>  triangleIndices()          const {return mMeshFile.isOpen() ? mMeshFile.triangleIndices()          : ArrayRef<int>(mIndices);}
 
 protected:
 
+  const MeshFile& meshFile() const { return mMeshFile; }
+
   // Override this method to recompute the bounding box of this object.
   BoundingBox computeBoundingBox() const override;
 
+  /// Interpolates normal and uv coordinates of the hit triangle. Expects
+  /// the triangle index in hit.primitive.
+  void surfaceModel(const Ray &ray, const HitRecord &hit,
+                    Vec3 &normal, Vec3 &uvw) const override;
+
+  /// Differentiates the interpolated normal and uv coordinates.
+  void surfaceDifferentialModel(const Ray &ray, const HitRecord &hit,
+                                const Vec3 &dP, Vec3 &dNormal,
+                                Vec3 &dUVW) const override;
+
 private:
   std::vector<Vec3>                   mVertexPosition;
   std::vector<Vec3>                   mVertexTextureCoordinate;
   std::vector<Vec3>                   mVertexNormal;
   std::vector<int>                    mIndices;
-};
-
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
-
-class IndexedTriangleMeshRayIntersection : public RayIntersection
-{
-public:
-  IndexedTriangleMeshRayIntersection(const Ray &ray, const real lambda,
-    std::shared_ptr<const Renderable> renderable,
-    const Vec3 &normal, const Vec3 &uvw) :
-  RayIntersection(ray,renderable,lambda,normal,uvw) {}
+  MeshFile                            mMeshFile;
 };
 
 } //rt
@@ -3,6 +3,7 @@
 
 #include "Math.hpp"
 #include "Ray.hpp"
+#include "RayPacket.hpp"
 
 namespace rt
 {
@@ -140,6 +141,77 @@ public:
       return false;
     return true;
   }
+
+  /// lineTriangle for the lanes in mask of a packet, computed for several
+  /// lanes at once with the same arithmetic as the single ray version.
+  /// Stores the barycentric coordinates of lane i in uvw[0..2][i] and the
+  /// distance in lambda[i], returns the mask of lanes within the triangle.
+  static int lineTriangle(const RayPacket &packet, int mask, const Vec3 &a, const Vec3 &b, const Vec3 &c,
+                          real (*uvw)[RayPacket::kMaxSize], real *lambda)
+  {
+    typedef PacketLanes L;
+    const int groupMask = (1<<L::kWidth)-1;
+
+    // the edges are shared by all lanes, see linePlane for the terms
+    const Vec3 e1 = a-c, e2 = b-c;
+    const L e1x = L::splat(e1[0]), e1y = L::splat(e1[1]), e1z = L::splat(e1[2]);
+    const L e2x = L::splat(e2[0]), e2y = L::splat(e2[1]), e2z = L::splat(e2[2]);
+    const L cx  = L::splat(c[0]),  cy  = L::splat(c[1]),  cz  = L::splat(c[2]);
+    const L zero = L::splat(0), one = L::splat(1), eps = L::splat(Math::safetyEps());
+
+    int inside = 0;
+    for(int g=0;g<packet.size;g+=L::kWidth)
+    {
+      if(!((mask>>g) & groupMask))
+        continue;
+
+      const L ndx = -L::load(&packet.direction[0][g]);
+      const L ndy = -L::load(&packet.direction[1][g]);
+      const L ndz = -L::load(&packet.direction[2][g]);
+      const L ttx = L::load(&packet.origin[0][g]) - cx;
+      const L tty = L::load(&packet.origin[1][g]) - cy;
+      const L ttz = L::load(&packet.origin[2][g]) - cz;
+
+      // pp = e2 x -d, qq = e1 x tt
+      const L ppx = e2y*ndz - e2z*ndy, ppy = e2z*ndx - e2x*ndz, ppz = e2x*ndy - e2y*ndx;
+      const L qqx = e1y*ttz - e1z*tty, qqy = e1z*ttx - e1x*ttz, qqz = e1x*tty - e1y*ttx;
+
+      const L detA = ((zero + e1x*ppx) + e1y*ppy) + e1z*ppz;
+      const L u = (((zero + ttx*ppx) + tty*ppy) + ttz*ppz)/detA;
+      const L v = (((zero + ndx*qqx) + ndy*qqy) + ndz*qqz)/detA;
+      const L w = (one - u) - v;
+      const L t = (((zero - e2x*qqx) - e2y*qqy) - e2z*qqz)/detA;
+
+      const int outside = L::less(L::abs(detA),eps) |
+                          L::less(u,zero) | L::less(one,u) |
+                          L::less(v,zero) | L::less(one,v) |
+                          L::less(w,zero) | L::less(one,w);
+      inside |= (~outside & groupMask) << g;
+
+      u.store(&uvw[0][g]);
+      v.store(&uvw[1][g]);
+      w.store(&uvw[2][g]);
+      t.store(&lambda[g]);
+    }
+    return inside & mask;
+  }
+
+  /// Change of the barycentric coordinates (weights of a, b and c) for an
+  /// offset dP of a point in the triangle plane. Components of dP off the
+  /// plane are projected out (least squares).
+  static Vec3 barycentricDifferential(const Vec3 &a, const Vec3 &b, const Vec3 &c, const Vec3 &dP)
+  {
+    // dP = db*e1 + dc*e2, solved with the 2x2 normal equations
+    const Vec3 e1 = b-a, e2 = c-a;
+    const real e11 = e1|e1, e12 = e1|e2, e22 = e2|e2;
+    const real det = e11*e22-e12*e12;
+    if(det <= 0)
+      return Vec3(0,0,0);
+    const real r1 = e1|dP, r2 = e2|dP;
+    const real db = (e22*r1-e12*r2)/det;
+    const real dc = (e11*r2-e12*r1)/det;
+    return Vec3(-db-dc,db,dc);
+  }
 };
 
 
@@ -0,0 +1,141 @@
+#include "MappedFile.hpp"
+
+#if defined(_WIN32) || defined(_WIN64)
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+#include <cstdio>
+
+namespace rt
+{
+
+#if defined(_WIN32) || defined(_WIN64)
+
+MappedFile::MappedFile() : mData(0), mSize(0), mOpen(false), mFile(0), mMapping(0)
+{
+}
+
+bool MappedFile::open(const std::string &filePath)
+{
+  this->close();
+
+  HANDLE file = CreateFileA(filePath.c_str(),GENERIC_READ,FILE_SHARE_READ,0,
+                            OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,0);
+  if(file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER size;
+  if(!GetFileSizeEx(file,&size))
+  {
+    CloseHandle(file);
+    return false;
+  }
+
+  mFile = file;
+  mSize = size_t(size.QuadPart);
+  mOpen = true;
+
+  //empty files cannot be mapped, but are valid
+  if(mSize == 0)
+    return true;
+
+  mMapping = CreateFileMappingA(file,0,PAGE_READONLY,0,0,0);
+  if(mMapping)
+    mData = (const char*)MapViewOfFile(mMapping,FILE_MAP_READ,0,0,0);
+  if(!mData)
+  {
+    this->close();
+    return false;
+  }
+  return true;
+}
+
+void MappedFile::close()
+{
+  if(mData)
+    UnmapViewOfFile(mData);
+  if(mMapping)
+    CloseHandle(mMapping);
+  if(mFile)
+    CloseHandle(mFile);
+  mData = 0;
+  mSize = 0;
+  mOpen = false;
+  mFile = 0;
+  mMapping = 0;
+}
+
+#else
+
+MappedFile::MappedFile() : mData(0), mSize(0), mOpen(false)
+{
+}
+
+bool MappedFile::open(const std::string &filePath)
+{
+  this->close();
+
+  const int file = ::open(filePath.c_str(),O_RDONLY);
+  if(file < 0)
+    return false;
+
+  struct stat status;
+  if(fstat(file,&status) != 0)
+  {
+    ::close(file);
+    return false;
+  }
+
+  mSize = size_t(status.st_size);
+  mOpen = true;
+
+  //empty files cannot be mapped, but are valid
+  if(mSize > 0)
+  {
+    void *data = mmap(0,mSize,PROT_READ,MAP_PRIVATE,file,0);
+    if(data == MAP_FAILED)
+    {
+      ::close(file);
+      mSize = 0;
+      mOpen = false;
+      return false;
+    }
+    mData = (const char*)data;
+  }
+
+  //the mapping stays valid after closing the descriptor
+  ::close(file);
+  return true;
+}
+
+void MappedFile::close()
+{
+  if(mData)
+    munmap((void*)mData,mSize);
+  mData = 0;
+  mSize = 0;
+  mOpen = false;
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+  this->close();
+}
+
+bool replaceFile(const std::string &source, const std::string &target)
+{
+#if defined(_WIN32) || defined(_WIN64)
+  //rename fails on Windows if the target exists
+  return MoveFileExA(source.c_str(),target.c_str(),MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return std::rename(source.c_str(),target.c_str()) == 0;
+#endif
+}
+
+} //namespace rt
@@ -0,0 +1,59 @@
+#ifndef MAPPEDFILE_HPP_INCLUDE_ONCE
+#define MAPPEDFILE_HPP_INCLUDE_ONCE
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace rt
+{
+
+/// Read only memory mapping of a whole file. The data stays valid until the
+/// file is closed or the object is destroyed.
+class MappedFile
+{
+public:
+  MappedFile();
+  ~MappedFile();
+
+  /// Maps the file, returns false if it does not exist or cannot be mapped.
+  bool open(const std::string &filePath);
+  void close();
+
+  bool isOpen() const { return mOpen; }
+  const char* data() const { return mData; }
+  size_t size() const { return mSize; }
+
+private:
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+  const char *mData;
+  size_t      mSize;
+  bool        mOpen;
+#if defined(_WIN32) || defined(_WIN64)
+  void       *mFile;
+  void       *mMapping;
+#endif
+};
+
+/// Checks an array stored in a mapped file: count elements of elementSize
+/// bytes at offset have to lie within size bytes, and offset has to be a
+/// multiple of alignment. The values may come from a corrupt file header,
+/// the check cannot overflow. Empty arrays are always valid.
+inline bool isValidFileArray(uint64_t offset, uint64_t count, size_t elementSize,
+                             size_t alignment, uint64_t size)
+{
+  if(count == 0)
+    return true;
+  return offset <= size && count <= (size-offset)/elementSize && offset%alignment == 0;
+}
+
+/// Renames source to target, replacing an existing target atomically: a
+/// concurrent reader or a crash never sees target missing. Used to publish
+/// completely written temporary files.
+bool replaceFile(const std::string &source, const std::string &target);
+
+} //namespace rt
+
+#endif //MAPPEDFILE_HPP_INCLUDE_ONCE
@@ -20,7 +20,7 @@ public:
 
   // Returns the RGBA color for a point viewed from a direction 
   // lit by a light.
-  virtual Vec4 shade(std::shared_ptr<RayIntersection> intersection, 
+  virtual Vec4 shade(const RayIntersection &intersection, 
                      const Light& light) const = 0;
 
   const Vec3& color() const {return mColor;}
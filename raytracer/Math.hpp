@@ -24,7 +24,13 @@
 namespace rt
 {
 
+/// Precision of the raytracer core, selected at build time. Define
+/// RT_USE_FLOAT to trace in single precision.
+#ifdef RT_USE_FLOAT
+typedef float real;
+#else
 typedef double real;
+#endif
 typedef util::Vector<2,real> Vec2;
 typedef util::Vector<3,real> Vec3;
 typedef util::Vector<4,real> Vec4;
@@ -53,7 +59,13 @@ public:
     return std::max(minVal, std::min(maxVal,val));
   }
 
+  /// Offset of secondary rays from a surface, larger than the rounding
+  /// error of hit points at scene scale.
+#ifdef RT_USE_FLOAT
+  inline static const real safetyEps() { return real(0.0001); }
+#else
   inline static const real safetyEps() { return 0.000000001; }
+#endif
 
   template <typename T>
   static T log2(T d) {return log(d)/log(T(2)) ;}	
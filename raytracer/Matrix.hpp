@@ -555,4 +555,6 @@ typedef AffineMatrix<4,int> Mat4i;
 
 } //namespace util
 
+#include "MatrixSIMD.hpp"
+
 #endif // MATRIX_HPP_INCLUDE_ONCE
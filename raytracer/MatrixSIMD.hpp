@@ -0,0 +1,119 @@
+/*
+ *  SIMD versions of AffineMatrix<4,T>::transformPoint and transformVector
+ *  for float and double, included by Matrix.hpp. The rows are transposed in
+ *  registers and the columns are accumulated in the order of the generic
+ *  row dot products, the results are bitwise identical. The generic code
+ *  also copies the upper 3x3 block for every transformVector, which is
+ *  avoided here. Define UTIL_NO_SIMD to use the generic code.
+ */
+
+#ifndef MATRIXSIMD_HPP_INCLUDE_ONCE
+#define MATRIXSIMD_HPP_INCLUDE_ONCE
+
+#include "VectorSIMD.hpp"
+
+#ifdef UTIL_VECTOR_SSE2
+
+namespace util {
+
+//! Accumulates (0 + c0*v0) + c1*v1 + c2*v2 for the column pairs of two
+//! matrix rows, the pairs hold (row0[j], row1[j]).
+inline __m128d transformRowPair(const double *row0, const double *row1,
+                                const __m128d &v0, const __m128d &v1, const __m128d &v2,
+                                __m128d &c3) {
+  const __m128d a01 = _mm_loadu_pd(row0), a23 = _mm_loadu_pd(row0+2);
+  const __m128d b01 = _mm_loadu_pd(row1), b23 = _mm_loadu_pd(row1+2);
+  c3 = _mm_unpackhi_pd(a23,b23);
+
+  __m128d acc = _mm_add_pd(_mm_setzero_pd(),_mm_mul_pd(_mm_unpacklo_pd(a01,b01),v0));
+  acc = _mm_add_pd(acc,_mm_mul_pd(_mm_unpackhi_pd(a01,b01),v1));
+  acc = _mm_add_pd(acc,_mm_mul_pd(_mm_unpacklo_pd(a23,b23),v2));
+  return acc;
+}
+
+template<>
+template<>
+inline Vector<3,double> AffineMatrix<4,double>::transformVector<double>(const Vector<3,double> &v) const {
+  const __m128d v0 = _mm_set1_pd(v[0]), v1 = _mm_set1_pd(v[1]), v2 = _mm_set1_pd(v[2]);
+  __m128d c3;
+  const __m128d xy = transformRowPair(&this->row(0)[0],&this->row(1)[0],v0,v1,v2,c3);
+  const __m128d zw = transformRowPair(&this->row(2)[0],&this->row(3)[0],v0,v1,v2,c3);
+
+  Vector<3,double> ret;
+  _mm_storeu_pd(&ret[0],xy);
+  _mm_store_sd(&ret[2],zw);
+  return ret;
+}
+
+template<>
+template<>
+inline Vector<3,double> AffineMatrix<4,double>::transformPoint<double>(const Vector<3,double> &v) const {
+  const __m128d v0 = _mm_set1_pd(v[0]), v1 = _mm_set1_pd(v[1]), v2 = _mm_set1_pd(v[2]);
+  __m128d c3;
+  __m128d xy = transformRowPair(&this->row(0)[0],&this->row(1)[0],v0,v1,v2,c3);
+  xy = _mm_add_pd(xy,c3);
+  __m128d zw = transformRowPair(&this->row(2)[0],&this->row(3)[0],v0,v1,v2,c3);
+  zw = _mm_add_pd(zw,c3);
+
+  Vector<3,double> ret;
+  const double w = _mm_cvtsd_f64(_mm_unpackhi_pd(zw,zw));
+  if(!(fabs(w) > 0.0))
+    return ret;
+
+  const __m128d ww = _mm_set1_pd(w);
+  _mm_storeu_pd(&ret[0],_mm_div_pd(xy,ww));
+  _mm_store_sd(&ret[2],_mm_div_sd(zw,ww));
+  return ret;
+}
+
+//! Accumulates (0 + c0*v0) + c1*v1 + c2*v2 over the columns c of all four
+//! rows, c3 receives the last column.
+inline __m128 transformRows(const float *row0, const float *row1,
+                            const float *row2, const float *row3,
+                            const Vector<3,float> &v, __m128 &c3) {
+  __m128 c0 = _mm_loadu_ps(row0), c1 = _mm_loadu_ps(row1);
+  __m128 c2 = _mm_loadu_ps(row2);
+  c3 = _mm_loadu_ps(row3);
+  _MM_TRANSPOSE4_PS(c0,c1,c2,c3);
+
+  __m128 acc = _mm_add_ps(_mm_setzero_ps(),_mm_mul_ps(c0,_mm_set1_ps(v[0])));
+  acc = _mm_add_ps(acc,_mm_mul_ps(c1,_mm_set1_ps(v[1])));
+  acc = _mm_add_ps(acc,_mm_mul_ps(c2,_mm_set1_ps(v[2])));
+  return acc;
+}
+
+template<>
+template<>
+inline Vector<3,float> AffineMatrix<4,float>::transformVector<float>(const Vector<3,float> &v) const {
+  __m128 c3;
+  Pack3f r;
+  r.v = transformRows(&this->row(0)[0],&this->row(1)[0],&this->row(2)[0],&this->row(3)[0],v,c3);
+
+  Vector<3,float> ret;
+  r.store(&ret[0]);
+  return ret;
+}
+
+template<>
+template<>
+inline Vector<3,float> AffineMatrix<4,float>::transformPoint<float>(const Vector<3,float> &v) const {
+  __m128 c3;
+  __m128 p = transformRows(&this->row(0)[0],&this->row(1)[0],&this->row(2)[0],&this->row(3)[0],v,c3);
+  p = _mm_add_ps(p,c3);
+
+  Vector<3,float> ret;
+  const float w = _mm_cvtss_f32(_mm_shuffle_ps(p,p,_MM_SHUFFLE(3,3,3,3)));
+  if(!(fabs(w) > 0.0f))
+    return ret;
+
+  Pack3f r;
+  r.v = _mm_div_ps(p,_mm_set1_ps(w));
+  r.store(&ret[0]);
+  return ret;
+}
+
+} //namespace util
+
+#endif //UTIL_VECTOR_SSE2
+
+#endif //MATRIXSIMD_HPP_INCLUDE_ONCE
@@ -0,0 +1,209 @@
+#include "MeshFile.hpp"
+#include "BVTree.hpp"
+#include "IndexedTriangleIO.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace rt
+{
+
+//Increase whenever the file layout changes
+static const uint32_t kMeshFileVersion = 1;
+static const char     kMeshFileMagic[8] = {'R','T','M','E','S','H','\0','\0'};
+
+//Header of a mesh file. Every array starts at a 64 byte aligned offset,
+//bvhOffset is 0 if no tree is stored.
+struct MeshFile::Header
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t byteOrder;       //0x01020304 in the byte order of the writer
+  uint32_t realSize;        //sizeof(real) of the writer
+  uint32_t vectorSize;      //sizeof(Vec3) of the writer
+  uint64_t numPositions;
+  uint64_t positionOffset;
+  uint64_t numTextureCoordinates;
+  uint64_t textureCoordinateOffset;
+  uint64_t numNormals;
+  uint64_t normalOffset;
+  uint64_t numIndices;
+  uint64_t indexOffset;
+  uint64_t bvhOffset;
+};
+
+static uint64_t alignOffset(uint64_t offset)
+{
+  return (offset+63) & ~uint64_t(63);
+}
+
+MeshFile::MeshFile() : mBVHOffset(0)
+{
+}
+
+bool MeshFile::save(const std::string &filePath,
+                    ArrayRef<Vec3> vertexPositions, ArrayRef<Vec3> vertexTextureCoordinates,
+                    ArrayRef<Vec3> vertexNormals, ArrayRef<int> triangleIndices,
+                    const BVTree *tree)
+{
+  Header header;
+  std::memset(&header,0,sizeof(header));
+  std::memcpy(header.magic,kMeshFileMagic,8);
+  header.version                 = kMeshFileVersion;
+  header.byteOrder               = 0x01020304;
+  header.realSize                = uint32_t(sizeof(real));
+  header.vectorSize              = uint32_t(sizeof(Vec3));
+  header.numPositions            = vertexPositions.size();
+  header.positionOffset          = alignOffset(sizeof(Header));
+  header.numTextureCoordinates   = vertexTextureCoordinates.size();
+  header.textureCoordinateOffset = alignOffset(header.positionOffset+vertexPositions.size()*sizeof(Vec3));
+  header.numNormals              = vertexNormals.size();
+  header.normalOffset            = alignOffset(header.textureCoordinateOffset+vertexTextureCoordinates.size()*sizeof(Vec3));
+  header.numIndices              = triangleIndices.size();
+  header.indexOffset             = alignOffset(header.normalOffset+vertexNormals.size()*sizeof(Vec3));
+  header.bvhOffset               = tree ? alignOffset(header.indexOffset+triangleIndices.size()*sizeof(int)) : 0;
+
+  //the sections in file order with their offsets
+  const char *data[4] = {(const char*)vertexPositions.data(), (const char*)vertexTextureCoordinates.data(),
+                         (const char*)vertexNormals.data(), (const char*)triangleIndices.data()};
+  const uint64_t offset[4] = {header.positionOffset, header.textureCoordinateOffset,
+                              header.normalOffset, header.indexOffset};
+  const uint64_t size[4] = {vertexPositions.size()*sizeof(Vec3), vertexTextureCoordinates.size()*sizeof(Vec3),
+                            vertexNormals.size()*sizeof(Vec3), triangleIndices.size()*sizeof(int)};
+
+  //write to a temporary file first, so readers never see a partial file
+  const std::string tempFile = filePath+".tmp";
+  {
+    std::ofstream out(tempFile.c_str(),std::ios::binary | std::ios::out | std::ios::trunc);
+    if(!out.is_open())
+      return false;
+
+    const char padding[64] = {0};
+    uint64_t position = sizeof(header);
+    out.write((const char*)&header,sizeof(header));
+    for(int i=0;i<4;++i)
+    {
+      out.write(padding,std::streamsize(offset[i]-position));
+      if(size[i] > 0)
+        out.write(data[i],std::streamsize(size[i]));
+      position = offset[i]+size[i];
+    }
+    if(tree)
+    {
+      out.write(padding,std::streamsize(header.bvhOffset-position));
+      tree->save(out);
+    }
+
+    if(!out)
+    {
+      out.close();
+      std::remove(tempFile.c_str());
+      return false;
+    }
+  }
+
+  return replaceFile(tempFile,filePath);
+}
+
+bool MeshFile::convertFromOBJ(const std::string &objFilePath, const std::string &filePath,
+                              int branchingFactor)
+{
+  IndexedTriangleIO io;
+  if(!io.loadFromOBJ(objFilePath))
+    return false;
+
+  const std::vector<int> &indices = io.triangleIndices();
+  std::unique_ptr<BVTree> tree;
+  if(branchingFactor > 0)
+  {
+    tree.reset(new BVTree());
+    tree->setBranchingFactor(branchingFactor);
+    tree->build(io.vertexPositions(),
+                ArrayRef<Vec3i>((const Vec3i*)indices.data(),indices.size()/3));
+  }
+
+  if(!MeshFile::save(filePath,io.vertexPositions(),io.vertexTextureCoordinates(),
+                     io.vertexNormals(),indices,tree.get()))
+  {
+    std::cerr<<"Error: Could not write mesh file "<<filePath<<std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool MeshFile::open(const std::string &filePath)
+{
+  this->close();
+
+  std::shared_ptr<MappedFile> file(new MappedFile());
+  if(!file->open(filePath) || file->size() < sizeof(Header))
+    return false;
+
+  Header header;
+  std::memcpy(&header,file->data(),sizeof(header));
+  if(std::memcmp(header.magic,kMeshFileMagic,8) != 0 || header.version != kMeshFileVersion ||
+     header.byteOrder != 0x01020304 || header.realSize != sizeof(real) ||
+     header.vectorSize != sizeof(Vec3))
+    return false;
+
+  //the mapping is page aligned, so aligned offsets give aligned arrays
+  const uint64_t size = file->size();
+  if(!isValidFileArray(header.positionOffset,header.numPositions,sizeof(Vec3),alignof(Vec3),size) ||
+     !isValidFileArray(header.textureCoordinateOffset,header.numTextureCoordinates,sizeof(Vec3),alignof(Vec3),size) ||
+     !isValidFileArray(header.normalOffset,header.numNormals,sizeof(Vec3),alignof(Vec3),size) ||
+     !isValidFileArray(header.indexOffset,header.numIndices,sizeof(int),alignof(int),size) ||
+     header.bvhOffset > size)
+    return false;
+
+  //texture coordinates and normals are optional, but given per vertex
+  if(header.numIndices%3 != 0 ||
+     (header.numTextureCoordinates != 0 && header.numTextureCoordinates != header.numPositions) ||
+     (header.numNormals != 0 && header.numNormals != header.numPositions))
+    return false;
+
+  const char *data = file->data();
+  const ArrayRef<Vec3> positions = header.numPositions ?
+    ArrayRef<Vec3>((const Vec3*)(data+header.positionOffset),size_t(header.numPositions)) : ArrayRef<Vec3>();
+  const ArrayRef<Vec3> textureCoordinates = header.numTextureCoordinates ?
+    ArrayRef<Vec3>((const Vec3*)(data+header.textureCoordinateOffset),size_t(header.numTextureCoordinates)) : ArrayRef<Vec3>();
+  const ArrayRef<Vec3> normals = header.numNormals ?
+    ArrayRef<Vec3>((const Vec3*)(data+header.normalOffset),size_t(header.numNormals)) : ArrayRef<Vec3>();
+  const ArrayRef<int> indices = header.numIndices ?
+    ArrayRef<int>((const int*)(data+header.indexOffset),size_t(header.numIndices)) : ArrayRef<int>();
+
+  //like the face indices of an OBJ file, every index has to refer to a vertex
+  for(size_t i=0;i<indices.size();++i)
+    if(indices[i] < 0 || uint64_t(indices[i]) >= header.numPositions)
+    {
+      std::cerr<<"Error: Mesh file "<<filePath<<" has a triangle index out of range"<<std::endl;
+      return false;
+    }
+
+  mVertexPositions          = positions;
+  mVertexTextureCoordinates = textureCoordinates;
+  mVertexNormals            = normals;
+  mTriangleIndices          = indices;
+  mBVHOffset                = size_t(header.bvhOffset);
+  mFile = file;
+  return true;
+}
+
+void MeshFile::close()
+{
+  mFile.reset();
+  mVertexPositions          = ArrayRef<Vec3>();
+  mVertexTextureCoordinates = ArrayRef<Vec3>();
+  mVertexNormals            = ArrayRef<Vec3>();
+  mTriangleIndices          = ArrayRef<int>();
+  mBVHOffset = 0;
+}
+
+bool MeshFile::loadBVH(BVTree &tree) const
+{
+  if(!mFile || mBVHOffset == 0)
+    return false;
+  return tree.load(mFile,mBVHOffset,mTriangleIndices.size()/3);
+}
+
+} //namespace rt
@@ -0,0 +1,67 @@
+#ifndef MESHFILE_HPP_INCLUDE_ONCE
+#define MESHFILE_HPP_INCLUDE_ONCE
+
+#include <memory>
+#include <string>
+#include <cstdint>
+#include "Math.hpp"
+#include "ArrayRef.hpp"
+#include "MappedFile.hpp"
+
+namespace rt
+{
+
+class BVTree;
+
+/// Binary container of an indexed triangle mesh. A header with counts and
+/// offsets is followed by the 64 byte aligned position, texture coordinate,
+/// normal and index arrays and optionally by a prebuilt BVH. Opening a file
+/// maps it into memory, the arrays are used in place without parsing or
+/// copying.
+class MeshFile
+{
+public:
+  MeshFile();
+
+  /// Writes a mesh, tree is stored along if not 0. The file is written to a
+  /// temporary file first and then renamed.
+  static bool save(const std::string &filePath,
+                   ArrayRef<Vec3> vertexPositions, ArrayRef<Vec3> vertexTextureCoordinates,
+                   ArrayRef<Vec3> vertexNormals, ArrayRef<int> triangleIndices,
+                   const BVTree *tree = 0);
+
+  /// Converts a Wavefront OBJ file. A BVH with the given branching factor is
+  /// built and stored unless branchingFactor is 0.
+  static bool convertFromOBJ(const std::string &objFilePath, const std::string &filePath,
+                             int branchingFactor = 4);
+
+  /// Maps a mesh file, returns false if it cannot be mapped or was written
+  /// with a different byte order or precision.
+  bool open(const std::string &filePath);
+  void close();
+  bool isOpen() const { return bool(mFile); }
+
+  ArrayRef<Vec3> vertexPositions()          const { return mVertexPositions; }
+  ArrayRef<Vec3> vertexTextureCoordinates() const { return mVertexTextureCoordinates; }
+  ArrayRef<Vec3> vertexNormals()            const { return mVertexNormals; }
+  ArrayRef<int>  triangleIndices()          const { return mTriangleIndices; }
+
+  /// Uses the stored BVH in place. Returns false if the file holds no tree
+  /// or one with a different branching factor than set for tree.
+  bool hasBVH() const { return mBVHOffset > 0; }
+  bool loadBVH(BVTree &tree) const;
+
+private:
+  struct Header;
+
+  std::shared_ptr<MappedFile> mFile;
+  ArrayRef<Vec3> mVertexPositions;
+  ArrayRef<Vec3> mVertexTextureCoordinates;
+  ArrayRef<Vec3> mVertexNormals;
+  ArrayRef<int>  mTriangleIndices;
+  size_t         mBVHOffset;
+};
+
+} //namespace rt
+
+#endif //MESHFILE_HPP_INCLUDE_ONCE
@@ -8,4 +8,31 @@ Ray PerspectiveCamera::ray(size_t x, size_t y) const
            ((this->topLeft() + this->right()*real(x) - this->down()*real(y)) - this->position()));
 }
 
+Ray PerspectiveCamera::ray(size_t x, size_t y, RayDifferentials &differentials) const
+{
+  const Vec3 d = (this->topLeft() + this->right()*real(x) - this->down()*real(y)) - this->position();
+  const Ray ray(this->position(),d);
+
+  //all rays start at the eye, the unnormalized direction changes by right
+  //and -down per pixel, differentiate its normalization
+  const Vec3 &D = ray.direction();
+  const real invLength = real(1)/d.norm();
+  const Vec3 dx =  this->right(), dy = -this->down();
+  differentials.dOdx  = Vec3(0,0,0);
+  differentials.dOdy  = Vec3(0,0,0);
+  differentials.dDdx  = (dx - D*(D|dx))*invLength;
+  differentials.dDdy  = (dy - D*(D|dy))*invLength;
+  differentials.valid = true;
+  return ray;
+}
+
+void PerspectiveCamera::rays(size_t x, size_t y, size_t width, size_t height,
+                             RayPacket &packet, RayDifferentials *differentials) const
+{
+  packet.size = int(width*height);
+  for(size_t j=0;j<height;++j)
+    for(size_t i=0;i<width;++i)
+      packet.setRay(int(i+width*j),PerspectiveCamera::ray(x+i,y+j,differentials[i+width*j]));
+}
+
 } //namespace rt
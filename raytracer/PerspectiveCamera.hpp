@@ -9,6 +9,11 @@ class PerspectiveCamera : public Camera
 {
 public:
   Ray ray(size_t x, size_t y) const override;
+  Ray ray(size_t x, size_t y, RayDifferentials &differentials) const override;
+
+  /// Computes the rays without virtual calls, the same as ray() per pixel.
+  void rays(size_t x, size_t y, size_t width, size_t height,
+            RayPacket &packet, RayDifferentials *differentials) const override;
 };
 
 } //namespace rt
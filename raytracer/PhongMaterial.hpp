@@ -16,7 +16,7 @@ public:
                 real reflectance=1.0,
                 real shininess=10.0);
 
-  Vec4 shade(std::shared_ptr<RayIntersection> intersection, 
+  Vec4 shade(const RayIntersection &intersection, 
     const Light& light) const override;
 
   real shininess() const { return mShininess; }
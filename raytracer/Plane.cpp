@@ -27,8 +27,8 @@ Plane::Plane(const Vec3& normal) :
   }
 }
 
-std::shared_ptr<RayIntersection>
-Plane::closestIntersectionModel(const Ray &ray, real maxLambda) const
+bool Plane::closestIntersectionModel(const Ray &ray, real maxLambda,
+                                     HitRecord &hit) const
 {
   // Solve linear equation for lambda
   // see also http://en.wikipedia.org/wiki/Line-plane_intersection
@@ -37,19 +37,34 @@ Plane::closestIntersectionModel(const Ray &ray, real maxLambda) const
 
   // No intersection if ray is (almost) parallel to plane
   if (fabs(d)<Math::safetyEps())
-    return nullptr;
+    return false;
 
   real lambda = a / d;
 
   // Only intersections in [0,1] range are valid.
   if (lambda<0.0 || lambda>maxLambda)
-    return nullptr;
+    return false;
 
-  const Vec3 p = ray.pointOnRay(lambda);
-  const Vec3 uvw(p | mTangent, p | mBitangent, real(0));
+  hit.lambda    = lambda;
+  hit.primitive = 0;
+  return true;
+}
+
+void Plane::surfaceModel(const Ray &ray, const HitRecord &hit,
+                         Vec3 &normal, Vec3 &uvw) const
+{
+  const Vec3 p = ray.pointOnRay(hit.lambda);
 
-  return std::make_shared<PlaneRayIntersection>(ray,lambda, shared_from_this(),
-    mNormal,uvw);
+  normal = mNormal;
+  uvw    = Vec3(p | mTangent, p | mBitangent, real(0));
+}
+
+void Plane::surfaceDifferentialModel(const Ray &/*ray*/, const HitRecord &/*hit*/,
+                                     const Vec3 &dP, Vec3 &dNormal,
+                                     Vec3 &dUVW) const
+{
+  dNormal = Vec3(0,0,0);
+  dUVW    = Vec3(dP | mTangent, dP | mBitangent, real(0));
 }
 
 BoundingBox Plane::computeBoundingBox() const
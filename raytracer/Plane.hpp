@@ -16,8 +16,17 @@ public:
   Plane(const Vec3& normal = Vec3(0.0,0.0,1.0));
 
   /// Implements the intersection computation between ray and plane
-  virtual std::shared_ptr<RayIntersection>
-  closestIntersectionModel(const Ray &ray, real maxLambda) const override;
+  bool closestIntersectionModel(const Ray &ray, real maxLambda,
+                                HitRecord &hit) const override;
+
+  /// Computes normal and planar parameterization of the hit point.
+  void surfaceModel(const Ray &ray, const HitRecord &hit,
+                    Vec3 &normal, Vec3 &uvw) const override;
+
+  /// The normal is constant, the parameters change linearly.
+  void surfaceDifferentialModel(const Ray &ray, const HitRecord &hit,
+                                const Vec3 &dP, Vec3 &dNormal,
+                                Vec3 &dUVW) const override;
 
   const Vec3& normal() const { return mNormal; }
 
@@ -32,18 +41,5 @@ private:
   Vec3 mNormal, mTangent, mBitangent;
 };
 
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
-
-/// Intersection between plane and ray.
-class PlaneRayIntersection : public RayIntersection
-{
-public:
-  PlaneRayIntersection(const Ray &ray, const real lambda,
-                       std::shared_ptr<const Renderable> renderable,
-                       const Vec3 &normal, const Vec3 &uvw) :
-    RayIntersection(ray,renderable,lambda,normal,uvw) {}
-};
-
 }
 #endif //PLANE_HPP_INCLUDE_ONCE
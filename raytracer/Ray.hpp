@@ -2,6 +2,7 @@
 #define RAY_HPP_INCLUDE_ONCE
 
 #include <memory>
+#include <limits>
 
 #include "Math.hpp"
 
@@ -46,32 +47,83 @@ private:
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 
+/// Ray differentials (Igehy 1999): derivatives of the origin and of the
+/// normalized direction of a ray with respect to the image coordinates x and
+/// y. They are kept apart from Ray, so shadow rays and the intersection
+/// tests do not carry them along.
+struct RayDifferentials
+{
+  RayDifferentials() : valid(false) {}
+
+  Vec3 dOdx, dOdy;              ///< Derivatives of the origin.
+  Vec3 dDdx, dDdy;              ///< Derivatives of the direction.
+  bool valid;                   ///< False for rays without a footprint.
+};
+
+/// Ray differentials transferred to a hit point: derivatives of position,
+/// normal and uvw parameters with respect to the image coordinates, and of
+/// the direction of the incoming ray for secondary rays.
+struct SurfaceDifferentials
+{
+  SurfaceDifferentials() : valid(false) {}
+
+  Vec3 dDdx,   dDdy;
+  Vec3 dPdx,   dPdy;
+  Vec3 dNdx,   dNdy;
+  Vec3 dUVWdx, dUVWdy;
+  bool valid;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+/// Minimal record of a hit between a ray and a renderable. It is a plain
+/// value filled in by the intersection tests without any allocation. The
+/// expensive surface information (position, normal, texture coordinates) is
+/// computed only once for the final closest hit, see
+/// Renderable::intersection().
+struct HitRecord
+{
+  HitRecord() : lambda(std::numeric_limits<real>::infinity()), primitive(-1),
+    bary(0,0,0), renderable(nullptr) {}
+
+  real lambda;                  ///< Ray parameter of the hit.
+  int  primitive;               ///< Index of the hit primitive, e.g. triangle.
+  Vec3 bary;                    ///< Barycentric coordinates within the primitive.
+  const Renderable *renderable; ///< Hit object (set in world coordinates).
+};
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
 /// Container class for intersection between a renderable and a ray
 class RayIntersection
 {
 public:
 
   /// All necessary information for intersection must be passed to
-  /// constructor. No mutator methods are available.
+  /// constructor. Only the differentials are set afterwards, see
+  /// Renderable::intersection().
   RayIntersection(const Ray &ray,
-                  std::shared_ptr<const Renderable> renderable,
+                  const Renderable *renderable,
                   const real lambda, const Vec3 &normal, const Vec3 &uvw) :
     mRay(ray), mRenderable(renderable), mLambda(lambda), mNormal(normal), mUVW(uvw)
   {
     mPosition=ray.pointOnRay(mLambda);
   }
 
-  virtual ~RayIntersection() {}
+  const Ray& ray()                  const { return mRay; }
+  const Renderable* renderable()    const { return mRenderable; }
+  real lambda()                     const { return mLambda; }
+  const Vec3& position()            const { return mPosition; }
+  const Vec3& normal()              const { return mNormal; }
+  const Vec3& uvw()                 const { return mUVW; }
+  const SurfaceDifferentials& differentials() const { return mDifferentials; }
 
-  const Ray& ray()                               const { return mRay; }
-  std::shared_ptr<const Renderable> renderable() const { return mRenderable; }
-  real lambda()                                  const { return mLambda; }
-  const Vec3& position()                         const { return mPosition; }
-  const Vec3& normal()                           const { return mNormal; }
-  const Vec3& uvw()                              const { return mUVW; }
+  void setDifferentials(const SurfaceDifferentials &differentials) { mDifferentials=differentials; }
 
-  virtual void transform(const Mat4 &transform,
-                         const Mat4 &transformInvTransp)
+  void transform(const Mat4 &transform,
+                 const Mat4 &transformInvTransp)
   {
 
     //transform local intersection information to global system
@@ -83,11 +135,12 @@ public:
 
 protected:
   Ray mRay;
-  std::shared_ptr<const Renderable> mRenderable;
+  const Renderable *mRenderable;
   real mLambda;
   Vec3 mPosition;
   Vec3 mNormal;
   Vec3 mUVW;
+  SurfaceDifferentials mDifferentials;
 };
 
 } //namespace rt
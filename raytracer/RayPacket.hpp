@@ -0,0 +1,232 @@
+#ifndef RAYPACKET_HPP_INCLUDE_ONCE
+#define RAYPACKET_HPP_INCLUDE_ONCE
+
+#include <limits>
+
+#include "Math.hpp"
+#include "Ray.hpp"
+#include "SlabTest.hpp"
+
+namespace rt
+{
+
+/// Up to 16 coherent rays traced together, e.g. the primary rays of a block
+/// of pixels. Every lane is kept as a Ray for the single ray fallbacks and in
+/// structure of arrays layout for the tests across lanes. Lanes are selected
+/// by bit masks, bit i stands for lane i.
+struct RayPacket
+{
+  static const int kMaxSize = 16;
+
+  /// All lanes are zero rays until they are set.
+  RayPacket() : size(0), origin(), direction() {}
+
+  /// Mask of all lanes below size.
+  int fullMask() const { return (1<<size)-1; }
+
+  void setRay(int lane, const Ray &ray)
+  {
+    rays[lane] = ray;
+    for(int a=0;a<3;++a)
+    {
+      origin[a][lane]    = ray.origin()[a];
+      direction[a][lane] = ray.direction()[a];
+    }
+  }
+
+  int  size;
+  Ray  rays[kMaxSize];
+  real origin[3][kMaxSize];
+  real direction[3][kMaxSize];
+};
+
+/// Index of the lowest lane in a non-empty lane mask. The lanes of a mask
+/// are visited by for(int m=mask;m;m&=m-1) { const int l = lowestLane(m); }
+inline int lowestLane(int mask)
+{
+#if defined(__GNUC__)
+  return __builtin_ctz(unsigned(mask));
+#else
+  int lane = 0;
+  while(!(mask & (1<<lane)))
+    ++lane;
+  return lane;
+#endif
+}
+
+/// The SlabRay of every lane in mask of a packet, in structure of arrays
+/// layout. Other lanes are zero.
+struct SlabRayPacket
+{
+  SlabRayPacket(const RayPacket &packet, int mask) : size(packet.size), origin(), invDirection()
+  {
+    for(int m=mask;m;m&=m-1)
+    {
+      const int l = lowestLane(m);
+      const SlabRay slabRay(packet.rays[l]);
+      for(int a=0;a<3;++a)
+      {
+        origin[a][l]       = slabRay.origin[a];
+        invDirection[a][l] = slabRay.invDirection[a];
+      }
+    }
+  }
+
+  int   size;
+  float origin[3][RayPacket::kMaxSize];
+  float invDirection[3][RayPacket::kMaxSize];
+};
+
+/// Consecutive lanes of a RayPacket in one SIMD register: two doubles with
+/// SSE2, four doubles with AVX or four floats. Without SIMD support a group
+/// is a single lane. The operators evaluate like the scalar code.
+#if defined(UTIL_VECTOR_SSE2) && defined(RT_USE_FLOAT)
+struct PacketLanes
+{
+  static const int kWidth = 4;
+  __m128 v;
+
+  static PacketLanes load(const real *p) { PacketLanes r; r.v = _mm_loadu_ps(p); return r; }
+  static PacketLanes splat(real s)       { PacketLanes r; r.v = _mm_set1_ps(s); return r; }
+  void store(real *p) const              { _mm_storeu_ps(p,v); }
+
+  friend PacketLanes operator+(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = _mm_add_ps(a.v,b.v); return r; }
+  friend PacketLanes operator-(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = _mm_sub_ps(a.v,b.v); return r; }
+  friend PacketLanes operator*(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = _mm_mul_ps(a.v,b.v); return r; }
+  friend PacketLanes operator/(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = _mm_div_ps(a.v,b.v); return r; }
+  friend PacketLanes operator-(const PacketLanes &a) { PacketLanes r; r.v = _mm_xor_ps(a.v,_mm_set1_ps(-0.0f)); return r; }
+
+  static PacketLanes abs(const PacketLanes &a) { PacketLanes r; r.v = _mm_andnot_ps(_mm_set1_ps(-0.0f),a.v); return r; }
+  /// Lane mask of a < b.
+  static int less(const PacketLanes &a, const PacketLanes &b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v,b.v)); }
+};
+#elif defined(UTIL_VECTOR_AVX)
+struct PacketLanes
+{
+  static const int kWidth = 4;
+  __m256d v;
+
+  static PacketLanes load(const real *p) { PacketLanes r; r.v = _mm256_loadu_pd(p); return r; }
+  static PacketLanes splat(real s)       { PacketLanes r; r.v = _mm256_set1_pd(s); return r; }
+  void store(real *p) const              { _mm256_storeu_pd(p,v); }
+
+  friend PacketLanes operator+(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = _mm256_add_pd(a.v,b.v); return r; }
+  friend PacketLanes operator-(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = _mm256_sub_pd(a.v,b.v); return r; }
+  friend PacketLanes operator*(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = _mm256_mul_pd(a.v,b.v); return r; }
+  friend PacketLanes operator/(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = _mm256_div_pd(a.v,b.v); return r; }
+  friend PacketLanes operator-(const PacketLanes &a) { PacketLanes r; r.v = _mm256_xor_pd(a.v,_mm256_set1_pd(-0.0)); return r; }
+
+  static PacketLanes abs(const PacketLanes &a) { PacketLanes r; r.v = _mm256_andnot_pd(_mm256_set1_pd(-0.0),a.v); return r; }
+  static int less(const PacketLanes &a, const PacketLanes &b) { return _mm256_movemask_pd(_mm256_cmp_pd(a.v,b.v,_CMP_LT_OQ)); }
+};
+#elif defined(UTIL_VECTOR_SSE2)
+struct PacketLanes
+{
+  static const int kWidth = 2;
+  __m128d v;
+
+  static PacketLanes load(const real *p) { PacketLanes r; r.v = _mm_loadu_pd(p); return r; }
+  static PacketLanes splat(real s)       { PacketLanes r; r.v = _mm_set1_pd(s); return r; }
+  void store(real *p) const              { _mm_storeu_pd(p,v); }
+
+  friend PacketLanes operator+(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = _mm_add_pd(a.v,b.v); return r; }
+  friend PacketLanes operator-(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = _mm_sub_pd(a.v,b.v); return r; }
+  friend PacketLanes operator*(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = _mm_mul_pd(a.v,b.v); return r; }
+  friend PacketLanes operator/(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = _mm_div_pd(a.v,b.v); return r; }
+  friend PacketLanes operator-(const PacketLanes &a) { PacketLanes r; r.v = _mm_xor_pd(a.v,_mm_set1_pd(-0.0)); return r; }
+
+  static PacketLanes abs(const PacketLanes &a) { PacketLanes r; r.v = _mm_andnot_pd(_mm_set1_pd(-0.0),a.v); return r; }
+  static int less(const PacketLanes &a, const PacketLanes &b) { return _mm_movemask_pd(_mm_cmplt_pd(a.v,b.v)); }
+};
+#else
+struct PacketLanes
+{
+  static const int kWidth = 1;
+  real v;
+
+  static PacketLanes load(const real *p) { PacketLanes r; r.v = *p; return r; }
+  static PacketLanes splat(real s)       { PacketLanes r; r.v = s; return r; }
+  void store(real *p) const              { *p = v; }
+
+  friend PacketLanes operator+(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = a.v+b.v; return r; }
+  friend PacketLanes operator-(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = a.v-b.v; return r; }
+  friend PacketLanes operator*(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = a.v*b.v; return r; }
+  friend PacketLanes operator/(const PacketLanes &a, const PacketLanes &b) { PacketLanes r; r.v = a.v/b.v; return r; }
+  friend PacketLanes operator-(const PacketLanes &a) { PacketLanes r; r.v = -a.v; return r; }
+
+  static PacketLanes abs(const PacketLanes &a) { PacketLanes r; r.v = std::fabs(a.v); return r; }
+  static int less(const PacketLanes &a, const PacketLanes &b) { return a.v < b.v ? 1 : 0; }
+};
+#endif
+
+/// Tests the lanes in mask against a single box given as min x,y,z, max
+/// x,y,z, with the same arithmetic as the single ray test. Returns the mask
+/// of lanes entering the box within [0,tmax[lane]] and stores the smallest
+/// entry distance of these lanes in tnear. Lanes without rays must have a
+/// negative tmax, the lanes of a group are tested together.
+inline int slabTest(const float *bounds, const SlabRayPacket &packet, int mask,
+                    const float *tmax, float &tnear)
+{
+  int hitMask = 0;
+#ifdef RT_SLABTEST_SSE
+  const __m128 minX = _mm_set1_ps(bounds[0]), maxX = _mm_set1_ps(bounds[3]);
+  const __m128 minY = _mm_set1_ps(bounds[1]), maxY = _mm_set1_ps(bounds[4]);
+  const __m128 minZ = _mm_set1_ps(bounds[2]), maxZ = _mm_set1_ps(bounds[5]);
+  const __m128 infinity = _mm_set1_ps(std::numeric_limits<float>::infinity());
+  __m128 nearest = infinity;
+  for(int g=0;g<packet.size;g+=4)
+  {
+    if(!((mask>>g) & 15))
+      continue;
+    const __m128 ox = _mm_loadu_ps(&packet.origin[0][g]);
+    const __m128 oy = _mm_loadu_ps(&packet.origin[1][g]);
+    const __m128 oz = _mm_loadu_ps(&packet.origin[2][g]);
+    const __m128 ix = _mm_loadu_ps(&packet.invDirection[0][g]);
+    const __m128 iy = _mm_loadu_ps(&packet.invDirection[1][g]);
+    const __m128 iz = _mm_loadu_ps(&packet.invDirection[2][g]);
+
+    const __m128 x0 = _mm_mul_ps(_mm_sub_ps(minX,ox),ix), x1 = _mm_mul_ps(_mm_sub_ps(maxX,ox),ix);
+    const __m128 y0 = _mm_mul_ps(_mm_sub_ps(minY,oy),iy), y1 = _mm_mul_ps(_mm_sub_ps(maxY,oy),iy);
+    const __m128 z0 = _mm_mul_ps(_mm_sub_ps(minZ,oz),iz), z1 = _mm_mul_ps(_mm_sub_ps(maxZ,oz),iz);
+
+    const __m128 tmin = _mm_max_ps(
+      _mm_max_ps(_mm_min_ps(x0,x1),_mm_min_ps(y0,y1)),
+      _mm_max_ps(_mm_min_ps(z0,z1),_mm_setzero_ps()));
+    const __m128 tfar = _mm_min_ps(
+      _mm_min_ps(_mm_max_ps(x0,x1),_mm_max_ps(y0,y1)),
+      _mm_min_ps(_mm_max_ps(z0,z1),_mm_loadu_ps(tmax+g)));
+
+    //lanes outside mask which enter the box only make tnear smaller
+    const __m128 entered = _mm_cmple_ps(tmin,tfar);
+    nearest = _mm_min_ps(nearest,_mm_or_ps(_mm_and_ps(entered,tmin),_mm_andnot_ps(entered,infinity)));
+    hitMask |= _mm_movemask_ps(entered) << g;
+  }
+  nearest = _mm_min_ps(nearest,_mm_movehl_ps(nearest,nearest));
+  nearest = _mm_min_ss(nearest,_mm_shuffle_ps(nearest,nearest,_MM_SHUFFLE(1,1,1,1)));
+  tnear = _mm_cvtss_f32(nearest);
+#else
+  tnear = std::numeric_limits<float>::infinity();
+  for(int m=mask;m;m&=m-1)
+  {
+    const int l = lowestLane(m);
+    float tmin = 0, tfar = tmax[l];
+    for(int a=0;a<3;++a)
+    {
+      const float t0 = (bounds[a  ]-packet.origin[a][l])*packet.invDirection[a][l];
+      const float t1 = (bounds[a+3]-packet.origin[a][l])*packet.invDirection[a][l];
+      tmin = std::max(tmin,std::min(t0,t1));
+      tfar = std::min(tfar,std::max(t0,t1));
+    }
+    if(tmin <= tfar)
+    {
+      tnear = std::min(tnear,tmin);
+      hitMask |= 1<<l;
+    }
+  }
+#endif
+  return hitMask & mask;
+}
+
+} //namespace rt
+
+#endif //RAYPACKET_HPP_INCLUDE_ONCE
@@ -6,15 +6,62 @@
 #include "Renderable.hpp"
 #include "Material.hpp"
 #include "Math.hpp"
-#include "Image.hpp"
+#include "TileScheduler.hpp"
+#include "RayPacket.hpp"
 #include <thread>
-
-#define THREADS 16
+#include <algorithm>
+#include <cstdint>
 
 namespace rt
 {
 
-Raytracer::Raytracer(size_t maxDepth) : mMaxDepth(maxDepth)
+namespace
+{
+
+// Mixes the direct light of a hit with the radiance reflected toward the
+// viewer.
+Vec4 reflectedColor(const Vec4 &color, const Vec4 &incident_radiance, const Material &material)
+{
+  const real t = material.reflectance();
+  Vec4 mixed = color*(1.0-t) + incident_radiance * Vec4(material.color(),1) * t;
+  mixed[3]=1.0;
+  return mixed;
+}
+
+// Signs of the direction components as bits 0 to 2.
+int directionOctant(const Vec3 &direction)
+{
+  return (direction[0] < 0 ? 1 : 0) | (direction[1] < 0 ? 2 : 0) | (direction[2] < 0 ? 4 : 0);
+}
+
+}
+
+// Rays of the bounce depths of a tile. Every entry refers to the pixel
+// (depth 0) or the entry of the previous depth it was reflected from, and
+// to its reflected ray in the next depth. color holds the direct light
+// until the colors are combined.
+struct Raytracer::RayStream
+{
+  struct Entry
+  {
+    Entry() : parent(-1), child(-1), material(0) {}
+
+    Ray              ray;
+    RayDifferentials differentials;
+    int              parent;
+    int              child;
+    const Material  *material;
+    Vec4             color;
+  };
+
+  std::vector<std::vector<Entry>>           depths;
+  std::vector<std::pair<uint32_t,uint32_t>> keys;
+  std::vector<Entry>                        sorted;
+  RayPacket                                 packet;
+};
+
+Raytracer::Raytracer(size_t maxDepth) : mMaxDepth(maxDepth), mTileSize(16),
+  mNumThreads(0), mPacketSize(16), mRayStreaming(false)
 {
 }
 
@@ -35,86 +82,322 @@ void Raytracer::renderToImage(std::shared_ptr<Image> image) const
   Camera &camera = *(mScene->camera().get());
   camera.setResolution(image->width(),image->height());
 
-  std::thread threads[THREADS];
-  
-  for (int i = 0; i < THREADS; i++) {
-	threads[i] = std::thread([&](int i) {
-	  for(size_t y = (image->height() / THREADS) * i; y < (image->height() / THREADS) * (i + 1); ++y)
-		for(size_t x = 0;x < image->width(); ++x)
-		{
-		  // ray shot from camera position through camera pixel into scene
-		  const Ray ray = camera.ray(x,y);
-		  
-		  // call recursive raytracing function
-		  Vec4 color = this->trace(ray,0);
-		  image->setPixel(color,x,y);
-		}
-	}, i);
+  const size_t numThreads = mNumThreads ? mNumThreads : TileScheduler::defaultNumThreads();
+  TileScheduler scheduler(image->width(),image->height(),mTileSize,numThreads);
+
+  // pixel block of a packet
+  const size_t packetWidth  = mPacketSize >= 8 ? 4 : mPacketSize >= 4 ? 2 : 1;
+  const size_t packetHeight = mPacketSize >= 16 ? 4 : mPacketSize >= 4 ? 2 : 1;
+
+  auto worker = [&](size_t workerIndex)
+  {
+    RayPacket packet;
+    RayDifferentials packetDifferentials[RayPacket::kMaxSize];
+    Vec4 colors[RayPacket::kMaxSize];
+    RayStream stream;
+    if(mRayStreaming)
+      stream.depths.resize(mMaxDepth+1);
+
+    Tile tile;
+    while(scheduler.next(workerIndex,tile))
+    {
+      if(mRayStreaming)
+      {
+        this->traceStream(tile,camera,stream,*image);
+        continue;
+      }
+
+      if(packetWidth*packetHeight > 1)
+      {
+        for(size_t y = tile.y0; y < tile.y1; y += packetHeight)
+          for(size_t x = tile.x0; x < tile.x1; x += packetWidth)
+          {
+            // blocks at the tile border are clipped
+            const size_t width  = std::min(packetWidth,tile.x1-x);
+            const size_t height = std::min(packetHeight,tile.y1-y);
+            camera.rays(x,y,width,height,packet,packetDifferentials);
+            this->trace(packet,packetDifferentials,colors);
+
+            for(size_t j = 0; j < height; ++j)
+              for(size_t i = 0; i < width; ++i)
+                image->setPixel(colors[i+width*j],x+i,y+j);
+          }
+        continue;
+      }
+
+      for(size_t y = tile.y0; y < tile.y1; ++y)
+        for(size_t x = tile.x0; x < tile.x1; ++x)
+        {
+          // ray shot from camera position through camera pixel into scene
+          RayDifferentials differentials;
+          const Ray ray = camera.ray(x,y,differentials);
+
+          // call recursive raytracing function
+          Vec4 color = this->trace(ray,differentials,0);
+          image->setPixel(color,x,y);
+        }
+    }
+  };
+
+  // The calling thread works on the last queue itself
+  std::vector<std::thread> threads;
+  for(size_t i = 0; i+1 < numThreads; ++i)
+    threads.push_back(std::thread(worker,i));
+  worker(numThreads-1);
+
+  for(size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+}
+
+void Raytracer::trace(const RayPacket &packet, const RayDifferentials *differentials,
+                      Vec4 *colors) const
+{
+  HitRecord hits[RayPacket::kMaxSize];
+  const int hitMask = mScene->closestIntersections(packet, hits);
+
+  // the hit points are shaded one by one, reflected rays are no longer
+  // coherent and continue as single rays
+  for (int l = 0; l < packet.size; ++l)
+  {
+    if (hitMask & (1<<l))
+      colors[l] = this->shade(hits[l].renderable->intersection(packet.rays[l], hits[l], &differentials[l]), 0);
+    else
+      colors[l] = mScene->backgroundColor();
   }
-  
-  for (int i = 0; i < THREADS; i++)
-	threads[i].join();
 }
 
-Vec4 Raytracer::trace(const Ray &ray, size_t depth) const
+Vec4 Raytracer::trace(const Ray &ray, const RayDifferentials &differentials,
+                      size_t depth) const
 {
-  std::shared_ptr<RayIntersection> intersection;
-  if ((intersection = mScene->closestIntersection(ray)))
-    return this->shade(intersection, depth);
+  HitRecord hit;
+  if (mScene->closestIntersection(ray, hit))
+    return this->shade(hit.renderable->intersection(ray, hit, &differentials), depth);
 
   return mScene->backgroundColor();
 }
 
-Vec4 Raytracer::shade(std::shared_ptr<RayIntersection> intersection,
+Vec4 Raytracer::shade(const RayIntersection &intersection,
                       size_t depth) const
+{
+  Vec4 color = this->directLight(intersection);
+
+  Ray r;
+  RayDifferentials reflected;
+  if (depth<mMaxDepth && this->reflection(intersection, r, reflected))
+  {
+    // calculate incident radiance by recursive ray tracing
+    const Vec4 incident_radiance = this->trace(r,reflected,++depth);
+    color = reflectedColor(color, incident_radiance, *intersection.renderable()->material());
+  }
+
+  return color;
+}
+
+Vec4 Raytracer::directLight(const RayIntersection &intersection) const
 {
   // This offset must be added to intersection points for further
   // traced rays to avoid noise in the image
-  const Vec3 offset(intersection->normal() * Math::safetyEps());
+  const Vec3 offset(intersection.normal() * Math::safetyEps());
 
   Vec4 color(0,0,0,1);
-  std::shared_ptr<const Renderable> renderable = intersection->renderable();
+  const Renderable *renderable = intersection.renderable();
   std::shared_ptr<const Material>   material   = renderable->material();
-  std::shared_ptr<const Image>    texture    = renderable->texture();
 
   for(size_t i=0;i <mScene->lights().size();++i)
   {
     const Light &light = *(mScene->lights()[i].get());
 
     //Shadow ray from light to hit point.
-    const Vec3 L = (intersection->position() + offset) - light.position();
+    const Vec3 L = (intersection.position() + offset) - light.position();
     const Ray shadowRay(light.position(), L);
 
     //Shade only if light in visible from intersection point.
     if (!mScene->anyIntersection(shadowRay,L.norm()))
       color += material->shade(intersection,light);
   }
+  return color;
+}
+
+bool Raytracer::reflection(const RayIntersection &intersection, Ray &ray,
+                           RayDifferentials &differentials) const
+{
+  if (!(intersection.renderable()->material()->reflectance() > real(0)))
+    return false;
+
+  const Vec3 offset(intersection.normal() * Math::safetyEps());
+  const Vec3 &N(intersection.normal());
+
+  // get incident viewing vector
+  const Vec3 &I = intersection.ray().direction();
+
+  // get out-going viewing direction (reflect)
+  Vec3 D = reflect(I, N).normalized();
+
+  // reflect the differentials as well (Igehy 1999), the footprint
+  // widens on curved surfaces
+  const SurfaceDifferentials &surface = intersection.differentials();
+  differentials = RayDifferentials();
+  if (surface.valid)
+  {
+    const real IN = I|N;
+    differentials.dOdx  = surface.dPdx;
+    differentials.dOdy  = surface.dPdy;
+    differentials.dDdx  = surface.dDdx - (surface.dNdx*IN + N*((surface.dDdx|N) + (I|surface.dNdx)))*real(2);
+    differentials.dDdy  = surface.dDdy - (surface.dNdy*IN + N*((surface.dDdy|N) + (I|surface.dNdy)))*real(2);
+    differentials.valid = true;
+  }
+
+  ray = Ray(intersection.position()+offset, D);
+  return true;
+}
+
+void Raytracer::traceStream(const Tile &tile, const Camera &camera,
+                            RayStream &stream, Image &image) const
+{
+  const size_t tileWidth = tile.x1-tile.x0;
+  const size_t packetWidth  = mPacketSize >= 8 ? 4 : mPacketSize >= 4 ? 2 : 1;
+  const size_t packetHeight = mPacketSize >= 16 ? 4 : mPacketSize >= 4 ? 2 : 1;
+  const size_t batchSize = packetWidth*packetHeight;
+
+  // the primary rays are generated in the blocks of the packets
+  std::vector<RayStream::Entry> &primary = stream.depths[0];
+  primary.clear();
+  RayPacket &packet = stream.packet;
+  RayDifferentials differentials[RayPacket::kMaxSize];
+  for(size_t y = tile.y0; y < tile.y1; y += packetHeight)
+    for(size_t x = tile.x0; x < tile.x1; x += packetWidth)
+    {
+      const size_t width  = std::min(packetWidth,tile.x1-x);
+      const size_t height = std::min(packetHeight,tile.y1-y);
+      camera.rays(x,y,width,height,packet,differentials);
+      for(int l = 0; l < packet.size; ++l)
+      {
+        RayStream::Entry entry;
+        entry.ray = packet.rays[l];
+        entry.differentials = differentials[l];
+        entry.parent = int(x-tile.x0 + l%width + (y-tile.y0 + l/width)*tileWidth);
+        primary.push_back(entry);
+      }
+    }
 
-  if (depth<mMaxDepth)
+  // trace one depth after the other, the reflected rays of a depth are
+  // collected for the next one
+  size_t numDepths = 0;
+  for(size_t depth = 0; depth <= mMaxDepth; ++depth)
   {
-    const Vec3 &N(intersection->normal());
-	
-    // get incident viewing vector
-    const Vec3 &I = intersection->ray().direction();
-	
-    real t= material->reflectance();
-	
-    if (t>real(0))
+    std::vector<RayStream::Entry> &entries = stream.depths[depth];
+    if(entries.empty())
+      break;
+    ++numDepths;
+    if(depth > 0)
+      this->sortStream(stream,depth);
+
+    std::vector<RayStream::Entry> *next = depth < mMaxDepth ? &stream.depths[depth+1] : 0;
+    if(next)
+      next->clear();
+
+    HitRecord hits[RayPacket::kMaxSize];
+    for(size_t first = 0; first < entries.size();)
     {
-      // get out-going viewing direction (reflect)
-      Vec3 D = reflect(I, N).normalized();
-	  
-      // calculate incident radiance by recursive ray tracing
-      const Ray  r(intersection->position()+offset, D);
-      const Vec4 incident_radiance = this->trace(r,++depth);
-	  
-      // how much of the incident radiance is reflected toward the viewer?
-      color = color*(1.0-t) + incident_radiance * Vec4(material->color(),1) * t;
-      color[3]=1.0;
-	}
+      // batches of reflected rays end where the direction octant changes
+      size_t count = 1;
+      const int octant = directionOctant(entries[first].ray.direction());
+      while(count < batchSize && first+count < entries.size() &&
+            (depth == 0 || directionOctant(entries[first+count].ray.direction()) == octant))
+        ++count;
+
+      int hitMask = 0;
+      if(count == 1)
+        hitMask = mScene->closestIntersection(entries[first].ray,hits[0]) ? 1 : 0;
+      else
+      {
+        packet.size = int(count);
+        for(size_t l = 0; l < count; ++l)
+          packet.setRay(int(l),entries[first+l].ray);
+        hitMask = mScene->closestIntersections(packet,hits);
+      }
+
+      for(size_t l = 0; l < count; ++l)
+      {
+        RayStream::Entry &entry = entries[first+l];
+        entry.child = -1;
+        if(!(hitMask & (1<<l)))
+        {
+          entry.color = mScene->backgroundColor();
+          continue;
+        }
+
+        const RayIntersection intersection = hits[l].renderable->intersection(entry.ray, hits[l], &entry.differentials);
+        entry.color = this->directLight(intersection);
+
+        RayStream::Entry reflected;
+        if(next && this->reflection(intersection, reflected.ray, reflected.differentials))
+        {
+          entry.material = intersection.renderable()->material().get();
+          reflected.parent = int(first+l);
+          next->push_back(reflected);
+        }
+      }
+      first += count;
+    }
   }
 
-  return color;
+  // combine the colors from the deepest bounce up to the primary rays
+  for(size_t depth = numDepths; depth-- > 0;)
+  {
+    std::vector<RayStream::Entry> &entries = stream.depths[depth];
+    for(size_t i = 0; i < entries.size(); ++i)
+      if(entries[i].child >= 0)
+        entries[i].color = reflectedColor(entries[i].color, stream.depths[depth+1][entries[i].child].color,
+                                          *entries[i].material);
+  }
+
+  for(size_t i = 0; i < primary.size(); ++i)
+    image.setPixel(primary[i].color, tile.x0 + primary[i].parent%tileWidth,
+                   tile.y0 + primary[i].parent/tileWidth);
+}
+
+void Raytracer::sortStream(RayStream &stream, size_t depth) const
+{
+  std::vector<RayStream::Entry> &entries = stream.depths[depth];
+
+  // origins are put into a grid of 16^3 cells over their bounding box
+  Vec3 lower = entries[0].ray.origin(), upper = lower;
+  for(size_t i = 1; i < entries.size(); ++i)
+    for(int k = 0; k < 3; ++k)
+    {
+      lower[k] = std::min(lower[k],entries[i].ray.origin()[k]);
+      upper[k] = std::max(upper[k],entries[i].ray.origin()[k]);
+    }
+  Vec3 scale;
+  for(int k = 0; k < 3; ++k)
+    scale[k] = upper[k] > lower[k] ? real(15.999)/(upper[k]-lower[k]) : real(0);
+
+  // the key is the direction octant followed by the cell in Morton order
+  stream.keys.clear();
+  for(size_t i = 0; i < entries.size(); ++i)
+  {
+    uint32_t key = uint32_t(directionOctant(entries[i].ray.direction()));
+    const Vec3 &origin = entries[i].ray.origin();
+    const uint32_t cell[3] = {uint32_t((origin[0]-lower[0])*scale[0]),
+                              uint32_t((origin[1]-lower[1])*scale[1]),
+                              uint32_t((origin[2]-lower[2])*scale[2])};
+    for(int bit = 3; bit >= 0; --bit)
+      for(int k = 0; k < 3; ++k)
+        key = (key << 1) | ((cell[k] >> bit) & 1);
+    stream.keys.push_back(std::make_pair(key,uint32_t(i)));
+  }
+  std::sort(stream.keys.begin(),stream.keys.end());
+
+  std::vector<RayStream::Entry> &sorted = stream.sorted;
+  sorted.clear();
+  std::vector<RayStream::Entry> &parents = stream.depths[depth-1];
+  for(size_t i = 0; i < stream.keys.size(); ++i)
+  {
+    sorted.push_back(entries[stream.keys[i].second]);
+    parents[sorted.back().parent].child = int(i);
+  }
+  entries.swap(sorted);
 }
 
 } //namespace rt
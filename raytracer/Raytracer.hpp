@@ -12,8 +12,12 @@ namespace rt
 
 class Scene;
 class Ray;
+struct RayDifferentials;
 class RayIntersection;
+struct RayPacket;
 class Image;
+class Camera;
+struct Tile;
 
 /// Performs recursive raytracing.
 class Raytracer
@@ -28,18 +32,68 @@ public:
   /// Writes RGBA values to an image.
   void renderToImage(std::shared_ptr<Image> image) const;
 
+  /// Edge length in pixels of the square tiles distributed to the threads.
+  void setTileSize(size_t tileSize) { mTileSize=tileSize; }
+  size_t tileSize() const { return mTileSize; }
+
+  /// Number of render threads, 0 selects the number of hardware threads.
+  void setNumThreads(size_t numThreads) { mNumThreads=numThreads; }
+  size_t numThreads() const { return mNumThreads; }
+
+  /// Number of primary rays traced together as a packet: 1 (single rays),
+  /// 4, 8 or 16 rays of 2x2, 4x2 or 4x4 pixel blocks. Shading and all
+  /// secondary rays are traced as single rays.
+  void setPacketSize(size_t packetSize) { mPacketSize=packetSize; }
+  size_t packetSize() const { return mPacketSize; }
+
+  /// Traces the reflections of a tile bounce by bounce instead of depth
+  /// first: the rays of one depth are sorted by origin cell and direction
+  /// octant and traced in coherent batches of the packet size. The colors
+  /// of the reflections are combined once the deepest bounce is shaded.
+  void setRayStreaming(bool enabled) { mRayStreaming=enabled; }
+  bool rayStreaming() const { return mRayStreaming; }
+
 protected:
 
-  /// Returns the color of a traced ray.
+  /// Traces the primary rays of a packet and stores the color of every lane.
+  void trace(const RayPacket &packet,
+             const RayDifferentials *differentials,
+             Vec4 *colors) const;
+
+  /// Returns the color of a traced ray. The differentials of the ray are
+  /// passed on to the intersection and to reflected rays.
   Vec4 trace(const Ray &ray,
+             const RayDifferentials &differentials,
              size_t depth) const;
 
   /// Determines the color of an intersection point.
-  Vec4 shade(std::shared_ptr<RayIntersection> intersection,
+  Vec4 shade(const RayIntersection &intersection,
              size_t depth) const;
 
+  /// Sum of the lights visible from an intersection point.
+  Vec4 directLight(const RayIntersection &intersection) const;
+
+  /// Returns false if the material does not reflect, otherwise the
+  /// reflected ray and its differentials.
+  bool reflection(const RayIntersection &intersection, Ray &ray,
+                  RayDifferentials &differentials) const;
+
+  /// Per thread buffers of the bounces of a tile in streaming mode.
+  struct RayStream;
+
+  /// Renders a tile in streaming mode.
+  void traceStream(const Tile &tile, const Camera &camera,
+                   RayStream &stream, Image &image) const;
+
+  /// Sorts the rays of a bounce depth and links their parents to them.
+  void sortStream(RayStream &stream, size_t depth) const;
+
 private:
   size_t mMaxDepth;              ///< Maximum number of ray indirections.
+  size_t mTileSize;              ///< Tile edge length in pixels.
+  size_t mNumThreads;            ///< Number of render threads (0 = hardware threads).
+  size_t mPacketSize;            ///< Number of primary rays per packet.
+  bool mRayStreaming;            ///< Trace reflections bounce by bounce.
   std::shared_ptr<Scene> mScene;
 };
 
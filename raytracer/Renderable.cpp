@@ -15,32 +15,150 @@ Renderable::~Renderable()
 
 bool Renderable::anyIntersectionModel(const Ray &ray, real maxLambda) const
 {
-  return this->closestIntersectionModel(ray,maxLambda) != nullptr;
+  HitRecord hit;
+  return this->closestIntersectionModel(ray,maxLambda,hit);
 }
 
-std::shared_ptr<RayIntersection>
-Renderable::closestIntersection(const Ray &ray, real maxLambda) const
+void Renderable::surfaceDifferentialModel(const Ray &/*ray*/, const HitRecord &/*hit*/,
+                                          const Vec3 &/*dP*/, Vec3 &dNormal,
+                                          Vec3 &dUVW) const
+{
+  dNormal = Vec3(0,0,0);
+  dUVW    = Vec3(0,0,0);
+}
+
+bool Renderable::closestIntersection(const Ray &ray, real maxLambda,
+                                     HitRecord &hit) const
 {
   //adapt maximal lambda value relative to transformation properties
   //(e.g., scaling)
   Ray  modelRay       = transformRayWorldToModel(ray);
-  maxLambda = transformRayLambdaWorldToModel(ray, maxLambda);
+  const real scale    = transformRayLambdaWorldToModel(ray, real(1));
+  maxLambda *= scale;
 
   // early out test - do we hit the bounding box of the object?
   if (!mBoundingBox.anyIntersection(modelRay, maxLambda))
-    return nullptr;
+    return false;
+
+  HitRecord modelHit;
+  if (!this->closestIntersectionModel(modelRay,maxLambda,modelHit))
+    return false;
+
+  //transform ray parameter from model to world coordinate system
+  hit = modelHit;
+  hit.lambda /= scale;
+  hit.renderable = this;
+  return true;
+}
+
+int Renderable::closestIntersectionsModel(const RayPacket &packet, int mask,
+                                          real *maxLambda, HitRecord *hits) const
+{
+  int hitMask = 0;
+  for(int m=mask;m;m&=m-1)
+  {
+    const int l = lowestLane(m);
+    if(this->closestIntersectionModel(packet.rays[l],maxLambda[l],hits[l]))
+    {
+      maxLambda[l] = hits[l].lambda;
+      hitMask |= 1<<l;
+    }
+  }
+  return hitMask;
+}
+
+int Renderable::closestIntersections(const RayPacket &packet, int mask,
+                                     const real *maxLambda, HitRecord *hits) const
+{
+  //a single lane is not worth setting up a packet
+  if(!(mask & (mask-1)))
+  {
+    const int l = mask ? lowestLane(mask) : 0;
+    return mask && this->closestIntersection(packet.rays[l],maxLambda[l],hits[l]) ? mask : 0;
+  }
 
-  //transform ray from world to model coordinate system
-  std::shared_ptr<RayIntersection> isect_local =
-      this->closestIntersectionModel(modelRay,maxLambda);
+  //the lanes are transformed like single rays, lanes missing the bounding
+  //box are dropped before the model is intersected
+  RayPacket modelPacket;
+  modelPacket.size = packet.size;
+  real scale[RayPacket::kMaxSize], modelMaxLambda[RayPacket::kMaxSize];
+  for(int m=mask;m;m&=m-1)
+  {
+    const int l = lowestLane(m);
+    modelPacket.setRay(l,transformRayWorldToModel(packet.rays[l]));
+    scale[l] = transformRayLambdaWorldToModel(packet.rays[l], real(1));
+    modelMaxLambda[l] = maxLambda[l]*scale[l];
+    if (!mBoundingBox.anyIntersection(modelPacket.rays[l], modelMaxLambda[l]))
+      mask &= ~(1<<l);
+  }
+  if(!mask)
+    return 0;
 
-  if (!isect_local)
-    return nullptr;
+  HitRecord modelHits[RayPacket::kMaxSize];
+  const int hitMask = this->closestIntersectionsModel(modelPacket,mask,modelMaxLambda,modelHits);
+
+  //transform ray parameters from model to world coordinate system
+  for(int m=hitMask;m;m&=m-1)
+  {
+    const int l = lowestLane(m);
+    hits[l] = modelHits[l];
+    hits[l].lambda /= scale[l];
+    hits[l].renderable = this;
+  }
+  return hitMask;
+}
+
+RayIntersection Renderable::intersection(const Ray &ray, const HitRecord &hit,
+                                         const RayDifferentials *differentials) const
+{
+  Ray modelRay = transformRayWorldToModel(ray);
+
+  HitRecord modelHit = hit;
+  modelHit.lambda = transformRayLambdaWorldToModel(ray, hit.lambda);
+
+  Vec3 normal, uvw;
+  this->surfaceModel(modelRay, modelHit, normal, uvw);
 
   //transform intersection from model to world coordinate system
-  isect_local->transform(mTransform, mTransformInvTransp);
+  RayIntersection isect(modelRay, this, modelHit.lambda, normal, uvw);
+  isect.transform(mTransform, mTransformInvTransp);
 
-  return isect_local;
+  if(differentials && differentials->valid)
+  {
+    //transfer the differentials to the tangent plane of the hit point in
+    //world coordinates (Igehy 1999), then evaluate the surface in the
+    //model coordinate system
+    const Vec3 &N = isect.normal();
+    const Vec3 &D = ray.direction();
+    const real DN = D|N;
+    if(std::fabs(DN) > Math::safetyEps())
+    {
+      SurfaceDifferentials surface;
+      surface.dDdx = differentials->dDdx;
+      surface.dDdy = differentials->dDdy;
+      surface.dPdx = differentials->dOdx + differentials->dDdx*hit.lambda;
+      surface.dPdy = differentials->dOdy + differentials->dDdy*hit.lambda;
+      surface.dPdx -= D*((surface.dPdx|N)/DN);
+      surface.dPdy -= D*((surface.dPdy|N)/DN);
+
+      this->surfaceDifferentialModel(modelRay, modelHit,
+                                     mTransformInv.transformVector(surface.dPdx),
+                                     surface.dNdx, surface.dUVWdx);
+      this->surfaceDifferentialModel(modelRay, modelHit,
+                                     mTransformInv.transformVector(surface.dPdy),
+                                     surface.dNdy, surface.dUVWdy);
+
+      //differentiate the normalization of the transformed model normal
+      const real invLength = real(1)/mTransformInvTransp.transformVector(normal).norm();
+      surface.dNdx  = mTransformInvTransp.transformVector(surface.dNdx)*invLength;
+      surface.dNdy  = mTransformInvTransp.transformVector(surface.dNdy)*invLength;
+      surface.dNdx -= N*(N|surface.dNdx);
+      surface.dNdy -= N*(N|surface.dNdy);
+      surface.valid = true;
+      isect.setDifferentials(surface);
+    }
+  }
+  return isect;
 }
 
 bool Renderable::anyIntersection(const Ray &ray, real maxLambda) const
@@ -54,6 +172,36 @@ bool Renderable::anyIntersection(const Ray &ray, real maxLambda) const
   return this->anyIntersectionModel(modelRay,maxLambda);
 }
 
+void Renderable::updateBoundingBox()
+{
+  this->updateTransforms();
+  mBoundingBox = this->computeBoundingBox();
+
+  if(!this->isBounded())
+  {
+    mWorldBoundingBox = mBoundingBox;
+    return;
+  }
+
+  // transform all eight corners of the model space box
+  mWorldBoundingBox = BoundingBox();
+  for(int i=0;i<8;++i)
+  {
+    const Vec3 corner((i&1) ? mBoundingBox.max()[0] : mBoundingBox.min()[0],
+                      (i&2) ? mBoundingBox.max()[1] : mBoundingBox.min()[1],
+                      (i&4) ? mBoundingBox.max()[2] : mBoundingBox.min()[2]);
+    mWorldBoundingBox.expandByPoint(mTransform.transformPoint(corner));
+  }
+}
+
+bool Renderable::isBounded() const
+{
+  for(int i=0;i<3;++i)
+    if(std::isinf(mBoundingBox.min()[i]) || std::isinf(mBoundingBox.max()[i]))
+      return false;
+  return true;
+}
+
 void Renderable::updateTransforms() const
 {
   if(!mTransformClean)
@@ -5,12 +5,12 @@
 #include <vector>
 #include "BoundingBox.hpp"
 #include "Math.hpp"
+#include "Ray.hpp"
+#include "RayPacket.hpp"
 
 namespace rt
 {
 class Material;
-class Ray;
-class RayIntersection;
 class Image;
 
 /// Abstract class for visible geometry.
@@ -22,9 +22,22 @@ public:
   // Destructor.
   virtual ~Renderable();
 
-  // Computes the point of intersection between ray and object.
-  std::shared_ptr<RayIntersection>
-    closestIntersection(const Ray &ray, real maxLambda) const;
+  // Computes the point of intersection between ray and object. If the object
+  // is hit closer than maxLambda, hit is overwritten and true is returned.
+  bool closestIntersection(const Ray &ray, real maxLambda, HitRecord &hit) const;
+
+  // Packet version of closestIntersection for the lanes in mask: the hit
+  // records of lanes hitting the object closer than their maxLambda are
+  // overwritten, the mask of these lanes is returned.
+  int closestIntersections(const RayPacket &packet, int mask,
+                           const real *maxLambda, HitRecord *hits) const;
+
+  // Computes position, normal and surface parameters in world coordinates
+  // for a hit returned by closestIntersection. If valid differentials of
+  // the ray are given, they are transferred to the hit point and stored in
+  // the intersection, e.g. to select texture mip levels.
+  RayIntersection intersection(const Ray &ray, const HitRecord &hit,
+                               const RayDifferentials *differentials = 0) const;
 
   // This is used for so-called 'any hit' rays (returns true if there is at
   // least one intersection.)
@@ -45,8 +58,19 @@ public:
   void setTexture(std::shared_ptr<Image> texture) { mTexture = texture; mHasTexture = true; }
   bool hasTexture() const { return mHasTexture; }
 
-  // Recomputes the bounding box.
-  void updateBoundingBox() { mBoundingBox = this->computeBoundingBox();}
+  // Recomputes the model and world space bounding boxes. This also updates
+  // the cached inverse transformations, so that rendering threads only read
+  // them afterwards.
+  void updateBoundingBox();
+
+  // Gets the bounding box in model coordinates.
+  const BoundingBox& boundingBox() const { return mBoundingBox; }
+
+  // Gets the bounding box of the transformed object in world coordinates.
+  const BoundingBox& worldBoundingBox() const { return mWorldBoundingBox; }
+
+  // Returns false for objects of infinite extent, e.g. planes.
+  bool isBounded() const;
 
   // Override this method for pre-render initialization
   virtual void initialize() {} 
@@ -55,9 +79,31 @@ protected:
 
   // This function does the ray intersection test in the local model coordinate
   // system of the object. Override this function for each class inheriting
-  // from Renderable.
-  virtual std::shared_ptr<RayIntersection>
-    closestIntersectionModel(const Ray &ray, real maxLambda) const = 0;
+  // from Renderable. On a hit, set lambda, primitive and barycentric
+  // coordinates of hit and return true. Do not compute any surface
+  // information here, most hits are discarded later on.
+  virtual bool closestIntersectionModel(const Ray &ray, real maxLambda,
+                                        HitRecord &hit) const = 0;
+
+  // Packet version of closestIntersectionModel for the lanes in mask. Sets
+  // the hit records and lowers maxLambda of the lanes hit, returns their
+  // mask. By default every lane is intersected as a single ray, override
+  // this for tests across lanes.
+  virtual int closestIntersectionsModel(const RayPacket &packet, int mask,
+                                        real *maxLambda, HitRecord *hits) const;
+
+  // Computes normal and surface parameters in the local model coordinate
+  // system for a hit found by closestIntersectionModel.
+  virtual void surfaceModel(const Ray &ray, const HitRecord &hit,
+                            Vec3 &normal, Vec3 &uvw) const = 0;
+
+  // Computes the change of the normal and of the surface parameters for a
+  // small offset dP of the hit point within the tangent plane, in the local
+  // model coordinate system. The default keeps both constant, so textures
+  // are sampled at full resolution.
+  virtual void surfaceDifferentialModel(const Ray &ray, const HitRecord &hit,
+                                        const Vec3 &dP, Vec3 &dNormal,
+                                        Vec3 &dUVW) const;
 
   // This function does an any hit ray intersection test in the local model
   // coordinate system of the object. By default, closestIntersectionLocal
@@ -80,6 +126,7 @@ private:
   Ray  transformRayWorldToModel(const Ray &ray) const;
   real transformRayLambdaWorldToModel(const Ray &ray, const real lambda) const;
   BoundingBox mBoundingBox;
+  BoundingBox mWorldBoundingBox;
   bool mHasTexture;
 };
 
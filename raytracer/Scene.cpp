@@ -14,45 +14,98 @@ Scene::~Scene()
 {
 }
 
-std::shared_ptr<RayIntersection>
-Scene::closestIntersection(const Ray &ray, real maxLambda) const
+bool Scene::closestIntersection(const Ray &ray, HitRecord &hit,
+                                real maxLambda) const
 { 
   real closestLambda = maxLambda;
-  std::shared_ptr<RayIntersection> tmpIntersection;
-  std::shared_ptr<RayIntersection> closestIntersection;
-  for (size_t i=0;i<mRenderables.size();++i)
+  bool found = false;
+
+  // test unbounded objects first, their hits shorten the ray for the
+  // traversal of the hierarchy
+  for (size_t i=0;i<mUnboundedRenderables.size();++i)
   {
-    std::shared_ptr<Renderable> r = mRenderables[i];
-    if((tmpIntersection = r->closestIntersection(ray,closestLambda)))
+    if(mUnboundedRenderables[i]->closestIntersection(ray,closestLambda,hit))
     {
-      if(tmpIntersection->lambda() < closestLambda)
-      {
-        closestLambda = tmpIntersection->lambda();
-        closestIntersection = tmpIntersection;
-      }
+      closestLambda = hit.lambda;
+      found = true;
     }
   }
-  return closestIntersection;
+
+  if(mTopLevelTree.closestIntersection(ray, closestLambda,
+       [&](int index, real &lambdaMax) -> bool
+     {
+       if(!mBoundedRenderables[index]->closestIntersection(ray,lambdaMax,hit))
+         return false;
+       lambdaMax = hit.lambda;
+       return true;
+     }))
+    found = true;
+  return found;
+}
+
+int Scene::closestIntersections(const RayPacket &packet, HitRecord *hits) const
+{
+  real closestLambda[RayPacket::kMaxSize];
+  for (int l=0;l<RayPacket::kMaxSize;++l)
+    closestLambda[l] = std::numeric_limits<real>::infinity();
+  int found = 0;
+
+  // lanes hitting unbounded objects are shortened for the traversal
+  for (size_t i=0;i<mUnboundedRenderables.size();++i)
+  {
+    const int hitMask = mUnboundedRenderables[i]->closestIntersections(packet,packet.fullMask(),closestLambda,hits);
+    for (int m=hitMask;m;m&=m-1)
+      closestLambda[lowestLane(m)] = hits[lowestLane(m)].lambda;
+    found |= hitMask;
+  }
+
+  found |= mTopLevelTree.closestIntersections(packet, packet.fullMask(), closestLambda,
+       [&](int index, int laneMask, real *lambdaMax) -> int
+     {
+       const int hitMask = mBoundedRenderables[index]->closestIntersections(packet,laneMask,lambdaMax,hits);
+       for (int m=hitMask;m;m&=m-1)
+         lambdaMax[lowestLane(m)] = hits[lowestLane(m)].lambda;
+       return hitMask;
+     });
+  return found;
 }
 
 bool Scene::anyIntersection(const Ray &ray, real maxLambda) const
 {
-  for (size_t i=0;i<mRenderables.size();++i)
+  for (size_t i=0;i<mUnboundedRenderables.size();++i)
   {
-    std::shared_ptr<Renderable> r = mRenderables[i];
-    if(r->anyIntersection(ray,maxLambda))
+    if(mUnboundedRenderables[i]->anyIntersection(ray,maxLambda))
       return true;
   }
-  return false;
+
+  return mTopLevelTree.anyIntersection(ray, maxLambda,
+    [&](int index, real &lambdaMax) -> bool
+  {
+    return mBoundedRenderables[index]->anyIntersection(ray,lambdaMax);
+  });
 }
 
 void Scene::prepareScene()
 {
+  mBoundedRenderables.clear();
+  mUnboundedRenderables.clear();
+
+  std::vector<BoundingBox> boxes;
   for(size_t i=0;i<mRenderables.size();++i)
   {
-    mRenderables[i]->updateBoundingBox();
     mRenderables[i]->initialize();
+    mRenderables[i]->updateBoundingBox();
+
+    if(mRenderables[i]->isBounded())
+    {
+      mBoundedRenderables.push_back(mRenderables[i].get());
+      boxes.push_back(mRenderables[i]->worldBoundingBox());
+    }
+    else
+      mUnboundedRenderables.push_back(mRenderables[i].get());
   }
+
+  mTopLevelTree.build(boxes);
 }
 
 }
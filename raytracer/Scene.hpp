@@ -6,6 +6,7 @@
 
 #include "Math.hpp"
 #include "Renderable.hpp"
+#include "BVTree.hpp"
 
 namespace rt
 {
@@ -13,8 +14,6 @@ namespace rt
   class Camera;
   class Light;
   class Renderable;
-  class Ray;
-  class RayIntersection;
 
 class Scene
 {
@@ -22,7 +21,8 @@ public:
   Scene();
   virtual ~Scene();
 
-  /// Add geometry to the scene.
+  /// Add geometry to the scene. Call prepareScene() after adding all
+  /// renderables, otherwise they are not found by the intersection queries.
   void addRenderable(std::shared_ptr<Renderable> renderable) {
     mRenderables.push_back(renderable);
   }
@@ -36,9 +36,15 @@ public:
   const std::vector<std::shared_ptr<Light>>& lights() const { return mLights; }
 
   /// Computes the closest intersection of a ray and any object in scene.
-  std::shared_ptr<RayIntersection>
-  closestIntersection(const Ray &ray,
-                      real maxLambda = std::numeric_limits<real>::infinity()) const; 
+  /// Returns false if nothing is hit closer than maxLambda. Surface
+  /// information of the hit is obtained by hit.renderable->intersection().
+  bool closestIntersection(const Ray &ray, HitRecord &hit,
+                           real maxLambda = std::numeric_limits<real>::infinity()) const;
+
+  /// Closest intersections of all lanes of a packet, the hierarchy is
+  /// traversed once for the packet. hits receives one record per lane,
+  /// returns the mask of lanes which hit anything.
+  int closestIntersections(const RayPacket &packet, HitRecord *hits) const;
 
   /// Checks whether a ray intersects any object in the scene.
   bool anyIntersection(const Ray &ray,
@@ -50,7 +56,8 @@ public:
   void setBackgroundColor(const Vec4& rgba)      { mBackgroundColor = rgba; }
   void setCamera(std::shared_ptr<Camera> camera) {mCamera=camera; }
 
-  //prepare scene for rendering
+  //prepare scene for rendering: initializes the renderables and builds the
+  //top level hierarchy over their world space bounding boxes
   void prepareScene();
 
 private:
@@ -60,6 +67,13 @@ private:
 
   std::vector<std::shared_ptr<Light>> mLights;
   std::vector<std::shared_ptr<Renderable>> mRenderables;
+
+  // Top level hierarchy over all bounded renderables. Its leaves refer to
+  // indices into mBoundedRenderables. Renderables of infinite extent (e.g.
+  // planes) cannot be put into the hierarchy and are tested separately.
+  BVTree mTopLevelTree;
+  std::vector<const Renderable*> mBoundedRenderables;
+  std::vector<const Renderable*> mUnboundedRenderables;
 };
 
 } //namespace rt
@@ -0,0 +1,193 @@
+#ifndef SLABTEST_HPP_INCLUDE_ONCE
+#define SLABTEST_HPP_INCLUDE_ONCE
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#  define RT_SLABTEST_SSE
+#  include <xmmintrin.h>
+#endif
+#if defined(__AVX__)
+#  define RT_SLABTEST_AVX
+#  include <immintrin.h>
+#endif
+
+#include "Math.hpp"
+#include "Ray.hpp"
+
+namespace rt
+{
+
+/// Single precision ray prepared for slab tests against many boxes: the
+/// reciprocal direction is computed once per ray. Zero direction components
+/// are replaced by a huge reciprocal, so no NaNs can occur in the tests.
+struct SlabRay
+{
+  SlabRay(const Ray &ray)
+  {
+    for(int i=0;i<3;++i)
+    {
+      const real d = ray.direction()[i];
+      origin[i] = float(ray.origin()[i]);
+      invDirection[i] = d != 0 ? float(real(1)/d) : (std::signbit(d) ? -1e30f : 1e30f);
+    }
+  }
+
+  float origin[3];
+  float invDirection[3];
+};
+
+/// Rounds a box bound to single precision such that the float box contains
+/// the double box, with some additional room for the rounding of the ray.
+inline float roundBoundDown(real value)
+{
+  if(!std::isfinite(value))
+    return float(value);
+  const float f = float(value - std::fabs(value)*real(1e-6));
+  return std::nextafter(f,-std::numeric_limits<float>::infinity());
+}
+
+inline float roundBoundUp(real value)
+{
+  if(!std::isfinite(value))
+    return float(value);
+  const float f = float(value + std::fabs(value)*real(1e-6));
+  return std::nextafter(f,std::numeric_limits<float>::infinity());
+}
+
+/// Tests a ray against N boxes at once. The boxes are stored as structure of
+/// arrays, bounds[0..2][i] is the min corner and bounds[3..5][i] the max
+/// corner of box i. Returns a bit mask of the boxes entered within [0,tmax]
+/// and stores the entry distances in tnear.
+template<int N>
+inline int slabTest(const float (*bounds)[N], const SlabRay &ray, float tmax,
+                    float *tnear)
+{
+  int mask = 0;
+  for(int i=0;i<N;++i)
+  {
+    float tmin = 0, tfar = tmax;
+    for(int a=0;a<3;++a)
+    {
+      const float t0 = (bounds[a  ][i]-ray.origin[a])*ray.invDirection[a];
+      const float t1 = (bounds[a+3][i]-ray.origin[a])*ray.invDirection[a];
+      tmin = std::max(tmin,std::min(t0,t1));
+      tfar = std::min(tfar,std::max(t0,t1));
+    }
+    tnear[i] = tmin;
+    if(tmin <= tfar)
+      mask |= 1<<i;
+  }
+  return mask;
+}
+
+/// Tests a ray against a single box given as min x,y,z, max x,y,z.
+inline bool slabTest(const float *bounds, const SlabRay &ray, float tmax,
+                     float &tnear)
+{
+  float tmin = 0, tfar = tmax;
+  for(int a=0;a<3;++a)
+  {
+    const float t0 = (bounds[a  ]-ray.origin[a])*ray.invDirection[a];
+    const float t1 = (bounds[a+3]-ray.origin[a])*ray.invDirection[a];
+    tmin = std::max(tmin,std::min(t0,t1));
+    tfar = std::min(tfar,std::max(t0,t1));
+  }
+  tnear = tmin;
+  return tmin <= tfar;
+}
+
+/// Largest float distance passed as tmax, keeps boxes at infinity unhit.
+inline float slabTestMax(real maxLambda)
+{
+  return std::min(roundBoundUp(maxLambda),std::numeric_limits<float>::max());
+}
+
+#ifdef RT_SLABTEST_SSE
+// Four boxes starting at column offset of the bounds arrays.
+inline int slabTestSSE(const float *minX, const float *minY, const float *minZ,
+                       const float *maxX, const float *maxY, const float *maxZ,
+                       const SlabRay &ray, float tmax, float *tnear)
+{
+  const __m128 ox = _mm_set1_ps(ray.origin[0]);
+  const __m128 oy = _mm_set1_ps(ray.origin[1]);
+  const __m128 oz = _mm_set1_ps(ray.origin[2]);
+  const __m128 ix = _mm_set1_ps(ray.invDirection[0]);
+  const __m128 iy = _mm_set1_ps(ray.invDirection[1]);
+  const __m128 iz = _mm_set1_ps(ray.invDirection[2]);
+
+  const __m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(minX),ox),ix);
+  const __m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(maxX),ox),ix);
+  const __m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(minY),oy),iy);
+  const __m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(maxY),oy),iy);
+  const __m128 z0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(minZ),oz),iz);
+  const __m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(maxZ),oz),iz);
+
+  const __m128 tmin = _mm_max_ps(
+    _mm_max_ps(_mm_min_ps(x0,x1),_mm_min_ps(y0,y1)),
+    _mm_max_ps(_mm_min_ps(z0,z1),_mm_setzero_ps()));
+  const __m128 tfar = _mm_min_ps(
+    _mm_min_ps(_mm_max_ps(x0,x1),_mm_max_ps(y0,y1)),
+    _mm_min_ps(_mm_max_ps(z0,z1),_mm_set1_ps(tmax)));
+
+  _mm_storeu_ps(tnear,tmin);
+  return _mm_movemask_ps(_mm_cmple_ps(tmin,tfar));
+}
+
+template<>
+inline int slabTest<4>(const float (*bounds)[4], const SlabRay &ray, float tmax,
+                       float *tnear)
+{
+  return slabTestSSE(bounds[0],bounds[1],bounds[2],bounds[3],bounds[4],bounds[5],
+                     ray,tmax,tnear);
+}
+#endif
+
+#if defined(RT_SLABTEST_AVX)
+template<>
+inline int slabTest<8>(const float (*bounds)[8], const SlabRay &ray, float tmax,
+                       float *tnear)
+{
+  const __m256 ox = _mm256_set1_ps(ray.origin[0]);
+  const __m256 oy = _mm256_set1_ps(ray.origin[1]);
+  const __m256 oz = _mm256_set1_ps(ray.origin[2]);
+  const __m256 ix = _mm256_set1_ps(ray.invDirection[0]);
+  const __m256 iy = _mm256_set1_ps(ray.invDirection[1]);
+  const __m256 iz = _mm256_set1_ps(ray.invDirection[2]);
+
+  const __m256 x0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[0]),ox),ix);
+  const __m256 x1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[3]),ox),ix);
+  const __m256 y0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[1]),oy),iy);
+  const __m256 y1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[4]),oy),iy);
+  const __m256 z0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[2]),oz),iz);
+  const __m256 z1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[5]),oz),iz);
+
+  const __m256 tmin = _mm256_max_ps(
+    _mm256_max_ps(_mm256_min_ps(x0,x1),_mm256_min_ps(y0,y1)),
+    _mm256_max_ps(_mm256_min_ps(z0,z1),_mm256_setzero_ps()));
+  const __m256 tfar = _mm256_min_ps(
+    _mm256_min_ps(_mm256_max_ps(x0,x1),_mm256_max_ps(y0,y1)),
+    _mm256_min_ps(_mm256_max_ps(z0,z1),_mm256_set1_ps(tmax)));
+
+  _mm256_storeu_ps(tnear,tmin);
+  return _mm256_movemask_ps(_mm256_cmp_ps(tmin,tfar,_CMP_LE_OQ));
+}
+#elif defined(RT_SLABTEST_SSE)
+// Without AVX eight boxes are tested as two groups of four.
+template<>
+inline int slabTest<8>(const float (*bounds)[8], const SlabRay &ray, float tmax,
+                       float *tnear)
+{
+  const int lo = slabTestSSE(bounds[0],bounds[1],bounds[2],bounds[3],bounds[4],bounds[5],
+                             ray,tmax,tnear);
+  const int hi = slabTestSSE(bounds[0]+4,bounds[1]+4,bounds[2]+4,bounds[3]+4,bounds[4]+4,bounds[5]+4,
+                             ray,tmax,tnear+4);
+  return lo | (hi<<4);
+}
+#endif
+
+} //namespace rt
+
+#endif //SLABTEST_HPP_INCLUDE_ONCE
@@ -5,8 +5,8 @@
 namespace rt
 {
 
-std::shared_ptr<RayIntersection>
-Sphere::closestIntersectionModel(const Ray &ray, real maxLambda) const
+bool Sphere::closestIntersectionModel(const Ray &ray, real maxLambda,
+                                      HitRecord &hit) const
 {
   // Implicit sphere: (x-c)^2-r^2 = 0
   // r = 1, c=0
@@ -32,7 +32,7 @@ Sphere::closestIntersectionModel(const Ray &ray, real maxLambda) const
 
   //discriminant is negative, no intersection
   if(ds < 0)
-    return nullptr;
+    return false;
 
   real dssqr = sqrt(ds);
 
@@ -46,18 +46,42 @@ Sphere::closestIntersectionModel(const Ray &ray, real maxLambda) const
     lambda = t1;
 
   if(lambda < 0 || lambda > maxLambda)
-    return nullptr;
+    return false;
 
+  hit.lambda    = lambda;
+  hit.primitive = 0;
+  return true;
+}
+
+void Sphere::surfaceModel(const Ray &ray, const HitRecord &hit,
+                          Vec3 &normal, Vec3 &uvw) const
+{
   // Compute intersection point
-  const Vec3 p = ray.pointOnRay(lambda);
+  const Vec3 p = ray.pointOnRay(hit.lambda);
 
   // Compute parameterization of intersection point
   const real theta = std::atan2(p[1], p[0]);
   const real phi   = std::acos (p[2]);
-  const Vec3 uvw(theta,phi,real(0));
 
-  return std::make_shared<SphereRayIntersection>(ray, lambda,
-    shared_from_this(), ray.pointOnRay(lambda),uvw);
+  normal = p;
+  uvw    = Vec3(theta,phi,real(0));
+}
+
+void Sphere::surfaceDifferentialModel(const Ray &ray, const HitRecord &hit,
+                                      const Vec3 &dP, Vec3 &dNormal,
+                                      Vec3 &dUVW) const
+{
+  const Vec3 p = ray.pointOnRay(hit.lambda);
+
+  // The normal of the unit sphere is the position, theta and phi are
+  // singular at the poles
+  const real rho2 = p[0]*p[0]+p[1]*p[1];
+  const real rho  = std::sqrt(rho2);
+
+  dNormal = dP;
+  dUVW    = Vec3(rho2 > 0 ? (p[0]*dP[1]-p[1]*dP[0])/rho2 : real(0),
+                 rho  > 0 ? -dP[2]/rho : real(0),
+                 real(0));
 }
 
 BoundingBox Sphere::computeBoundingBox() const
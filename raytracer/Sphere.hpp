@@ -8,31 +8,25 @@
 namespace rt
 {
 
-class SphereRayIntersection;
-
 //Unit sphere; i.e. sphere centered at origin with radius = 1
 class Sphere : public Renderable
 {
 public:
   /// Implements the intersection computation between ray and sphere.
-  std::shared_ptr<RayIntersection>
-  closestIntersectionModel(const Ray &ray, real maxLambda) const override;
+  bool closestIntersectionModel(const Ray &ray, real maxLambda,
+                                HitRecord &hit) const override;
 
-  // Override this method to recompute the bounding box of this object.
-  BoundingBox computeBoundingBox() const override;
-};
+  /// Computes normal and spherical coordinates of the hit point.
+  void surfaceModel(const Ray &ray, const HitRecord &hit,
+                    Vec3 &normal, Vec3 &uvw) const override;
 
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
+  /// Differentiates normal and spherical coordinates.
+  void surfaceDifferentialModel(const Ray &ray, const HitRecord &hit,
+                                const Vec3 &dP, Vec3 &dNormal,
+                                Vec3 &dUVW) const override;
 
-/// Intersection between sphere and ray.
-class SphereRayIntersection : public RayIntersection
-{
-public:
-  SphereRayIntersection(const Ray &ray,  const real lambda,
-                        std::shared_ptr<const Renderable> renderable,
-                        const Vec3 &normal, const Vec3 &uvw) :
-    RayIntersection(ray,renderable,lambda,normal,uvw) {}
+  // Override this method to recompute the bounding box of this object.
+  BoundingBox computeBoundingBox() const override;
 };
 
 } //namespace rt
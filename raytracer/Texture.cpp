@@ -0,0 +1,179 @@
+#include "Texture.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace rt
+{
+
+Texture::Texture(const Image &image, Filter filter, Wrap wrap) :
+  mFormat(image.format() == Image::RGBA8 ? Image::RGBA8 : Image::RGBA32F),
+  mFilter(filter), mWrap(wrap)
+{
+  if(image.width() == 0 || image.height() == 0)
+    return;
+
+  //level sizes down to 1x1, odd sizes are rounded down
+  size_t width = image.width(), height = image.height(), numTexels = 0;
+  for(;;)
+  {
+    Level level;
+    level.width  = width;
+    level.height = height;
+    level.tilesX = (width+kTileSize-1)/kTileSize;
+    level.offset = numTexels*Image::bytesPerPixel(mFormat);
+    mLevels.push_back(level);
+    numTexels += level.tilesX*((height+kTileSize-1)/kTileSize)*kTileSize*kTileSize;
+
+    if(width == 1 && height == 1)
+      break;
+    width  = std::max(width/2,size_t(1));
+    height = std::max(height/2,size_t(1));
+  }
+  mData.resize(numTexels*Image::bytesPerPixel(mFormat));
+
+  //every level is a 2x2 box filtered version of the previous one, computed
+  //from the unquantized colors
+  std::vector<Vec4> colors(image.width()*image.height());
+  for(size_t y=0;y<image.height();++y)
+    for(size_t x=0;x<image.width();++x)
+      colors[x+image.width()*y] = image.pixel(x,y);
+
+  for(size_t l=0;l<mLevels.size();++l)
+  {
+    const Level &level = mLevels[l];
+    if(l > 0)
+    {
+      const Level &previous = mLevels[l-1];
+      std::vector<Vec4> reduced(level.width*level.height);
+      for(size_t y=0;y<level.height;++y)
+        for(size_t x=0;x<level.width;++x)
+        {
+          const size_t x0 = std::min(2*x,previous.width-1), x1 = std::min(2*x+1,previous.width-1);
+          const size_t y0 = std::min(2*y,previous.height-1), y1 = std::min(2*y+1,previous.height-1);
+          reduced[x+level.width*y] = (colors[x0+previous.width*y0] + colors[x1+previous.width*y0] +
+                                      colors[x0+previous.width*y1] + colors[x1+previous.width*y1])*real(0.25);
+        }
+      colors.swap(reduced);
+    }
+
+    for(size_t y=0;y<level.height;++y)
+      for(size_t x=0;x<level.width;++x)
+        this->setTexel(level,x,y,colors[x+level.width*y]);
+  }
+}
+
+void Texture::setTexel(const Level &level, size_t x, size_t y, const Vec4 &color)
+{
+  const size_t index = this->texelIndex(level,x,y);
+  if(mFormat == Image::RGBA8)
+  {
+    unsigned char *p = &mData[level.offset+4*index];
+    for(int k=0;k<4;++k)
+      p[k] = (unsigned char)(Math::clamp(color[k])*255+real(0.5));
+  }
+  else
+  {
+    float *p = (float*)&mData[level.offset+16*index];
+    for(int k=0;k<4;++k)
+      p[k] = float(color[k]);
+  }
+}
+
+Vec4 Texture::texel(const Level &level, long x, long y) const
+{
+  //x and y are at most one texel outside of the level
+  const long width = long(level.width), height = long(level.height);
+  if(mWrap == Repeat)
+  {
+    x = x < 0 ? x+width  : x >= width  ? x-width  : x;
+    y = y < 0 ? y+height : y >= height ? y-height : y;
+  }
+  else
+  {
+    x = std::min(std::max(x,0L),width-1);
+    y = std::min(std::max(y,0L),height-1);
+  }
+
+  const size_t index = this->texelIndex(level,size_t(x),size_t(y));
+  if(mFormat == Image::RGBA8)
+  {
+    const unsigned char *p = &mData[level.offset+4*index];
+    return Vec4(p[0]/real(255),p[1]/real(255),p[2]/real(255),p[3]/real(255));
+  }
+  const float *p = (const float*)&mData[level.offset+16*index];
+  return Vec4(p[0],p[1],p[2],p[3]);
+}
+
+Vec4 Texture::nearest(size_t level, real u, real v) const
+{
+  const Level &l = mLevels[level];
+  return this->texel(l,long(std::floor(u*l.width)),long(std::floor(v*l.height)));
+}
+
+Vec4 Texture::bilinear(size_t level, real u, real v) const
+{
+  //texel centers are at half integer positions
+  const Level &l = mLevels[level];
+  const real x = u*l.width-real(0.5), y = v*l.height-real(0.5);
+  const real x0 = std::floor(x), y0 = std::floor(y);
+  const real fx = x-x0, fy = y-y0;
+  const long ix = long(x0), iy = long(y0);
+
+  return (this->texel(l,ix,iy  )*(1-fx) + this->texel(l,ix+1,iy  )*fx)*(1-fy) +
+         (this->texel(l,ix,iy+1)*(1-fx) + this->texel(l,ix+1,iy+1)*fx)*fy;
+}
+
+real Texture::levelOfDetail(real dudx, real dvdx, real dudy, real dvdy) const
+{
+  if(mLevels.empty())
+    return 0;
+
+  //footprint in texels of the full resolution level
+  const real w = real(mLevels[0].width), h = real(mLevels[0].height);
+  const real x = (dudx*w)*(dudx*w) + (dvdx*h)*(dvdx*h);
+  const real y = (dudy*w)*(dudy*w) + (dvdy*h)*(dvdy*h);
+  const real size2 = std::max(x,y);
+  return size2 > 1 ? real(0.5)*std::log2(size2) : real(0);
+}
+
+Vec4 Texture::sample(real u, real v, real lod) const
+{
+  if(mLevels.empty())
+    return Vec4(1,1,1,1);
+
+  //reduce to [0,1] so all texel coordinates stay within one texel of the level
+  if(!std::isfinite(u) || !std::isfinite(v))
+    u = v = 0;
+  if(mWrap == Repeat)
+  {
+    u -= std::floor(u);
+    v -= std::floor(v);
+  }
+  else
+  {
+    u = Math::clamp(u);
+    v = Math::clamp(v);
+  }
+
+  const real maxLevel = real(mLevels.size()-1);
+  lod = std::isfinite(lod) ? Math::clamp(lod,real(0),maxLevel) : 0;
+
+  switch(mFilter)
+  {
+  case Nearest:
+    return this->nearest(size_t(lod+real(0.5)),u,v);
+  case Bilinear:
+    return this->bilinear(size_t(lod+real(0.5)),u,v);
+  default:
+  {
+    const size_t level = size_t(lod);
+    const real t = lod-real(level);
+    if(t == 0 || level+1 >= mLevels.size())
+      return this->bilinear(level,u,v);
+    return this->bilinear(level,u,v)*(1-t) + this->bilinear(level+1,u,v)*t;
+  }
+  }
+}
+
+} //namespace rt
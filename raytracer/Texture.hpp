@@ -0,0 +1,88 @@
+#ifndef TEXTURE_HPP_INCLUDE_ONCE
+#define TEXTURE_HPP_INCLUDE_ONCE
+
+#include "Math.hpp"
+#include "Image.hpp"
+
+#include <vector>
+
+namespace rt
+{
+
+/// Filtered texture lookups on an Image. The image is stored with a full
+/// mip pyramid, each level in tiles of 4x4 texels, so the texels of a
+/// bilinear footprint mostly share a cache line (64 bytes for RGBA8).
+/// RGBA8 images keep their format, all others are stored as RGBA32F.
+class Texture
+{
+public:
+  enum Filter
+  {
+    Nearest,    //closest texel of the closest mip level
+    Bilinear,   //bilinear interpolation in the closest mip level
+    Trilinear   //bilinear in the two closest levels, blended by the fraction
+  };
+
+  enum Wrap
+  {
+    Repeat,     //the texture repeats outside [0,1]
+    Clamp       //coordinates are clamped to the border texels
+  };
+
+  explicit Texture(const Image &image, Filter filter=Trilinear, Wrap wrap=Repeat);
+
+  void setFilter(Filter filter) { mFilter=filter; }
+  Filter filter() const { return mFilter; }
+  void setWrap(Wrap wrap) { mWrap=wrap; }
+  Wrap wrap() const { return mWrap; }
+
+  /// Looks up the color at texture coordinates (u,v), where [0,1]^2 covers
+  /// the image. lod is the mip level, 0 is the full resolution and every
+  /// further level halves it. An empty texture is white.
+  Vec4 sample(real u, real v, real lod=0) const;
+
+  /// Mip level whose texels match a footprint with the given derivatives of
+  /// the texture coordinates along the two image axes (the longer axis
+  /// decides, no anisotropic filtering).
+  real levelOfDetail(real dudx, real dvdx, real dudy, real dvdy) const;
+
+  size_t numLevels() const { return mLevels.size(); }
+  size_t width (size_t level=0) const { return mLevels[level].width; }
+  size_t height(size_t level=0) const { return mLevels[level].height; }
+
+  /// Memory of all mip levels in bytes.
+  size_t memory() const { return mData.size(); }
+
+private:
+  static const size_t kTileSize = 4;
+
+  struct Level
+  {
+    size_t width;
+    size_t height;
+    size_t tilesX;
+    size_t offset;      //first byte in mData
+  };
+
+  size_t texelIndex(const Level &level, size_t x, size_t y) const
+  {
+    return (y/kTileSize*level.tilesX + x/kTileSize)*kTileSize*kTileSize +
+           (y%kTileSize)*kTileSize + x%kTileSize;
+  }
+
+  Vec4 texel(const Level &level, long x, long y) const;
+  void setTexel(const Level &level, size_t x, size_t y, const Vec4 &color);
+
+  Vec4 nearest(size_t level, real u, real v) const;
+  Vec4 bilinear(size_t level, real u, real v) const;
+
+  std::vector<Level>         mLevels;
+  std::vector<unsigned char> mData;
+  Image::PixelFormat         mFormat;
+  Filter                     mFilter;
+  Wrap                       mWrap;
+};
+
+} //namespace rt
+
+#endif //TEXTURE_HPP_INCLUDE_ONCE
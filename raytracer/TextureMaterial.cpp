@@ -14,21 +14,28 @@
 namespace rt
 {
   
-  TextureMaterial::TextureMaterial(std::shared_ptr<Image> texture, real reflectance, real shininess) :
+  TextureMaterial::TextureMaterial(std::shared_ptr<Image> texture, real reflectance, real shininess,
+								   Texture::Filter filter, Texture::Wrap wrap) :
+  Material(Vec3(1,1,1),reflectance), mShininess(shininess),
+  mTexture(std::make_shared<Texture>(*texture,filter,wrap))
+  {
+	
+  }
+  TextureMaterial::TextureMaterial(std::shared_ptr<const Texture> texture, real reflectance, real shininess) :
   Material(Vec3(1,1,1),reflectance), mShininess(shininess), mTexture(texture)
   {
 	
   }
-  Vec4 TextureMaterial::shade(std::shared_ptr<RayIntersection> intersection,
+  Vec4 TextureMaterial::shade(const RayIntersection &intersection,
 							const Light& light) const
   {
 	// get normal and light direction
-	Vec3 N = intersection->normal();
-	Vec3 L = (light.position() - intersection->position()).normalized();
+	Vec3 N = intersection.normal();
+	Vec3 L = (light.position() - intersection.position()).normalized();
 	
 	real cosNL = std::max(N.dot(L),real(0));
 	
-	Vec3 V = intersection->ray().direction();
+	Vec3 V = intersection.ray().direction();
 	Vec3 R = util::reflect(L, N);
 	
 	real cosRV = std::max(R.dot(V),real(0));
@@ -37,11 +44,16 @@ namespace rt
 	// This method currently implements a Lambert's material with ideal
 	// diffuse reflection.
 	// Your task is to implement a Phong, or a Blinn-Phong shading model.
-	const Vec3& texcoord = intersection->uvw();
-	Vec4 color = this->mTexture->getTexPixel(texcoord[0], texcoord[1]);
+	const Vec3& texcoord = intersection.uvw();
+	// select the mip level from the footprint of the ray, if known
+	const SurfaceDifferentials &differentials = intersection.differentials();
+	const real lod = differentials.valid ?
+	  this->mTexture->levelOfDetail(differentials.dUVWdx[0], differentials.dUVWdx[1],
+									differentials.dUVWdy[0], differentials.dUVWdy[1]) : real(0);
+	Vec4 color = this->mTexture->sample(texcoord[0], texcoord[1], lod);
 	Vec3 lightcolor = light.spectralIntensity() / 255;
 	Vec3 diffuse = Vec3(color[0],color[1],color[2])*cosNL;
-	Vec3 specular = reflectance() * ((shininess() + 2) / (2 * M_PI)) * pow(cosRV,shininess()) * lightcolor;
+	Vec3 specular = real(reflectance() * ((shininess() + 2) / (2 * M_PI)) * pow(cosRV,shininess())) * lightcolor;
 	return Vec4(diffuse + specular, 1);
   }
   
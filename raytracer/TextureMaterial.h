@@ -11,7 +11,7 @@
 
 
 #include "Material.hpp"
-#include "Image.hpp"
+#include "Texture.hpp"
 
 namespace rt
 {
@@ -22,20 +22,27 @@ namespace rt
   class TextureMaterial : public Material
   {
   public:
+	/// The image is converted into a mipmapped Texture on construction.
 	TextureMaterial(std::shared_ptr<Image> texture,
+				  real reflectance=1.0,
+				  real shininess=10.0,
+				  Texture::Filter filter=Texture::Trilinear,
+				  Texture::Wrap wrap=Texture::Repeat);
+	TextureMaterial(std::shared_ptr<const Texture> texture,
 				  real reflectance=1.0,
 				  real shininess=10.0);
 	
-	Vec4 shade(std::shared_ptr<RayIntersection> intersection,
+	Vec4 shade(const RayIntersection &intersection,
 			   const Light& light) const override;
 	
 	real shininess() const { return mShininess; }
+	const Texture &texture() const { return *mTexture; }
 	
   private:
 	
 	real mShininess;
   protected:
-	std::shared_ptr<Image> mTexture;
+	std::shared_ptr<const Texture> mTexture;
   };
   
 }
@@ -0,0 +1,78 @@
+#include "TileScheduler.hpp"
+#include <thread>
+#include <algorithm>
+
+namespace rt
+{
+
+TileScheduler::TileScheduler(size_t width, size_t height, size_t tileSize, size_t numWorkers)
+{
+  tileSize   = std::max(tileSize, size_t(1));
+  numWorkers = std::max(numWorkers, size_t(1));
+
+  const size_t tilesX = (width  + tileSize - 1) / tileSize;
+  const size_t tilesY = (height + tileSize - 1) / tileSize;
+  mNumTiles = tilesX * tilesY;
+
+  for(size_t i=0;i<numWorkers;++i)
+    mQueues.push_back(std::unique_ptr<Queue>(new Queue()));
+
+  // Each worker initially gets a contiguous run of tiles in scanline order,
+  // which keeps neighbouring pixels (and their rays) on the same core.
+  for(size_t t=0;t<mNumTiles;++t)
+  {
+    Tile tile;
+    tile.x0 = (t % tilesX) * tileSize;
+    tile.y0 = (t / tilesX) * tileSize;
+    tile.x1 = std::min(tile.x0 + tileSize, width);
+    tile.y1 = std::min(tile.y0 + tileSize, height);
+
+    mQueues[(t * numWorkers) / mNumTiles]->tiles.push_back(tile);
+  }
+}
+
+bool TileScheduler::next(size_t worker, Tile &tile)
+{
+  if(popFront(*mQueues[worker], tile))
+    return true;
+
+  // Own queue is drained, steal from the back of the others. Start with
+  // the next worker to spread thieves over different victims.
+  for(size_t i=1;i<mQueues.size();++i)
+  {
+    Queue &victim = *mQueues[(worker + i) % mQueues.size()];
+    if(popBack(victim, tile))
+    {
+      ++mQueues[worker]->stolen;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TileScheduler::popFront(Queue &queue, Tile &tile)
+{
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if(queue.tiles.empty())
+    return false;
+  tile = queue.tiles.front();
+  queue.tiles.pop_front();
+  return true;
+}
+
+bool TileScheduler::popBack(Queue &queue, Tile &tile)
+{
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if(queue.tiles.empty())
+    return false;
+  tile = queue.tiles.back();
+  queue.tiles.pop_back();
+  return true;
+}
+
+size_t TileScheduler::defaultNumThreads()
+{
+  return std::max(size_t(std::thread::hardware_concurrency()), size_t(1));
+}
+
+} //namespace rt
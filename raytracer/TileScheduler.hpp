@@ -0,0 +1,65 @@
+#ifndef TILESCHEDULER_HPP_INCLUDE_ONCE
+#define TILESCHEDULER_HPP_INCLUDE_ONCE
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+
+namespace rt
+{
+
+/// Rectangular image region [x0,x1) x [y0,y1) rendered as one unit of work.
+struct Tile
+{
+  size_t x0, y0;
+  size_t x1, y1;
+};
+
+/// Splits an image into square tiles and hands them out to a fixed number
+/// of workers. Every worker owns a queue of neighbouring tiles which it
+/// processes front to back. A worker running out of tiles steals from the
+/// back of the other queues, so expensive image regions do not stall the
+/// remaining threads.
+class TileScheduler
+{
+public:
+  /// Creates the tiles for a width x height image. The last row and column
+  /// of tiles is clipped to the image, so every pixel is covered exactly once.
+  TileScheduler(size_t width, size_t height, size_t tileSize, size_t numWorkers);
+
+  /// Fetches the next tile for the given worker. Returns false once all
+  /// tiles of all queues have been handed out.
+  bool next(size_t worker, Tile &tile);
+
+  size_t numTiles()   const { return mNumTiles; }
+  size_t numWorkers() const { return mQueues.size(); }
+
+  /// Returns the number of tiles a worker has taken from another queue.
+  size_t numStolen(size_t worker) const { return mQueues[worker]->stolen; }
+
+  /// Returns the number of threads to use if numThreads is 0, i.e. the
+  /// number of hardware threads (at least 1).
+  static size_t defaultNumThreads();
+
+private:
+
+  // Queues are allocated separately so workers do not share cache lines.
+  struct Queue
+  {
+    Queue() : stolen(0) {}
+    std::mutex       mutex;
+    std::deque<Tile> tiles;
+    size_t           stolen;
+  };
+
+  bool popFront(Queue &queue, Tile &tile);
+  bool popBack (Queue &queue, Tile &tile);
+
+  size_t mNumTiles;
+  std::vector<std::unique_ptr<Queue>> mQueues;
+};
+
+} //namespace rt
+
+#endif //TILESCHEDULER_HPP_INCLUDE_ONCE
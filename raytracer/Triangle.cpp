@@ -16,24 +16,61 @@ Triangle::Triangle(const Vec3 &v0, const Vec3 &v1, const Vec3 &v2,
   mUVW[2] = uvw2;
 }
 
-std::shared_ptr<RayIntersection>
-Triangle::closestIntersectionModel(const Ray &ray, real maxLambda) const
+bool Triangle::closestIntersectionModel(const Ray &ray, real maxLambda,
+                                        HitRecord &hit) const
 {
   Vec3 bary;
   real lambda;
 
   if(!Intersection::lineTriangle(ray,mVertices[0],mVertices[1],mVertices[2],bary,lambda))
-    return nullptr;
+    return false;
 
   // Intersection is inside triangle if 0<=u,v,w<=1
   if(lambda<0 || lambda>maxLambda)
-    return nullptr;
+    return false;
 
-  const Vec3 normal = util::cross(mVertices[1]-mVertices[0],mVertices[2]-mVertices[0]).normalized();
-  const Vec3 uvw = mUVW[0]*bary[0]+mUVW[1]*bary[1]+mUVW[2]*bary[2];
+  hit.lambda    = lambda;
+  hit.primitive = 0;
+  hit.bary      = bary;
+  return true;
+}
+
+int Triangle::closestIntersectionsModel(const RayPacket &packet, int mask,
+                                        real *maxLambda, HitRecord *hits) const
+{
+  real bary[3][RayPacket::kMaxSize], lambda[RayPacket::kMaxSize];
+  const int inside = Intersection::lineTriangle(packet,mask,mVertices[0],mVertices[1],mVertices[2],bary,lambda);
+
+  int hitMask = 0;
+  for(int m=inside;m;m&=m-1)
+  {
+    const int l = lowestLane(m);
+    if(lambda[l]<0 || lambda[l]>maxLambda[l])
+      continue;
+    maxLambda[l]      = lambda[l];
+    hits[l].lambda    = lambda[l];
+    hits[l].primitive = 0;
+    hits[l].bary      = Vec3(bary[0][l],bary[1][l],bary[2][l]);
+    hitMask |= 1<<l;
+  }
+  return hitMask;
+}
 
-    return std::make_shared<TriangleRayIntersection>(ray, lambda, shared_from_this(),normal,uvw);
-                                
+void Triangle::surfaceModel(const Ray &ray, const HitRecord &hit,
+                            Vec3 &normal, Vec3 &uvw) const
+{
+  const Vec3 &bary = hit.bary;
+  normal = util::cross(mVertices[1]-mVertices[0],mVertices[2]-mVertices[0]).normalized();
+  uvw    = mUVW[0]*bary[0]+mUVW[1]*bary[1]+mUVW[2]*bary[2];
+}
+
+void Triangle::surfaceDifferentialModel(const Ray &/*ray*/, const HitRecord &/*hit*/,
+                                        const Vec3 &dP, Vec3 &dNormal,
+                                        Vec3 &dUVW) const
+{
+  const Vec3 dBary = Intersection::barycentricDifferential(mVertices[0],mVertices[1],mVertices[2],dP);
+  dNormal = Vec3(0,0,0);
+  dUVW    = mUVW[0]*dBary[0]+mUVW[1]*dBary[1]+mUVW[2]*dBary[2];
 }
 
 } //namespace rt
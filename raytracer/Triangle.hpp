@@ -8,7 +8,6 @@
 namespace rt
 {
 
-class TriangleRayIntersection;
 
 /// Triangle defined by position and radius.
 class Triangle : public Renderable
@@ -19,8 +18,21 @@ public:
             const Vec3 &uvw2=Vec3(0,0,0));
 
   /// Implements the intersection computation between ray and Triangle.
-  std::shared_ptr<RayIntersection>
-  closestIntersectionModel(const Ray &ray, real maxLambda) const override;
+  bool closestIntersectionModel(const Ray &ray, real maxLambda,
+                                HitRecord &hit) const override;
+
+  /// Tests all lanes of a packet against the triangle at once.
+  int closestIntersectionsModel(const RayPacket &packet, int mask,
+                                real *maxLambda, HitRecord *hits) const override;
+
+  /// Computes the face normal and interpolates the uvw parameters.
+  void surfaceModel(const Ray &ray, const HitRecord &hit,
+                    Vec3 &normal, Vec3 &uvw) const override;
+
+  /// Differentiates the barycentric interpolation of the uvw parameters.
+  void surfaceDifferentialModel(const Ray &ray, const HitRecord &hit,
+                                const Vec3 &dP, Vec3 &dNormal,
+                                Vec3 &dUVW) const override;
 
 private:
 
@@ -29,19 +41,6 @@ private:
   Vec3 mUVW[3];
 };
 
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
-
-/// Intersection between Triangle and ray.
-class TriangleRayIntersection : public RayIntersection
-{
-public:
-  TriangleRayIntersection(const Ray &ray, const real lambda,
-                          std::shared_ptr<const Renderable> renderable,
-                          const Vec3 &normal, const Vec3 &uvw) :
-    RayIntersection(ray,renderable,lambda,normal,uvw) {}
-};
-
 } //namespace rt
 
 #endif //_Triangle_HPP_INCLUDE_ONCE
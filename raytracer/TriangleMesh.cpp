@@ -3,61 +3,99 @@
 
 namespace rt
 {
+void TriangleMesh::initialize()
+{
+  std::vector<BoundingBox> boxes(mTriangles.size());
+  for (size_t i=0;i<mTriangles.size();++i)
+  {
+    const TriangleElement &tri = mTriangles[i];
+    boxes[i].expandByPoint(tri.v0);
+    boxes[i].expandByPoint(tri.v1);
+    boxes[i].expandByPoint(tri.v2);
+  }
 
+  // refit() falls back to a full build for a changed number of triangles
+  if (mTree.numPrimitives() > 0)
+    mTree.refit(boxes);
+  else
+    mTree.build(boxes);
+}
 
-std::shared_ptr<RayIntersection>  TriangleMesh::closestIntersectionModel(const Ray &ray,
-                                                                         real maxLambda) const
+bool TriangleMesh::closestIntersectionModel(const Ray &ray, real maxLambda,
+                                            HitRecord &hit) const
 {
   real closestLambda = maxLambda;
   Vec3 closestbary;
   int  closestTri = -1;
 
-  Vec3 bary;
-  real lambda;
-
-  // Loop over all stored triangles to find a possible intersection between ray 
-  // and any triangle
-  for (size_t i=0;i<mTriangles.size();++i)
+  // Traverse the BVH to find the closest intersection between ray and any
+  // triangle, every hit shrinks the ray
+  mTree.closestIntersection(ray, closestLambda,
+    [&](int i, real &lambdaMax) -> bool
   {
     const TriangleElement &tri = mTriangles[i];
 
+    Vec3 bary;
+    real lambda;
     if (Intersection::lineTriangle(ray,tri.v0,tri.v1,tri.v2,bary,lambda) &&
-      lambda > 0 && lambda < closestLambda)
+      lambda > 0 && lambda < lambdaMax)
     {
-      closestLambda = lambda;
+      lambdaMax = lambda;
       closestbary = bary;
-      closestTri = (int)i;
+      closestTri = i;
+      return true;
     }
-  }
+    return false;
+  });
 
-  // If an intersection occurred, compute the normal and the uv coordinates based
-  // on the barycentric coordinates of the hit point
-  if (closestTri >= 0)
-  {
-    const TriangleElement &tri = mTriangles[closestTri];
-    Vec3 n = (tri.n0*closestbary[0]+tri.n1*closestbary[1]+
-              tri.n2*closestbary[2]).normalized();
-    Vec3 uvw = tri.uvw0*closestbary[0]+tri.uvw1*closestbary[1]+
-               tri.uvw2*closestbary[2];
-    return std::make_shared<TriangleMeshRayIntersection>(ray, closestLambda,
-                                                         shared_from_this(),n,uvw);
-  }
+  if (closestTri < 0)
+    return false;
 
-  return nullptr;
+  hit.lambda    = closestLambda;
+  hit.primitive = closestTri;
+  hit.bary      = closestbary;
+  return true;
+}
+
+void TriangleMesh::surfaceModel(const Ray &ray, const HitRecord &hit,
+                                Vec3 &normal, Vec3 &uvw) const
+{
+  // compute the normal and the uv coordinates based on the barycentric
+  // coordinates of the hit point
+  const TriangleElement &tri = mTriangles[hit.primitive];
+  const Vec3 &bary = hit.bary;
+  normal = (tri.n0*bary[0]+tri.n1*bary[1]+tri.n2*bary[2]).normalized();
+  uvw    = tri.uvw0*bary[0]+tri.uvw1*bary[1]+tri.uvw2*bary[2];
+}
+
+void TriangleMesh::surfaceDifferentialModel(const Ray &/*ray*/, const HitRecord &hit,
+                                            const Vec3 &dP, Vec3 &dNormal,
+                                            Vec3 &dUVW) const
+{
+  const TriangleElement &tri = mTriangles[hit.primitive];
+  const Vec3 &bary = hit.bary;
+  const Vec3 dBary = Intersection::barycentricDifferential(tri.v0,tri.v1,tri.v2,dP);
+
+  // derivative of the normalized interpolated normal
+  const Vec3 n  = tri.n0*bary[0]+tri.n1*bary[1]+tri.n2*bary[2];
+  const Vec3 dn = tri.n0*dBary[0]+tri.n1*dBary[1]+tri.n2*dBary[2];
+  const Vec3 normal = n.normalized();
+  dNormal = (dn - normal*(normal|dn))/n.norm();
+  dUVW    = tri.uvw0*dBary[0]+tri.uvw1*dBary[1]+tri.uvw2*dBary[2];
 }
 
 bool TriangleMesh::anyIntersectionModel(const Ray &ray, real maxLambda) const
 {
-  Vec3 uvw;
-  real lambda;
-  for (size_t i=0;i<mTriangles.size();++i)
+  return mTree.anyIntersection(ray, maxLambda,
+    [&](int i, real &lambdaMax) -> bool
   {
     const TriangleElement &tri = mTriangles[i];
-    if (Intersection::lineTriangle(ray,tri.v0,tri.v1,tri.v2,uvw,lambda) &&
-      lambda > 0 && lambda < maxLambda)
-      return true;
-  }
-  return false;
+
+    Vec3 uvw;
+    real lambda;
+    return Intersection::lineTriangle(ray,tri.v0,tri.v1,tri.v2,uvw,lambda) &&
+      lambda > 0 && lambda < lambdaMax;
+  });
 }
 
 BoundingBox TriangleMesh::computeBoundingBox() const
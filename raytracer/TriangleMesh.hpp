@@ -3,13 +3,14 @@
 
 #include "Renderable.hpp"
 #include "Triangle.hpp"
+#include "BVTree.hpp"
 
 namespace rt
 {
 
 /// Stores a collection of triangles (or rather TriangleElements)
 /// Supports the intersection test of a ray with any of the stored
-/// triangles ( linear time w.r.t. the number of triangles).
+/// triangles using a BVH, which is built or refitted by initialize().
 class TriangleMesh : public Renderable
 {
 private:
@@ -59,10 +60,15 @@ private:
   };
 
 public:
-  
+
+  /// Builds the BVH over the triangles. If the number of triangles did not
+  /// change since the last call, the BVH is only refitted to the moved
+  /// triangles (see BVTree::refit).
+  void initialize() override;
+
   /// Implements the intersection computation between ray and any stored triangle.
-  std::shared_ptr<RayIntersection>
-    closestIntersectionModel(const Ray &ray, real maxLambda) const override;
+  bool closestIntersectionModel(const Ray &ray, real maxLambda,
+                                HitRecord &hit) const override;
 
   bool anyIntersectionModel(const Ray &ray, real maxLambda) const override;
 
@@ -84,25 +90,25 @@ public:
 
 protected:
 
+  /// Removes all triangles, e.g. before the mesh is tessellated again.
+  void clearTriangles() { mTriangles.clear(); }
+
   // Override this method to recompute the bounding box of this object.
   BoundingBox computeBoundingBox() const override;
 
-private:
-  std::vector<TriangleElement> mTriangles;
+  /// Interpolates normal and uv coordinates of the hit triangle.
+  void surfaceModel(const Ray &ray, const HitRecord &hit,
+                    Vec3 &normal, Vec3 &uvw) const override;
 
-};
+  /// Differentiates the interpolated normal and uv coordinates.
+  void surfaceDifferentialModel(const Ray &ray, const HitRecord &hit,
+                                const Vec3 &dP, Vec3 &dNormal,
+                                Vec3 &dUVW) const override;
 
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
+private:
+  std::vector<TriangleElement> mTriangles;
+  BVTree                       mTree;
 
-/// Intersection between plane and ray.
-class TriangleMeshRayIntersection : public RayIntersection
-{
-public:
-  TriangleMeshRayIntersection(const Ray &ray, const real lambda,
-    std::shared_ptr<const Renderable> renderable,
-    const Vec3 &normal, const Vec3 &uvw) :
-  RayIntersection(ray,renderable,lambda,normal,uvw) {}
 };
 
 } //namespace rt
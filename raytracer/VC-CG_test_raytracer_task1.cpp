@@ -84,21 +84,21 @@ std::shared_ptr<rt::Scene> makeTask1Scene()
   // Intersect ray with triangle
   rt::Ray ray(rt::Vec3(5,0,5),rt::Vec3(-1,3/20.0,-1));
   rt::real maxLambda(1000);
-  std::shared_ptr<rt::RayIntersection> isect1=  triangle->closestIntersection(ray,maxLambda);
-  if(isect1)
+  rt::HitRecord hit1;
+  if(triangle->closestIntersection(ray,maxLambda,hit1))
   {
     std::cout << "Ray-Triangle Intersection at "<<std::endl;
-    std::cout<<isect1->position()<<std::endl;
+    std::cout<<triangle->intersection(ray,hit1).position()<<std::endl;
   }
   else
     std::cout<<"No Ray-Triangle Intersection"<<std::endl;
 
   // Intersect ray with sphere with c=(0,1,1) and radius r=1.5
-  std::shared_ptr<rt::RayIntersection> isect2=  sphere2->closestIntersection(ray,maxLambda);
-  if(isect2)
+  rt::HitRecord hit2;
+  if(sphere2->closestIntersection(ray,maxLambda,hit2))
   {
     std::cout << "Ray-Sphere Intersection at "<<std::endl;
-    std::cout<<isect2->position()<<std::endl;
+    std::cout<<sphere2->intersection(ray,hit2).position()<<std::endl;
   }
   else
     std::cout<<"No Ray-Sphere Intersection"<<std::endl;
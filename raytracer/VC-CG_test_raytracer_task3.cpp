@@ -12,12 +12,83 @@
 #include "Timer.hpp"
 #include <sstream>
 #include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+
+#if defined(__linux__)
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
 
 #include "BezierPatchMesh.hpp"
 #include "CheckerMaterial.hpp"
 
 #include "BVHIndexedTriangleMesh.hpp"
+#include "IndexedTriangleIO.hpp"
+#include "MeshFile.hpp"
 #include "PhongMaterial.hpp"
+#include "Intersection.hpp"
+
+// Counts all heap allocations of the program. Used to check that tracing
+// rays does not touch the heap.
+static std::atomic<size_t> gNumAllocations(0);
+
+// GCC 11+ inlines the replacements below into their callers and then takes
+// the free of memory from operator new for a mismatch
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+  ++gNumAllocations;
+  if(void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+  ::operator delete(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+//Traces all primary rays of the camera (without shading) and prints the
+//number of heap allocations per ray.
+void printAllocationsPerPrimaryRay(std::shared_ptr<rt::Scene> scene)
+{
+  const rt::Camera &camera = *scene->camera();
+  const size_t numRays = camera.xResolution()*camera.yResolution();
+  size_t numHits = 0;
+
+  const size_t allocationsBefore = gNumAllocations;
+  for(size_t y=0;y<camera.yResolution();++y)
+    for(size_t x=0;x<camera.xResolution();++x)
+    {
+      rt::HitRecord hit;
+      if(scene->closestIntersection(camera.ray(x,y),hit))
+        ++numHits;
+    }
+  const size_t allocations = gNumAllocations - allocationsBefore;
+
+  std::cout << "Primary rays: " << numRays << " (" << numHits << " hits), "
+            << "heap allocations per ray: " << rt::real(allocations)/rt::real(std::max(numRays,size_t(1)))
+            << std::endl;
+}
 
 //Creates a cuboid podium
 std::shared_ptr<rt::Renderable> makePodium()
@@ -313,6 +384,7 @@ std::shared_ptr<rt::Scene> makeMeshScene(std::string fileName)
 
   std::shared_ptr<rt::BVHIndexedTriangleMesh> mesh = std::make_shared<rt::BVHIndexedTriangleMesh>();
   mesh->loadFromOBJ(fileName);
+  mesh->setBVHCacheFile(fileName+".bvh");
 
   std::cout<<"Loaded BVHMesh with "<<mesh->triangleIndices().size()/3<<
     " triangles and "<< mesh->vertexPositions().size()<<" vertices"<<std::endl;
@@ -360,6 +432,7 @@ std::shared_ptr<rt::Scene> makeMeshScene(std::string fileName, std::string texFi
   
   std::shared_ptr<rt::BVHIndexedTriangleMesh> mesh = std::make_shared<rt::BVHIndexedTriangleMesh>();
   mesh->loadFromOBJ(fileName);
+  mesh->setBVHCacheFile(fileName+".bvh");
   
   std::cout<<"Loaded BVHMesh with "<<mesh->triangleIndices().size()/3<<
   " triangles and "<< mesh->vertexPositions().size()<<" vertices"<<std::endl;
@@ -369,8 +442,550 @@ std::shared_ptr<rt::Scene> makeMeshScene(std::string fileName, std::string texFi
   return scene;
 }
 
-int main()
+//Builds the BVH of a mesh with both construction algorithms and prints
+//build time, tree size and SAH costs for comparison.
+void compareBVHBuilders(const std::string &fileName)
+{
+  rt::IndexedTriangleIO io;
+  if(!io.loadFromOBJ(fileName))
+    return;
+
+  const std::vector<int> &indices = io.triangleIndices();
+  const rt::ArrayRef<rt::Vec3i> triangles((const rt::Vec3i*)indices.data(),indices.size()/3);
+  std::cout<<fileName<<": "<<triangles.size()<<" triangles"<<std::endl;
+
+  const rt::BVTree::BuildMethod methods[2] = {rt::BVTree::SweepSAH, rt::BVTree::BinnedSAH};
+  const char *names[2] = {"sweep SAH ", "binned SAH"};
+  for(int i=0;i<2;++i)
+  {
+    rt::BVTree tree;
+    tree.setBuildMethod(methods[i]);
+    tree.build(io.vertexPositions(),triangles);
+    std::cout<<"  "<<names[i]<<": "<<tree.buildTime()<<"s, "
+             <<tree.numNodes()<<" nodes, "<<tree.numLeaves()<<" leaves, "
+             <<"SAH cost "<<tree.sahCost()<<std::endl;
+  }
+}
+
+void printMemoryFootprint(const std::string &fileName)
+{
+  rt::IndexedTriangleIO io;
+  if(!io.loadFromOBJ(fileName))
+    return;
+
+  const std::vector<int> &indices = io.triangleIndices();
+  const rt::ArrayRef<rt::Vec3i> triangles((const rt::Vec3i*)indices.data(),indices.size()/3);
+  const size_t meshBytes = (io.vertexPositions().size()+io.vertexNormals().size()
+    +io.vertexTextureCoordinates().size())*sizeof(rt::Vec3)+triangles.size()*sizeof(rt::Vec3i);
+  std::cout<<fileName<<": "<<triangles.size()<<" triangles, mesh "<<meshBytes/1024<<" KiB"<<std::endl;
+
+  const int branchingFactors[3] = {2, 4, 8};
+  for(int i=0;i<3;++i)
+  {
+    rt::BVTree tree;
+    tree.setBranchingFactor(branchingFactors[i]);
+    tree.build(io.vertexPositions(),triangles);
+    std::cout<<"  BVH"<<branchingFactors[i]<<": nodes "<<tree.nodeMemory()/1024<<" KiB"
+             <<" (build tree "<<tree.buildNodeMemory()/1024<<" KiB), primitive indices "
+             <<tree.primitiveIndexMemory()/1024<<" KiB"<<std::endl;
+  }
+}
+
+//Converts a mesh to the binary mesh format and compares the time until
+//the mesh is ready for rendering (loaded, BVH built, bounds computed).
+void benchmarkMeshLoading(const std::string &fileName)
+{
+  const std::string meshFileName = fileName+".rtmesh";
+  if(!rt::MeshFile::convertFromOBJ(fileName,meshFileName))
+    return;
+
+  typedef std::chrono::steady_clock Clock;
+  for(int i=0;i<2;++i)
+  {
+    const Clock::time_point start = Clock::now();
+    rt::BVHIndexedTriangleMesh mesh;
+    const bool loaded = i == 0 ? mesh.loadFromOBJ(fileName) : mesh.loadFromMeshFile(meshFileName);
+    const Clock::time_point loadedTime = Clock::now();
+    if(!loaded)
+      return;
+    mesh.initialize();
+    mesh.updateBoundingBox();
+    const Clock::time_point readyTime = Clock::now();
+
+    std::cout<<(i == 0 ? fileName : meshFileName)<<": "<<mesh.triangleIndices().size()/3<<" triangles, load "
+             <<std::chrono::duration<double>(loadedTime-start).count()<<"s, ready to render "
+             <<std::chrono::duration<double>(readyTime-start).count()<<"s"<<std::endl;
+  }
+}
+
+//Writes an 8K frame as TGA and the given mesh as OBJ and reports the
+//throughput of both writers. The written files are removed afterwards.
+void benchmarkWriters(const std::string &fileName)
+{
+  rt::Image image(7680,4320);
+  for(size_t j=0;j<image.height();++j)
+    for(size_t i=0;i<image.width();++i)
+    {
+      rt::Vec4 color(rt::real(i)/image.width(),rt::real(j)/image.height(),0.5,1);
+      image.setPixel(color,i,j);
+    }
+
+  rt::WriteStatistics statistics;
+  if(image.saveToTGA("write_benchmark.tga",&statistics))
+    std::cout<<"TGA 7680x4320 ("<<image.memory()/(1024*1024)<<" MiB framebuffer): "<<statistics.bytes/1024<<" KiB in "<<statistics.seconds<<"s, "
+             <<statistics.bytesPerSecond()/(1024*1024)<<" MiB/s"<<std::endl;
+  std::remove("write_benchmark.tga");
+
+  rt::IndexedTriangleIO io;
+  if(io.loadFromOBJ(fileName) && io.saveToOBJ("write_benchmark.obj",true,true,&statistics))
+    std::cout<<"OBJ "<<fileName<<": "<<statistics.bytes/1024<<" KiB in "<<statistics.seconds<<"s, "
+             <<statistics.bytesPerSecond()/(1024*1024)<<" MiB/s"<<std::endl;
+  std::remove("write_benchmark.obj");
+}
+
+//Renders the task scenes and reports the primary ray throughput of this
+//build's precision (see RT_USE_FLOAT in Math.hpp). The images are kept as
+//precision_<scene>_<float|double>.tga, if the other build has written its
+//images before, the pixel differences to them are printed as well.
+void benchmarkPrecision(size_t resolution)
+{
+  const bool isFloat = sizeof(rt::real) == sizeof(float);
+  const char *precision = isFloat ? "float" : "double";
+  const char *other     = isFloat ? "double" : "float";
+
+  std::shared_ptr<rt::Scene> meshScene = makeMeshScene("rubberduck.obj");
+  std::shared_ptr<rt::Camera> meshCamera = std::make_shared<rt::PerspectiveCamera>();
+  meshCamera->setPosition(rt::Vec3(0,5,5));
+  meshCamera->setFOV(60.0,60.0);
+  meshScene->setCamera(meshCamera);
+
+  const std::shared_ptr<rt::Scene> scenes[3] = {makeTask2Scene(), makeTask3Scene(), meshScene};
+  const char *names[3] = {"task2", "task3", "mesh"};
+
+  std::cout<<"real = "<<precision<<" ("<<sizeof(rt::real)<<" bytes), "
+           <<resolution<<"x"<<resolution<<" pixels"<<std::endl;
+
+  typedef std::chrono::steady_clock Clock;
+  for(int i=0;i<3;++i)
+  {
+    std::shared_ptr<rt::Image> image = std::make_shared<rt::Image>(resolution,resolution);
+    rt::Raytracer raytracer;
+    raytracer.setScene(scenes[i]);
+    raytracer.renderToImage(image); //builds the BVHs
+
+    // best of three renders
+    double seconds = std::numeric_limits<double>::infinity();
+    for(int k=0;k<3;++k)
+    {
+      const Clock::time_point start = Clock::now();
+      raytracer.renderToImage(image);
+      seconds = std::min(seconds,std::chrono::duration<double>(Clock::now()-start).count());
+    }
+
+    const std::string fileName = std::string("precision_")+names[i]+"_"+precision+".tga";
+    const std::string otherName = std::string("precision_")+names[i]+"_"+other+".tga";
+    image->saveToTGA(fileName);
+    std::cout<<"  "<<names[i]<<": "<<seconds<<"s, "
+             <<double(resolution*resolution)/seconds/1e6<<" Mrays/s (primary)";
+
+    const rt::Image written(fileName), reference(otherName);
+    if(reference.width() == written.width() && reference.height() == written.height())
+    {
+      int maxDifference = 0;
+      size_t numDifferent = 0;
+      for(size_t y=0;y<written.height();++y)
+        for(size_t x=0;x<written.width();++x)
+        {
+          const rt::Vec4 a = written.pixel(x,y), b = reference.pixel(x,y);
+          int difference = 0;
+          for(int c=0;c<3;++c)
+            difference = std::max(difference,int(std::fabs(a[c]-b[c])*255+rt::real(0.5)));
+          maxDifference = std::max(maxDifference,difference);
+          numDifferent += difference > 2;
+        }
+      std::cout<<", vs "<<other<<": max difference "<<maxDifference<<"/255, "
+               <<numDifferent<<" pixels off by more than 2";
+    }
+    std::cout<<std::endl;
+  }
+}
+
+//Times the vector and matrix operations of the inner loops: the triangle
+//test of Intersection::linePlane, Ray::transformed as done for every
+//renderable and a Phong shader evaluation. Build once more with
+//UTIL_NO_SIMD defined to compare against the generic Vector code.
+void benchmarkVectorOperations()
+{
+#if defined(UTIL_VECTOR_AVX)
+  std::cout<<"Vector kernels: SSE2 + AVX";
+#elif defined(UTIL_VECTOR_SSE2)
+  std::cout<<"Vector kernels: SSE2";
+#else
+  std::cout<<"Vector kernels: generic";
+#endif
+  std::cout<<", real = "<<(sizeof(rt::real) == sizeof(float) ? "float" : "double")<<std::endl;
+
+  const size_t n = 4096, repetitions = 500;
+  std::vector<rt::Ray>  rays(n);
+  std::vector<rt::Vec3> vertices(3*n);
+  for(size_t i=0;i<n;++i)
+  {
+    const rt::real t = rt::real(i)/n;
+    rays[i] = rt::Ray(rt::Vec3(t,-5,1-t),rt::Vec3(t-rt::real(0.5),1,rt::real(0.25)-t));
+    vertices[3*i+0] = rt::Vec3(-1+t,0,-1);
+    vertices[3*i+1] = rt::Vec3( 1,t,-1);
+    vertices[3*i+2] = rt::Vec3( 0,0, 1+t);
+  }
+  rt::Mat4 transform;
+  transform.rotate(rt::Vec3(1,2,3),0.5);
+  transform.scale(rt::Vec3(2,1,rt::real(0.5)));
+  transform.translate(rt::Vec3(1,-2,3));
+
+  std::shared_ptr<rt::PhongMaterial> material = std::make_shared<rt::PhongMaterial>(rt::Vec3(1.0,0.4,0.1),0.8,50.0);
+  const rt::Light light(rt::Vec3(5.0,2.0,6.0),rt::Vec3(200,170,150));
+
+  typedef std::chrono::steady_clock Clock;
+  rt::real checksum = 0;
+
+  Clock::time_point start = Clock::now();
+  for(size_t r=0;r<repetitions;++r)
+    for(size_t i=0;i<n;++i)
+    {
+      rt::Vec3 uvw;
+      rt::real lambda;
+      if(rt::Intersection::linePlane(rays[i],vertices[3*i],vertices[3*i+1],vertices[3*i+2],uvw,lambda))
+        checksum += lambda + uvw[0];
+    }
+  const double linePlaneSeconds = std::chrono::duration<double>(Clock::now()-start).count();
+
+  start = Clock::now();
+  for(size_t r=0;r<repetitions;++r)
+    for(size_t i=0;i<n;++i)
+    {
+      const rt::Ray ray = rays[i].transformed(transform);
+      checksum += ray.origin()[0] + ray.direction()[1];
+    }
+  const double transformSeconds = std::chrono::duration<double>(Clock::now()-start).count();
+
+  start = Clock::now();
+  for(size_t r=0;r<repetitions;++r)
+    for(size_t i=0;i<n;++i)
+    {
+      const rt::RayIntersection intersection(rays[i],nullptr,rt::real(4.5),
+                                             vertices[3*i+2].normalized(),rt::Vec3(0,0,0));
+      checksum += material->shade(intersection,light)[0];
+    }
+  const double shadeSeconds = std::chrono::duration<double>(Clock::now()-start).count();
+
+  const double numCalls = double(n*repetitions);
+  std::cout<<"  Intersection::linePlane: "<<linePlaneSeconds/numCalls*1e9<<" ns"<<std::endl
+           <<"  Ray::transformed:        "<<transformSeconds/numCalls*1e9<<" ns"<<std::endl
+           <<"  PhongMaterial::shade:    "<<shadeSeconds/numCalls*1e9<<" ns"<<std::endl
+           <<"  (checksum "<<checksum<<")"<<std::endl;
+}
+
+//Compares tracing the primary rays one by one with packets of 4, 8 and 16
+//rays for the task scenes: the time of the closest hit queries alone and
+//of full renders, and whether the images match the single ray image.
+void benchmarkPackets(size_t resolution)
+{
+  std::shared_ptr<rt::Scene> meshScene = makeMeshScene("rubberduck.obj");
+  std::shared_ptr<rt::Camera> meshCamera = std::make_shared<rt::PerspectiveCamera>();
+  meshCamera->setPosition(rt::Vec3(0,5,5));
+  meshCamera->setFOV(60.0,60.0);
+  meshScene->setCamera(meshCamera);
+
+  const std::shared_ptr<rt::Scene> scenes[3] = {makeTask2Scene(), makeTask3Scene(), meshScene};
+  const char *names[3] = {"task2", "task3", "mesh"};
+  const size_t packetSizes[4] = {1, 4, 8, 16};
+
+  std::cout<<resolution<<"x"<<resolution<<" pixels, best of three"<<std::endl;
+
+  typedef std::chrono::steady_clock Clock;
+  for(int i=0;i<3;++i)
+  {
+    rt::Scene &scene = *scenes[i];
+    std::shared_ptr<rt::Image> reference = std::make_shared<rt::Image>(resolution,resolution);
+    rt::Raytracer raytracer;
+    raytracer.setScene(scenes[i]);
+    raytracer.setPacketSize(1);
+    raytracer.renderToImage(reference); //builds the BVHs
+
+    std::cout<<"  "<<names[i]<<":"<<std::endl;
+    const rt::Camera &camera = *scene.camera();
+    for(int p=0;p<4;++p)
+    {
+      const size_t packetSize = packetSizes[p];
+      const size_t blockWidth  = packetSize >= 8 ? 4 : packetSize >= 4 ? 2 : 1;
+      const size_t blockHeight = packetSize >= 16 ? 4 : packetSize >= 4 ? 2 : 1;
+
+      //the rays are generated with differentials as done by the renderer
+      double querySeconds = std::numeric_limits<double>::infinity();
+      size_t numHits = 0;
+      rt::RayPacket packet;
+      rt::RayDifferentials differentials[rt::RayPacket::kMaxSize];
+      rt::HitRecord hits[rt::RayPacket::kMaxSize];
+      for(int k=0;k<3;++k)
+      {
+        numHits = 0;
+        const Clock::time_point start = Clock::now();
+        for(size_t y=0;y<resolution;y+=blockHeight)
+          for(size_t x=0;x<resolution;x+=blockWidth)
+          {
+            if(packetSize == 1)
+            {
+              rt::HitRecord hit;
+              numHits += scene.closestIntersection(camera.ray(x,y,differentials[0]),hit);
+              continue;
+            }
+            camera.rays(x,y,std::min(blockWidth,resolution-x),std::min(blockHeight,resolution-y),
+                        packet,differentials);
+            const int hitMask = scene.closestIntersections(packet,hits);
+            for(int l=0;l<packet.size;++l)
+              numHits += (hitMask>>l) & 1;
+          }
+        querySeconds = std::min(querySeconds,std::chrono::duration<double>(Clock::now()-start).count());
+      }
+
+      std::shared_ptr<rt::Image> image = std::make_shared<rt::Image>(resolution,resolution);
+      raytracer.setPacketSize(packetSize);
+      double renderSeconds = std::numeric_limits<double>::infinity();
+      for(int k=0;k<3;++k)
+      {
+        const Clock::time_point start = Clock::now();
+        raytracer.renderToImage(image);
+        renderSeconds = std::min(renderSeconds,std::chrono::duration<double>(Clock::now()-start).count());
+      }
+
+      size_t numDifferent = 0;
+      for(size_t y=0;y<resolution;++y)
+        for(size_t x=0;x<resolution;++x)
+        {
+          const rt::Vec4 a = image->pixel(x,y), b = reference->pixel(x,y);
+          numDifferent += a[0] != b[0] || a[1] != b[1] || a[2] != b[2] || a[3] != b[3];
+        }
+
+      std::cout<<"    packet size "<<std::setw(2)<<packetSize<<": closest hits "
+               <<double(resolution*resolution)/querySeconds/1e6<<" Mrays/s ("<<numHits<<" hits), render "
+               <<renderSeconds<<"s, "<<numDifferent<<" pixels differ from single rays"<<std::endl;
+    }
+  }
+}
+
+//Counts the hardware cache misses of the process between start and stop
+//(all threads). Only available on Linux with access to the PMU, valid()
+//is false otherwise.
+class CacheMissCounter
+{
+public:
+  CacheMissCounter() : mL1(-1), mLLC(-1)
+  {
+#if defined(__linux__)
+    mL1 = open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    mLLC = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#endif
+  }
+
+  ~CacheMissCounter()
+  {
+#if defined(__linux__)
+    if(mL1 >= 0) close(mL1);
+    if(mLLC >= 0) close(mLLC);
+#endif
+  }
+
+  bool valid() const { return mL1 >= 0 && mLLC >= 0; }
+
+  void start()
+  {
+#if defined(__linux__)
+    if(!valid())
+      return;
+    ioctl(mL1,PERF_EVENT_IOC_RESET,0);
+    ioctl(mLLC,PERF_EVENT_IOC_RESET,0);
+    ioctl(mL1,PERF_EVENT_IOC_ENABLE,0);
+    ioctl(mLLC,PERF_EVENT_IOC_ENABLE,0);
+#endif
+  }
+
+  //returns the L1 data read misses and the last level cache misses
+  void stop(unsigned long long &l1Misses, unsigned long long &llcMisses)
+  {
+    l1Misses = llcMisses = 0;
+#if defined(__linux__)
+    if(!valid())
+      return;
+    ioctl(mL1,PERF_EVENT_IOC_DISABLE,0);
+    ioctl(mLLC,PERF_EVENT_IOC_DISABLE,0);
+    if(read(mL1,&l1Misses,sizeof(l1Misses)) != sizeof(l1Misses) ||
+       read(mLLC,&llcMisses,sizeof(llcMisses)) != sizeof(llcMisses))
+      l1Misses = llcMisses = 0;
+#endif
+  }
+
+private:
+#if defined(__linux__)
+  static int open(unsigned int type, unsigned long long config)
+  {
+    perf_event_attr attr;
+    std::memset(&attr,0,sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return int(syscall(__NR_perf_event_open,&attr,0,-1,-1,0));
+  }
+#endif
+
+  int mL1;
+  int mLLC;
+};
+
+//Compares tracing the reflections depth first with tracing them bounce by
+//bounce in sorted streams, for single rays and packets of 16 rays: render
+//time, cache misses (where the PMU is accessible) and whether the images
+//match.
+void benchmarkRayStreams(size_t resolution)
 {
+  const std::shared_ptr<rt::Scene> scenes[2] = {makeTask2Scene(), makeTask3Scene()};
+  const char *names[2] = {"task2 (podium, teapot)", "task3"};
+  const size_t packetSizes[2] = {1, 16};
+
+  CacheMissCounter counter;
+  std::cout<<resolution<<"x"<<resolution<<" pixels, best of three";
+  if(!counter.valid())
+    std::cout<<", cache miss counters not available";
+  std::cout<<std::endl;
+
+  typedef std::chrono::steady_clock Clock;
+  for(int i=0;i<2;++i)
+  {
+    std::shared_ptr<rt::Image> reference = std::make_shared<rt::Image>(resolution,resolution);
+    rt::Raytracer raytracer;
+    raytracer.setScene(scenes[i]);
+    raytracer.renderToImage(reference); //builds the BVHs
+
+    std::cout<<"  "<<names[i]<<":"<<std::endl;
+    for(int p=0;p<2;++p)
+      for(int streaming=0;streaming<2;++streaming)
+      {
+        raytracer.setPacketSize(packetSizes[p]);
+        raytracer.setRayStreaming(streaming != 0);
+
+        std::shared_ptr<rt::Image> image = std::make_shared<rt::Image>(resolution,resolution);
+        double seconds = std::numeric_limits<double>::infinity();
+        unsigned long long l1Misses = 0, llcMisses = 0;
+        for(int k=0;k<3;++k)
+        {
+          unsigned long long l1, llc;
+          counter.start();
+          const Clock::time_point start = Clock::now();
+          raytracer.renderToImage(image);
+          const double elapsed = std::chrono::duration<double>(Clock::now()-start).count();
+          counter.stop(l1,llc);
+          if(elapsed < seconds)
+          {
+            seconds = elapsed;
+            l1Misses = l1;
+            llcMisses = llc;
+          }
+        }
+
+        size_t numDifferent = 0;
+        for(size_t y=0;y<resolution;++y)
+          for(size_t x=0;x<resolution;++x)
+          {
+            const rt::Vec4 a = image->pixel(x,y), b = reference->pixel(x,y);
+            numDifferent += a[0] != b[0] || a[1] != b[1] || a[2] != b[2] || a[3] != b[3];
+          }
+
+        std::cout<<"    packet size "<<std::setw(2)<<packetSizes[p]
+                 <<(streaming ? ", streamed:    " : ", depth first: ")<<seconds<<"s";
+        if(counter.valid())
+          std::cout<<", L1D read misses "<<l1Misses<<", LLC misses "<<llcMisses;
+        std::cout<<", "<<numDifferent<<" pixels differ"<<std::endl;
+      }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  // Usage: --compare-bvh mesh.obj [mesh2.obj ...] prints the statistics of
+  // both BVH builders for the given meshes instead of rendering.
+  if(argc > 2 && std::string(argv[1]) == "--compare-bvh")
+  {
+    for(int i=2;i<argc;++i)
+      compareBVHBuilders(argv[i]);
+    return 0;
+  }
+
+  // Usage: --memory-report mesh.obj [mesh2.obj ...] prints the memory used
+  // by the mesh and by the BVH node layouts.
+  if(argc > 2 && std::string(argv[1]) == "--memory-report")
+  {
+    for(int i=2;i<argc;++i)
+      printMemoryFootprint(argv[i]);
+    return 0;
+  }
+
+  // Usage: --write-benchmark mesh.obj reports the throughput of the TGA and
+  // OBJ writers.
+  if(argc == 3 && std::string(argv[1]) == "--write-benchmark")
+  {
+    benchmarkWriters(argv[2]);
+    return 0;
+  }
+
+  // Usage: --convert-mesh mesh.obj mesh.rtmesh converts an OBJ file to the
+  // binary mesh format including the BVH.
+  if(argc == 4 && std::string(argv[1]) == "--convert-mesh")
+    return rt::MeshFile::convertFromOBJ(argv[2],argv[3]) ? 0 : 1;
+
+  // Usage: --precision-benchmark [resolution] renders the task scenes with
+  // the precision of this build, run it from a float (-DRT_USE_FLOAT) and
+  // a double build in the same folder to compare them.
+  if(argc <= 3 && argc > 1 && std::string(argv[1]) == "--precision-benchmark")
+  {
+    benchmarkPrecision(argc == 3 ? std::strtoul(argv[2],0,10) : 512);
+    return 0;
+  }
+
+  // Usage: --vector-benchmark times the vector operations of the
+  // intersection, transformation and shading code.
+  if(argc == 2 && std::string(argv[1]) == "--vector-benchmark")
+  {
+    benchmarkVectorOperations();
+    return 0;
+  }
+
+  // Usage: --packet-benchmark [resolution] compares primary ray packets of
+  // 4, 8 and 16 rays with single rays.
+  if(argc <= 3 && argc > 1 && std::string(argv[1]) == "--packet-benchmark")
+  {
+    benchmarkPackets(argc == 3 ? std::strtoul(argv[2],0,10) : 512);
+    return 0;
+  }
+
+  // Usage: --stream-benchmark [resolution] compares tracing reflections
+  // depth first with sorted ray streams.
+  if(argc <= 3 && argc > 1 && std::string(argv[1]) == "--stream-benchmark")
+  {
+    benchmarkRayStreams(argc == 3 ? std::strtoul(argv[2],0,10) : 512);
+    return 0;
+  }
+
+  // Usage: --mesh-load-benchmark mesh.obj [mesh2.obj ...] compares loading
+  // the OBJ file with loading its binary conversion (written to mesh.obj.rtmesh).
+  if(argc > 2 && std::string(argv[1]) == "--mesh-load-benchmark")
+  {
+    for(int i=2;i<argc;++i)
+      benchmarkMeshLoading(argv[i]);
+    return 0;
+  }
   
 
 //  std::shared_ptr<rt::Scene> scene = makeTask2Scene(); //task2 solution with teapot
@@ -408,6 +1023,8 @@ int main()
 	util::StopWatch s; s.tic();
 	raytracer->renderToImage(image);
 	s.toc(std::cout);
+	if (i == 1)
+	  printAllocationsPerPrimaryRay(scene);
 	std::ostringstream oss;
 	oss << "/tmp/frame_" << std::setw(4) << std::setfill('0') << i;
 	
@@ -39,6 +39,55 @@ struct TupleFiller<Tuple, FillType, 1, offset> {
   }
 };
 
+//! Componentwise kernels of Vector on the coefficient arrays. Results may
+//! alias the arguments. Specialized with SIMD instructions for 3- and
+//! 4-vectors of float and double in VectorSIMD.hpp.
+template<size_t N, typename T>
+struct VectorOps {
+  static void neg(T *r, const T *a) {
+    for(size_t i=0; i<N; ++i)
+      r[i] = -a[i];
+  }
+  static void add(T *r, const T *a, const T *b) {
+    for(size_t i=0; i<N; ++i)
+      r[i] = a[i] + b[i];
+  }
+  static void sub(T *r, const T *a, const T *b) {
+    for(size_t i=0; i<N; ++i)
+      r[i] = a[i] - b[i];
+  }
+  static void mul(T *r, const T *a, const T *b) {
+    for(size_t i=0; i<N; ++i)
+      r[i] = a[i] * b[i];
+  }
+  static void div(T *r, const T *a, const T *b) {
+    for(size_t i=0; i<N; ++i)
+      r[i] = a[i] / b[i];
+  }
+  static void addScalar(T *r, const T *a, const T &s) {
+    for(size_t i=0; i<N; ++i)
+      r[i] = a[i] + s;
+  }
+  static void subScalar(T *r, const T *a, const T &s) {
+    for(size_t i=0; i<N; ++i)
+      r[i] = a[i] - s;
+  }
+  static void mulScalar(T *r, const T *a, const T &s) {
+    for(size_t i=0; i<N; ++i)
+      r[i] = a[i] * s;
+  }
+  static void divScalar(T *r, const T *a, const T &s) {
+    for(size_t i=0; i<N; ++i)
+      r[i] = a[i] / s;
+  }
+  static T dot(const T *a, const T *b) {
+    T ret(0);
+    for(size_t i=0; i<N; ++i)
+      ret += a[i]*b[i];
+    return ret;
+  }
+};
+
 template<size_t N, typename T>
 class Vector {
   static_assert(N>0, "Error: Vector size parameter must be greater than zero!");
@@ -279,128 +328,111 @@ Vector<N,T> Vector<N,T>::normalized() const {
 template<size_t N, typename T>
 Vector<N,T> Vector<N,T>::operator -() const {
   Vector<N,T> ret;
-  for(size_t i=0; i<N; ++i)
-    ret.mCoefficients[i] = -this->mCoefficients[i];
+  VectorOps<N,T>::neg(ret.mCoefficients.data(), mCoefficients.data());
   return ret;
 }
 
 template<size_t N, typename T>
 Vector<N,T> Vector<N,T>::operator +(const T &s) const {
   Vector<N,T> ret;
-  for(size_t i=0; i<N; ++i)
-    ret.mCoefficients[i] = this->mCoefficients[i] + s;
+  VectorOps<N,T>::addScalar(ret.mCoefficients.data(), mCoefficients.data(), s);
   return ret;
 }
 
 template<size_t N, typename T>
 Vector<N,T> Vector<N,T>::operator -(const T &s) const {
   Vector<N,T> ret;
-  for(size_t i=0; i<N; ++i)
-    ret.mCoefficients[i] = this->mCoefficients[i] - s;
+  VectorOps<N,T>::subScalar(ret.mCoefficients.data(), mCoefficients.data(), s);
   return ret;
 }
 
 template<size_t N, typename T>
 Vector<N,T> Vector<N,T>::operator *(const T &s) const {
   Vector<N,T> ret;
-  for(size_t i=0; i<N; ++i)
-    ret.mCoefficients[i] = this->mCoefficients[i] * s;
+  VectorOps<N,T>::mulScalar(ret.mCoefficients.data(), mCoefficients.data(), s);
   return ret;
 }
 
 template<size_t N, typename T>
 Vector<N,T> Vector<N,T>::operator /(const T &s) const {
   Vector<N,T> ret;
-  for(size_t i=0; i<N; ++i)
-    ret.mCoefficients[i] = this->mCoefficients[i] / s;
+  VectorOps<N,T>::divScalar(ret.mCoefficients.data(), mCoefficients.data(), s);
   return ret;
 }
 
 template<size_t N, typename T>
 Vector<N,T> Vector<N,T>::operator +(const Vector& v) const {
   Vector<N,T> ret;
-  for(size_t i=0; i<N; ++i)
-    ret.mCoefficients[i] = this->mCoefficients[i] + v.mCoefficients[i];
+  VectorOps<N,T>::add(ret.mCoefficients.data(), mCoefficients.data(), v.mCoefficients.data());
   return ret;
 }
 
 template<size_t N, typename T>
 Vector<N,T> Vector<N,T>::operator -(const Vector& v) const {
   Vector<N,T> ret;
-  for(size_t i=0; i<N; ++i)
-    ret.mCoefficients[i] = this->mCoefficients[i] - v.mCoefficients[i];
+  VectorOps<N,T>::sub(ret.mCoefficients.data(), mCoefficients.data(), v.mCoefficients.data());
   return ret;
 }
 
 template<size_t N, typename T>
 Vector<N,T> Vector<N,T>::operator *(const Vector<N,T> &v) const {
   Vector<N,T> ret;
-  for(size_t i=0; i<N; ++i)
-    ret.mCoefficients[i] = this->mCoefficients[i] * v.mCoefficients[i];
+  VectorOps<N,T>::mul(ret.mCoefficients.data(), mCoefficients.data(), v.mCoefficients.data());
   return ret;
 }
 
 template<size_t N, typename T>
 Vector<N,T> Vector<N,T>::operator /(const Vector<N,T> &v) const {
   Vector<N,T> ret;
-  for(size_t i=0; i<N; ++i)
-    ret.mCoefficients[i] = this->mCoefficients[i] / v.mCoefficients[i];
+  VectorOps<N,T>::div(ret.mCoefficients.data(), mCoefficients.data(), v.mCoefficients.data());
   return ret;
 }
 
 template<size_t N, typename T>
 Vector<N,T>& Vector<N,T>::operator +=(const T &s) {
-  for(size_t i=0; i<N; ++i)
-    this->mCoefficients[i] += s;
+  VectorOps<N,T>::addScalar(mCoefficients.data(), mCoefficients.data(), s);
   return *this;
 }
 
 template<size_t N, typename T>
 Vector<N,T>& Vector<N,T>::operator -=(const T &s) {
-  for(size_t i=0; i<N; ++i)
-    this->mCoefficients[i] -= s;
+  VectorOps<N,T>::subScalar(mCoefficients.data(), mCoefficients.data(), s);
   return *this;
 }
 
 template<size_t N, typename T>
 Vector<N,T>& Vector<N,T>::operator *=(const T &s) {
-  for(size_t i=0; i<N; ++i)
-    this->mCoefficients[i] *= s;
+  VectorOps<N,T>::mulScalar(mCoefficients.data(), mCoefficients.data(), s);
   return *this;
 }
 
 template<size_t N, typename T>
 Vector<N,T>& Vector<N,T>::operator /=(const T &s) {
-  for(size_t i=0; i<N; ++i)
-    this->mCoefficients[i] /= s;
+  VectorOps<N,T>::divScalar(mCoefficients.data(), mCoefficients.data(), s);
   return *this;
 }
 
 template<size_t N, typename T>
 Vector<N,T>& Vector<N,T>::operator +=(const Vector<N,T> &v) {
-  for(size_t i=0; i<N; ++i)
-    mCoefficients[i] += v.mCoefficients[i];
+  VectorOps<N,T>::add(mCoefficients.data(), mCoefficients.data(), v.mCoefficients.data());
   return *this;
 }
 
 template<size_t N, typename T>
 Vector<N,T>& Vector<N,T>::operator -=(const Vector<N,T> &v) {
-  for(size_t i=0; i<N; ++i)
-    mCoefficients[i] -= v.mCoefficients[i];
+  VectorOps<N,T>::sub(mCoefficients.data(), mCoefficients.data(), v.mCoefficients.data());
   return *this;
 }
 
 template<size_t N, typename T>
 Vector<N,T>& Vector<N,T>::operator *=(const Vector<N,T> &v) {
-  for(size_t i=0; i<N; ++i)
-    mCoefficients[i] *= v.mCoefficients[i];
+  VectorOps<N,T>::mul(mCoefficients.data(), mCoefficients.data(), v.mCoefficients.data());
   return *this;
 }
 
 template<size_t N, typename T>
 Vector<N,T>& Vector<N,T>::operator /=(const Vector<N,T> &v) {
-  for(size_t i=0; i<N; ++i)
-    mCoefficients[i] /= v.mCoefficients[i];
+  VectorOps<N,T>::div(mCoefficients.data(), mCoefficients.data(), v.mCoefficients.data());
   return *this;
 }
 
@@ -430,10 +462,7 @@ const T& Vector<N,T>::operator [](size_t i) const {
 
 template<size_t N, typename T>
 T Vector<N,T>::dot(const Vector<N,T> &v) const {
-  T ret(0);
-  for(size_t i=0; i<N; ++i)
-    ret += mCoefficients[i]*v.mCoefficients[i];
-  return ret;
+  return VectorOps<N,T>::dot(mCoefficients.data(), v.mCoefficients.data());
 }
 
 template<size_t N, typename T>
@@ -486,4 +515,6 @@ Vector<N,decltype(T1(0)*T2(0))> reflect(const Vector<N,T1> &v0,
 
 } //namespace util
 
+#include "VectorSIMD.hpp"
+
 #endif //VECTOR_HPP_INCLUDE_ONCE
@@ -0,0 +1,217 @@
+/*
+ *  SIMD versions of the Vector kernels for 3- and 4-vectors of float and
+ *  double, included by Vector.hpp. The coefficients stay packed (a Vector<3,T>
+ *  is still three T), so vectors in meshes and mapped files are loaded with
+ *  unaligned and partial loads. Every operation is evaluated in the order of
+ *  the generic code, the results are bitwise identical. Define UTIL_NO_SIMD
+ *  to use the generic code.
+ */
+
+#ifndef VECTORSIMD_HPP_INCLUDE_ONCE
+#define VECTORSIMD_HPP_INCLUDE_ONCE
+
+#if !defined(UTIL_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#  define UTIL_VECTOR_SSE2
+#  include <emmintrin.h>
+#  if defined(__AVX__)
+#    define UTIL_VECTOR_AVX
+#    include <immintrin.h>
+#  endif
+#endif
+
+#ifdef UTIL_VECTOR_SSE2
+
+namespace util {
+
+//! Coefficients of a vector in SIMD registers. Lanes past N hold arbitrary
+//! values and are never stored.
+struct Pack3d {
+  __m128d lo, hi;
+
+  static Pack3d load(const double *p)  { Pack3d r; r.lo = _mm_loadu_pd(p); r.hi = _mm_load_sd(p+2); return r; }
+  static Pack3d splat(const double &s) { Pack3d r; r.lo = r.hi = _mm_set1_pd(s); return r; }
+  void store(double *p) const          { _mm_storeu_pd(p,lo); _mm_store_sd(p+2,hi); }
+
+  static Pack3d add(const Pack3d &a, const Pack3d &b) { Pack3d r; r.lo = _mm_add_pd(a.lo,b.lo); r.hi = _mm_add_pd(a.hi,b.hi); return r; }
+  static Pack3d sub(const Pack3d &a, const Pack3d &b) { Pack3d r; r.lo = _mm_sub_pd(a.lo,b.lo); r.hi = _mm_sub_pd(a.hi,b.hi); return r; }
+  static Pack3d mul(const Pack3d &a, const Pack3d &b) { Pack3d r; r.lo = _mm_mul_pd(a.lo,b.lo); r.hi = _mm_mul_pd(a.hi,b.hi); return r; }
+  static Pack3d div(const Pack3d &a, const Pack3d &b) { Pack3d r; r.lo = _mm_div_pd(a.lo,b.lo); r.hi = _mm_div_pd(a.hi,b.hi); return r; }
+  static Pack3d neg(const Pack3d &a) {
+    const __m128d sign = _mm_set1_pd(-0.0);
+    Pack3d r; r.lo = _mm_xor_pd(a.lo,sign); r.hi = _mm_xor_pd(a.hi,sign); return r;
+  }
+
+  // ((0 + a0*b0) + a1*b1) + a2*b2
+  static double dot(const Pack3d &a, const Pack3d &b) {
+    const __m128d lo = _mm_mul_pd(a.lo,b.lo), hi = _mm_mul_pd(a.hi,b.hi);
+    __m128d s = _mm_add_sd(_mm_setzero_pd(),lo);
+    s = _mm_add_sd(s,_mm_unpackhi_pd(lo,lo));
+    s = _mm_add_sd(s,hi);
+    return _mm_cvtsd_f64(s);
+  }
+};
+
+#ifdef UTIL_VECTOR_AVX
+struct Pack4d {
+  __m256d v;
+
+  static Pack4d load(const double *p)  { Pack4d r; r.v = _mm256_loadu_pd(p); return r; }
+  static Pack4d splat(const double &s) { Pack4d r; r.v = _mm256_set1_pd(s); return r; }
+  void store(double *p) const          { _mm256_storeu_pd(p,v); }
+
+  static Pack4d add(const Pack4d &a, const Pack4d &b) { Pack4d r; r.v = _mm256_add_pd(a.v,b.v); return r; }
+  static Pack4d sub(const Pack4d &a, const Pack4d &b) { Pack4d r; r.v = _mm256_sub_pd(a.v,b.v); return r; }
+  static Pack4d mul(const Pack4d &a, const Pack4d &b) { Pack4d r; r.v = _mm256_mul_pd(a.v,b.v); return r; }
+  static Pack4d div(const Pack4d &a, const Pack4d &b) { Pack4d r; r.v = _mm256_div_pd(a.v,b.v); return r; }
+  static Pack4d neg(const Pack4d &a) { Pack4d r; r.v = _mm256_xor_pd(a.v,_mm256_set1_pd(-0.0)); return r; }
+
+  // (((0 + a0*b0) + a1*b1) + a2*b2) + a3*b3
+  static double dot(const Pack4d &a, const Pack4d &b) {
+    const __m256d p = _mm256_mul_pd(a.v,b.v);
+    const __m128d lo = _mm256_castpd256_pd128(p), hi = _mm256_extractf128_pd(p,1);
+    __m128d s = _mm_add_sd(_mm_setzero_pd(),lo);
+    s = _mm_add_sd(s,_mm_unpackhi_pd(lo,lo));
+    s = _mm_add_sd(s,hi);
+    s = _mm_add_sd(s,_mm_unpackhi_pd(hi,hi));
+    return _mm_cvtsd_f64(s);
+  }
+};
+#else
+struct Pack4d {
+  __m128d lo, hi;
+
+  static Pack4d load(const double *p)  { Pack4d r; r.lo = _mm_loadu_pd(p); r.hi = _mm_loadu_pd(p+2); return r; }
+  static Pack4d splat(const double &s) { Pack4d r; r.lo = r.hi = _mm_set1_pd(s); return r; }
+  void store(double *p) const          { _mm_storeu_pd(p,lo); _mm_storeu_pd(p+2,hi); }
+
+  static Pack4d add(const Pack4d &a, const Pack4d &b) { Pack4d r; r.lo = _mm_add_pd(a.lo,b.lo); r.hi = _mm_add_pd(a.hi,b.hi); return r; }
+  static Pack4d sub(const Pack4d &a, const Pack4d &b) { Pack4d r; r.lo = _mm_sub_pd(a.lo,b.lo); r.hi = _mm_sub_pd(a.hi,b.hi); return r; }
+  static Pack4d mul(const Pack4d &a, const Pack4d &b) { Pack4d r; r.lo = _mm_mul_pd(a.lo,b.lo); r.hi = _mm_mul_pd(a.hi,b.hi); return r; }
+  static Pack4d div(const Pack4d &a, const Pack4d &b) { Pack4d r; r.lo = _mm_div_pd(a.lo,b.lo); r.hi = _mm_div_pd(a.hi,b.hi); return r; }
+  static Pack4d neg(const Pack4d &a) {
+    const __m128d sign = _mm_set1_pd(-0.0);
+    Pack4d r; r.lo = _mm_xor_pd(a.lo,sign); r.hi = _mm_xor_pd(a.hi,sign); return r;
+  }
+
+  // (((0 + a0*b0) + a1*b1) + a2*b2) + a3*b3
+  static double dot(const Pack4d &a, const Pack4d &b) {
+    const __m128d lo = _mm_mul_pd(a.lo,b.lo), hi = _mm_mul_pd(a.hi,b.hi);
+    __m128d s = _mm_add_sd(_mm_setzero_pd(),lo);
+    s = _mm_add_sd(s,_mm_unpackhi_pd(lo,lo));
+    s = _mm_add_sd(s,hi);
+    s = _mm_add_sd(s,_mm_unpackhi_pd(hi,hi));
+    return _mm_cvtsd_f64(s);
+  }
+};
+#endif
+
+//! Three floats are loaded as two plus one, the fourth lane is 0.
+struct Pack3f {
+  __m128 v;
+
+  static Pack3f load(const float *p) {
+    Pack3f r;
+    r.v = _mm_movelh_ps(_mm_loadl_pi(_mm_setzero_ps(),(const __m64*)p),_mm_load_ss(p+2));
+    return r;
+  }
+  static Pack3f splat(const float &s) { Pack3f r; r.v = _mm_set1_ps(s); return r; }
+  void store(float *p) const          { _mm_storel_pi((__m64*)p,v); _mm_store_ss(p+2,_mm_movehl_ps(v,v)); }
+
+  static Pack3f add(const Pack3f &a, const Pack3f &b) { Pack3f r; r.v = _mm_add_ps(a.v,b.v); return r; }
+  static Pack3f sub(const Pack3f &a, const Pack3f &b) { Pack3f r; r.v = _mm_sub_ps(a.v,b.v); return r; }
+  static Pack3f mul(const Pack3f &a, const Pack3f &b) { Pack3f r; r.v = _mm_mul_ps(a.v,b.v); return r; }
+  static Pack3f div(const Pack3f &a, const Pack3f &b) { Pack3f r; r.v = _mm_div_ps(a.v,b.v); return r; }
+  static Pack3f neg(const Pack3f &a) { Pack3f r; r.v = _mm_xor_ps(a.v,_mm_set1_ps(-0.0f)); return r; }
+
+  // ((0 + a0*b0) + a1*b1) + a2*b2
+  static float dot(const Pack3f &a, const Pack3f &b) {
+    const __m128 p = _mm_mul_ps(a.v,b.v);
+    __m128 s = _mm_add_ss(_mm_setzero_ps(),p);
+    s = _mm_add_ss(s,_mm_shuffle_ps(p,p,_MM_SHUFFLE(1,1,1,1)));
+    s = _mm_add_ss(s,_mm_movehl_ps(p,p));
+    return _mm_cvtss_f32(s);
+  }
+};
+
+struct Pack4f {
+  __m128 v;
+
+  static Pack4f load(const float *p)  { Pack4f r; r.v = _mm_loadu_ps(p); return r; }
+  static Pack4f splat(const float &s) { Pack4f r; r.v = _mm_set1_ps(s); return r; }
+  void store(float *p) const          { _mm_storeu_ps(p,v); }
+
+  static Pack4f add(const Pack4f &a, const Pack4f &b) { Pack4f r; r.v = _mm_add_ps(a.v,b.v); return r; }
+  static Pack4f sub(const Pack4f &a, const Pack4f &b) { Pack4f r; r.v = _mm_sub_ps(a.v,b.v); return r; }
+  static Pack4f mul(const Pack4f &a, const Pack4f &b) { Pack4f r; r.v = _mm_mul_ps(a.v,b.v); return r; }
+  static Pack4f div(const Pack4f &a, const Pack4f &b) { Pack4f r; r.v = _mm_div_ps(a.v,b.v); return r; }
+  static Pack4f neg(const Pack4f &a) { Pack4f r; r.v = _mm_xor_ps(a.v,_mm_set1_ps(-0.0f)); return r; }
+
+  // (((0 + a0*b0) + a1*b1) + a2*b2) + a3*b3
+  static float dot(const Pack4f &a, const Pack4f &b) {
+    const __m128 p = _mm_mul_ps(a.v,b.v);
+    __m128 s = _mm_add_ss(_mm_setzero_ps(),p);
+    s = _mm_add_ss(s,_mm_shuffle_ps(p,p,_MM_SHUFFLE(1,1,1,1)));
+    s = _mm_add_ss(s,_mm_movehl_ps(p,p));
+    s = _mm_add_ss(s,_mm_shuffle_ps(p,p,_MM_SHUFFLE(3,3,3,3)));
+    return _mm_cvtss_f32(s);
+  }
+};
+
+//! Vector kernels on top of a pack type P holding T coefficients.
+template<typename T, typename P>
+struct SimdVectorOps {
+  static void neg(T *r, const T *a)                  { P::neg(P::load(a)).store(r); }
+  static void add(T *r, const T *a, const T *b)      { P::add(P::load(a),P::load(b)).store(r); }
+  static void sub(T *r, const T *a, const T *b)      { P::sub(P::load(a),P::load(b)).store(r); }
+  static void mul(T *r, const T *a, const T *b)      { P::mul(P::load(a),P::load(b)).store(r); }
+  static void div(T *r, const T *a, const T *b)      { P::div(P::load(a),P::load(b)).store(r); }
+  static void addScalar(T *r, const T *a, const T &s) { P::add(P::load(a),P::splat(s)).store(r); }
+  static void subScalar(T *r, const T *a, const T &s) { P::sub(P::load(a),P::splat(s)).store(r); }
+  static void mulScalar(T *r, const T *a, const T &s) { P::mul(P::load(a),P::splat(s)).store(r); }
+  static void divScalar(T *r, const T *a, const T &s) { P::div(P::load(a),P::splat(s)).store(r); }
+  static T dot(const T *a, const T *b)               { return P::dot(P::load(a),P::load(b)); }
+};
+
+template<> struct VectorOps<3,double> : SimdVectorOps<double,Pack3d> {};
+template<> struct VectorOps<4,double> : SimdVectorOps<double,Pack4d> {};
+template<> struct VectorOps<3,float>  : SimdVectorOps<float, Pack3f> {};
+template<> struct VectorOps<4,float>  : SimdVectorOps<float, Pack4f> {};
+
+//! cross products of equally typed vectors, same terms as the generic operator
+inline Vector<3,double> operator %(const Vector<3,double> &v0,
+                                   const Vector<3,double> &v1) {
+  // loaded like Pack3d, overlapping loads would miss the store forwarding
+  // of vectors just written
+  const Pack3d a = Pack3d::load(&v0[0]), b = Pack3d::load(&v1[0]);
+  const __m128d a01 = a.lo, a12 = _mm_shuffle_pd(a.lo,a.hi,1), a20 = _mm_unpacklo_pd(a.hi,a.lo);
+  const __m128d b01 = b.lo, b12 = _mm_shuffle_pd(b.lo,b.hi,1), b20 = _mm_unpacklo_pd(b.hi,b.lo);
+
+  // (a1*b2 - a2*b1, a2*b0 - a0*b2) and a0*b1 - a1*b0
+  const __m128d xy = _mm_sub_pd(_mm_mul_pd(a12,b20),_mm_mul_pd(a20,b12));
+  const __m128d p  = _mm_mul_pd(a01,_mm_shuffle_pd(b01,b01,1));
+  const __m128d z  = _mm_sub_sd(p,_mm_unpackhi_pd(p,p));
+
+  Vector<3,double> ret;
+  _mm_storeu_pd(&ret[0],xy);
+  _mm_store_sd(&ret[2],z);
+  return ret;
+}
+
+inline Vector<3,float> operator %(const Vector<3,float> &v0,
+                                  const Vector<3,float> &v1) {
+  const __m128 a = Pack3f::load(&v0[0]).v, b = Pack3f::load(&v1[0]).v;
+  const __m128 ayzx = _mm_shuffle_ps(a,a,_MM_SHUFFLE(3,0,2,1)), azxy = _mm_shuffle_ps(a,a,_MM_SHUFFLE(3,1,0,2));
+  const __m128 byzx = _mm_shuffle_ps(b,b,_MM_SHUFFLE(3,0,2,1)), bzxy = _mm_shuffle_ps(b,b,_MM_SHUFFLE(3,1,0,2));
+
+  Pack3f r;
+  r.v = _mm_sub_ps(_mm_mul_ps(ayzx,bzxy),_mm_mul_ps(azxy,byzx));
+  Vector<3,float> ret;
+  r.store(&ret[0]);
+  return ret;
+}
+
+} //namespace util
+
+#endif //UTIL_VECTOR_SSE2
+
+#endif //VECTORSIMD_HPP_INCLUDE_ONCE
@@ -0,0 +1,23 @@
+#ifndef WRITESTATISTICS_HPP_INCLUDE_ONCE
+#define WRITESTATISTICS_HPP_INCLUDE_ONCE
+
+#include <cstddef>
+
+namespace rt
+{
+
+/// Size and wall clock time of a file written by Image::saveToTGA or
+/// IndexedTriangleIO::saveToOBJ, including formatting the data.
+struct WriteStatistics
+{
+  WriteStatistics() : bytes(0), seconds(0) {}
+
+  double bytesPerSecond() const { return seconds > 0 ? double(bytes)/seconds : 0; }
+
+  size_t bytes;
+  double seconds;
+};
+
+} //namespace rt
+
+#endif //WRITESTATISTICS_HPP_INCLUDE_ONCE